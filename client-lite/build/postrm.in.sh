@@ -8,6 +8,7 @@ do_user_name=@do_user@
 config_path=@docs_svc_config_dir_path@
 log_path=@docs_svc_log_dir_path@
 run_path=@docs_svc_run_dir_path@
+persistence_path=@docs_svc_persistence_dir_path@
 svc_name=@docs_svc_name@
 svc_config_path=@docs_systemd_cfg_path@
 
@@ -27,6 +28,9 @@ do_remove_dirs() {
 
     echo "Removing run directory: $run_path"
     rm -rf $run_path
+
+    echo "Removing persistence directory: $persistence_path"
+    rm -rf $persistence_path
 }
 
 do_remove_user_and_group() {
@@ -6,10 +6,95 @@
 #include <chrono>
 
 constexpr auto g_mccHostBanInterval = std::chrono::minutes(15);
+
+// Downloads use the cache host expected to deliver this many bytes the soonest, going by its measured connect time
+// and throughput. Hosts that failed more than the max error rate of their recent requests are used only as a last resort.
+constexpr UINT64 g_mccHostSelectionSampleBytes = 16 * 1024 * 1024;
+constexpr double g_mccHostMaxErrorRate = 0.5;
+
+// Cache hosts are probed in the background this often, and when the network changes, which is checked
+// more often. Unreachable hosts are banned ahead of downloads, reachable ones unbanned.
+constexpr auto g_mccProbeInterval = std::chrono::seconds(60);
+constexpr auto g_mccProbeNetworkCheckInterval = std::chrono::seconds(10);
 constexpr auto g_progressTrackerCheckInterval = std::chrono::seconds(10);
 constexpr UINT g_progressTrackerMaxNoProgressIntervals = 30;
 constexpr auto g_progressTrackerMaxRetryDelay = std::chrono::seconds(30);
 
+// Large files are split into segments that are downloaded over parallel connections.
+// A file is segmented only if the server supports range requests and each segment
+// would be at least g_downloadSegmentMinSizeBytes in size.
+constexpr UINT64 g_downloadSegmentMinSizeBytes = 16 * 1024 * 1024;
+constexpr UINT g_maxConnectionsPerDownloadLimit = 16;
+
+// Range requests carry an If-Range validator. A download starts over when the content changed at
+// the source, up to this many times.
+constexpr UINT g_downloadMaxContentRestarts = 3;
+
+// Downloaded data is coalesced into buffers of this size and written to disk by a separate I/O thread.
+// The pool is bounded, transfers are paused when it is exhausted and resumed as buffers free up.
+constexpr size_t g_writeBehindBufferSizeBytes = 512 * 1024;
+constexpr UINT g_writeBehindMaxBuffers = 16;
+
+// Downloaded data is verified against IntegrityCheckInfo as it arrives. Data already in the file is read back
+// in chunks of this size only when verification has to catch up with it, like after an agent restart.
+constexpr size_t g_integrityCheckReadBufferSize = 1024 * 1024;
+
+// Limits for the connections and easy handles that all curl requests share
+constexpr long g_curlMaxConnectionsPerHost = 2 * g_maxConnectionsPerDownloadLimit;
+constexpr long g_curlMaxCachedConnections = 64;
+constexpr size_t g_curlMaxIdleEasyHandles = 32;
+constexpr auto g_curlMaxIdleConnectionAge = std::chrono::seconds(60);
+
+// Status subscribers get an event for every state change and, while transferring, progress events every
+// CallbackFreqSeconds or CallbackFreqPercent of the content. Without either property, every default interval.
+// A subscriber that lets more than the max bytes of events queue up is dropped.
+constexpr auto g_statusEventDefaultInterval = std::chrono::seconds(1);
+constexpr size_t g_statusEventMaxQueuedBytes = 64 * 1024;
+
+// Connections to the cache host and to origins of recent downloads are opened ahead of requests and
+// reopened before they get too old to reuse, for as long as an origin has been used recently.
+constexpr auto g_connectionPrewarmInterval = std::chrono::seconds(50);
+constexpr auto g_connectionPrewarmOriginExpiry = std::chrono::minutes(5);
+constexpr size_t g_connectionPrewarmMaxOrigins = 8;
+constexpr auto g_connectionPrewarmConnectTimeout = std::chrono::seconds(15);
+constexpr auto g_connectionPrewarmTimeout = std::chrono::seconds(30);
+
+// Bandwidth limits let transfers burst for this long at the limited rate, but at least by the size of
+// the chunks curl hands over to the write callback
+constexpr auto g_rateLimiterBurstInterval = std::chrono::milliseconds(100);
+constexpr size_t g_rateLimiterMinBurstBytes = 16 * 1024;  // CURL_MAX_WRITE_SIZE
+
+// Connect timeouts, stall detection and retry delays adapt to each host's measured connect time and throughput.
+// Estimates are kept for this many hosts. Transfers smaller than the min sample size don't measure throughput.
+constexpr size_t g_hostEstimatesMaxHosts = 32;
+constexpr UINT64 g_hostEstimatesMinThroughputSampleBytes = 256 * 1024;
+constexpr auto g_connectTimeoutMin = std::chrono::seconds(2);
+constexpr auto g_connectTimeoutMax = std::chrono::seconds(60);
+constexpr UINT g_connectTimeoutMaxBackoffs = 4;
+
+// Requests are aborted when transferring slower than the stall speed limit for the stall time.
+// Hosts with a known throughput get a limit of 1/g_stallSpeedLimitDivisor of it.
+constexpr UINT64 g_stallSpeedLimitDefault = 4000;   // 7KB/s or 56kb/s is dial-up modem speed
+constexpr UINT64 g_stallSpeedLimitMin = 1024;
+constexpr UINT64 g_stallSpeedLimitMax = 1024 * 1024;
+constexpr UINT64 g_stallSpeedLimitDivisor = 16;
+constexpr auto g_stallTimeDefault = std::chrono::seconds(20);
+constexpr auto g_stallTimeMin = std::chrono::seconds(3);
+
+// Delay before the first retry of a failed request, doubled on each further failure
+constexpr auto g_retryDelayDefault = std::chrono::seconds(1);
+constexpr auto g_retryDelayMin = std::chrono::milliseconds(100);
+constexpr auto g_retryDelayMax = std::chrono::seconds(5);
+
+// Proxy lookups are cached per scheme and host for this long and dropped when the network changes.
+// Reports on how requests through a proxy went count for ranking it for the same time.
+constexpr auto g_proxyCacheTtl = std::chrono::minutes(5);
+constexpr size_t g_proxyCacheMaxHosts = 32;
+constexpr size_t g_proxyCacheMaxProxies = 16;
+
+// Downloads are spread across up to this many task threads, capped by the number of cores
+constexpr size_t g_taskThreadPoolMaxThreads = 4;
+
 // Provides a wait time of ~49 days which should be sufficient for uses
 // of steady_clock (timing, event waits, condition_variable waits).
 constexpr auto g_steadyClockInfiniteWaitTime = std::chrono::milliseconds(MAXUINT);
@@ -22,5 +107,13 @@ constexpr auto g_cacheHostFallbackDelayNoFallback = std::chrono::seconds(-1);
 
 const char* const ConfigName_CacheHostServer = "DOCacheHost";
 
+const char* const ConfigName_MaxConnectionsPerDownload = "DOMaxConnectionsPerDownload";
+constexpr UINT g_maxConnectionsPerDownloadDefault = 4;
+
+// Bandwidth limits in bytes per second, zero or not set means unlimited.
+// The per-download limit applies to downloads that don't set the MaxBytesPerSecond property.
+const char* const ConfigName_MaxDownloadBytesPerSecond = "DOMaxDownloadBytesPerSecond";
+const char* const ConfigName_MaxBytesPerSecondPerDownload = "DOMaxBytesPerSecondPerDownload";
+
 const char* const ConfigName_RestControllerValidateRemoteAddr = "RestControllerValidateRemoteAddr";
 constexpr auto g_RestControllerValidateRemoteAddrDefault = true; // default: enabled
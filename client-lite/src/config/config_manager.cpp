@@ -4,6 +4,7 @@
 #include "do_common.h"
 #include "config_manager.h"
 
+#include <algorithm>
 #include "config_defaults.h"
 #include "do_persistence.h"
 #include "string_ops.h"
@@ -22,11 +23,13 @@ ConfigManager::ConfigManager(const std::string& adminConfigPath, const std::stri
 
 void ConfigManager::RefreshAdminConfigs()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
     _adminConfigs.Refresh();
 }
 
 boost::optional<std::chrono::seconds> ConfigManager::CacheHostFallbackDelay()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
     boost::optional<std::chrono::seconds> returnValue;
 
     // We don't yet differentiate between background and foreground downloads, so check both configs
@@ -45,18 +48,43 @@ boost::optional<std::chrono::seconds> ConfigManager::CacheHostFallbackDelay()
 
 boost::optional<std::string> ConfigManager::CacheHostServer()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
     boost::optional<std::string> cacheHostServer = _adminConfigs.Get<std::string>(ConfigName_CacheHostServer);
     return cacheHostServer;
 }
 
 std::string ConfigManager::IoTConnectionString()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
     boost::optional<std::string> connectionString = _sdkConfigs.Get<std::string>(ConfigName_AduIoTConnectionString);
     return boost::get_optional_value_or(connectionString, std::string{});
 }
 
+UINT ConfigManager::MaxConnectionsPerDownload()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    boost::optional<UINT> maxConnections = _adminConfigs.Get<UINT>(ConfigName_MaxConnectionsPerDownload);
+    const UINT value = boost::get_optional_value_or(maxConnections, g_maxConnectionsPerDownloadDefault);
+    return std::max(1u, std::min(value, g_maxConnectionsPerDownloadLimit));
+}
+
+UINT64 ConfigManager::MaxDownloadBytesPerSecond()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    boost::optional<UINT64> maxBytesPerSecond = _adminConfigs.Get<UINT64>(ConfigName_MaxDownloadBytesPerSecond);
+    return boost::get_optional_value_or(maxBytesPerSecond, 0);
+}
+
+UINT64 ConfigManager::MaxBytesPerSecondPerDownload()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    boost::optional<UINT64> maxBytesPerSecond = _adminConfigs.Get<UINT64>(ConfigName_MaxBytesPerSecondPerDownload);
+    return boost::get_optional_value_or(maxBytesPerSecond, 0);
+}
+
 bool ConfigManager::RestControllerValidateRemoteAddr()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
     boost::optional<bool> validateRemoteAddr = _adminConfigs.Get<bool>(ConfigName_RestControllerValidateRemoteAddr);
     return boost::get_optional_value_or(validateRemoteAddr, g_RestControllerValidateRemoteAddrDefault);
 }   
@@ -3,9 +3,11 @@
 
 #pragma once
 
+#include <mutex>
 #include <boost/optional.hpp>
 #include "do_json_parser.h"
 
+// Thread-safe, downloads query configs from multiple task threads
 class ConfigManager
 {
 public:
@@ -17,9 +19,13 @@ public:
     boost::optional<std::chrono::seconds> CacheHostFallbackDelay();
     boost::optional<std::string> CacheHostServer();
     std::string IoTConnectionString();
+    UINT MaxConnectionsPerDownload();
+    UINT64 MaxDownloadBytesPerSecond();
+    UINT64 MaxBytesPerSecondPerDownload();
     bool RestControllerValidateRemoteAddr();
 
 private:
+    std::mutex _mutex;
     JsonParser _adminConfigs;
     JsonParser _sdkConfigs;
 };
@@ -4,13 +4,14 @@
 #include "do_common.h"
 #include "mcc_manager.h"
 
+#include <algorithm>
+#include <tuple>
+#include <utility>
 #include "config_defaults.h"
 #include "config_manager.h"
-#include "do_cpprest_uri.h"
+#include "do_host_estimates.h"
 #include "http_agent.h"
 
-namespace msdod = microsoft::deliveryoptimization::details;
-
 static std::string GetHostNameFromIoTConnectionString(const char* connectionString)
 {
     DoLogDebug("Parsing connection string: %s", connectionString);
@@ -38,6 +39,21 @@ static std::string GetHostNameFromIoTConnectionString(const char* connectionStri
     return hostname;
 }
 
+static std::vector<std::string> SplitHostList(const std::string& hostList)
+{
+    static const char* separators = ", \t";
+
+    std::vector<std::string> hosts;
+    auto start = hostList.find_first_not_of(separators);
+    while (start != std::string::npos)
+    {
+        const auto end = hostList.find_first_of(separators, start);
+        hosts.emplace_back(hostList.substr(start, (end == std::string::npos) ? end : end - start));
+        start = hostList.find_first_not_of(separators, end);
+    }
+    return hosts;
+}
+
 MCCManager::MCCManager(ConfigManager& sdkConfigs):
     _configManager(sdkConfigs)
 {
@@ -48,29 +64,88 @@ boost::optional<std::chrono::seconds> MCCManager::FallbackDelay()
     return _configManager.CacheHostFallbackDelay();
 }
 
-std::string MCCManager::GetHost()
+std::vector<std::string> MCCManager::GetHosts()
 {
     boost::optional<std::string> mccHostNameOpt =_configManager.CacheHostServer();
-    std::string mccHostName;
+    std::vector<std::string> mccHostNames;
 
     if (mccHostNameOpt.is_initialized())
     {
-        mccHostName = mccHostNameOpt.get();
+        mccHostNames = SplitHostList(mccHostNameOpt.get());
     }
     else
     {
         const std::string connString = _configManager.IoTConnectionString();
         if (!connString.empty())
         {
-            mccHostName = GetHostNameFromIoTConnectionString(connString.data());
+            std::string mccHostName = GetHostNameFromIoTConnectionString(connString.data());
+            if (!mccHostName.empty())
+            {
+                mccHostNames.push_back(std::move(mccHostName));
+            }
         }
     }
 
-    DoLogVerbose("Returning MCC host: [%s]", mccHostName.c_str());
-    return mccHostName;
+    DoLogVerbose("Returning %zu MCC host(s)", mccHostNames.size());
+    return mccHostNames;
 }
 
-void MCCManager::ReportHostError(HRESULT hr, UINT httpStatusCode, const std::string& mccHost, const std::string& originalUrl)
+std::string MCCManager::SelectHost(const std::string& originalHost, const HostEstimateTable& hostEstimates,
+    const std::string& hostToSkip)
+{
+    // Unhealthy hosts last, then by expected fetch time. Unmeasured hosts have none and go first,
+    // so that every host gets measured. Hosts ranked the same keep the configured order.
+    struct Candidate
+    {
+        std::string host;
+        bool fUnhealthy;
+        std::chrono::milliseconds fetchTime;
+    };
+    std::vector<std::string> mccHosts = GetHosts();
+    std::vector<Candidate> candidates;
+    {
+        std::unique_lock<std::mutex> lock(_mccHostsMutex);
+        for (auto& mccHost : mccHosts)
+        {
+            if (mccHost == hostToSkip)
+            {
+                continue;
+            }
+
+            auto it = _mccHosts.find(mccHost);
+            if ((it != _mccHosts.end()) && it->second.IsBanned(originalHost))
+            {
+                continue;
+            }
+
+            const bool fUnhealthy = (it != _mccHosts.end()) && (it->second.ErrorRate() > g_mccHostMaxErrorRate);
+            const auto fetchTime = hostEstimates.ExpectedFetchTime(mccHost, g_mccHostSelectionSampleBytes);
+            candidates.push_back({ std::move(mccHost), fUnhealthy, fetchTime });
+        }
+    }
+
+    auto best = std::min_element(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+        {
+            return std::tie(a.fUnhealthy, a.fetchTime) < std::tie(b.fUnhealthy, b.fetchTime);
+        });
+    if (best == candidates.end())
+    {
+        DoLogVerbose("No MCC host to use for %s", originalHost.c_str());
+        return {};
+    }
+
+    DoLogVerbose("Selected MCC host: [%s] out of %zu, expected fetch time: %lld ms", best->host.c_str(),
+        candidates.size(), static_cast<long long>(best->fetchTime.count()));
+    return best->host;
+}
+
+void MCCManager::ReportHostSuccess(const std::string& mccHost)
+{
+    std::unique_lock<std::mutex> lock(_mccHostsMutex);
+    _GetOrAddHostUnderLock(mccHost).OnRequestDone(true);
+}
+
+void MCCManager::ReportHostError(HRESULT hr, UINT httpStatusCode, const std::string& mccHost, const std::string& originalHost)
 {
     // Client error (HTTP 4xx codes) indicates that MCC is responsive but does not support this
     // original URL/host. The other errors indicate an unresponsive MCC.
@@ -78,40 +153,61 @@ void MCCManager::ReportHostError(HRESULT hr, UINT httpStatusCode, const std::str
     const bool generalFatalError = (hr == WININET_E_TIMEOUT)
         || (hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_NAME_NOT_RESOLVED))
         || (hr == HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT));
-    const auto originalHost = msdod::cpprest_web::uri{originalUrl}.host();
     DoLogWarningHr(hr, "ACK error from MCC host: [%s], original host: [%s], fatal error? %d",
         mccHost.data(), originalHost.data(), perHostFatalError || generalFatalError);
-    if (perHostFatalError || generalFatalError)
+
+    std::unique_lock<std::mutex> lock(_mccHostsMutex);
+    auto& host = _GetOrAddHostUnderLock(mccHost);
+
+    // Not supporting an original host says nothing about the cache host's health
+    if (!perHostFatalError)
     {
-        auto it = std::find(_mccHosts.begin(), _mccHosts.end(), mccHost);
-        if (it == _mccHosts.end())
-        {
-            it = _mccHosts.emplace(_mccHosts.end(), mccHost);
-        }
+        host.OnRequestDone(false);
+    }
 
+    if (perHostFatalError || generalFatalError)
+    {
         if (perHostFatalError)
         {
-            it->BanForOriginalHost(originalHost, g_mccHostBanInterval);
+            host.BanForOriginalHost(originalHost, g_mccHostBanInterval);
         }
         else
         {
-            it->Ban(g_mccHostBanInterval);
+            host.Ban(g_mccHostBanInterval);
         }
     }
 }
 
-bool MCCManager::IsBanned(const std::string& mccHost, const std::string& originalUrl) const
+bool MCCManager::IsBanned(const std::string& mccHost, const std::string& originalHost) const
 {
-    auto it = std::find(_mccHosts.begin(), _mccHosts.end(), mccHost);
-    if (it == _mccHosts.end())
+    std::unique_lock<std::mutex> lock(_mccHostsMutex);
+    auto it = _mccHosts.find(mccHost);
+    return (it != _mccHosts.end()) && it->second.IsBanned(originalHost);
+}
+
+void MCCManager::ReportProbeResult(const std::string& mccHost, bool fReachable)
+{
+    DoLogVerbose("Probed MCC host: [%s], reachable? %d", mccHost.c_str(), fReachable);
+    std::unique_lock<std::mutex> lock(_mccHostsMutex);
+    auto& host = _GetOrAddHostUnderLock(mccHost);
+    if (fReachable)
     {
-        return false;
+        host.Unban();
     }
     else
     {
-        const auto originalHost = msdod::cpprest_web::uri{originalUrl}.host();
-        return it->IsBanned(originalHost);
+        host.Ban(g_mccHostBanInterval);
+    }
+}
+
+MCCManager::MccHost& MCCManager::_GetOrAddHostUnderLock(const std::string& mccHost)
+{
+    auto it = _mccHosts.find(mccHost);
+    if (it == _mccHosts.end())
+    {
+        it = _mccHosts.emplace(mccHost, MccHost{mccHost}).first;
     }
+    return it->second;
 }
 
 MCCManager::MccHost::MccHost(const std::string& address) :
@@ -128,20 +224,40 @@ void MCCManager::MccHost::Ban(std::chrono::seconds banInterval)
 
 void MCCManager::MccHost::BanForOriginalHost(const std::string& originalHost, std::chrono::seconds banInterval)
 {
-    auto timeOfUnban = std::chrono::steady_clock::now() + banInterval;
+    const auto now = std::chrono::steady_clock::now();
     DoLogInfo("%s banned for %ld s for %s", _address.c_str(), banInterval.count(), originalHost.c_str());
 
-    auto banForOriginalHost = std::find(_timeOfUnbanForOriginalHosts.begin(), _timeOfUnbanForOriginalHosts.end(), originalHost);
-    if (banForOriginalHost == _timeOfUnbanForOriginalHosts.end())
+    // Drop the bans that are over, the table only grows with the origins that are banned at the same time
+    for (auto it = _timeOfUnbanForOriginalHosts.begin(); it != _timeOfUnbanForOriginalHosts.end(); )
     {
-        _timeOfUnbanForOriginalHosts.emplace_back(originalHost, timeOfUnban);
+        it = (it->second <= now) ? _timeOfUnbanForOriginalHosts.erase(it) : std::next(it);
     }
-    else
+    _timeOfUnbanForOriginalHosts[originalHost] = now + banInterval;
+}
+
+// Lifts the ban for all original hosts. Bans for specific original hosts stay, the host is still
+// responsive but doesn't serve them.
+void MCCManager::MccHost::Unban()
+{
+    if (std::chrono::steady_clock::now() < _timeOfUnban)
     {
-        banForOriginalHost->timeOfUnban = timeOfUnban;
+        DoLogInfo("%s unbanned", _address.data());
+        _timeOfUnban = std::chrono::steady_clock::time_point::min();
     }
 }
 
+void MCCManager::MccHost::OnRequestDone(bool fSucceeded)
+{
+    _errorRate = (0.75 * ErrorRate()) + (fSucceeded ? 0 : 0.25);
+    _timeOfLastRequest = std::chrono::steady_clock::now();
+}
+
+// Forgotten after a ban interval without requests, a host that is not picked for failing gets another chance
+double MCCManager::MccHost::ErrorRate() const
+{
+    return ((std::chrono::steady_clock::now() - _timeOfLastRequest) < g_mccHostBanInterval) ? _errorRate : 0;
+}
+
 bool MCCManager::MccHost::IsBanned(const std::string& originalHost) const
 {
     const auto now = std::chrono::steady_clock::now();
@@ -153,13 +269,13 @@ bool MCCManager::MccHost::IsBanned(const std::string& originalHost) const
     }
     else
     {
-        auto banForOriginalHost = std::find(_timeOfUnbanForOriginalHosts.begin(), _timeOfUnbanForOriginalHosts.end(), originalHost);
+        auto banForOriginalHost = _timeOfUnbanForOriginalHosts.find(originalHost);
         if (banForOriginalHost != _timeOfUnbanForOriginalHosts.end())
         {
-            isBanned = (now < banForOriginalHost->timeOfUnban);
+            isBanned = (now < banForOriginalHost->second);
             if (isBanned)
             {
-                const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(banForOriginalHost->timeOfUnban - now);
+                const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(banForOriginalHost->second - now);
                 DoLogVerbose("%s will be unbanned after %ld ms for host %s", _address.data(), diff.count(), originalHost.c_str());
             }
         }
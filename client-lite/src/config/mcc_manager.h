@@ -4,10 +4,14 @@
 #pragma once
 
 #include <chrono>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include <boost/optional.hpp>
 
 class ConfigManager;
+class HostEstimateTable;
 
 class MCCManager
 {
@@ -15,9 +19,22 @@ public:
     MCCManager(ConfigManager& configManager);
 
     boost::optional<std::chrono::seconds> FallbackDelay();
-    std::string GetHost();
-    void ReportHostError(HRESULT hr, UINT httpStatusCode, const std::string& mccHost, const std::string& originalUrl);
-    bool IsBanned(const std::string& mccHost, const std::string& originalUrl) const;
+
+    // Cache hosts in configured order, DOCacheHost can list several separated by commas or spaces
+    std::vector<std::string> GetHosts();
+
+    // The best cache host for downloads from the original host, empty if there is none to use. Hosts that are banned
+    // or failed too many of their recent requests are skipped, the rest ranked by their connect time and throughput.
+    std::string SelectHost(const std::string& originalHost, const HostEstimateTable& hostEstimates,
+        const std::string& hostToSkip = {});
+
+    void ReportHostSuccess(const std::string& mccHost);
+    void ReportHostError(HRESULT hr, UINT httpStatusCode, const std::string& mccHost, const std::string& originalHost);
+    bool IsBanned(const std::string& mccHost, const std::string& originalHost) const;
+
+    // Result of a background health probe. An unreachable host is banned before downloads run into it,
+    // a reachable one has its ban lifted.
+    void ReportProbeResult(const std::string& mccHost, bool fReachable);
 
 private:
     // MCC host can be banned for all original hosts (connection failures) or per host (not part of MCC allow list).
@@ -29,31 +46,26 @@ private:
 
         void Ban(std::chrono::seconds banInterval);
         void BanForOriginalHost(const std::string& originalHost, std::chrono::seconds banInterval);
+        void Unban();
+        void OnRequestDone(bool fSucceeded);
 
         const std::string& Address() const noexcept { return _address; }
         bool IsBanned(const std::string& originalHost) const;
-        bool operator==(const std::string& otherMccAddress) const noexcept { return (_address == otherMccAddress); }
+        double ErrorRate() const;
 
     private:
-        struct OriginalHostStatus
-        {
-            std::string host;
-            std::chrono::steady_clock::time_point timeOfUnban;
-
-            OriginalHostStatus(const std::string& host, std::chrono::steady_clock::time_point timeOfUnban) :
-                host(host),
-                timeOfUnban(timeOfUnban)
-            {
-            }
-
-            bool operator==(const std::string& otherHost) const noexcept { return (host == otherHost); }
-        };
-
         std::string _address;
         std::chrono::steady_clock::time_point _timeOfUnban;
-        std::vector<OriginalHostStatus> _timeOfUnbanForOriginalHosts;
+        double _errorRate { 0 };    // smoothed over recent requests
+        std::chrono::steady_clock::time_point _timeOfLastRequest;
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> _timeOfUnbanForOriginalHosts;
     };
 
+    MccHost& _GetOrAddHostUnderLock(const std::string& mccHost);
+
     ConfigManager& _configManager;
-    std::vector<MccHost> _mccHosts;
+
+    // Downloads on different task threads report errors and check bans concurrently
+    mutable std::mutex _mccHostsMutex;
+    std::unordered_map<std::string, MccHost> _mccHosts;
 };
@@ -7,6 +7,25 @@
 #include <errno.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+// An interface that has an IPv4/IPv6 address, is running and not a loopback interface
+static bool IsViableInterface(const struct ifaddrs* ifa)
+{
+    if (ifa->ifa_addr == nullptr)
+    {
+        return false;
+    }
+
+    const int family = ifa->ifa_addr->sa_family;
+    if ((family != AF_INET) && (family != AF_INET6))
+    {
+        return false;
+    }
+
+    return (ifa->ifa_flags & IFF_RUNNING) && !(ifa->ifa_flags & IFF_LOOPBACK);
+}
 
 bool NetworkMonitor::HasViableInterface()
 {
@@ -23,20 +42,9 @@ bool NetworkMonitor::HasViableInterface()
     //      local/portal/internet connectivity, or in case of false detections with current logic).
     for (struct ifaddrs* ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next)
     {
-        if (ifa->ifa_addr == nullptr)
-        {
-            continue;
-        }
-
-        int family = ifa->ifa_addr->sa_family;
-        if ((family != AF_INET) && (family != AF_INET6))
-        {
-            continue;
-        }
-
-        if ((ifa->ifa_flags & IFF_RUNNING)
-            && !(ifa->ifa_flags & IFF_LOOPBACK))
+        if (IsViableInterface(ifa))
         {
+            const int family = ifa->ifa_addr->sa_family;
             DoLogInfo("Viable network interface detected: %s, family: %d%s, flags: 0x%x.",
                 ifa->ifa_name, family,
                 (family == AF_INET) ? " (AF_INET)" :
@@ -51,3 +59,36 @@ bool NetworkMonitor::HasViableInterface()
     freeifaddrs(ifaddr);
     return false;
 }
+
+std::string NetworkMonitor::ViableInterfacesFingerprint()
+{
+    struct ifaddrs* ifaddr;
+    if (getifaddrs(&ifaddr) == -1)
+    {
+        DoLogError("getifaddrs() failed, errno: %d", errno);
+        return {};
+    }
+
+    std::string fingerprint;
+    for (struct ifaddrs* ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next)
+    {
+        if (!IsViableInterface(ifa))
+        {
+            continue;
+        }
+
+        char address[INET6_ADDRSTRLEN] = {};
+        const void* pAddr = (ifa->ifa_addr->sa_family == AF_INET) ?
+            static_cast<const void*>(&reinterpret_cast<const struct sockaddr_in*>(ifa->ifa_addr)->sin_addr) :
+            static_cast<const void*>(&reinterpret_cast<const struct sockaddr_in6*>(ifa->ifa_addr)->sin6_addr);
+        (void)inet_ntop(ifa->ifa_addr->sa_family, pAddr, address, sizeof(address));
+
+        fingerprint += ifa->ifa_name;
+        fingerprint += '/';
+        fingerprint += address;
+        fingerprint += ';';
+    }
+
+    freeifaddrs(ifaddr);
+    return fingerprint;
+}
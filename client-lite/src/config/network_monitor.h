@@ -3,8 +3,13 @@
 
 #pragma once
 
+#include <string>
+
 class NetworkMonitor
 {
 public:
     static bool HasViableInterface();
+
+    // Names and addresses of the viable interfaces. Changes when the device connects to a different network.
+    static std::string ViableInterfacesFingerprint();
 };
@@ -4,9 +4,14 @@
 #include "do_common.h"
 #include "download.h"
 
+#include <algorithm>
 #include <cmath>
+#include "config_manager.h"
 #include "do_cpprest_uri.h"
+#include "do_curl_wrappers.h"
 #include "do_error.h"
+#include "download_status_stream.h"
+#include "download_stream.h"
 #include "event_data.h"
 #include "mcc_manager.h"
 #include "network_monitor.h"
@@ -21,25 +26,103 @@ const std::chrono::seconds Download::_unsetTimeout = std::chrono::seconds(0);
 
 static std::string SwapUrlHostNameForMCC(const std::string& url, const std::string& newHostname, UINT16 port = INTERNET_DEFAULT_PORT);
 
-Download::Download(MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
-        std::string url, std::string destFilePath) :
+static std::string QueryHeaderValue(const IHttpAgent& httpAgent, PCSTR name)
+{
+    std::string_view value;
+    (void)httpAgent.QueryHeaders(name, value);
+    return std::string(value);
+}
+
+Download::Download(ConfigManager& config, MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
+        WriteBehindQueue& writeQueue, DownloadJournal& journal, REFGUID id, std::string url, std::string destFilePath) :
+    _config(config),
     _curlOps(curlOps),
+    _writeQueue(writeQueue),
+    _journal(journal),
     _mccManager(mccManager),
     _taskThread(taskThread),
+    _id(id),
     _url(std::move(url)),
     _destFilePath(std::move(destFilePath))
 {
     if (!_url.empty())
     {
         THROW_HR_IF(INET_E_INVALID_URL, !HttpAgent::ValidateUrl(_url));
+        _urlHost = msdod::cpprest_web::uri(_url).host();
     }
-    _id = CreateNewGuid();
+    RefreshBandwidthLimit();
     DoLogInfo("%s, new download, url: %s, dest: %s", GuidToString(_id).data(), _url.data(), _destFilePath.data());
 }
 
+Download::Download(ConfigManager& config, MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
+        WriteBehindQueue& writeQueue, DownloadJournal& journal, const DownloadJournalRecord& record) :
+    Download(config, mccManager, taskThread, curlOps, writeQueue, journal, record.id, record.url, record.destFilePath)
+{
+    _noProgressTimeout = std::chrono::seconds(record.noProgressTimeoutSecs);
+    _status.BytesTotal = record.bytesTotal;
+    _fDestFileCreated = record.fDestFileCreated;
+    _etag = record.etag;
+    _lastModified = record.lastModified;
+    _ranges = _ParseRanges(record.ranges);
+    _integrityCheck = IntegrityCheckInfo::Parse(record.integrityCheckInfo);
+    _fIntegrityCheckMandatory = record.fIntegrityCheckMandatory;
+    if (record.maxBytesPerSecond)
+    {
+        _maxBytesPerSecond = *record.maxBytesPerSecond;
+        RefreshBandwidthLimit();
+    }
+
+    // Without the content length, the missing parts can't be requested with range requests.
+    // Segments of a range download are requested with range requests from the start.
+    const bool fStartOver = (record.bytesTotal == 0) && !_IsRangeDownload();
+    for (const auto& recordSegment : record.segments)
+    {
+        auto segment = std::make_unique<Segment>(*this, recordSegment.offset, recordSegment.length);
+        segment->bytesWritten = fStartOver ? 0 : recordSegment.bytesWritten;
+        _bytesTransferred += segment->bytesWritten;
+        _segments.push_back(std::move(segment));
+    }
+    _status.BytesTransferred = _bytesTransferred;
+    _cbTransferredAtJournalUpdate = _bytesTransferred;
+    _LoadRequestSettings();
+
+    // Pieces up to where each segment left off were verified before the restart. The rest, including the
+    // piece in progress, is verified as the download resumes.
+    if (_integrityCheck.IsSet())
+    {
+        for (const auto& segment : _segments)
+        {
+            _bytesVerified += _integrityCheck.PieceStart(segment->offset + segment->bytesWritten) - segment->offset;
+        }
+    }
+
+    if (record.state == DownloadState::Transferred)
+    {
+        _bytesVerified = _integrityCheck.IsSet() ? _status.BytesTotal : 0;
+        _status._Transferred();
+    }
+    else
+    {
+        _status._Paused();
+    }
+    DoLogInfo("%s, restored from journal, state: %d, %llu out of %llu bytes in %zu segments", GuidToString(_id).data(),
+        _status.State, _status.BytesTransferred, _status.BytesTotal, _segments.size());
+}
+
 Download::~Download()
 {
     _CancelTasks();
+    if (_stream)
+    {
+        // The stream's callbacks refer to the segments
+        _stream->CloseWriter();
+        _stream->Abort();
+    }
+    // Clients see the end of the stream without a final state, like at agent shutdown
+    for (auto& statusStream : _statusStreams)
+    {
+        statusStream->Finish();
+    }
 }
 
 void Download::Start()
@@ -90,11 +173,12 @@ void Download::SetProperty(DownloadProperty key, const std::string& value)
         THROW_HR_IF(DO_E_INVALID_STATE, (_status.State != DownloadState::Created) && (_status.State != DownloadState::Paused));
         const bool fUrlChanged = (value != _url);
         _url = value;
+        _urlHost = msdod::cpprest_web::uri(_url).host();
         if ((_status.State == DownloadState::Paused) && fUrlChanged)
         {
             DoLogInfo("%s, URL changed, reset progress tracker and proxy list", GuidToString(_id).data());
             _progressTracker.Reset();
-            _proxyList.Refresh(_url);
+            _proxyList.Refresh(_curlOps.Proxies(), _url);
         }
         break;
     }
@@ -105,6 +189,24 @@ void Download::SetProperty(DownloadProperty key, const std::string& value)
         _destFilePath = value;
         break;
 
+    case DownloadProperty::CallbackFreqPercent:
+    {
+        const UINT percent = docli::string_conversions::ToUInt(value);
+        THROW_HR_IF(E_INVALIDARG, (percent == 0) || (percent > 100));
+        _callbackFreqPercent = percent;
+        _SchedStatusEvents();
+        break;
+    }
+
+    case DownloadProperty::CallbackFreqSeconds:
+    {
+        const UINT seconds = docli::string_conversions::ToUInt(value);
+        THROW_HR_IF(E_INVALIDARG, seconds == 0);
+        _callbackFreqSeconds = seconds;
+        _SchedStatusEvents();
+        break;
+    }
+
     case DownloadProperty::NoProgressTimeoutSeconds:
     {
         const auto timeout = std::chrono::seconds(docli::string_conversions::ToUInt(value));
@@ -113,10 +215,32 @@ void Download::SetProperty(DownloadProperty key, const std::string& value)
         break;
     }
 
+    case DownloadProperty::MaxBytesPerSecond:
+        _maxBytesPerSecond = docli::string_conversions::ToUInt(value);
+        RefreshBandwidthLimit();
+        break;
+
+    case DownloadProperty::Ranges:
+        THROW_HR_IF(DO_E_INVALID_STATE, _status.State != DownloadState::Created);
+        _ranges = _ParseRanges(value);
+        break;
+
+    case DownloadProperty::IntegrityCheckInfo:
+        THROW_HR_IF(DO_E_INVALID_STATE, _status.State != DownloadState::Created);
+        _integrityCheck = IntegrityCheckInfo::Parse(value);
+        break;
+
+    case DownloadProperty::IntegrityCheckMandatory:
+        THROW_HR_IF(DO_E_INVALID_STATE, _status.State != DownloadState::Created);
+        _fIntegrityCheckMandatory = (docli::string_conversions::ToUInt(value) != 0);
+        break;
+
     default:
         DO_ASSERT(false);
         break;
     }
+
+    _UpdateJournal();
 }
 
 std::string Download::GetProperty(DownloadProperty key) const
@@ -133,19 +257,80 @@ std::string Download::GetProperty(DownloadProperty key) const
     case DownloadProperty::LocalPath:
         return _destFilePath;
 
+    case DownloadProperty::CallbackFreqPercent:
+        return _callbackFreqPercent ? std::to_string(*_callbackFreqPercent) : "0";
+
+    case DownloadProperty::CallbackFreqSeconds:
+        return _callbackFreqSeconds ? std::to_string(*_callbackFreqSeconds) : "0";
+
     case DownloadProperty::NoProgressTimeoutSeconds:
         return std::to_string(_noProgressTimeout.count());
 
+    case DownloadProperty::MaxBytesPerSecond:
+        return std::to_string(_rateLimiter.Rate());
+
+    case DownloadProperty::Ranges:
+        return _RangesToString(_ranges);
+
+    case DownloadProperty::IntegrityCheckInfo:
+        return _integrityCheck.ToString();
+
+    case DownloadProperty::IntegrityCheckMandatory:
+        return _fIntegrityCheckMandatory ? "1" : "0";
+
     default:
         DO_ASSERT(false);
         return {};
     }
 }
 
+void Download::RefreshBandwidthLimit()
+{
+    const UINT64 maxBytesPerSecond = _maxBytesPerSecond ? *_maxBytesPerSecond : _config.MaxBytesPerSecondPerDownload();
+    if (maxBytesPerSecond != _rateLimiter.Rate())
+    {
+        DoLogInfo("%s, bandwidth limit: %llu bytes/s", GuidToString(_id).data(), maxBytesPerSecond);
+        _rateLimiter.SetRate(maxBytesPerSecond);
+    }
+}
+
 DownloadStatus Download::GetStatus() const
 {
     TelemetryLogger::getInstance().TraceDownloadStatus({*this});
-    return _status;
+    return Status();
+}
+
+DownloadStatus Download::Status() const
+{
+    DownloadStatus status = _status;
+    status.BytesTransferred = _bytesTransferred.load(std::memory_order_relaxed);
+    status.BytesVerified = _bytesVerified.load(std::memory_order_relaxed);
+    return status;
+}
+
+void Download::AttachStream(std::shared_ptr<DownloadStream> stream)
+{
+    THROW_HR_IF(DO_E_INVALID_STATE, (_status.State != DownloadState::Created) || _stream);
+    stream->Open();
+    _stream = std::move(stream);
+    DoLogInfo("%s, streaming to client", GuidToString(_id).data());
+}
+
+void Download::AttachStatusStream(std::shared_ptr<DownloadStatusStream> stream)
+{
+    stream->Open();
+
+    // Only the new subscriber needs the current status, the others have it or get it with the next event
+    const DownloadStatus status = Status();
+    THROW_IF_FAILED(stream->Send(status));
+    if ((status.State == DownloadState::Finalized) || (status.State == DownloadState::Aborted))
+    {
+        stream->Finish();
+        return;
+    }
+    _statusStreams.push_back(std::move(stream));
+    DoLogInfo("%s, status subscribers: %zu", GuidToString(_id).data(), _statusStreams.size());
+    _SchedStatusEvents();
 }
 
 #pragma GCC diagnostic push
@@ -252,92 +437,138 @@ void Download::_PerformStateChange(DownloadState newState)
     {
         DO_ASSERT(false);
     }
+
+    _UpdateJournal();
+    _SendStatusEvents();
 }
 #pragma GCC diagnostic pop
 
 void Download::_Start()
 {
     THROW_HR_IF(DO_E_DOWNLOAD_NO_URI, _url.empty());
-    THROW_HR_IF(DO_E_FILE_DOWNLOADSINK_UNSPECIFIED, _destFilePath.empty());
+    THROW_HR_IF(DO_E_FILE_DOWNLOADSINK_UNSPECIFIED, _destFilePath.empty() && !_IsStreaming());
+    THROW_HR_IF(DO_E_INTEGRITY_CHECK_INFO_MISSING, _fIntegrityCheckMandatory && !_integrityCheck.IsSet());
+    // Pieces are digests of the whole content, a range download doesn't have all of them
+    THROW_HR_IF(E_INVALIDARG, _integrityCheck.IsSet() && _IsRangeDownload());
 
-    _fileStream = DOFile::Create(_destFilePath);
-    _fDestFileCreated = true;
-    _httpAgent = std::make_unique<HttpAgent>(_curlOps, *this);
-    _proxyList.Refresh(_url);
+    DO_ASSERT((_status.BytesTotal == 0) && (_bytesTransferred == 0));
 
-    const auto mccFallbackDelay = _mccManager.FallbackDelay();
-    if (mccFallbackDelay)
+    if (!_IsStreaming())
     {
-        if (*mccFallbackDelay == g_cacheHostFallbackDelayNoFallback)
-        {
-            _mccFallbackDue = std::chrono::steady_clock::time_point::max();
-        }
-        else
-        {
-            _mccFallbackDue = std::chrono::steady_clock::now() + *mccFallbackDelay;
-        }
-        DoLogInfo("MCC fallback to original URL throttled for %ld s", mccFallbackDelay->count());
+        _fileStream = DOFile::Create(_destFilePath);
+        _fDestFileCreated = true;
     }
+    _CreateSegments();
+    _status.BytesTotal = _SegmentsBytesTotal();
+    _LoadRequestSettings();
 
-    _mccHost = _mccManager.GetHost();
+    _mccHost = _mccManager.SelectHost(_urlHost, _curlOps.HostEstimates());
 
-    DO_ASSERT((_status.BytesTotal == 0) && (_status.BytesTransferred == 0));
     _SendHttpRequest();
 }
 
 void Download::_Resume()
 {
-    DO_ASSERT(_httpAgent);
-    // BytesTotal can be zero if the start request never completed due to an error/pause
-    DO_ASSERT((_status.BytesTotal != 0) || (_status.BytesTransferred == 0));
-
-    _fileStream = DOFile::Open(_destFilePath);
+    DO_ASSERT(!_segments.empty());
+    // Same as on start, a restored download could have come back without its digests
+    THROW_HR_IF(DO_E_INTEGRITY_CHECK_INFO_MISSING, _fIntegrityCheckMandatory && !_integrityCheck.IsSet());
+    _status.BytesTransferred = _bytesTransferred;
+    // BytesTotal can be zero if the start request never completed due to an error/pause,
+    // or until the length of an open ended range is known
+    DO_ASSERT((_status.BytesTotal != 0) || (_status.BytesTransferred == 0) || _IsRangeDownload());
+
+    if (!_IsStreaming())
+    {
+        _fileStream = DOFile::Open(_destFilePath);
+    }
 
     if ((_status.BytesTotal != 0) && (_status.BytesTransferred == _status.BytesTotal))
     {
-        // We could get here if download was Paused just as we wrote the last block in OnData and scheduled the status update.
+        // We could get here if download was Paused just as we wrote the last block in OnData.
         // That would have caused OnComplete to not get called so now we discover that the download was completed.
         // Schedule the state update asynchronously here to account for the state change that is done upon returning from here.
         DoLogInfo("%s, already transferred %llu out of %llu bytes", GuidToString(_id).data(), _status.BytesTransferred, _status.BytesTotal);
         _taskThread.SchedImmediate([this]()
         {
-            _status._Transferred();
+            const HRESULT hr = _VerifyContentEnd();
+            if (FAILED(hr))
+            {
+                _Pause();
+                _status._Paused(hr);
+            }
+            else
+            {
+                _status._Transferred();
+            }
+            _UpdateJournal();
+            _SendStatusEvents();
         }, this);
     }
     else
     {
         if (_fAllowMcc)
         {
-            _mccHost = _mccManager.GetHost();
+            _mccHost = _mccManager.SelectHost(_urlHost, _curlOps.HostEstimates());
         }
         _SendHttpRequest();
     }
 }
 
+// Settings that apply for the lifetime of the download, loaded when it starts
+void Download::_LoadRequestSettings()
+{
+    // A stream, and a digest of the whole content, take the data in order from a single connection
+    const bool fInOrder = _IsStreaming() || (_integrityCheck.PieceSize() == IntegrityCheckInfo::WholeContent);
+    _maxConnections = fInOrder ? 1 : _config.MaxConnectionsPerDownload();
+    _proxyList.Refresh(_curlOps.Proxies(), _url);
+
+    const auto mccFallbackDelay = _mccManager.FallbackDelay();
+    if (mccFallbackDelay)
+    {
+        if (*mccFallbackDelay == g_cacheHostFallbackDelayNoFallback)
+        {
+            _mccFallbackDue = std::chrono::steady_clock::time_point::max();
+        }
+        else
+        {
+            _mccFallbackDue = std::chrono::steady_clock::now() + *mccFallbackDelay;
+        }
+        DoLogInfo("MCC fallback to original URL throttled for %ld s", mccFallbackDelay->count());
+    }
+}
+
 void Download::_Pause()
 {
-    _httpAgent->Close();    // waits until all callbacks are complete
+    _CloseHttpRequests();   // waits until all callbacks and writes are complete
     _timer.Stop();
-    _fHttpRequestActive = false;
     _fileStream.Close();   // safe to close now that no callbacks are expected
 }
 
 void Download::_Finalize()
 {
-    _httpAgent->Close();    // waits until all callbacks are complete
-    _fHttpRequestActive = false;
+    _CloseHttpRequests();   // waits until all callbacks and writes are complete
     _fileStream.Close();    // safe since no callbacks are expected
     _CancelTasks();
 }
 
 void Download::_Abort() try
 {
-    if (_httpAgent)
+    _CloseHttpRequests();
+    _timer.Stop();
+    if (_fDestFileCreated && _fileStream)
     {
-        _httpAgent->Close();
+        // Give back the preallocated space right away, it stays in use past the delete below
+        // for as long as anyone else has the file open
+        try
+        {
+            _fileStream.Truncate(0);
+        } CATCH_LOG()
     }
-    _timer.Stop();
     _fileStream.Close();
+    if (_stream)
+    {
+        _stream->Abort();
+    }
     _CancelTasks();
     // Delete file only if this download is the creator/owner. The abort could be from an
     // error downloading to an already existing file.
@@ -355,6 +586,7 @@ void Download::_HandleTransientError(HRESULT hr)
     const auto retryDelay = std::chrono::seconds(30);
     DoLogInfo("%s, transient error: %x, will retry in %lld seconds", GuidToString(_id).data(), hr, retryDelay.count());
     _status._Paused(S_OK, hr);
+    _SendStatusEvents();
     _taskThread.Sched([this]()
     {
         if (NetworkMonitor::HasViableInterface())
@@ -374,52 +606,317 @@ void Download::_ResumeAfterTransientError()
     DoLogInfo("%s, state: %d, error: %x, ext_error: %x", GuidToString(_id).data(), _status.State, _status.Error, _status.ExtendedError);
     if (_status.IsTransientError())
     {
-        DO_ASSERT(!_fHttpRequestActive);
+        DO_ASSERT(!_IsHttpRequestActive());
         _SendHttpRequest();
         _status._Transferring();
+        _SendStatusEvents();
     }
     // else nothing to do since we are not in transient error state
 }
 
 void Download::_SendHttpRequest(bool retryAfterFailure)
 {
-    const auto& proxy = _proxyList.Next();
-    const PCSTR szProxyUrl = !proxy.empty() ? proxy.data() : nullptr;
+    _requestProxy = _proxyList.Next();
+    _requestUrl = _UpdateConnectionTypeAndGetUrl(retryAfterFailure);
+    _requestHost = msdod::cpprest_web::uri(_requestUrl).host();
+    _SendSegmentRequests();
+
+    _timer.Start();
+    _cbTransferredAtRequestBegin = _bytesTransferred;
+    if (_connectionType == ConnectionType::CDN)
+    {
+        _fOriginalHostAttempted = true;
+    }
+
+    // Clear error codes, they will get updated once the request completes
+    _status.Error = S_OK;
+    _status.ExtendedError = S_OK;
+
+    _SchedProgressTracking();
+}
+
+// Requests up to _maxConnections segments at a time. The rest are requested as earlier ones complete
+// and reuse their connections, a range download can have many more segments than connections.
+void Download::_SendSegmentRequests()
+{
+    auto numActive = static_cast<UINT>(std::count_if(_segments.begin(), _segments.end(), [](const auto& segment)
+        {
+            return segment->fRequestActive;
+        }));
+    for (auto& segment : _segments)
+    {
+        if (numActive >= _maxConnections)
+        {
+            break;
+        }
+        if (!segment->IsComplete() && !segment->fRequestActive)
+        {
+            _SendSegmentRequest(*segment);
+            ++numActive;
+        }
+    }
+}
 
-    const std::string url = _UpdateConnectionTypeAndGetUrl(retryAfterFailure);
+void Download::_SendSegmentRequest(Segment& segment)
+{
+    const PCSTR szProxyUrl = !_requestProxy.empty() ? _requestProxy.data() : nullptr;
 
-    // Default curl connect timeout is too long (300s). Override it.
-    // MCC requests get an even shorter timeout because it is expected to be quick and
-    // allows faster fallback to original source.
+    // Default curl connect timeout is too long (300s). Override it until the host's connect time is known,
+    // the http agent adapts it then. MCC requests get an even shorter timeout because it is expected
+    // to be quick and allows faster fallback to original source.
     const UINT connectTimeoutSecs = (_connectionType == ConnectionType::MCC) ? 3 : 15;
 
-    if (_status.BytesTransferred == 0)
+    if (!segment.httpAgent)
+    {
+        segment.httpAgent = std::make_unique<HttpAgent>(_curlOps, segment, &_rateLimiter);
+        if (!_IsStreaming())
+        {
+            segment.writeStream = std::make_unique<WriteBehindQueue::Stream>(_writeQueue, _fileStream, [&segment]()
+                {
+                    segment.httpAgent->Unpause();
+                });
+        }
+    }
+    if (_IsStreaming())
+    {
+        _stream->SetOnWritable([&segment]()
+            {
+                segment.httpAgent->Unpause();
+            });
+    }
+    if (_integrityCheck.IsSet())
+    {
+        _PrepareIntegrityHasher(segment);
+    }
+
+    // Before sending, the request can complete on the transfer thread right away and its completion
+    // must not look like it belongs to an earlier request
+    ++segment.requestGeneration;
+    segment.bytesWrittenAtRequestBegin = segment.bytesWritten;
+    segment.hrPreallocate = S_OK;
+    const UINT64 requestOffset = segment.offset + segment.bytesWritten;
+    if ((requestOffset == 0) && (segment.length == Segment::LengthUnknown))
     {
-        DoLogInfo("%s, requesting full file from %s", GuidToString(_id).data(), url.data());
-        THROW_IF_FAILED(_httpAgent->SendRequest(url.data(), szProxyUrl, nullptr, connectTimeoutSecs));
+        segment.fRangeRequest = false;
+        segment.ifRange.clear();
+        DoLogInfo("%s, requesting full file from %s", GuidToString(_id).data(), _requestUrl.data());
+        THROW_IF_FAILED(segment.httpAgent->SendRequest(_requestUrl.data(), szProxyUrl, nullptr, connectTimeoutSecs));
     }
     else
     {
-        DO_ASSERT((_status.BytesTotal != 0) && (_status.BytesTransferred < _status.BytesTotal));
+        DO_ASSERT(_IsRangeDownload() || ((_status.BytesTotal != 0) && (requestOffset < _status.BytesTotal)));
 
-        auto range = HttpAgent::MakeRange(_status.BytesTransferred, (_status.BytesTotal - _status.BytesTransferred));
-        DoLogInfo("%s, requesting range: %s from %s", GuidToString(_id).data(), range.data(), url.data());
-        THROW_IF_FAILED(_httpAgent->SendRequest(url.data(), szProxyUrl, range.data(), connectTimeoutSecs));
+        // An open ended range is requested as such until its response tells the content length
+        UINT64 requestLength = segment.length - segment.bytesWritten;
+        if (segment.length == Segment::LengthUnknown)
+        {
+            requestLength = _IsRangeDownload() ? Segment::LengthUnknown : (_status.BytesTotal - requestOffset);
+        }
+        auto range = HttpAgent::MakeRange(requestOffset, requestLength);
+        segment.fRangeRequest = true;
+        segment.ifRange = _IfRangeValidator();
+        DoLogInfo("%s, requesting range: %s, if-range: %s from %s", GuidToString(_id).data(), range.data(),
+            segment.ifRange.data(), _requestUrl.data());
+        THROW_IF_FAILED(segment.httpAgent->SendRequest(_requestUrl.data(), szProxyUrl, range.data(), connectTimeoutSecs,
+            segment.ifRange.data()));
     }
 
-    _timer.Start();
-    _fHttpRequestActive = true;
-    _cbTransferredAtRequestBegin = _status.BytesTransferred;
-    if (_connectionType == ConnectionType::CDN)
+    segment.fRequestActive = true;
+}
+
+// A download of the whole file starts with a single segment, a range download with one per range
+void Download::_CreateSegments()
+{
+    _segments.clear();
+    if (!_IsRangeDownload())
     {
-        _fOriginalHostAttempted = true;
+        _segments.push_back(std::make_unique<Segment>(*this, 0, Segment::LengthUnknown));
+        return;
     }
 
-    // Clear error codes, they will get updated once the request completes
+    for (const auto& range : _ranges)
+    {
+        _segments.push_back(std::make_unique<Segment>(*this, range.offset, range.length));
+    }
+    DoLogInfo("%s, range download of %zu ranges", GuidToString(_id).data(), _ranges.size());
+}
+
+// Called on the taskthread once the content length is known from the first segment's response
+void Download::_AddSegments(UINT numSegments)
+{
+    DO_ASSERT((_segments.size() == 1) && (numSegments > 1));
+    DO_ASSERT(_segments[0]->length == _SegmentLengthFor(_status.BytesTotal, numSegments));
+
+    const UINT64 segmentLength = _segments[0]->length;
+    for (UINT i = 1; i < numSegments; ++i)
+    {
+        const UINT64 offset = i * segmentLength;
+        const UINT64 length = (i == (numSegments - 1)) ? (_status.BytesTotal - offset) : segmentLength;
+        _segments.push_back(std::make_unique<Segment>(*this, offset, length));
+    }
+    DoLogInfo("%s, split into %u segments of %llu bytes", GuidToString(_id).data(), numSegments, segmentLength);
+
+    // The first segment's request could have completed/failed in the meantime. Nothing more to do
+    // here in that case, the remaining segments get requested along with the retry.
+    if ((_status.State == DownloadState::Transferring) && _IsHttpRequestActive())
+    {
+        try
+        {
+            _SendSegmentRequests();
+        } CATCH_LOG()
+    }
+}
+
+// Called on the taskthread when a range request found that the content changed at the source.
+// The data so far belongs to the old content, so start over from the first request.
+void Download::_RestartAfterContentChange()
+{
+    ++_numContentRestarts;
+    DoLogWarning("%s, content changed at the source, starting over (%u), discarding %llu bytes", GuidToString(_id).data(),
+        _numContentRestarts, static_cast<UINT64>(_bytesTransferred));
+
+    _CloseHttpRequests();   // waits until all callbacks and writes are complete
+
+    // Tasks still queued for the download refer to the segments that are about to go away
+    _taskThread.Unschedule(this);
+    _CreateSegments();
+
+    _bytesTransferred = 0;
+    _bytesVerified = 0;
+    _status.BytesTransferred = 0;
+    _status.BytesTotal = _SegmentsBytesTotal();
+    _sparseFileSize = 0;
     _status.Error = S_OK;
     _status.ExtendedError = S_OK;
+    _cbTransferredAtRequestBegin = 0;
+    _etag.clear();
+    _lastModified.clear();
+    try
+    {
+        // Gives back the space preallocated for the old content
+        _fileStream.Truncate(0);
+    } CATCH_LOG()
 
-    _SchedProgressTracking();
+    _SendSegmentRequests();
+    _UpdateJournal();
+}
+
+// If-Range takes a strong ETag or a Last-Modified date. Weak ETags can't be used for range requests.
+std::string Download::_IfRangeValidator() const
+{
+    if (!_etag.empty() && (_etag.compare(0, 2, "W/") != 0))
+    {
+        return _etag;
+    }
+    return _lastModified;
+}
+
+// Called on the taskthread with the content length from a range download's response. The file gets
+// the content's size, ranges land at their offsets and the parts in between stay holes. Unlike the file
+// of a full download it isn't preallocated, there is nothing to reserve for the parts not downloaded.
+void Download::_ExtendSparseFile(UINT64 fileSize) try
+{
+    if ((fileSize != 0) && (fileSize != _sparseFileSize) && _fileStream)
+    {
+        _fileStream.Truncate(fileSize);
+        _sparseFileSize = fileSize;
+    }
+} CATCH_LOG()
+
+HRESULT Download::_PreallocateFile(UINT64 fileSize) try
+{
+    _fileStream.Preallocate(fileSize);
+    return S_OK;
+} CATCH_RETURN()
+
+// Closes the requests and waits for their data to be written out
+void Download::_CloseHttpRequests()
+{
+    for (auto& segment : _segments)
+    {
+        if (segment->httpAgent)
+        {
+            segment->httpAgent->Close();    // waits until all callbacks are complete
+        }
+        segment->fRequestActive = false;
+
+        if (segment->writeStream)
+        {
+            UINT64 failedOffset;
+            const HRESULT hr = segment->writeStream->Drain(&failedOffset);
+            if (FAILED(hr))
+            {
+                // Data from the failed write onwards is not on disk, it gets requested again upon resume
+                const UINT64 cbWritten = failedOffset - segment->offset;
+                if (cbWritten < segment->bytesWritten)
+                {
+                    _bytesTransferred -= (segment->bytesWritten - cbWritten);
+                    segment->bytesWritten = cbWritten;
+                }
+            }
+        }
+    }
+
+    // Data the stream took is sent on its own, it only has to stop waking up the closed requests
+    if (_stream)
+    {
+        _stream->CloseWriter();
+    }
+}
+
+// Called on the taskthread after a segment's request completes, successfully or with a non-fatal error
+void Download::_OnSegmentRequestDone()
+{
+    // Move on to the segments that are waiting for a connection, unless a failure is going to be retried
+    if ((_status.State == DownloadState::Transferring) && SUCCEEDED(_status.Error) && !_AllSegmentsComplete())
+    {
+        try
+        {
+            _SendSegmentRequests();
+        } CATCH_LOG()
+    }
+
+    if (_IsHttpRequestActive())
+    {
+        // Wait for the remaining segments
+        return;
+    }
+
+    if (_AllSegmentsComplete())
+    {
+        _timer.Stop();
+        if (_stream)
+        {
+            _stream->Finish();
+        }
+        _status._Transferred();
+        _UpdateJournal();
+        _SendStatusEvents();
+        return;
+    }
+
+    // Stay in Transferring state and retry the incomplete segments
+    _progressTracker.OnDownloadFailure();
+    auto retryDelay = _progressTracker.NextRetryDelay(_curlOps.HostEstimates().RetryDelay(_requestHost));
+
+    // If we must fallback from MCC due to this error, retry without a delay
+    if (_ShouldPauseMccUsage(HttpAgent::IsClientError(_httpStatusCode)))
+    {
+        retryDelay = std::chrono::milliseconds(0);
+        _progressTracker.ResetRetryDelay();
+    }
+
+    DoLogInfoHr(_status.Error, "%s, failure, will retry in %lld ms, http_status: %d, headers:\n%s",
+        GuidToString(_id).data(), retryDelay.count(), _httpStatusCode, _responseHeaders.data());
+    _taskThread.Sched([this]()
+    {
+        // Nothing to do if we moved out of Transferring state in the meantime or
+        // if the http request was already made by a pause-resume cycle.
+        if ((_status.State == DownloadState::Transferring) && !_IsHttpRequestActive())
+        {
+            _SendHttpRequest(true);
+        }
+    }, retryDelay, this);
 }
 
 void Download::_SchedProgressTracking()
@@ -433,14 +930,21 @@ void Download::_SchedProgressTracking()
     {
         if (_status.State == DownloadState::Transferring)
         {
+            _status.BytesTransferred = _bytesTransferred;
             const bool fTimedOut = _progressTracker.CheckProgress(_status.BytesTransferred, _MaxNoProgressIntervals());
             if (fTimedOut)
             {
                 _Pause();
                 _status._Paused(DO_E_DOWNLOAD_NO_PROGRESS, _status.Error);
+                _UpdateJournal();
+                _SendStatusEvents();
             }
             else
             {
+                if (_status.BytesTransferred != _cbTransferredAtJournalUpdate)
+                {
+                    _UpdateJournal();
+                }
                 _SchedProgressTracking();
             }
         }
@@ -451,28 +955,364 @@ void Download::_CancelTasks()
 {
     _taskThread.Unschedule(this);
     _taskThread.Unschedule(&_progressTracker);
+    _taskThread.Unschedule(&_statusStreams);
 }
 
-UINT Download::_MaxNoProgressIntervals() const
+// Records the download in the journal. Downloads that were never started are not recorded,
+// finalized and aborted ones are removed from it.
+void Download::_UpdateJournal() try
 {
-    if (_noProgressTimeout == _unsetTimeout)
+    // A streamed download can't be resumed once its connection is gone
+    if (!_journal.IsEnabled() || (_status.State == DownloadState::Created) || _IsStreaming())
     {
-        return g_progressTrackerMaxNoProgressIntervals;
+        return;
     }
 
-    auto maxNoProgressIntervals = std::round(std::chrono::duration<double>(_noProgressTimeout) / g_progressTrackerCheckInterval);
-    DO_ASSERT(maxNoProgressIntervals >= 1);
-    return static_cast<UINT>(maxNoProgressIntervals);
-}
-
-std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
-{
-    auto newConnectionType = _connectionType;
-    if (retryAfterFailure)
+    if ((_status.State == DownloadState::Finalized) || (_status.State == DownloadState::Aborted))
     {
-        DO_ASSERT(_connectionType != ConnectionType::None);
+        _journal.Delete(_id);
+        return;
+    }
 
-        if (_mccFallbackDue)
+    DownloadJournalRecord record;
+    record.id = _id;
+    record.url = _url;
+    record.destFilePath = _destFilePath;
+    // Transient errors are retried automatically, so carry on with the download after a restart too
+    record.state = _status.IsTransientError() ? DownloadState::Transferring : _status.State;
+    record.bytesTotal = _status.BytesTotal;
+    record.noProgressTimeoutSecs = static_cast<UINT>(_noProgressTimeout.count());
+    record.fDestFileCreated = _fDestFileCreated;
+    record.etag = _etag;
+    record.lastModified = _lastModified;
+    record.maxBytesPerSecond = _maxBytesPerSecond;
+    record.ranges = _RangesToString(_ranges);
+    record.integrityCheckInfo = _integrityCheck.ToString();
+    record.fIntegrityCheckMandatory = _fIntegrityCheckMandatory;
+    for (const auto& segment : _segments)
+    {
+        record.segments.push_back({ segment->offset, segment->length, _DurableBytesWritten(*segment) });
+    }
+    _journal.Save(record);
+    _cbTransferredAtJournalUpdate = _bytesTransferred;
+} CATCH_LOG()
+
+// Sends the status to the subscribers if it changed since the last event. Called on every state change and for
+// progress, see _SchedStatusEvents. Finalized and aborted downloads have no further events.
+void Download::_SendStatusEvents()
+{
+    if (_statusStreams.empty())
+    {
+        return;
+    }
+
+    const DownloadStatus status = Status();
+    const bool fChanged = (status.State != _lastStatusEvent.State) || (status.Error != _lastStatusEvent.Error)
+        || (status.ExtendedError != _lastStatusEvent.ExtendedError) || (status.BytesTotal != _lastStatusEvent.BytesTotal)
+        || (status.BytesTransferred != _lastStatusEvent.BytesTransferred) || (status.BytesVerified != _lastStatusEvent.BytesVerified);
+    if (fChanged)
+    {
+        _lastStatusEvent = status;
+        for (auto it = _statusStreams.begin(); it != _statusStreams.end(); )
+        {
+            if (FAILED((*it)->Send(status)))
+            {
+                (*it)->Abort();
+                it = _statusStreams.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    if ((status.State == DownloadState::Finalized) || (status.State == DownloadState::Aborted))
+    {
+        for (auto& statusStream : _statusStreams)
+        {
+            statusStream->Finish();
+        }
+        _statusStreams.clear();
+    }
+    _SchedStatusEvents();
+}
+
+// Progress events go out every CallbackFreqSeconds and every time another CallbackFreqPercent of the content
+// is transferred, counted from the last event. The data callback schedules the latter once it gets there.
+void Download::_SchedStatusEvents()
+{
+    _cbNextStatusEvent = std::numeric_limits<UINT64>::max();
+    if (_statusStreams.empty() || (_status.State != DownloadState::Transferring))
+    {
+        _taskThread.Unschedule(&_statusStreams);
+        return;
+    }
+
+    if (_callbackFreqPercent && (_status.BytesTotal != 0))
+    {
+        const UINT64 cbStep = std::max<UINT64>((_status.BytesTotal * *_callbackFreqPercent) / 100, 1);
+        _cbNextStatusEvent = _lastStatusEvent.BytesTransferred + cbStep;
+    }
+
+    if (_callbackFreqSeconds || !_callbackFreqPercent)
+    {
+        const std::chrono::seconds interval = _callbackFreqSeconds ? std::chrono::seconds(*_callbackFreqSeconds)
+            : std::chrono::seconds(g_statusEventDefaultInterval);
+        _taskThread.SchedReplace([this]()
+        {
+            _SendStatusEvents();
+        }, interval, &_statusStreams);
+    }
+    else
+    {
+        _taskThread.Unschedule(&_statusStreams);
+    }
+}
+
+// Bytes of the segment known to be in the file. While a request is active, some of the
+// received data can still be waiting in the write-behind queue.
+UINT64 Download::_DurableBytesWritten(const Segment& segment) const
+{
+    if (!segment.fRequestActive || !segment.writeStream)
+    {
+        return segment.bytesWritten;
+    }
+
+    const UINT64 writtenOffset = segment.writeStream->WrittenOffset();
+    const UINT64 cbWritten = (writtenOffset > segment.offset) ? std::min(writtenOffset - segment.offset, segment.length.load()) : 0;
+    return std::max(segment.bytesWrittenAtRequestBegin, cbWritten);
+}
+
+bool Download::_IsHttpRequestActive() const
+{
+    return std::any_of(_segments.begin(), _segments.end(), [](const auto& segment)
+        {
+            return segment->fRequestActive;
+        });
+}
+
+bool Download::_AllSegmentsComplete() const
+{
+    return !_segments.empty() && std::all_of(_segments.begin(), _segments.end(), [](const auto& segment)
+        {
+            return segment->IsComplete();
+        });
+}
+
+// Zero until the length of every segment is known
+UINT64 Download::_SegmentsBytesTotal() const
+{
+    UINT64 bytesTotal = 0;
+    for (const auto& segment : _segments)
+    {
+        if (segment->length == Segment::LengthUnknown)
+        {
+            return 0;
+        }
+        bytesTotal += segment->length;
+    }
+    return bytesTotal;
+}
+
+// Called on the http_agent callback thread with the first segment's response to a full file request
+UINT Download::_SegmentCountFor(UINT64 bytesTotal, IHttpAgent& httpAgent) const
+{
+    if ((_maxConnections <= 1) || (bytesTotal < (2 * g_downloadSegmentMinSizeBytes)))
+    {
+        return 1;
+    }
+
+    // The server must support range requests for the parallel segments
+    std::string_view acceptRanges;
+    if (FAILED(httpAgent.QueryHeaders("Accept-Ranges", acceptRanges)) || (acceptRanges.find("bytes") == std::string_view::npos))
+    {
+        return 1;
+    }
+
+    UINT64 maxSegments = bytesTotal / g_downloadSegmentMinSizeBytes;
+    if (_integrityCheck.IsSet())
+    {
+        // Each segment gets at least one whole piece
+        maxSegments = std::min(maxSegments, bytesTotal / _integrityCheck.PieceSize());
+    }
+    return static_cast<UINT>(std::max(std::min(static_cast<UINT64>(_maxConnections), maxSegments), static_cast<UINT64>(1)));
+}
+
+// Segments other than the last end at a piece boundary when the pieces have digests, the last segment takes the rest
+UINT64 Download::_SegmentLengthFor(UINT64 bytesTotal, UINT numSegments) const
+{
+    const UINT64 length = bytesTotal / numSegments;
+    return ((numSegments > 1) && _integrityCheck.IsSet()) ? _integrityCheck.PieceStart(length) : length;
+}
+
+// Picks up verification where the segment's data continues. When the data hashed so far doesn't line up with it,
+// like after an agent restart or data that didn't make it to disk, hashing starts over from the beginning of
+// the piece and catches up by reading back what is already in the file.
+void Download::_PrepareIntegrityHasher(Segment& segment)
+{
+    const UINT64 resumeOffset = segment.offset + segment.bytesWritten;
+    if (segment.hasher && (segment.hasher->Offset() == resumeOffset))
+    {
+        return;
+    }
+
+    const UINT64 pieceStart = _integrityCheck.PieceStart(resumeOffset);
+    DO_ASSERT(pieceStart >= segment.offset);
+    if (segment.hasher && (segment.hasher->PieceStart() > pieceStart))
+    {
+        // Verified data that went missing from the file
+        _bytesVerified -= (segment.hasher->PieceStart() - pieceStart);
+    }
+    segment.hasher = std::make_unique<IntegrityHasher>(_integrityCheck, pieceStart);
+    if (pieceStart == resumeOffset)
+    {
+        return;
+    }
+
+    // Streamed data can't be read back, it is never taken back either
+    THROW_HR_IF(E_UNEXPECTED, !_fileStream);
+    DoLogInfo("%s, integrity check catching up on %llu bytes at offset %llu", GuidToString(_id).data(),
+        resumeOffset - pieceStart, pieceStart);
+    std::vector<BYTE> buffer(static_cast<size_t>(std::min(static_cast<UINT64>(g_integrityCheckReadBufferSize), resumeOffset - pieceStart)));
+    for (UINT64 offset = pieceStart; offset < resumeOffset; )
+    {
+        const size_t cbToRead = static_cast<size_t>(std::min(static_cast<UINT64>(buffer.size()), resumeOffset - offset));
+        THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_LENGTH), _fileStream.Read(offset, buffer.data(), cbToRead) != cbToRead);
+        UINT64 cbVerified;
+        THROW_IF_FAILED(segment.hasher->Update(buffer.data(), cbToRead, cbVerified));
+        offset += cbToRead;
+    }
+}
+
+// Called on the taskthread once the last segment is complete. Its last piece ends with the content.
+HRESULT Download::_VerifyContentEnd() try
+{
+    if (!_integrityCheck.IsSet())
+    {
+        return S_OK;
+    }
+
+    Segment& segment = *_segments.back();
+    DO_ASSERT(segment.IsComplete());
+    _PrepareIntegrityHasher(segment);
+
+    UINT64 cbVerified = 0;
+    const HRESULT hr = segment.hasher->Finish(cbVerified);
+    _bytesVerified += cbVerified;
+    if (FAILED(hr))
+    {
+        // The failed piece gets downloaded again upon resume
+        const UINT64 cbDiscard = (segment.offset + segment.bytesWritten) - segment.hasher->PieceStart();
+        segment.bytesWritten -= cbDiscard;
+        _bytesTransferred -= cbDiscard;
+        _status.BytesTransferred = _bytesTransferred;
+        return hr;
+    }
+    DoLogInfo("%s, integrity check passed for %llu bytes", GuidToString(_id).data(), static_cast<UINT64>(_bytesVerified));
+    return S_OK;
+} CATCH_RETURN()
+
+// Ranges are given as "offset:length,..." in any order. Overlapping and adjacent ones are merged so that
+// each takes a single range request. Ranges that add up to the whole content make a regular download.
+std::vector<Download::Range> Download::_ParseRanges(const std::string& value)
+{
+    std::vector<Range> ranges;
+    size_t itemBegin = 0;
+    while (itemBegin < value.size())
+    {
+        size_t itemEnd = value.find(',', itemBegin);
+        if (itemEnd == std::string::npos)
+        {
+            itemEnd = value.size();
+        }
+
+        const std::string item = value.substr(itemBegin, itemEnd - itemBegin);
+        const auto separator = item.find(':');
+        THROW_HR_IF(E_INVALIDARG, separator == std::string::npos);
+        const UINT64 offset = docli::string_conversions::ToUInt64(item.substr(0, separator));
+        const UINT64 length = docli::string_conversions::ToUInt64(item.substr(separator + 1));
+        THROW_HR_IF(E_INVALIDARG, length == 0);
+        THROW_HR_IF(E_INVALIDARG, (length != Segment::LengthUnknown) && (length > (Segment::LengthUnknown - offset)));
+        ranges.push_back({ offset, length });
+        itemBegin = itemEnd + 1;
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b)
+        {
+            return a.offset < b.offset;
+        });
+
+    std::vector<Range> coalesced;
+    for (const auto& range : ranges)
+    {
+        if (!coalesced.empty())
+        {
+            Range& last = coalesced.back();
+            if (last.length == Segment::LengthUnknown)
+            {
+                continue;   // already reaches the end
+            }
+
+            const UINT64 lastEnd = last.offset + last.length;
+            if (range.offset <= lastEnd)
+            {
+                last.length = (range.length == Segment::LengthUnknown) ?
+                    Segment::LengthUnknown : (std::max(lastEnd, range.offset + range.length) - last.offset);
+                continue;
+            }
+        }
+        coalesced.push_back(range);
+    }
+
+    if ((coalesced.size() == 1) && (coalesced[0].offset == 0) && (coalesced[0].length == Segment::LengthUnknown))
+    {
+        coalesced.clear();
+    }
+    return coalesced;
+}
+
+std::string Download::_RangesToString(const std::vector<Range>& ranges)
+{
+    std::string value;
+    for (const auto& range : ranges)
+    {
+        if (!value.empty())
+        {
+            value += ',';
+        }
+        value += std::to_string(range.offset);
+        value += ':';
+        value += std::to_string(range.length);
+    }
+    return value;
+}
+
+UINT Download::_MaxNoProgressIntervals() const
+{
+    if (_noProgressTimeout == _unsetTimeout)
+    {
+        return g_progressTrackerMaxNoProgressIntervals;
+    }
+
+    auto maxNoProgressIntervals = std::round(std::chrono::duration<double>(_noProgressTimeout) / g_progressTrackerCheckInterval);
+    DO_ASSERT(maxNoProgressIntervals >= 1);
+    return static_cast<UINT>(maxNoProgressIntervals);
+}
+
+std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
+{
+    auto newConnectionType = _connectionType;
+    if (retryAfterFailure)
+    {
+        DO_ASSERT(_connectionType != ConnectionType::None);
+
+        if ((_connectionType == ConnectionType::MCC) && _TryMccFailover())
+        {
+            // Another cache host gets a chance before falling back to the original URL
+            _numAttemptsWithCurrentConnectionType = 0;
+        }
+        else if (_mccFallbackDue)
         {
             if (*_mccFallbackDue <= std::chrono::steady_clock::now())
             {
@@ -488,7 +1328,7 @@ std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
             // Fallback config not overriden.
             // Use custom logic to decide when to switch between MCC and CDN.
 
-            const bool noProgressOnCurrentConnectionType = _cbTransferredAtRequestBegin == _status.BytesTransferred;
+            const bool noProgressOnCurrentConnectionType = _cbTransferredAtRequestBegin == _bytesTransferred;
             if (_connectionType == ConnectionType::MCC)
             {
                 if (_fOriginalHostAttempted)
@@ -524,8 +1364,14 @@ std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
 
     DO_ASSERT(newConnectionType != ConnectionType::None);
 
+    // The cache host might have been banned by another download since
+    if ((newConnectionType == ConnectionType::MCC) && _fAllowMcc && !_mccHost.empty() && _mccManager.IsBanned(_mccHost, _urlHost))
+    {
+        _mccHost = _mccManager.SelectHost(_urlHost, _curlOps.HostEstimates());
+    }
+
     std::string urlToUse;
-    if ((newConnectionType == ConnectionType::MCC) && _fAllowMcc && !_mccHost.empty() && !_mccManager.IsBanned(_mccHost, _url))
+    if ((newConnectionType == ConnectionType::MCC) && _fAllowMcc && !_mccHost.empty() && !_mccManager.IsBanned(_mccHost, _urlHost))
     {
         newConnectionType = ConnectionType::MCC;
         urlToUse = SwapUrlHostNameForMCC(_url, _mccHost);
@@ -540,6 +1386,7 @@ std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
     {
         _connectionType = newConnectionType;
         _numAttemptsWithCurrentConnectionType = 1;
+        _numMccFailovers = 0;
     }
     else
     {
@@ -551,6 +1398,32 @@ std::string Download::_UpdateConnectionTypeAndGetUrl(bool retryAfterFailure)
     return urlToUse;
 }
 
+// Moves to the next best cache host after a failed request, at most once for each of the other configured hosts
+// so that failing hosts don't keep the download from falling back
+bool Download::_TryMccFailover()
+{
+    if (!_fAllowMcc || (_mccFallbackDue && (*_mccFallbackDue <= std::chrono::steady_clock::now())))
+    {
+        return false;
+    }
+
+    if ((_numMccFailovers + 1) >= _mccManager.GetHosts().size())
+    {
+        return false;
+    }
+
+    auto nextMccHost = _mccManager.SelectHost(_urlHost, _curlOps.HostEstimates(), _mccHost);
+    if (nextMccHost.empty())
+    {
+        return false;
+    }
+
+    DoLogInfo("%s, failing over from MCC host [%s] to [%s]", GuidToString(_id).data(), _mccHost.data(), nextMccHost.data());
+    _mccHost = std::move(nextMccHost);
+    ++_numMccFailovers;
+    return true;
+}
+
 bool Download::_ShouldPauseMccUsage(bool isFatalError) const
 {
     if (_UsingMcc())
@@ -623,126 +1496,337 @@ bool Download::_IsFatalError(HRESULT hrRequest, HRESULT hrCallback, UINT httpSta
 
 // IHttpAgentEvents
 
-HRESULT Download::OnHeadersAvailable() try
+HRESULT Download::Segment::OnHeadersAvailable()
+{
+    return download._OnSegmentHeadersAvailable(*this);
+}
+
+HRESULT Download::Segment::OnData(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData)
+{
+    return download._OnSegmentData(*this, pData, cbData);
+}
+
+HRESULT Download::Segment::OnComplete(HRESULT hrRequest, HRESULT hrCallback)
+{
+    return download._OnSegmentComplete(*this, hrRequest, hrCallback);
+}
+
+HRESULT Download::_OnSegmentHeadersAvailable(Segment& segment) try
 {
     // Capture relevant data and update internal members asynchronously
     UINT httpStatusCode;
-    std::string responseHeaders;
-    LOG_IF_FAILED(_httpAgent->QueryStatusCode(&httpStatusCode));
-    LOG_IF_FAILED(_httpAgent->QueryHeaders(nullptr, responseHeaders));
+    std::string_view responseHeaders;
+    LOG_IF_FAILED(segment.httpAgent->QueryStatusCode(&httpStatusCode));
+    LOG_IF_FAILED(segment.httpAgent->QueryHeaders(nullptr, responseHeaders));
+
+    std::string etag = QueryHeaderValue(*segment.httpAgent, "ETag");
+    std::string lastModified = QueryHeaderValue(*segment.httpAgent, "Last-Modified");
+
+    // A full response to a range request. The server sends one for If-Range when the content changed,
+    // otherwise it ignored the range. Fail the request before any of the data goes into the file.
+    // A range from the start of the file is the exception when the content is unchanged: the full response serves
+    // just as well, its data stops at the end of the segment. Servers without range support get retried this way.
+    if ((httpStatusCode == HTTP_STATUS_OK) && segment.fRangeRequest)
+    {
+        const UINT64 requestOffset = segment.offset + segment.bytesWrittenAtRequestBegin;
+        const bool fContentChanged = !segment.ifRange.empty() && (segment.ifRange != etag) && (segment.ifRange != lastModified);
+        DoLogWarning("%s, full response to range request at offset %llu, if-range: %s, etag: %s, last-modified: %s",
+            GuidToString(_id).data(), requestOffset, segment.ifRange.data(), etag.data(), lastModified.data());
+        if (fContentChanged)
+        {
+            return DO_E_CONTENT_CHANGED;
+        }
+        if (requestOffset != 0)
+        {
+            return DO_E_INSUFFICIENT_RANGE_SUPPORT;
+        }
+    }
 
     // bytesTotal is required for resume after a pause/error
-    UINT64 bytesTotal;
+    UINT64 bytesTotal = 0;
+    UINT numSegments = 1;
+    bool fPreallocate = false;
     if (httpStatusCode == HTTP_STATUS_OK)
     {
-        RETURN_IF_FAILED(_httpAgent->QueryContentLength(&bytesTotal));
+        RETURN_IF_FAILED(segment.httpAgent->QueryContentLength(&bytesTotal));
+
+        // Full file response to the first request. Length of the first segment is now known and
+        // the rest of the file can be split across more segments if it is large enough.
+        if ((segment.offset == 0) && (segment.length == Segment::LengthUnknown) && (bytesTotal != 0))
+        {
+            // Reserve disk space for the whole file before transferring any of it, see below
+            if (!_IsStreaming())
+            {
+                fPreallocate = true;
+                segment.hrPreallocate = E_PENDING;
+            }
+
+            numSegments = _SegmentCountFor(bytesTotal, *segment.httpAgent);
+            segment.length = _SegmentLengthFor(bytesTotal, numSegments);
+        }
     }
     else if (httpStatusCode == HTTP_STATUS_PARTIAL_CONTENT)
     {
-        RETURN_IF_FAILED(_httpAgent->QueryContentLengthFromRange(&bytesTotal));
+        RETURN_IF_FAILED(segment.httpAgent->QueryContentLengthFromRange(&bytesTotal));
+        if (_IsRangeDownload() && (segment.length == Segment::LengthUnknown))
+        {
+            // Open ended range, its length is known now
+            RETURN_HR_IF(E_UNEXPECTED, bytesTotal <= segment.offset);
+            segment.length = bytesTotal - segment.offset;
+        }
     }
 
-    DoLogInfo("%s, http_status: %d, content_length: %llu, headers:\n%s",
-        GuidToString(_id).data(), httpStatusCode, bytesTotal, responseHeaders.data());
+    DoLogInfo("%s, http_status: %d, content_length: %llu, segment offset: %llu, headers:\n%.*s",
+        GuidToString(_id).data(), httpStatusCode, bytesTotal, segment.offset, static_cast<int>(responseHeaders.size()),
+        responseHeaders.data());
 
-    _taskThread.Sched([this, httpStatusCode, bytesTotal, responseHeaders = std::move(responseHeaders)]()
+    // The agent's header buffer is reused by the next request, keep a copy
+    _taskThread.Sched([this, &segment, requestGeneration = segment.requestGeneration, httpStatusCode, bytesTotal,
+        numSegments, fPreallocate, responseHeaders = std::string(responseHeaders), etag = std::move(etag),
+        lastModified = std::move(lastModified)]()
     {
+        // Fails the download right away if there isn't enough space and keeps the file contiguous on disk.
+        // Done here, not on the transfer thread, because fallocate can take a while on slow storage and would
+        // hold up every other transfer meanwhile. The segment's data waits for it, see _OnSegmentData.
+        // Skipped if a pause or retry closed the request in the meantime, and the file along with it on pause.
+        // The file then goes without the reservation, like one resumed from the journal.
+        const bool fRequestCurrent = (_status.State == DownloadState::Transferring) && segment.fRequestActive
+            && (segment.requestGeneration == requestGeneration);
+        if (fPreallocate && fRequestCurrent)
+        {
+            segment.hrPreallocate = _PreallocateFile(bytesTotal);
+            segment.httpAgent->Unpause();
+        }
+
         _httpStatusCode = httpStatusCode;
         _responseHeaders = std::move(responseHeaders);
-        _status.BytesTotal = bytesTotal;
+        if (_IsRangeDownload())
+        {
+            // Progress of a range download is measured against the ranges, not the whole content
+            _status.BytesTotal = _SegmentsBytesTotal();
+            _ExtendSparseFile(bytesTotal);
+        }
+        else
+        {
+            _status.BytesTotal = bytesTotal;
+        }
+        if (!etag.empty() || !lastModified.empty())
+        {
+            _etag = etag;
+            _lastModified = lastModified;
+        }
+        if (numSegments > 1)
+        {
+            _AddSegments(numSegments);
+        }
+
+        // Content length, segments and validators are known now
+        _UpdateJournal();
+        _SendStatusEvents();
     }, this);
 
     return S_OK;
 } CATCH_RETURN()
 
-HRESULT Download::OnData(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) try
+HRESULT Download::_OnSegmentData(Segment& segment, _In_reads_bytes_(cbData) BYTE* pData, UINT cbData) try
 {
-    _fileStream.Append(pData, cbData);
-    _taskThread.Sched([this, cbData]()
+    const HRESULT hrPreallocate = segment.hrPreallocate;
+    if (hrPreallocate == E_PENDING)
     {
-        _status.BytesTransferred += cbData;
-    }, this);
-    return S_OK;
+        // Disk space for the file is being reserved, curl delivers this data again once done
+        return E_PENDING;
+    }
+    RETURN_IF_FAILED(hrPreallocate);
+
+    // The first segment's full file response carries data beyond the segment when the file was split.
+    // Stop the transfer once the segment is filled.
+    HRESULT hr = S_OK;
+    UINT cbToWrite = cbData;
+    if (segment.length != Segment::LengthUnknown)
+    {
+        const UINT64 cbRemaining = segment.length - segment.bytesWritten;
+        if (cbData > cbRemaining)
+        {
+            cbToWrite = static_cast<UINT>(cbRemaining);
+            hr = S_FALSE;
+        }
+    }
+
+    if (cbToWrite != 0)
+    {
+        const HRESULT hrWrite = _IsStreaming() ? _stream->Write(pData, cbToWrite)
+            : segment.writeStream->Write(segment.offset + segment.bytesWritten, pData, cbToWrite);
+        if (hrWrite == E_PENDING)
+        {
+            // Out of write buffers or the client is behind, curl delivers this data again once there is room for it
+            return E_PENDING;
+        }
+        RETURN_IF_FAILED(hrWrite);
+        segment.bytesWritten += cbToWrite;
+        const UINT64 cbTransferred = _bytesTransferred.fetch_add(cbToWrite, std::memory_order_relaxed) + cbToWrite;
+        if ((cbTransferred >= _cbNextStatusEvent.load(std::memory_order_relaxed))
+            && (_cbNextStatusEvent.exchange(std::numeric_limits<UINT64>::max()) != std::numeric_limits<UINT64>::max()))
+        {
+            _taskThread.Sched([this]()
+            {
+                _SendStatusEvents();
+            }, &_statusStreams);
+        }
+
+        if (segment.hasher)
+        {
+            UINT64 cbVerified = 0;
+            const HRESULT hrVerify = segment.hasher->Update(pData, cbToWrite, cbVerified);
+            _bytesVerified.fetch_add(cbVerified, std::memory_order_relaxed);
+            if (FAILED(hrVerify))
+            {
+                // Fails the download. The failed piece gets downloaded again upon resume.
+                const UINT64 cbDiscard = (segment.offset + segment.bytesWritten) - segment.hasher->PieceStart();
+                segment.bytesWritten -= cbDiscard;
+                _bytesTransferred.fetch_sub(cbDiscard, std::memory_order_relaxed);
+                return hrVerify;
+            }
+        }
+    }
+    return hr;
 } CATCH_RETURN()
 
-HRESULT Download::OnComplete(HRESULT hrRequest, HRESULT hrCallback)
+HRESULT Download::_OnSegmentComplete(Segment& segment, HRESULT hrRequest, HRESULT hrCallback)
 {
     try
     {
-        if (SUCCEEDED(hrRequest))
+        const UINT requestGeneration = segment.requestGeneration;
+
+        // OnHeadersAvailable might not have been called in the failure case depending on
+        // when the failure occurred - upon connecting, or while reading response data.
+        UINT httpStatusCode = 0;
+        std::string responseHeaders;
+        if (FAILED(hrRequest))
         {
-            _taskThread.Sched([this]()
+            std::string_view headers;
+            LOG_IF_FAILED(segment.httpAgent->QueryStatusCode(&httpStatusCode));
+            LOG_IF_FAILED(segment.httpAgent->QueryHeaders(nullptr, headers));
+            responseHeaders = headers;
+        }
+
+        // The request is done only once all its data is on disk or sent. A failed write fails the request
+        // just like a write failure within OnData would have.
+        auto onFlushed = [this, &segment, requestGeneration, hrRequest, hrCallback, httpStatusCode,
+            responseHeaders = std::move(responseHeaders)](HRESULT hrWrite) mutable
+        {
+            try
             {
-                _fHttpRequestActive = false;
-                _timer.Stop();
-                _status._Transferred();
-            }, this);
+                const HRESULT hrCallbackWithWrite = FAILED(hrCallback) ? hrCallback : hrWrite;
+                _taskThread.Sched([this, &segment, requestGeneration, hrRequest, hrCallbackWithWrite, httpStatusCode,
+                    responseHeaders = std::move(responseHeaders)]()
+                {
+                    _OnSegmentRequestComplete(segment, requestGeneration, hrRequest, hrCallbackWithWrite, httpStatusCode, responseHeaders);
+                }, this);
+            } CATCH_LOG()
+        };
+        if (_IsStreaming())
+        {
+            _stream->Flush(std::move(onFlushed));
         }
         else
         {
-            // OnHeadersAvailable might not have been called in the failure case depending on
-            // when the failure occurred - upon connecting, or while reading response data.
-            UINT httpStatusCode;
-            std::string responseHeaders;
-            LOG_IF_FAILED(_httpAgent->QueryStatusCode(&httpStatusCode));
-            LOG_IF_FAILED(_httpAgent->QueryHeaders(nullptr, responseHeaders));
+            segment.writeStream->Flush(std::move(onFlushed));
+        }
+    } CATCH_LOG()
+    return S_OK;
+}
+
+void Download::_OnSegmentRequestComplete(Segment& segment, UINT requestGeneration, HRESULT hrRequest, HRESULT hrCallback,
+    UINT httpStatusCode, std::string responseHeaders)
+{
+    if (requestGeneration != segment.requestGeneration)
+    {
+        return;
+    }
 
-            _taskThread.Sched([this, hrRequest, hrCallback, httpStatusCode, responseHeaders = std::move(responseHeaders)]()
+    segment.fRequestActive = false;
+    if (SUCCEEDED(hrRequest) && SUCCEEDED(hrCallback))
+    {
+        if (_UsingMcc())
+        {
+            _mccManager.ReportHostSuccess(_mccHost);
+        }
+
+        if (segment.length == Segment::LengthUnknown)
+        {
+            // No content length from the server, the response is the whole file
+            segment.length = segment.bytesWritten;
+        }
+        if (segment.IsComplete() && (&segment == _segments.back().get()))
+        {
+            const HRESULT hrVerify = _VerifyContentEnd();
+            if (FAILED(hrVerify))
             {
-                _fHttpRequestActive = false;
-                _httpStatusCode = httpStatusCode;
-                _responseHeaders = std::move(responseHeaders);
+                DoLogWarningHr(hrVerify, "%s, fatal failure, content does not match its integrity check info", GuidToString(_id).data());
+                _Pause();
+                _status._Paused(hrVerify);
+                _UpdateJournal();
+                _SendStatusEvents();
+                return;
+            }
+        }
+        if (segment.IsComplete())
+        {
+            // Its data is on disk and no more requests are coming, give the connection's handle back to the pool
+            segment.writeStream.reset();
+            if (_stream)
+            {
+                _stream->CloseWriter();
+            }
+            segment.httpAgent.reset();
+        }
+        _OnSegmentRequestDone();
+        return;
+    }
 
-                if (!NetworkMonitor::HasViableInterface())
-                {
-                    _HandleTransientError(DO_E_BLOCKED_BY_NO_NETWORK);
-                    return;
-                }
+    if ((hrCallback == DO_E_CONTENT_CHANGED) && (_numContentRestarts < g_downloadMaxContentRestarts) && !_IsStreaming())
+    {
+        _RestartAfterContentChange();
+        return;
+    }
 
-                if (_UsingMcc())
-                {
-                    _mccManager.ReportHostError(hrRequest, _httpStatusCode, _mccHost, _url);
-                }
+    if (FAILED(hrRequest))
+    {
+        _httpStatusCode = httpStatusCode;
+        _responseHeaders = std::move(responseHeaders);
+    }
 
-                const auto hrErrorToReport = FAILED(hrCallback) ? hrCallback : hrRequest;
+    if (!NetworkMonitor::HasViableInterface())
+    {
+        _CloseHttpRequests();
+        _HandleTransientError(DO_E_BLOCKED_BY_NO_NETWORK);
+        return;
+    }
 
-                // Fail fast on certain http/local errors
-                if (_IsFatalError(hrRequest, hrCallback, httpStatusCode))
-                {
-                    DoLogWarningHr(hrRequest, "%s, fatal failure, http_status: %d, hrCallback: 0x%x, headers:\n%s",
-                        GuidToString(_id).data(), _httpStatusCode, hrCallback, _responseHeaders.data());
-                    _Pause();
-                    _status._Paused(hrErrorToReport);
-                    return;
-                }
+    if (_UsingMcc() && FAILED(hrRequest))
+    {
+        _mccManager.ReportHostError(hrRequest, _httpStatusCode, _mccHost, _urlHost);
+    }
 
-                // Make note of the failure and stay in Transferring state for retry
-                _status.Error = hrErrorToReport;
-                _progressTracker.OnDownloadFailure();
-                std::chrono::seconds retryDelay = _progressTracker.NextRetryDelay();
+    const auto hrErrorToReport = FAILED(hrCallback) ? hrCallback : hrRequest;
 
-                // If we must fallback from MCC due to this error, retry without a delay
-                if (_ShouldPauseMccUsage(HttpAgent::IsClientError(_httpStatusCode)))
-                {
-                    retryDelay = std::chrono::seconds(0);
-                    _progressTracker.ResetRetryDelay();
-                }
+    // Fail fast on certain http/local errors
+    if (_IsFatalError(hrRequest, hrCallback, _httpStatusCode))
+    {
+        DoLogWarningHr(hrRequest, "%s, fatal failure, http_status: %d, hrCallback: 0x%x, headers:\n%s",
+            GuidToString(_id).data(), _httpStatusCode, hrCallback, _responseHeaders.data());
+        _Pause();
+        _status._Paused(hrErrorToReport);
+        _UpdateJournal();
+        _SendStatusEvents();
+        return;
+    }
 
-                DoLogInfoHr(hrRequest, "%s, failure, will retry in %lld seconds, http_status: %d, hrCallback: 0x%x, headers:\n%s",
-                    GuidToString(_id).data(), retryDelay.count(), _httpStatusCode, hrCallback, _responseHeaders.data());
-                _taskThread.Sched([this]()
-                {
-                    // Nothing to do if we moved out of Transferring state in the meantime or
-                    // if the http request was already made by a pause-resume cycle.
-                    if ((_status.State == DownloadState::Transferring) && !_fHttpRequestActive)
-                    {
-                        _SendHttpRequest(true);
-                    }
-                }, retryDelay, this);
-            }, this);
-        }
-    } CATCH_LOG()
-    return S_OK;
+    // Make note of the failure, the retry happens once all active segments are done
+    DoLogInfoHr(hrRequest, "%s, segment at offset %llu failed, http_status: %d, hrCallback: 0x%x",
+        GuidToString(_id).data(), segment.offset, _httpStatusCode, hrCallback);
+    _status.Error = hrErrorToReport;
+    _OnSegmentRequestDone();
 }
 
 std::string SwapUrlHostNameForMCC(const std::string& url, const std::string& newHostname, UINT16 port)
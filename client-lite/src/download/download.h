@@ -3,24 +3,35 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <limits>
 #include <memory>
+#include <vector>
 #include <boost/optional.hpp>
 #include "do_file.h"
 #include "do_guid.h"
+#include "do_token_bucket.h"
+#include "do_write_behind.h"
+#include "download_integrity.h"
+#include "download_journal.h"
 #include "download_progress_tracker.h"
 #include "download_status.h"
 #include "http_agent_interface.h"
 #include "proxy_finder.h"
 #include "stop_watch.h"
 
+class ConfigManager;
 class CurlRequests;
+class DownloadStatusStream;
+class DownloadStream;
 class MCCManager;
 class TaskThread;
 
 // Keep this enum in sync with the full blown DO client in order to not
 // have separate mappings in the SDK.
-// Only Id, Uri, LocalPath and NoProgressTimeoutSeconds are supported in this client.
+// Only Id, Uri, LocalPath, CallbackFreqPercent, CallbackFreqSeconds, NoProgressTimeoutSeconds, IntegrityCheckInfo
+// and IntegrityCheckMandatory are supported in this client, along with MaxBytesPerSecond and Ranges which are specific to it.
 enum class DownloadProperty
 {
     Id = 0,
@@ -42,19 +53,30 @@ enum class DownloadProperty
     NetworkToken,
     CorrelationVector,
     DecryptionInfo,
-    IntegrityCheckInfo,
-    IntegrityCheckMandatory,
+    IntegrityCheckInfo,         // see IntegrityCheckInfo::Parse for the format
+    IntegrityCheckMandatory,    // "1" to refuse to start without IntegrityCheckInfo
     TotalSizeBytes,
+    DisallowOnCellular,
+    HttpCustomAuthHeaders,
+    HttpAllowSecureToNonSecureRedirect,
+    NonVolatile,
+
+    // Not in the full blown DO client
+    MaxBytesPerSecond,
+    Ranges,     // "offset:length,..." in bytes, length 18446744073709551615 (UINT64 max) reads up to the end
 
     Invalid // keep this at the end
 };
 
-class Download : public IHttpAgentEvents
+class Download
 {
 public:
-    // Download(TaskThread& taskThread, REFGUID id); TODO implement along with persistence
-    Download(MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
-        std::string url = {}, std::string destFilePath = {});
+    Download(ConfigManager& config, MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
+        WriteBehindQueue& writeQueue, DownloadJournal& journal, REFGUID id, std::string url = {}, std::string destFilePath = {});
+
+    // Restores a download from its journal record, in Paused or Transferred state
+    Download(ConfigManager& config, MCCManager& mccManager, TaskThread& taskThread, CurlRequests& curlOps,
+        WriteBehindQueue& writeQueue, DownloadJournal& journal, const DownloadJournalRecord& record);
     ~Download();
 
     void Start();
@@ -72,9 +94,21 @@ public:
     const std::string& GetMCCHost() const { return _mccHost; }
     std::chrono::milliseconds GetElapsedTime() const { return _timer.GetElapsedInterval(); }
 
+    // Applies the MaxBytesPerSecond property, or the admin configured default if the property is not set
+    void RefreshBandwidthLimit();
+
+    // Sends the download's data over the stream instead of writing it to the destination file.
+    // Only before the download starts. A streamed download is not journaled and does not start over
+    // when the content changes, the data sent so far can't be taken back.
+    void AttachStream(std::shared_ptr<DownloadStream> stream);
+
+    // Pushes the download's status over the stream, the current status right away and then as it changes,
+    // until the download is finalized or aborted. Any number of streams can be attached, in any state.
+    void AttachStatusStream(std::shared_ptr<DownloadStatusStream> stream);
+
     UINT HttpStatusCode() const { return _httpStatusCode; }
     const std::string& ResponseHeaders() const { return _responseHeaders; }
-    const DownloadStatus& Status() const { return _status; }
+    DownloadStatus Status() const;
 
 private:
     enum class ConnectionType
@@ -84,45 +118,166 @@ private:
         CDN,
     };
 
+    // A contiguous byte range of the file, fetched over its own http request.
+    // A download starts with a single segment. Large files get split into multiple segments
+    // that are downloaded in parallel once the content length is known (see _SegmentCountFor).
+    // A range download has one segment per range instead, and is never split further.
+    // Pause/resume and retries re-request only the missing part of each incomplete segment.
+    //
+    // bytesWritten, and length of the first segment until the content length is known, are updated
+    // on the http_agent callback thread while a request is active. length is atomic since the taskthread
+    // reads it meanwhile to journal the segment. Everything else is accessed only on the taskthread.
+    struct Segment : public IHttpAgentEvents
+    {
+        static constexpr UINT64 LengthUnknown = std::numeric_limits<UINT64>::max();
+
+        Segment(Download& download, UINT64 offset, UINT64 length) :
+            download(download),
+            offset(offset),
+            length(length)
+        {
+        }
+
+        ~Segment()
+        {
+            // Stop the transfer, then let pending writes and their callbacks complete before the http agent goes away
+            if (httpAgent)
+            {
+                httpAgent->Close();
+            }
+            writeStream.reset();
+        }
+
+        bool IsComplete() const noexcept { return (bytesWritten == length); }
+
+        // IHttpAgentEvents
+        HRESULT OnHeadersAvailable() override;
+        HRESULT OnData(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) override;
+        HRESULT OnComplete(HRESULT hrRequest, HRESULT hrCallback) override;
+
+        Download& download;
+        const UINT64 offset;
+        std::atomic<UINT64> length;
+        UINT64 bytesWritten { 0 };
+        UINT64 bytesWrittenAtRequestBegin { 0 };
+        std::unique_ptr<IHttpAgent> httpAgent;
+        std::unique_ptr<WriteBehindQueue::Stream> writeStream;
+
+        // Verifies the segment's data in the http_agent callback, when the download has IntegrityCheckInfo
+        std::unique_ptr<IntegrityHasher> hasher;
+
+        // Incremented for every request sent to identify completion callbacks from earlier requests
+        UINT requestGeneration { 0 };
+        bool fRequestActive { false };
+
+        // Whether the active request is a range request and the If-Range validator it was sent with, if any
+        bool fRangeRequest { false };
+        std::string ifRange;
+
+        // E_PENDING while the task thread reserves disk space for the file, the result once done.
+        // The response data is held off until then.
+        std::atomic<HRESULT> hrPreallocate { S_OK };
+    };
+
+    // Byte range of a range download, sorted and coalesced
+    struct Range
+    {
+        UINT64 offset;
+        UINT64 length;  // Segment::LengthUnknown for a range up to the end of the content
+    };
+
     static const std::chrono::seconds _unsetTimeout;
 
+    ConfigManager& _config;
     CurlRequests& _curlOps;
+    WriteBehindQueue& _writeQueue;
+    DownloadJournal& _journal;
     MCCManager& _mccManager;
     TaskThread& _taskThread;
 
-    // _fileStream and _httpAgent members are accessed on both the taskthread
+    // _fileStream, _stream and _segments members are accessed on both the taskthread
     // and http_agent callback thread. See _Pause and _Finalize for special handling.
     // Everything else is accessed only on the taskthread.
 
     GUID _id;
     std::string _url;
+    std::string _urlHost;   // identifies the download's bans at cache hosts
     std::string _destFilePath;
     std::chrono::seconds _noProgressTimeout { _unsetTimeout };
     boost::optional<std::chrono::steady_clock::time_point> _mccFallbackDue;
 
     DownloadStatus _status;
+
+    // Bytes written to the file, updated on the http_agent callback thread for every chunk of data.
+    // Folded into _status.BytesTransferred when the status is read and on progress tracker ticks
+    // instead of scheduling a task per chunk.
+    std::atomic<UINT64> _bytesTransferred { 0 };
     DownloadProgressTracker _progressTracker;
 
     StopWatch _timer;
 
+    // Declared ahead of _segments, their http agents use it
+    TokenBucket _rateLimiter;
+    boost::optional<UINT> _maxBytesPerSecond;
+
     DOFile _fileStream;
-    std::unique_ptr<IHttpAgent> _httpAgent;
+    std::shared_ptr<DownloadStream> _stream;
+    std::vector<std::unique_ptr<Segment>> _segments;
     std::string _responseHeaders;
     UINT _httpStatusCode { 0 };
     ProxyList _proxyList;
 
+    // Only set before the download starts, so it is safe to read on the http_agent callback thread.
+    // Empty for a download of the whole file.
+    std::vector<Range> _ranges;
+
+    // Only set before the download starts, like _ranges. Segments of a download with piece digests
+    // are split at piece boundaries so that each piece is verified by a single segment.
+    IntegrityCheckInfo _integrityCheck;
+    bool _fIntegrityCheckMandatory { false };
+
+    // Bytes of the pieces that matched their digests, updated on the http_agent callback thread
+    std::atomic<UINT64> _bytesVerified { 0 };
+
+    // Size the sparse file of a range download was extended to, once the content length is known
+    UINT64 _sparseFileSize { 0 };
+
+    // Validators from the latest response that had them
+    std::string _etag;
+    std::string _lastModified;
+
+    // Times the download started over because the content changed at the source
+    UINT _numContentRestarts { 0 };
+
+    // Subscribers to status events, see _SendStatusEvents. Accessed only on the taskthread,
+    // except for the byte count of the next progress event which the http_agent callback thread checks.
+    std::vector<std::shared_ptr<DownloadStatusStream>> _statusStreams;
+    DownloadStatus _lastStatusEvent;
+    std::atomic<UINT64> _cbNextStatusEvent { std::numeric_limits<UINT64>::max() };
+    boost::optional<UINT> _callbackFreqPercent;
+    boost::optional<UINT> _callbackFreqSeconds;
+
+    // Bytes transferred as of the last journal update
+    UINT64 _cbTransferredAtJournalUpdate { 0 };
+
+    // Read once on start, the config can change while the download is in progress
+    UINT _maxConnections { 1 };
+
+    // Url and proxy in use for the segment requests
+    std::string _requestUrl;
+    std::string _requestProxy;
+    std::string _requestHost;
+
     // The MCC host name we are using for the current http request, if any
     std::string _mccHost;
+    // Moves to another cache host since the download last switched to MCC
+    UINT _numMccFailovers { 0 };
 
     UINT _numAttemptsWithCurrentConnectionType { 0 };
     ConnectionType _connectionType { ConnectionType::None };
     UINT64 _cbTransferredAtRequestBegin { 0 };
     bool _fOriginalHostAttempted { false };
 
-    // This flag will indicate whether we have an outstanding http request or not.
-    // Need this because we will not move out of Transferring state while waiting before a retry.
-    bool _fHttpRequestActive { false };
-
     bool _fDestFileCreated { false };
 
     bool _fAllowMcc { true };
@@ -134,15 +289,48 @@ private:
     void _Pause();
     void _Finalize();
     void _Abort();
+    void _LoadRequestSettings();
 
     void _HandleTransientError(HRESULT hr);
     void _ResumeAfterTransientError();
     void _SendHttpRequest(bool retryAfterFailure = false);
+    void _SendSegmentRequests();
+    void _SendSegmentRequest(Segment& segment);
+    void _CreateSegments();
+    void _AddSegments(UINT numSegments);
+    void _ExtendSparseFile(UINT64 fileSize);
+    HRESULT _PreallocateFile(UINT64 fileSize);
+    void _RestartAfterContentChange();
+    std::string _IfRangeValidator() const;
+    void _CloseHttpRequests();
+    void _OnSegmentRequestDone();
+    void _OnSegmentRequestComplete(Segment& segment, UINT requestGeneration, HRESULT hrRequest, HRESULT hrCallback,
+        UINT httpStatusCode, std::string responseHeaders);
     void _SchedProgressTracking();
     void _CancelTasks();
+    void _UpdateJournal();
+    void _SendStatusEvents();
+    void _SchedStatusEvents();
+    UINT64 _DurableBytesWritten(const Segment& segment) const;
+
+    // Indicates whether we have an outstanding http request or not.
+    // Need this because we will not move out of Transferring state while waiting before a retry.
+    bool _IsHttpRequestActive() const;
+    bool _AllSegmentsComplete() const;
+    UINT64 _SegmentsBytesTotal() const;
+    UINT _SegmentCountFor(UINT64 bytesTotal, IHttpAgent& httpAgent) const;
+    UINT64 _SegmentLengthFor(UINT64 bytesTotal, UINT numSegments) const;
+    void _PrepareIntegrityHasher(Segment& segment);
+    HRESULT _VerifyContentEnd();
+    bool _IsRangeDownload() const { return !_ranges.empty(); }
+    bool _IsStreaming() const { return static_cast<bool>(_stream); }
+
+    static std::vector<Range> _ParseRanges(const std::string& value);
+    static std::string _RangesToString(const std::vector<Range>& ranges);
 
     UINT _MaxNoProgressIntervals() const;
     std::string _UpdateConnectionTypeAndGetUrl(bool retryAfterFailure);
+    bool _TryMccFailover();
 
     bool _NoFallbackFromMcc() const { return _mccFallbackDue && (*_mccFallbackDue == std::chrono::steady_clock::time_point::max()); }
     bool _FallbackFromMccDue() const { return _mccFallbackDue && (*_mccFallbackDue <= std::chrono::steady_clock::now()); }
@@ -151,8 +339,8 @@ private:
     bool _ShouldFailFastPerConnectionType() const;
     bool _IsFatalError(HRESULT hrRequest, HRESULT hrCallback, UINT httpStatusCode) const;
 
-    // IHttpAgentEvents
-    HRESULT OnHeadersAvailable() override;
-    HRESULT OnData(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) override;
-    HRESULT OnComplete(HRESULT hrRequest, HRESULT hrCallback) override;
+    // IHttpAgentEvents from each segment
+    HRESULT _OnSegmentHeadersAvailable(Segment& segment);
+    HRESULT _OnSegmentData(Segment& segment, _In_reads_bytes_(cbData) BYTE* pData, UINT cbData);
+    HRESULT _OnSegmentComplete(Segment& segment, HRESULT hrRequest, HRESULT hrCallback);
 };
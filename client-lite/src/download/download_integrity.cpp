@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "download_integrity.h"
+
+#include <algorithm>
+#include "do_error.h"
+#include "string_ops.h"
+
+static bool HexToDigest(const std::string& hex, IntegrityCheckInfo::Digest& digest)
+{
+    if (hex.size() != (2 * digest.size()))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < digest.size(); ++i)
+    {
+        const auto nibble = [](char ch) -> int
+        {
+            if ((ch >= '0') && (ch <= '9')) return ch - '0';
+            if ((ch >= 'a') && (ch <= 'f')) return ch - 'a' + 10;
+            if ((ch >= 'A') && (ch <= 'F')) return ch - 'A' + 10;
+            return -1;
+        };
+        const int hi = nibble(hex[2 * i]);
+        const int lo = nibble(hex[(2 * i) + 1]);
+        if ((hi < 0) || (lo < 0))
+        {
+            return false;
+        }
+        digest[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return true;
+}
+
+static std::string DigestToHex(const IntegrityCheckInfo::Digest& digest)
+{
+    static const char* const hexChars = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(2 * digest.size());
+    for (const auto b : digest)
+    {
+        hex += hexChars[b >> 4];
+        hex += hexChars[b & 0xf];
+    }
+    return hex;
+}
+
+IntegrityCheckInfo IntegrityCheckInfo::Parse(const std::string& value)
+{
+    IntegrityCheckInfo info;
+    if (value.empty())
+    {
+        return info;
+    }
+
+    const auto algorithmEnd = value.find(':');
+    THROW_HR_IF(E_INVALIDARG, (algorithmEnd == std::string::npos)
+        || (StringCompareCaseInsensitive(value.substr(0, algorithmEnd).data(), "sha256") != 0));
+    size_t digestBegin = algorithmEnd + 1;
+    const auto pieceSizeEnd = value.find(':', digestBegin);
+    if (pieceSizeEnd != std::string::npos)
+    {
+        info._pieceSize = docli::string_conversions::ToUInt64(value.substr(digestBegin, pieceSizeEnd - digestBegin));
+        THROW_HR_IF(E_INVALIDARG, (info._pieceSize == 0) || (info._pieceSize == WholeContent));
+        digestBegin = pieceSizeEnd + 1;
+    }
+
+    while (true)
+    {
+        size_t digestEnd = value.find(',', digestBegin);
+        if (digestEnd == std::string::npos)
+        {
+            digestEnd = value.size();
+        }
+
+        Digest digest;
+        THROW_HR_IF(E_INVALIDARG, !HexToDigest(value.substr(digestBegin, digestEnd - digestBegin), digest));
+        info._digests.push_back(digest);
+        if (digestEnd == value.size())
+        {
+            break;
+        }
+        digestBegin = digestEnd + 1;
+    }
+    THROW_HR_IF(E_INVALIDARG, (info._pieceSize == WholeContent) && (info._digests.size() != 1));
+    return info;
+}
+
+std::string IntegrityCheckInfo::ToString() const
+{
+    if (!IsSet())
+    {
+        return {};
+    }
+
+    std::string value = "sha256:";
+    if (_pieceSize != WholeContent)
+    {
+        value += std::to_string(_pieceSize);
+        value += ':';
+    }
+    for (size_t i = 0; i < _digests.size(); ++i)
+    {
+        if (i != 0)
+        {
+            value += ',';
+        }
+        value += DigestToHex(_digests[i]);
+    }
+    return value;
+}
+
+IntegrityHasher::IntegrityHasher(const IntegrityCheckInfo& info, UINT64 offset) :
+    _info(info),
+    _ctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free),
+    _pieceStart(offset),
+    _offset(offset)
+{
+    DO_ASSERT(info.IsSet() && (info.PieceStart(offset) == offset));
+    _nextPiece = (info.PieceSize() == IntegrityCheckInfo::WholeContent) ? 0 : static_cast<size_t>(offset / info.PieceSize());
+    THROW_HR_IF(E_OUTOFMEMORY, !_ctx);
+    _BeginPiece();
+}
+
+HRESULT IntegrityHasher::Update(_In_reads_bytes_(cbData) const BYTE* pData, size_t cbData, UINT64& cbVerified)
+{
+    cbVerified = 0;
+    while (cbData != 0)
+    {
+        // More data than the pieces cover
+        RETURN_HR_IF(DO_E_INTEGRITY_CHECK_FAILED, _nextPiece >= _info.PieceCount());
+
+        const UINT64 cbPieceLeft = _info.PieceSize() - (_offset - _pieceStart);
+        const size_t cbHash = static_cast<size_t>(std::min(static_cast<UINT64>(cbData), cbPieceLeft));
+        RETURN_HR_IF(E_FAIL, EVP_DigestUpdate(_ctx.get(), pData, cbHash) != 1);
+        _offset += cbHash;
+        pData += cbHash;
+        cbData -= cbHash;
+
+        if (cbHash == cbPieceLeft)
+        {
+            RETURN_IF_FAILED(_VerifyPiece(cbVerified));
+        }
+    }
+    return S_OK;
+}
+
+HRESULT IntegrityHasher::Finish(UINT64& cbVerified)
+{
+    cbVerified = 0;
+
+    // The last piece is usually shorter, it ends with the content. Empty content has a single empty piece.
+    if ((_offset != _pieceStart) || (_nextPiece == 0))
+    {
+        RETURN_IF_FAILED(_VerifyPiece(cbVerified));
+    }
+    RETURN_HR_IF(DO_E_INTEGRITY_CHECK_FAILED, _nextPiece != _info.PieceCount());
+    return S_OK;
+}
+
+HRESULT IntegrityHasher::_VerifyPiece(UINT64& cbVerified)
+{
+    IntegrityCheckInfo::Digest digest;
+    RETURN_HR_IF(E_FAIL, EVP_DigestFinal_ex(_ctx.get(), digest.data(), nullptr) != 1);
+    if (!_info.Matches(_nextPiece, digest))
+    {
+        DoLogError("Integrity check failed for piece %zu at offset %llu, actual digest: %s", _nextPiece, _pieceStart,
+            DigestToHex(digest).data());
+        // Hashing starts over with the failed piece once it is downloaded again
+        _offset = _pieceStart;
+        _BeginPiece();
+        return DO_E_INTEGRITY_CHECK_FAILED;
+    }
+
+    cbVerified += (_offset - _pieceStart);
+    ++_nextPiece;
+    _pieceStart = _offset;
+    _BeginPiece();
+    return S_OK;
+}
+
+void IntegrityHasher::_BeginPiece()
+{
+    THROW_HR_IF(E_FAIL, EVP_DigestInit_ex(_ctx.get(), EVP_sha256(), nullptr) != 1);
+}
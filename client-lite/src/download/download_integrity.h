@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include "do_noncopyable.h"
+
+// Expected SHA-256 digests of a download's content, the IntegrityCheckInfo property:
+//   "sha256:<hex digest>"                      digest of the whole content
+//   "sha256:<piece size>:<hex digest>,..."     digest of each piece of the content, the last piece can be shorter
+// A whole content digest can only be computed over the data in order. Piece digests let each connection
+// verify the pieces it downloads.
+class IntegrityCheckInfo
+{
+public:
+    static constexpr UINT64 WholeContent = std::numeric_limits<UINT64>::max();
+    using Digest = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+    static IntegrityCheckInfo Parse(const std::string& value);
+    std::string ToString() const;
+
+    bool IsSet() const noexcept { return !_digests.empty(); }
+    UINT64 PieceSize() const noexcept { return _pieceSize; }
+    size_t PieceCount() const noexcept { return _digests.size(); }
+    UINT64 PieceStart(UINT64 offset) const noexcept { return (offset / _pieceSize) * _pieceSize; }
+    bool Matches(size_t piece, const Digest& digest) const noexcept
+    {
+        return (piece < _digests.size()) && (digest == _digests[piece]);
+    }
+
+private:
+    UINT64 _pieceSize { WholeContent };
+    std::vector<Digest> _digests;
+};
+
+// Hashes data as it arrives, in order from a piece boundary on, and verifies each piece as soon as its last byte is in.
+// Not thread-safe, it is part of the request state of the segment that owns it.
+class IntegrityHasher : DONonCopyable
+{
+public:
+    IntegrityHasher(const IntegrityCheckInfo& info, UINT64 offset);
+
+    // Offset of the next byte expected and start of the piece in progress, every piece before it is verified
+    UINT64 Offset() const noexcept { return _offset; }
+    UINT64 PieceStart() const noexcept { return _pieceStart; }
+
+    // Returns DO_E_INTEGRITY_CHECK_FAILED once a piece does not match, PieceStart() is where that piece begins then.
+    // cbVerified is the size of the pieces that matched.
+    HRESULT Update(_In_reads_bytes_(cbData) const BYTE* pData, size_t cbData, UINT64& cbVerified);
+
+    // At the end of the content, verifies the last piece and that no pieces are missing
+    HRESULT Finish(UINT64& cbVerified);
+
+private:
+    HRESULT _VerifyPiece(UINT64& cbVerified);
+    void _BeginPiece();
+
+    const IntegrityCheckInfo& _info;
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> _ctx;
+    UINT64 _pieceStart;
+    UINT64 _offset;
+    size_t _nextPiece;
+};
@@ -0,0 +1,152 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "download_journal.h"
+
+#include <fstream>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include "do_filesystem.h"
+
+// Bump this when the record format changes incompatibly, older records get discarded
+static constexpr UINT g_journalVersion = 1;
+static constexpr char g_journalFileExtension[] = ".json";
+
+DownloadJournal::DownloadJournal(std::string directory) :
+    _directory(std::move(directory))
+{
+}
+
+void DownloadJournal::Save(const DownloadJournalRecord& record) const
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    boost::property_tree::ptree tree;
+    tree.put("version", g_journalVersion);
+    tree.put("id", GuidToString(record.id));
+    tree.put("url", record.url);
+    tree.put("path", record.destFilePath);
+    tree.put("state", static_cast<int>(record.state));
+    tree.put("bytesTotal", record.bytesTotal);
+    tree.put("noProgressTimeoutSecs", record.noProgressTimeoutSecs);
+    tree.put("destFileCreated", record.fDestFileCreated);
+    tree.put("etag", record.etag);
+    tree.put("lastModified", record.lastModified);
+    if (record.maxBytesPerSecond)
+    {
+        tree.put("maxBytesPerSecond", *record.maxBytesPerSecond);
+    }
+    if (!record.ranges.empty())
+    {
+        tree.put("ranges", record.ranges);
+    }
+    if (!record.integrityCheckInfo.empty())
+    {
+        tree.put("integrityCheckInfo", record.integrityCheckInfo);
+    }
+    if (record.fIntegrityCheckMandatory)
+    {
+        tree.put("integrityCheckMandatory", true);
+    }
+
+    boost::property_tree::ptree segments;
+    for (const auto& segment : record.segments)
+    {
+        boost::property_tree::ptree entry;
+        entry.put("offset", segment.offset);
+        entry.put("length", segment.length);
+        entry.put("bytesWritten", segment.bytesWritten);
+        segments.push_back(std::make_pair("", entry));
+    }
+    tree.add_child("segments", segments);
+
+    // Write to a temporary file and rename it over the record, rename is atomic
+    const std::string recordPath = _RecordPath(record.id);
+    const std::string tempPath = recordPath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::trunc);
+        THROW_HR_IF(E_FAIL, !file);
+        boost::property_tree::write_json(file, tree, false);
+        file.flush();
+        THROW_HR_IF(E_FAIL, !file);
+    }
+    if (rename(tempPath.data(), recordPath.data()) == -1)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+    }
+}
+
+void DownloadJournal::Delete(REFGUID id) const
+{
+    if (IsEnabled())
+    {
+        const std::string recordPath = _RecordPath(id);
+        if ((remove(recordPath.data()) == -1) && (errno != ENOENT))
+        {
+            DoLogWarning("Failed to delete journal record %s, errno: %d", recordPath.data(), errno);
+        }
+    }
+}
+
+std::vector<DownloadJournalRecord> DownloadJournal::LoadAll() const
+{
+    std::vector<DownloadJournalRecord> records;
+    if (!IsEnabled() || !fs::exists(_directory))
+    {
+        return records;
+    }
+
+    for (const auto& dirEntry : fs::directory_iterator(_directory))
+    {
+        const fs::path& path = dirEntry.path();
+        if (path.extension() != g_journalFileExtension)
+        {
+            continue;
+        }
+
+        try
+        {
+            boost::property_tree::ptree tree;
+            boost::property_tree::read_json(path.string(), tree);
+            THROW_HR_IF(E_INVALIDARG, tree.get<UINT>("version") != g_journalVersion);
+
+            DownloadJournalRecord record;
+            THROW_HR_IF(E_INVALIDARG, !StringToGuid(tree.get<std::string>("id").data(), &record.id));
+            record.url = tree.get<std::string>("url");
+            record.destFilePath = tree.get<std::string>("path");
+            record.state = static_cast<DownloadState>(tree.get<int>("state"));
+            record.bytesTotal = tree.get<UINT64>("bytesTotal");
+            record.noProgressTimeoutSecs = tree.get<UINT>("noProgressTimeoutSecs");
+            record.fDestFileCreated = tree.get<bool>("destFileCreated");
+            record.etag = tree.get<std::string>("etag");
+            record.lastModified = tree.get<std::string>("lastModified");
+            record.maxBytesPerSecond = tree.get_optional<UINT>("maxBytesPerSecond");
+            record.ranges = tree.get<std::string>("ranges", std::string());
+            record.integrityCheckInfo = tree.get<std::string>("integrityCheckInfo", std::string());
+            record.fIntegrityCheckMandatory = tree.get<bool>("integrityCheckMandatory", false);
+            for (const auto& entry : tree.get_child("segments"))
+            {
+                record.segments.push_back({ entry.second.get<UINT64>("offset"), entry.second.get<UINT64>("length"),
+                    entry.second.get<UINT64>("bytesWritten") });
+            }
+            THROW_HR_IF(E_INVALIDARG, record.segments.empty());
+            records.push_back(std::move(record));
+        }
+        catch (...)
+        {
+            LOG_CAUGHT_EXCEPTION();
+            DoLogWarning("Discarding unreadable journal record %s", path.string().data());
+            (void)remove(path.string().data());
+        }
+    }
+    return records;
+}
+
+std::string DownloadJournal::_RecordPath(REFGUID id) const
+{
+    return (fs::path(_directory) / (GuidToString(id) + g_journalFileExtension)).string();
+}
@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
+#include "do_guid.h"
+#include "download_status.h"
+
+// What is needed to bring a download back after an agent restart and resume it with range requests
+struct DownloadJournalRecord
+{
+    struct Segment
+    {
+        UINT64 offset;
+        UINT64 length;
+        UINT64 bytesWritten;    // only bytes known to be in the file
+    };
+
+    GUID id;
+    std::string url;
+    std::string destFilePath;
+    DownloadState state { DownloadState::Created };
+    UINT64 bytesTotal { 0 };
+    UINT noProgressTimeoutSecs { 0 };
+    bool fDestFileCreated { false };
+    boost::optional<UINT> maxBytesPerSecond;   // only if set on the download
+    std::string ranges;     // only for range downloads, same format as the Ranges property
+    std::string integrityCheckInfo;     // only if set on the download, same format as the property
+    bool fIntegrityCheckMandatory { false };
+
+    // Validators from the server's response, tell whether the content changed while the agent was down
+    std::string etag;
+    std::string lastModified;
+
+    std::vector<Segment> segments;
+};
+
+// Keeps one small json file per download in the given directory. Records are replaced atomically,
+// a crash while saving leaves the previous record intact. Journaling is disabled if no directory is given.
+class DownloadJournal
+{
+public:
+    DownloadJournal() = default;
+    DownloadJournal(std::string directory);
+
+    bool IsEnabled() const noexcept { return !_directory.empty(); }
+
+    void Save(const DownloadJournalRecord& record) const;
+    void Delete(REFGUID id) const;
+
+    // Records that can't be read are logged and deleted
+    std::vector<DownloadJournalRecord> LoadAll() const;
+
+private:
+    std::string _RecordPath(REFGUID id) const;
+
+    std::string _directory;
+};
@@ -4,32 +4,109 @@
 #include "do_common.h"
 #include "download_manager.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include "config_manager.h"
+#include "do_cpprest_uri_builder.h"
+#include "do_cpprest_uri.h"
 #include "do_error.h"
+#include "do_filesystem.h"
 #include "download.h"
+#include "http_agent.h"
+#include "network_monitor.h"
 
-DownloadManager::DownloadManager(ConfigManager& config) :
+namespace msdod = microsoft::deliveryoptimization::details;
+
+DownloadManager::DownloadManager(ConfigManager& config, std::string journalDirectory) :
     _config(config),
-    _mccManager(config)
+    _mccManager(config),
+    _journal(std::move(journalDirectory))
+{
+    _curlOps.RateLimiter().SetRate(_config.MaxDownloadBytesPerSecond());
+    _taskThreads[0].Sched([this]()
+        {
+            _PrewarmConnections();
+        }, &_recentOrigins);
+    _taskThreads[0].Sched([this]()
+        {
+            _ProbeCacheHosts();
+        }, &_mccManager);
+}
+
+DownloadManager::~DownloadManager()
+{
+    // Stop prewarming and probing on the task thread, so a prewarm in progress is done before _curlOps goes away
+    _taskThreads[0].SchedBlock([this]()
+        {
+            _taskThreads[0].Unschedule(this);
+            _taskThreads[0].Unschedule(&_recentOrigins);
+            _taskThreads[0].Unschedule(&_mccManager);
+        });
+
+    // _taskThreads is destroyed last, after the members that downloads use. Tasks still queued there could be
+    // holding on to downloads, which must be gone before those members are.
+    _taskThreads.Stop();
+}
+
+void DownloadManager::RestoreDownloads()
 {
+    for (const auto& record : _journal.LoadAll())
+    {
+        try
+        {
+            if (!fs::exists(record.destFilePath))
+            {
+                DoLogWarning("%s, file %s no longer exists, discarding journal record", GuidToString(record.id).data(),
+                    record.destFilePath.data());
+                _journal.Delete(record.id);
+                continue;
+            }
+
+            auto download = std::make_shared<Download>(_config, _mccManager, _taskThreads.ThreadFor(record.id), _curlOps,
+                _writeQueue, _journal, record);
+            if (record.state == DownloadState::Transferring)
+            {
+                _NoteOrigin(record.url);
+            }
+            {
+                std::unique_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+                _downloads.emplace(GuidToString(record.id), download);
+            }
+
+            if (record.state == DownloadState::Transferring)
+            {
+                _TaskThreadFor(*download).Sched([download]()
+                {
+                    try
+                    {
+                        download->Start();
+                    } CATCH_LOG()
+                });
+            }
+        } CATCH_LOG()
+    }
 }
 
 std::string DownloadManager::CreateDownload(std::string url, std::string destFilePath)
 {
-    auto newDownload = std::make_shared<Download>(_mccManager, _taskThread, _curlOps, url, destFilePath);
+    const GUID id = CreateNewGuid();
+    auto newDownload = std::make_shared<Download>(_config, _mccManager, _taskThreads.ThreadFor(id), _curlOps, _writeQueue,
+        _journal, id, url, destFilePath);
     const std::string downloadId = newDownload->GetProperty(DownloadProperty::Id);
 
     std::unique_lock<std::shared_timed_mutex> lock(_downloadsMtx);
     DO_ASSERT(_downloads.find(downloadId) == _downloads.end());
     THROW_HR_IF(DO_E_NO_SERVICE, !_fRunning);
     _downloads.emplace(downloadId, newDownload);
+    _NoteOrigin(url);
     return downloadId;
 }
 
 void DownloadManager::StartDownload(const std::string& downloadId) const
 {
     auto download = _GetDownload(downloadId);
-    _taskThread.SchedBlock([&download]()
+    _TaskThreadFor(*download).SchedBlock([&download]()
     {
         download->Start();
     });
@@ -38,7 +115,7 @@ void DownloadManager::StartDownload(const std::string& downloadId) const
 void DownloadManager::PauseDownload(const std::string& downloadId) const
 {
     auto download = _GetDownload(downloadId);
-    _taskThread.SchedBlock([&download]()
+    _TaskThreadFor(*download).SchedBlock([&download]()
     {
         download->Pause();
     });
@@ -47,7 +124,7 @@ void DownloadManager::PauseDownload(const std::string& downloadId) const
 void DownloadManager::FinalizeDownload(const std::string& downloadId)
 {
     auto download = _GetDownload(downloadId);
-    _taskThread.SchedBlock([&download]()
+    _TaskThreadFor(*download).SchedBlock([&download]()
     {
         download->Finalize();
     });
@@ -60,7 +137,7 @@ void DownloadManager::FinalizeDownload(const std::string& downloadId)
 void DownloadManager::AbortDownload(const std::string& downloadId)
 {
     auto download = _GetDownload(downloadId);
-    _taskThread.SchedBlock([&download]()
+    _TaskThreadFor(*download).SchedBlock([&download]()
     {
         download->Abort();
     });
@@ -72,17 +149,22 @@ void DownloadManager::AbortDownload(const std::string& downloadId)
 void DownloadManager::SetDownloadProperty(const std::string& downloadId, DownloadProperty key, const std::string& value)
 {
     auto download = _GetDownload(downloadId);
-    _taskThread.SchedBlock([&download, key, &value]()
+    _TaskThreadFor(*download).SchedBlock([&download, key, &value]()
     {
         download->SetProperty(key, value);
     });
+
+    if (key == DownloadProperty::Uri)
+    {
+        _NoteOrigin(value);
+    }
 }
 
 std::string DownloadManager::GetDownloadProperty(const std::string& downloadId, DownloadProperty key) const
 {
     auto download = _GetDownload(downloadId);
     std::string value;
-    _taskThread.SchedBlock([&download, key, &value]()
+    _TaskThreadFor(*download).SchedBlock([&download, key, &value]()
     {
         value = download->GetProperty(key);
     });
@@ -94,15 +176,170 @@ DownloadStatus DownloadManager::GetDownloadStatus(const std::string& downloadId)
     auto download = _GetDownload(downloadId);
 
     // Scheduled to the end of the queue in order to get all the updates
-    // that might be pending on task thread.
+    // that might be pending on the download's task thread.
     DownloadStatus status;
-    _taskThread.SchedBlock([&download, &status]()
+    _TaskThreadFor(*download).SchedBlock([&download, &status]()
     {
         status = download->GetStatus();
     }, false);
     return status;
 }
 
+std::vector<std::pair<std::string, HRESULT>> DownloadManager::CreateDownloads(
+    const std::vector<std::pair<std::string, std::string>>& urlsAndPaths, bool fStart)
+{
+    std::vector<std::pair<std::string, HRESULT>> results;
+    std::vector<std::shared_ptr<Download>> newDownloads;
+    results.reserve(urlsAndPaths.size());
+    newDownloads.reserve(urlsAndPaths.size());
+    for (const auto& urlAndPath : urlsAndPaths)
+    {
+        try
+        {
+            const GUID id = CreateNewGuid();
+            newDownloads.push_back(std::make_shared<Download>(_config, _mccManager, _taskThreads.ThreadFor(id), _curlOps,
+                _writeQueue, _journal, id, urlAndPath.first, urlAndPath.second));
+            results.emplace_back(GuidToString(id), S_OK);
+        }
+        catch (...)
+        {
+            newDownloads.push_back(nullptr);
+            results.emplace_back(std::string{}, LOG_CAUGHT_EXCEPTION());
+        }
+    }
+
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+        THROW_HR_IF(DO_E_NO_SERVICE, !_fRunning);
+        for (size_t i = 0; i < newDownloads.size(); ++i)
+        {
+            if (newDownloads[i])
+            {
+                _downloads.emplace(results[i].first, newDownloads[i]);
+                _NoteOrigin(urlsAndPaths[i].first);
+            }
+        }
+    }
+
+    if (fStart)
+    {
+        const auto startResults = _RunOnTaskThreads(newDownloads, [](size_t, Download& download)
+            {
+                download.Start();
+            });
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (newDownloads[i])
+            {
+                results[i].second = startResults[i];
+            }
+        }
+    }
+    return results;
+}
+
+std::vector<HRESULT> DownloadManager::StartDownloads(const std::vector<std::string>& downloadIds) const
+{
+    return _RunOnTaskThreads(_FindDownloads(downloadIds), [](size_t, Download& download)
+        {
+            download.Start();
+        });
+}
+
+std::vector<HRESULT> DownloadManager::PauseDownloads(const std::vector<std::string>& downloadIds) const
+{
+    return _RunOnTaskThreads(_FindDownloads(downloadIds), [](size_t, Download& download)
+        {
+            download.Pause();
+        });
+}
+
+std::vector<HRESULT> DownloadManager::FinalizeDownloads(const std::vector<std::string>& downloadIds)
+{
+    auto results = _RunOnTaskThreads(_FindDownloads(downloadIds), [](size_t, Download& download)
+        {
+            download.Finalize();
+        });
+    _EraseDownloads(downloadIds, results);
+    return results;
+}
+
+std::vector<HRESULT> DownloadManager::AbortDownloads(const std::vector<std::string>& downloadIds)
+{
+    auto results = _RunOnTaskThreads(_FindDownloads(downloadIds), [](size_t, Download& download)
+        {
+            download.Abort();
+        });
+    _EraseDownloads(downloadIds, results);
+    return results;
+}
+
+std::vector<HRESULT> DownloadManager::GetDownloadStatuses(const std::vector<std::string>& downloadIds,
+    std::vector<DownloadStatus>& statuses) const
+{
+    // Scheduled to the end of the queues, same as GetDownloadStatus
+    statuses.assign(downloadIds.size(), DownloadStatus{});
+    return _RunOnTaskThreads(_FindDownloads(downloadIds), [&statuses](size_t index, Download& download)
+        {
+            statuses[index] = download.GetStatus();
+        }, false);
+}
+
+std::vector<std::string> DownloadManager::EnumerateDownloads(const std::string& url, const std::string& destFilePath) const
+{
+    std::vector<std::string> ids;
+    std::vector<std::shared_ptr<Download>> downloads;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+        ids.reserve(_downloads.size());
+        downloads.reserve(_downloads.size());
+        for (const auto& item : _downloads)
+        {
+            ids.push_back(item.first);
+            downloads.push_back(item.second);
+        }
+    }
+    if (url.empty() && destFilePath.empty())
+    {
+        return ids;
+    }
+
+    std::vector<char> matches(downloads.size(), false);
+    (void)_RunOnTaskThreads(downloads, [&url, &destFilePath, &matches](size_t index, Download& download)
+        {
+            matches[index] = (url.empty() || (download.GetProperty(DownloadProperty::Uri) == url))
+                && (destFilePath.empty() || (download.GetProperty(DownloadProperty::LocalPath) == destFilePath));
+        });
+
+    std::vector<std::string> matchingIds;
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (matches[i])
+        {
+            matchingIds.push_back(std::move(ids[i]));
+        }
+    }
+    return matchingIds;
+}
+
+void DownloadManager::AttachDownloadStream(const std::string& downloadId, std::shared_ptr<DownloadStream> stream)
+{
+    auto download = _GetDownload(downloadId);
+    _TaskThreadFor(*download).SchedBlock([&download, &stream]()
+    {
+        download->AttachStream(std::move(stream));
+    });
+}
+
+void DownloadManager::AttachStatusStream(const std::string& downloadId, std::shared_ptr<DownloadStatusStream> stream)
+{
+    auto download = _GetDownload(downloadId);
+    _TaskThreadFor(*download).SchedBlock([&download, &stream]()
+    {
+        download->AttachStatusStream(std::move(stream));
+    });
+}
+
 bool DownloadManager::IsIdle() const
 {
     // Reset _fRunning if we are idle to disallow new downloads.
@@ -112,11 +349,30 @@ bool DownloadManager::IsIdle() const
     return !_fRunning;
 }
 
-void DownloadManager::RefreshAdminConfigs() const
+std::vector<HostEstimateTable::HostInfo> DownloadManager::GetHostEstimates() const
+{
+    return _curlOps.HostEstimates().Snapshot();
+}
+
+void DownloadManager::RefreshAdminConfigs()
 {
-    _taskThread.SchedImmediate([this]()
+    _taskThreads[0].SchedImmediate([this]()
         {
             _config.RefreshAdminConfigs();
+            _curlOps.RateLimiter().SetRate(_config.MaxDownloadBytesPerSecond());
+            _PrewarmConnections();
+            _timeOfLastCacheHostProbe = {};
+            _ProbeCacheHosts();
+
+            std::shared_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+            for (const auto& item : _downloads)
+            {
+                std::shared_ptr<Download> download = item.second;
+                _TaskThreadFor(*download).Sched([download]()
+                    {
+                        download->RefreshBandwidthLimit();
+                    });
+            }
         }, this);
 }
 
@@ -127,3 +383,251 @@ std::shared_ptr<Download> DownloadManager::_GetDownload(const std::string& downl
     THROW_HR_IF(E_NOT_SET, it == _downloads.end());
     return it->second;
 }
+
+// Null for the ids not found, the batch operations report those per download
+std::vector<std::shared_ptr<Download>> DownloadManager::_FindDownloads(const std::vector<std::string>& downloadIds) const
+{
+    std::vector<std::shared_ptr<Download>> downloads;
+    downloads.reserve(downloadIds.size());
+    std::shared_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+    for (const auto& downloadId : downloadIds)
+    {
+        auto it = _downloads.find(downloadId);
+        downloads.push_back((it != _downloads.end()) ? it->second : nullptr);
+    }
+    return downloads;
+}
+
+// Like SchedBlock for many downloads at once: each task thread gets one task for all of its downloads and the caller
+// waits for all of them. func gets the index of the download. Null downloads fail with E_NOT_SET.
+std::vector<HRESULT> DownloadManager::_RunOnTaskThreads(const std::vector<std::shared_ptr<Download>>& downloads,
+    const std::function<void(size_t, Download&)>& func, bool immediate) const
+{
+    std::vector<HRESULT> results(downloads.size(), S_OK);
+    std::vector<std::vector<size_t>> indexesPerThread(_taskThreads.Size());
+    for (size_t i = 0; i < downloads.size(); ++i)
+    {
+        if (downloads[i])
+        {
+            indexesPerThread[_taskThreads.IndexFor(downloads[i]->GetId())].push_back(i);
+        }
+        else
+        {
+            results[i] = E_NOT_SET;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cvDone;
+    size_t numPending = 0;
+    for (size_t t = 0; t < indexesPerThread.size(); ++t)
+    {
+        if (indexesPerThread[t].empty())
+        {
+            continue;
+        }
+
+        const std::vector<size_t>& indexes = indexesPerThread[t];
+        auto runAll = [&downloads, &func, &results, &indexes]()
+        {
+            for (size_t i : indexes)
+            {
+                try
+                {
+                    func(i, *downloads[i]);
+                }
+                catch (...)
+                {
+                    results[i] = LOG_CAUGHT_EXCEPTION();
+                }
+            }
+        };
+
+        TaskThread& taskThread = _taskThreads[t];
+        if (taskThread.IsCurrentThread())
+        {
+            runAll();
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ++numPending;
+        }
+        auto execOp = [&mutex, &cvDone, &numPending, runAll]()
+        {
+            runAll();
+            std::unique_lock<std::mutex> lock(mutex);
+            --numPending;
+            cvDone.notify_all();
+        };
+        try
+        {
+            if (immediate)
+            {
+                taskThread.SchedImmediate(std::move(execOp));
+            }
+            else
+            {
+                taskThread.Sched(std::move(execOp));
+            }
+        }
+        catch (...)
+        {
+            const HRESULT hr = LOG_CAUGHT_EXCEPTION();
+            for (size_t i : indexes)
+            {
+                results[i] = hr;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            --numPending;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cvDone.wait(lock, [&numPending]()
+        {
+            return (numPending == 0);
+        });
+    return results;
+}
+
+// Drops the downloads that were finalized or aborted
+void DownloadManager::_EraseDownloads(const std::vector<std::string>& downloadIds, const std::vector<HRESULT>& results)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(_downloadsMtx);
+    for (size_t i = 0; i < downloadIds.size(); ++i)
+    {
+        if (SUCCEEDED(results[i]))
+        {
+            _downloads.erase(downloadIds[i]);
+        }
+    }
+}
+
+// Remembers the url's origin for prewarming, and prewarms it right away if it is new
+void DownloadManager::_NoteOrigin(const std::string& url) try
+{
+    if (!HttpAgent::ValidateUrl(url))
+    {
+        return;
+    }
+
+    msdod::cpprest_web::uri_builder originBuilder(msdod::cpprest_web::uri{url});
+    originBuilder.set_user_info("").set_path("/").set_query("").set_fragment("");
+    auto origin = originBuilder.to_string();
+    _taskThreads[0].Sched([this, origin = std::move(origin)]()
+        {
+            const bool fNewOrigin = (_recentOrigins.find(origin) == _recentOrigins.end());
+            if (fNewOrigin && (_recentOrigins.size() >= g_connectionPrewarmMaxOrigins))
+            {
+                auto oldest = std::min_element(_recentOrigins.begin(), _recentOrigins.end(), [](const auto& a, const auto& b)
+                    {
+                        return a.second < b.second;
+                    });
+                _recentOrigins.erase(oldest);
+            }
+            _recentOrigins[origin] = std::chrono::steady_clock::now();
+            if (fNewOrigin)
+            {
+                _PrewarmConnections();
+            }
+        }, this);
+} CATCH_LOG()
+
+// Runs on the first task thread. Prewarms connections to the cache host and the recently used origins,
+// then again before the connections get too old, until no origin has been used for a while.
+void DownloadManager::_PrewarmConnections() try
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = _recentOrigins.begin(); it != _recentOrigins.end(); )
+    {
+        it = ((now - it->second) > g_connectionPrewarmOriginExpiry) ? _recentOrigins.erase(it) : std::next(it);
+    }
+
+    // Downloads go to their best cache host first, with the scheme of their original url
+    std::vector<std::string> urls;
+    for (const auto& item : _recentOrigins)
+    {
+        const std::string& origin = item.first;
+        urls.push_back(origin);
+        const msdod::cpprest_web::uri originUri{origin};
+        const std::string mccHost = _mccManager.SelectHost(originUri.host(), _curlOps.HostEstimates());
+        if (!mccHost.empty())
+        {
+            msdod::cpprest_web::uri_builder mccBuilder(originUri);
+            mccBuilder.set_host(mccHost);
+            urls.push_back(mccBuilder.to_string());
+        }
+    }
+    if (_recentOrigins.empty())
+    {
+        for (const auto& mccHost : _mccManager.GetHosts())
+        {
+            urls.push_back("http://" + mccHost + "/");
+        }
+    }
+
+    std::sort(urls.begin(), urls.end());
+    urls.erase(std::unique(urls.begin(), urls.end()), urls.end());
+    for (const auto& url : urls)
+    {
+        try
+        {
+            _curlOps.Prewarm(url);
+        } CATCH_LOG()
+    }
+
+    if (!_recentOrigins.empty())
+    {
+        _taskThreads[0].SchedReplace([this]()
+            {
+                _PrewarmConnections();
+            }, g_connectionPrewarmInterval, &_recentOrigins);
+    }
+} CATCH_LOG()
+
+// Runs on the first task thread. Probes the cache hosts with a HEAD request every g_mccProbeInterval and as soon as
+// the network changes, so that downloads skip unreachable hosts instead of timing out on them, and go back to hosts
+// that recovered without waiting out their ban.
+void DownloadManager::_ProbeCacheHosts() try
+{
+    _taskThreads[0].SchedReplace([this]()
+        {
+            _ProbeCacheHosts();
+        }, g_mccProbeNetworkCheckInterval, &_mccManager);
+
+    const auto now = std::chrono::steady_clock::now();
+    std::string networkFingerprint = NetworkMonitor::ViableInterfacesFingerprint();
+    const bool fNetworkChanged = (networkFingerprint != _probedNetworkFingerprint);
+    if (!fNetworkChanged && ((now - _timeOfLastCacheHostProbe) < g_mccProbeInterval))
+    {
+        return;
+    }
+
+    _probedNetworkFingerprint = std::move(networkFingerprint);
+    _timeOfLastCacheHostProbe = now;
+
+    // Without a network every host looks down, they get probed once it is back
+    if (_probedNetworkFingerprint.empty())
+    {
+        return;
+    }
+
+    for (const auto& mccHost : _mccManager.GetHosts())
+    {
+        try
+        {
+            // Any response counts, the cache host need not serve anything at its root
+            _curlOps.Prewarm("http://" + mccHost + "/", [this, mccHost](int curlResult)
+                {
+                    _mccManager.ReportProbeResult(mccHost, (curlResult == CURLE_OK));
+                });
+        } CATCH_LOG()
+    }
+} CATCH_LOG()
+
+TaskThread& DownloadManager::_TaskThreadFor(const Download& download) const noexcept
+{
+    return _taskThreads.ThreadFor(download.GetId());
+}
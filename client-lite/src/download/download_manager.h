@@ -3,14 +3,21 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 #include "do_curl_wrappers.h"
+#include "do_write_behind.h"
+#include "download_journal.h"
 #include "mcc_manager.h"
-#include "task_thread.h"
+#include "task_thread_pool.h"
 
 enum class DownloadProperty;
 class Download;
+class DownloadStatusStream;
+class DownloadStream;
 struct DownloadStatus;
 
 class DownloadManager
@@ -18,7 +25,12 @@ class DownloadManager
     friend std::shared_ptr<Download> DownloadForId(const DownloadManager& manager, const std::string& id);
 
 public:
-    DownloadManager(ConfigManager& config);
+    // Downloads are journaled to journalDirectory, if specified, see RestoreDownloads
+    DownloadManager(ConfigManager& config, std::string journalDirectory = {});
+    ~DownloadManager();
+
+    // Brings back the downloads recorded in the journal, resuming the ones that were in progress
+    void RestoreDownloads();
 
     std::string CreateDownload(std::string url = {}, std::string destFilePath = {});
 
@@ -30,19 +42,66 @@ public:
     std::string GetDownloadProperty(const std::string& downloadId, DownloadProperty key) const;
     DownloadStatus GetDownloadStatus(const std::string& downloadId) const;
 
+    // Batch forms of the above. Each is a single hop to every task thread that owns some of the downloads, the task
+    // threads work through their downloads in parallel. Results are per download, in the order given, and a failure
+    // for one download doesn't affect the others. Unknown ids get E_NOT_SET.
+    std::vector<std::pair<std::string, HRESULT>> CreateDownloads(const std::vector<std::pair<std::string, std::string>>& urlsAndPaths,
+        bool fStart);
+    std::vector<HRESULT> StartDownloads(const std::vector<std::string>& downloadIds) const;
+    std::vector<HRESULT> PauseDownloads(const std::vector<std::string>& downloadIds) const;
+    std::vector<HRESULT> FinalizeDownloads(const std::vector<std::string>& downloadIds);
+    std::vector<HRESULT> AbortDownloads(const std::vector<std::string>& downloadIds);
+    std::vector<HRESULT> GetDownloadStatuses(const std::vector<std::string>& downloadIds, std::vector<DownloadStatus>& statuses) const;
+
+    // Ids of the downloads with the given url and file path, any of them if empty
+    std::vector<std::string> EnumerateDownloads(const std::string& url = {}, const std::string& destFilePath = {}) const;
+
+    // The download sends its data over the stream instead of writing it to a file, see Download::AttachStream
+    void AttachDownloadStream(const std::string& downloadId, std::shared_ptr<DownloadStream> stream);
+
+    // The download pushes its status over the stream, see Download::AttachStatusStream
+    void AttachStatusStream(const std::string& downloadId, std::shared_ptr<DownloadStatusStream> stream);
+
     bool IsIdle() const;
-    void RefreshAdminConfigs() const;
+
+    // Network estimates of the hosts downloaded from recently, for debugging
+    std::vector<HostEstimateTable::HostInfo> GetHostEstimates() const;
+
+    // Also applies bandwidth limits from the refreshed configs to the downloads in progress,
+    // and prewarms connections to and probes the possibly changed cache hosts
+    void RefreshAdminConfigs();
 
 private:
-    mutable TaskThread _taskThread;
+    // Declared ahead of _downloads, downloads use these until they are destroyed.
+    // MCCManager outlives CurlRequests, probes report to it until their transfers are gone.
+    // _taskThreads is stopped in the destructor, before any of these go away.
+    TaskThreadPool _taskThreads;
+    ConfigManager& _config;
+    WriteBehindQueue _writeQueue;
+    MCCManager _mccManager;
+    CurlRequests _curlOps;
+    DownloadJournal _journal;
+
     std::unordered_map<std::string, std::shared_ptr<Download>> _downloads;
     mutable bool _fRunning { true };
     mutable std::shared_timed_mutex _downloadsMtx;
 
-    ConfigManager& _config;
-    CurlRequests _curlOps;
-    MCCManager _mccManager;
+    // Origins (scheme://host:port/) of recently created downloads and when they were last used.
+    // Accessed only on the first task thread.
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> _recentOrigins;
+
+    // Network the cache hosts were last probed on and when. Accessed only on the first task thread.
+    std::string _probedNetworkFingerprint;
+    std::chrono::steady_clock::time_point _timeOfLastCacheHostProbe;
 
 private:
+    void _NoteOrigin(const std::string& url);
+    void _PrewarmConnections();
+    void _ProbeCacheHosts();
     std::shared_ptr<Download> _GetDownload(const std::string& downloadId) const;
+    std::vector<std::shared_ptr<Download>> _FindDownloads(const std::vector<std::string>& downloadIds) const;
+    std::vector<HRESULT> _RunOnTaskThreads(const std::vector<std::shared_ptr<Download>>& downloads,
+        const std::function<void(size_t, Download&)>& func, bool immediate = true) const;
+    void _EraseDownloads(const std::vector<std::string>& downloadIds, const std::vector<HRESULT>& results);
+    TaskThread& _TaskThreadFor(const Download& download) const noexcept;
 };
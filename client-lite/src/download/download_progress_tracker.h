@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include "config_defaults.h"
 
@@ -29,7 +30,9 @@ public:
 
     void OnDownloadFailure()
     {
-        _nextRetryDelay = std::min(g_progressTrackerMaxRetryDelay, _nextRetryDelay * 2);
+        // Enough to reach the max delay from any base delay
+        constexpr UINT maxRetryBackoffs = 16;
+        _numRetryBackoffs = std::min(_numRetryBackoffs + 1, maxRetryBackoffs);
     }
 
     // Forget the count of no-progress until now, retry delay will start from minimum next time
@@ -41,16 +44,22 @@ public:
 
     void ResetRetryDelay()
     {
-        _nextRetryDelay = std::chrono::seconds(1);
+        _numRetryBackoffs = 0;
     }
 
-    auto NextRetryDelay() const
+    // The base delay comes from the host's estimates, doubled for each failure since the last reset
+    std::chrono::milliseconds NextRetryDelay(std::chrono::milliseconds baseDelay) const
     {
-        return _nextRetryDelay;
+        auto retryDelay = baseDelay;
+        for (UINT i = 0; (i < _numRetryBackoffs) && (retryDelay < g_progressTrackerMaxRetryDelay); ++i)
+        {
+            retryDelay *= 2;
+        }
+        return std::min<std::chrono::milliseconds>(retryDelay, g_progressTrackerMaxRetryDelay);
     }
 
 private:
-    std::chrono::seconds _nextRetryDelay { 1 };
+    UINT _numRetryBackoffs { 0 };
     UINT _numNoProgressIntervals { 0 };
     UINT64 _lastSeenBytesTransferred { 0 };
 };
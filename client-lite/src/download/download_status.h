@@ -19,6 +19,7 @@ struct DownloadStatus
 
     UINT64 BytesTotal { 0 };
     UINT64 BytesTransferred { 0 };
+    UINT64 BytesVerified { 0 };     // bytes of content that matched IntegrityCheckInfo
     DownloadState State { DownloadState::Created };
     HRESULT Error { S_OK };
     HRESULT ExtendedError { S_OK };
@@ -0,0 +1,120 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "download_status_stream.h"
+
+#include <sstream>
+#include <boost/asio/write.hpp>
+#include "config_defaults.h"
+#include "do_version.h"
+
+DownloadStatusStream::DownloadStatusStream(std::shared_ptr<boost::asio::generic::stream_protocol::socket> socket,
+    format_event_t formatEvent) :
+    _socket(std::move(socket)),
+    _formatEvent(std::move(formatEvent))
+{
+}
+
+void DownloadStatusStream::Open()
+{
+    std::stringstream ss;
+    ss << "HTTP/1.1 200 OK\r\n";
+    ss << "Server: Delivery-Optimization-Agent/" << microsoft::deliveryoptimization::util::details::SimpleVersion() << "\r\n";
+    ss << "Content-Type: text/event-stream\r\n";
+    ss << "Cache-Control: no-cache\r\n";
+    ss << "\r\n";
+    const std::string response = ss.str();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    boost::system::error_code ec;
+    boost::asio::write(*_socket, boost::asio::buffer(response.data(), response.size()), ec);
+    if (ec)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(ec.value()));
+    }
+}
+
+HRESULT DownloadStatusStream::Send(const DownloadStatus& status)
+{
+    std::string event = _formatEvent(status);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (FAILED(_hrSend))
+    {
+        return _hrSend;
+    }
+
+    if ((_queued.size() + event.size()) > g_statusEventMaxQueuedBytes)
+    {
+        DoLogWarning("Status events not read by the client, dropping it");
+        _hrSend = HRESULT_FROM_XPLAT_SYSERR(ENOBUFS);
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+        return _hrSend;
+    }
+
+    _queued += event;
+    _WriteQueuedUnderLock();
+    return S_OK;
+}
+
+void DownloadStatusStream::Finish()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _fFinishing = true;
+    if (_writing.empty() && _queued.empty())
+    {
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_send, ec);
+    }
+    // else shut down once the queued events are sent
+}
+
+void DownloadStatusStream::Abort()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_socket->is_open())
+    {
+        // Also cancels a write in progress, its callback runs with an error
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+        _socket->close(ec);
+    }
+}
+
+void DownloadStatusStream::_WriteQueuedUnderLock()
+{
+    if (!_writing.empty() || _queued.empty())
+    {
+        return;
+    }
+
+    _writing.swap(_queued);
+    boost::asio::async_write(*_socket, boost::asio::buffer(_writing.data(), _writing.size()),
+        [self = shared_from_this()](const boost::system::error_code& ec, size_t)
+        {
+            self->_OnWritten(ec);
+        });
+}
+
+// Called on the io thread
+void DownloadStatusStream::_OnWritten(const boost::system::error_code& ec)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _writing.clear();
+    if (ec)
+    {
+        _hrSend = HRESULT_FROM_XPLAT_SYSERR(ec.value());
+        _queued.clear();
+        DoLogVerbose("Status event send failed: %d, %s", ec.value(), ec.message().data());
+        return;
+    }
+
+    _WriteQueuedUnderLock();
+    if (_fFinishing && _writing.empty())
+    {
+        boost::system::error_code ecShutdown;
+        _socket->shutdown(boost::asio::socket_base::shutdown_send, ecShutdown);
+    }
+}
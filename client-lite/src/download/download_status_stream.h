@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include "do_noncopyable.h"
+#include "download_status.h"
+
+// Pushes a download's status to the SDK over the REST connection that subscribed to it, as server-sent events.
+// Events are formatted by the REST layer, see RestApiRequestBase::ProcessSubscribe. Sends never block the
+// taskthread: events queue up while a write is in progress, and a client that lets too much queue up is dropped.
+// Everything is meant to be called from the taskthread, writes complete on the io thread.
+class DownloadStatusStream : public std::enable_shared_from_this<DownloadStatusStream>, DONonCopyable
+{
+public:
+    using format_event_t = std::function<std::string(const DownloadStatus&)>;
+
+    DownloadStatusStream(std::shared_ptr<boost::asio::generic::stream_protocol::socket> socket, format_event_t formatEvent);
+
+    // Sends the response to the subscribe request, the events follow it. Blocks like DownloadStream::Open.
+    void Open();
+
+    // Returns the send error once sending failed, like when the client went away
+    HRESULT Send(const DownloadStatus& status);
+
+    // Client reads the end of the stream once the queued events are sent
+    void Finish();
+
+    // Closes the connection right away
+    void Abort();
+
+private:
+    void _WriteQueuedUnderLock();
+    void _OnWritten(const boost::system::error_code& ec);
+
+    std::shared_ptr<boost::asio::generic::stream_protocol::socket> _socket;
+    const format_event_t _formatEvent;
+
+    std::mutex _mutex;
+    std::string _queued;
+    std::string _writing;
+    HRESULT _hrSend { S_OK };
+    bool _fFinishing { false };
+};
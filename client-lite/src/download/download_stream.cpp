@@ -0,0 +1,222 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "download_stream.h"
+
+#include <sstream>
+#include <boost/asio/write.hpp>
+#include "do_version.h"
+
+DownloadStream::DownloadStream(std::shared_ptr<boost::asio::generic::stream_protocol::socket> socket) :
+    _socket(std::move(socket))
+{
+}
+
+void DownloadStream::Open()
+{
+    std::stringstream ss;
+    ss << "HTTP/1.1 200 OK\r\n";
+    ss << "Server: Delivery-Optimization-Agent/" << microsoft::deliveryoptimization::util::details::SimpleVersion() << "\r\n";
+    ss << "\r\n";
+    const std::string response = ss.str();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    boost::system::error_code ec;
+    boost::asio::write(*_socket, boost::asio::buffer(response.data(), response.size()), ec);
+    if (ec)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(ec.value()));
+    }
+
+    // Sends from here on must not block the transfer thread
+    _socket->non_blocking(true, ec);
+    if (ec)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(ec.value()));
+    }
+}
+
+HRESULT DownloadStream::Write(_In_reads_bytes_(cbData) const BYTE* pData, size_t cbData)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (FAILED(_hrSend))
+    {
+        return _hrSend;
+    }
+
+    if (!_pending.empty())
+    {
+        _fWriterWaiting = true;
+        return E_PENDING;
+    }
+
+    boost::system::error_code ec;
+    size_t cbSent = _socket->write_some(boost::asio::buffer(pData, cbData), ec);
+    if (ec == boost::asio::error::would_block)
+    {
+        cbSent = 0;
+    }
+    else if (ec)
+    {
+        _hrSend = HRESULT_FROM_XPLAT_SYSERR(ec.value());
+        DoLogWarning("Stream send failed: %d, %s", ec.value(), ec.message().data());
+        return _hrSend;
+    }
+
+    // The client is not keeping up, keep the rest until the socket takes more
+    if (cbSent < cbData)
+    {
+        _pending.assign(pData + cbSent, pData + cbData);
+        _cbPendingSent = 0;
+        _WaitWritableUnderLock();
+    }
+    return S_OK;
+}
+
+void DownloadStream::Flush(std::function<void(HRESULT)> onFlushed)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_pending.empty() && SUCCEEDED(_hrSend))
+    {
+        // Invoked on the io thread once the kept data is sent
+        _onFlushed = std::move(onFlushed);
+        return;
+    }
+
+    const HRESULT hrSend = _hrSend;
+    lock.unlock();
+    onFlushed(hrSend);
+}
+
+void DownloadStream::SetOnWritable(std::function<void()> onWritable)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _onWritable = std::move(onWritable);
+}
+
+void DownloadStream::CloseWriter()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _onWritable = nullptr;
+    _onFlushed = nullptr;
+    _fWriterWaiting = false;
+    _cvCallbacksDone.wait(lock, [this]()
+        {
+            return (_numCallbacksInProgress == 0);
+        });
+}
+
+void DownloadStream::Finish()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _fFinishing = true;
+    if (_pending.empty())
+    {
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_send, ec);
+    }
+    // else shut down once the kept data is sent
+}
+
+void DownloadStream::Abort()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_socket->is_open())
+    {
+        // Also cancels the wait for the socket, its callback runs with an error
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+        _socket->close(ec);
+    }
+}
+
+HRESULT DownloadStream::_SendPendingUnderLock()
+{
+    while (_cbPendingSent < _pending.size())
+    {
+        boost::system::error_code ec;
+        const size_t cbSent = _socket->write_some(boost::asio::buffer(_pending.data() + _cbPendingSent,
+            _pending.size() - _cbPendingSent), ec);
+        if (ec == boost::asio::error::would_block)
+        {
+            return E_PENDING;
+        }
+        if (ec)
+        {
+            _hrSend = HRESULT_FROM_XPLAT_SYSERR(ec.value());
+            DoLogWarning("Stream send failed: %d, %s", ec.value(), ec.message().data());
+            return _hrSend;
+        }
+        _cbPendingSent += cbSent;
+    }
+
+    _pending.clear();
+    _cbPendingSent = 0;
+    return S_OK;
+}
+
+void DownloadStream::_WaitWritableUnderLock()
+{
+    if (_fWaitingForSocket)
+    {
+        return;
+    }
+
+    // Waits for the socket to become writable without sending anything, the kept data is sent from the callback
+    _fWaitingForSocket = true;
+    _socket->async_write_some(boost::asio::null_buffers(), [self = shared_from_this()](const boost::system::error_code& ec, size_t)
+        {
+            self->_OnWritable(ec);
+        });
+}
+
+// Called on the io thread
+void DownloadStream::_OnWritable(const boost::system::error_code& ec)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _fWaitingForSocket = false;
+
+    HRESULT hr;
+    if (ec)
+    {
+        hr = HRESULT_FROM_XPLAT_SYSERR(ec.value());
+        _hrSend = hr;
+    }
+    else
+    {
+        hr = _SendPendingUnderLock();
+        if (hr == E_PENDING)
+        {
+            _WaitWritableUnderLock();
+            return;
+        }
+    }
+
+    if (_fFinishing && SUCCEEDED(hr))
+    {
+        boost::system::error_code ecShutdown;
+        _socket->shutdown(boost::asio::socket_base::shutdown_send, ecShutdown);
+    }
+
+    // The kept data is sent or sending failed, either way the writer and a flush can go on now
+    auto onWritable = _fWriterWaiting ? _onWritable : nullptr;
+    auto onFlushed = std::move(_onFlushed);
+    _onFlushed = nullptr;
+    _fWriterWaiting = false;
+    ++_numCallbacksInProgress;
+    lock.unlock();
+
+    if (onWritable)
+    {
+        onWritable();
+    }
+    if (onFlushed)
+    {
+        onFlushed(hr);
+    }
+
+    lock.lock();
+    --_numCallbacksInProgress;
+    _cvCallbacksDone.notify_all();
+}
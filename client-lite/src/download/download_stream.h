@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include "do_noncopyable.h"
+
+// Sends a download's data to the SDK over the REST connection that asked for it, in place of the destination file.
+// The data goes from the transfer callback's buffer straight into the socket. Writes never block the transfer
+// thread: data the socket can't take right away is kept until it becomes writable and further writes are
+// refused with E_PENDING until then, the same way WriteBehindQueue::Stream backs off.
+// Write and Flush are meant to be called from the transfer callback thread, everything else from the taskthread.
+class DownloadStream : public std::enable_shared_from_this<DownloadStream>, DONonCopyable
+{
+public:
+    DownloadStream(std::shared_ptr<boost::asio::generic::stream_protocol::socket> socket);
+
+    // Sends the response to the stream request, the data follows it until end of stream.
+    // Blocks, it is a few bytes on a connection that has nothing else to send yet.
+    void Open();
+
+    // Sends what the socket takes right away and keeps the rest. Returns E_PENDING without consuming any data
+    // while earlier data is still kept, onWritable gets invoked (on the io thread) once the caller can retry.
+    // Returns the send error once sending failed, like when the client went away.
+    HRESULT Write(_In_reads_bytes_(cbData) const BYTE* pData, size_t cbData);
+
+    // onFlushed is invoked with the send result once the kept data is sent, inline if there is none
+    void Flush(std::function<void(HRESULT)> onFlushed);
+
+    // Set for each request that writes to the stream
+    void SetOnWritable(std::function<void()> onWritable);
+
+    // Drops the callbacks of the request that wrote to the stream, once it is closed.
+    // Waits for a callback in progress to complete.
+    void CloseWriter();
+
+    // Client reads the end of the stream once the kept data is sent
+    void Finish();
+
+    // Closes the connection right away, the client reads the end of the stream or an error
+    void Abort();
+
+private:
+    HRESULT _SendPendingUnderLock();
+    void _WaitWritableUnderLock();
+    void _OnWritable(const boost::system::error_code& ec);
+
+    std::shared_ptr<boost::asio::generic::stream_protocol::socket> _socket;
+
+    std::mutex _mutex;
+    std::condition_variable _cvCallbacksDone;
+    std::vector<BYTE> _pending;
+    size_t _cbPendingSent { 0 };
+    std::function<void()> _onWritable;
+    std::function<void(HRESULT)> _onFlushed;
+    UINT _numCallbacksInProgress { 0 };
+    HRESULT _hrSend { S_OK };
+    bool _fWriterWaiting { false };
+    bool _fWaitingForSocket { false };
+    bool _fFinishing { false };
+};
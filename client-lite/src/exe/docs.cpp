@@ -131,10 +131,14 @@ HRESULT Run() try
     BoostAsioService asioService;
 
     ConfigManager clientConfigs;
-    auto downloadManager = std::make_shared<DownloadManager>(clientConfigs);
+    auto downloadManager = std::make_shared<DownloadManager>(clientConfigs, docli::GetPersistenceDirectory());
     RestHttpController controller(clientConfigs, downloadManager);
 
-    controller.Start(asioService.IoService());
+    controller.Start(asioService.IoService(), docli::GetRestSocketPath());
+#ifndef DO_BUILD_FOR_SNAP
+    // Members of the 'do' group may connect to the socket, see RestHttpListener::Start
+    SetDOPathPermissions(docli::GetRestSocketPath(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+#endif
     DoLogInfo("HTTP controller listening at: %s", controller.ServerEndpoint().data());
 
     RestPortAdvertiser portAdvertiser(controller.Port());
@@ -147,9 +151,12 @@ HRESULT Run() try
     DOLog::Init(docli::GetLogDirectory(), DOLog::Level::Verbose);
 
     DoLogInfo("Started, %s", msdoutil::ComponentVersion().c_str());
-    DoLogInfo("**Paths**\nLog: %s\nRun: %s\nConfig: %s\nSdkConfig: %s\nAdminConfig: %s",
-        docli::GetLogDirectory().c_str(), docli::GetRuntimeDirectory().c_str(), docli::GetConfigDirectory().c_str(),
-        docli::GetSDKConfigFilePath().c_str(), docli::GetAdminConfigFilePath().c_str());
+    DoLogInfo("**Paths**\nLog: %s\nRun: %s\nPersistence: %s\nConfig: %s\nSdkConfig: %s\nAdminConfig: %s",
+        docli::GetLogDirectory().c_str(), docli::GetRuntimeDirectory().c_str(), docli::GetPersistenceDirectory().c_str(),
+        docli::GetConfigDirectory().c_str(), docli::GetSDKConfigFilePath().c_str(), docli::GetAdminConfigFilePath().c_str());
+
+    // After dropping permissions, restored downloads must not touch files as root
+    downloadManager->RestoreDownloads();
 
     ProcessController procController([&downloadManager]()
     {
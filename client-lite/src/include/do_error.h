@@ -25,6 +25,9 @@
 #define DO_E_INVALID_STATE                          HRESULT(0x80D02013L)    // The requested action is not allowed in the current job state. The job might have been canceled or completed transferring. It is in a read-only state now.
 #define DO_E_FILE_DOWNLOADSINK_UNSPECIFIED          HRESULT(0x80D02018L)    // Unable to start a download because no download sink (either local file or stream interface) was specified
 #define DO_E_INSUFFICIENT_RANGE_SUPPORT             HRESULT(0x80D05011L)    // The server does not support the necessary HTTP Range protocol header.
+#define DO_E_CONTENT_CHANGED                        HRESULT(0x80D05012L)    // The content at the source changed since the download started.
+#define DO_E_INTEGRITY_CHECK_FAILED                 HRESULT(0x80D05013L)    // The downloaded content does not match the hash given in IntegrityCheckInfo.
+#define DO_E_INTEGRITY_CHECK_INFO_MISSING           HRESULT(0x80D05014L)    // IntegrityCheckMandatory is set but no IntegrityCheckInfo was given.
 
 // IDODownload interface
 
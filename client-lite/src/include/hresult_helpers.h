@@ -45,6 +45,7 @@ inline constexpr HRESULT HRESULT_FROM_WIN32(unsigned long x)
 #define S_OK            ((HRESULT)0L)
 #define S_FALSE         ((HRESULT)1L)
 #define E_NOTIMPL       ((HRESULT)0x80004001L)
+#define E_PENDING       ((HRESULT)0x8000000AL)
 #define E_ABORT         ((HRESULT)0x80004004L)
 #define E_FAIL          ((HRESULT)0x80004005L)
 #define E_ACCESSDENIED  ((HRESULT)0x80070005L)
@@ -14,7 +14,13 @@ const RestApiParam RestApiParam::_knownParams[] =
     { INSERT_REST_API_PARAM(Id), DownloadProperty::Id, RestApiParamTypes::String },
     { INSERT_REST_API_PARAM(Uri), DownloadProperty::Uri, RestApiParamTypes::String },
     { INSERT_REST_API_PARAM(DownloadFilePath), DownloadProperty::LocalPath, RestApiParamTypes::String },
+    { INSERT_REST_API_PARAM(CallbackFreqPercent), DownloadProperty::CallbackFreqPercent, RestApiParamTypes::UInt },
+    { INSERT_REST_API_PARAM(CallbackFreqSeconds), DownloadProperty::CallbackFreqSeconds, RestApiParamTypes::UInt },
     { INSERT_REST_API_PARAM(NoProgressTimeoutSeconds), DownloadProperty::NoProgressTimeoutSeconds, RestApiParamTypes::UInt },
+    { INSERT_REST_API_PARAM(MaxBytesPerSecond), DownloadProperty::MaxBytesPerSecond, RestApiParamTypes::UInt },
+    { INSERT_REST_API_PARAM(Ranges), DownloadProperty::Ranges, RestApiParamTypes::String },
+    { INSERT_REST_API_PARAM(IntegrityCheckInfo), DownloadProperty::IntegrityCheckInfo, RestApiParamTypes::String },
+    { INSERT_REST_API_PARAM(IntegrityCheckMandatory), DownloadProperty::IntegrityCheckMandatory, RestApiParamTypes::UInt },
     { INSERT_REST_API_PARAM(PropertyKey), DownloadProperty::Invalid, RestApiParamTypes::String },
 };
 
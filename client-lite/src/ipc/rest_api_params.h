@@ -10,7 +10,13 @@ enum class RestApiParameters
     Id,
     Uri,
     DownloadFilePath,
+    CallbackFreqPercent,
+    CallbackFreqSeconds,
     NoProgressTimeoutSeconds,
+    MaxBytesPerSecond,
+    Ranges,
+    IntegrityCheckInfo,
+    IntegrityCheckMandatory,
     PropertyKey,
 };
 
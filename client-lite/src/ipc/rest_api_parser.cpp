@@ -4,6 +4,8 @@
 #include "do_common.h"
 #include "rest_api_parser.h"
 
+#include <sstream>
+#include <boost/property_tree/json_parser.hpp>
 #include "do_http_defines.h"
 #include "do_cpprest_uri.h"
 #include "string_ops.h"
@@ -36,6 +38,15 @@ RestApiMethods RestApiParser::Method()
             { "getstatus", std::make_pair(RestApiMethods::GetStatus, msdod::http_methods::GET) },
             { "getproperty", std::make_pair(RestApiMethods::GetProperty, msdod::http_methods::GET) },
             { "setproperty", std::make_pair(RestApiMethods::SetProperty, msdod::http_methods::POST) },
+            { "gethostestimates", std::make_pair(RestApiMethods::GetHostEstimates, msdod::http_methods::GET) },
+            { "stream", std::make_pair(RestApiMethods::Stream, msdod::http_methods::GET) },
+            { "subscribe", std::make_pair(RestApiMethods::Subscribe, msdod::http_methods::GET) },
+            { "createbatch", std::make_pair(RestApiMethods::CreateBatch, msdod::http_methods::POST) },
+            { "startbatch", std::make_pair(RestApiMethods::StartBatch, msdod::http_methods::POST) },
+            { "pausebatch", std::make_pair(RestApiMethods::PauseBatch, msdod::http_methods::POST) },
+            { "finalizebatch", std::make_pair(RestApiMethods::FinalizeBatch, msdod::http_methods::POST) },
+            { "abortbatch", std::make_pair(RestApiMethods::AbortBatch, msdod::http_methods::POST) },
+            { "getstatusbatch", std::make_pair(RestApiMethods::GetStatusBatch, msdod::http_methods::POST) },
         };
 
     if (!_methodInitialized)
@@ -81,6 +92,27 @@ std::string RestApiParser::GetStringParam(RestApiParameters param)
     return {};
 }
 
+const boost::property_tree::ptree& RestApiParser::JsonBody()
+{
+    if (!_jsonBodyInitialized)
+    {
+        if (!_request->body.empty())
+        {
+            try
+            {
+                std::istringstream body{_request->body};
+                boost::property_tree::read_json(body, _jsonBody);
+            }
+            catch (const boost::property_tree::json_parser_error& e)
+            {
+                THROW_HR_MSG(E_INVALIDARG, "Malformed JSON body: %s", e.what());
+            }
+        }
+        _jsonBodyInitialized = true;
+    }
+    return _jsonBody;
+}
+
 void RestApiParser::_ParseQueryString()
 {
     // Search for and store only known parameters.
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <map>
+#include <boost/property_tree/ptree.hpp>
 #include "do_http_packet.h"
 #include "rest_api_params.h"
 
@@ -18,6 +19,15 @@ enum class RestApiMethods
     GetStatus,
     GetProperty,
     SetProperty,
+    GetHostEstimates,
+    Stream,
+    Subscribe,
+    CreateBatch,
+    StartBatch,
+    PauseBatch,
+    FinalizeBatch,
+    AbortBatch,
+    GetStatusBatch,
 };
 
 class RestApiParser
@@ -35,6 +45,9 @@ public:
 
     std::string GetStringParam(RestApiParameters param);
 
+    // Empty for requests without a body
+    const boost::property_tree::ptree& JsonBody();
+
 private:
     void _ParseQueryString();
     const query_data_t& _QueryParams();
@@ -45,6 +58,8 @@ private:
     // All further data members are lazy-init
     RestApiMethods _method;
     query_data_t _queryData;
+    boost::property_tree::ptree _jsonBody;
     bool _methodInitialized { false };
     bool _queryDataInitialized { false };
+    bool _jsonBodyInitialized { false };
 };
@@ -4,10 +4,15 @@
 #include "do_common.h"
 #include "rest_api_request.h"
 
+#include <sstream>
+#include <boost/property_tree/json_parser.hpp>
 #include "do_error.h"
 #include "do_guid.h"
 #include "download.h"
 #include "download_manager.h"
+#include "download_status_stream.h"
+#include "download_stream.h"
+#include "rest_http_listener_conn.h"
 #include "string_ops.h"
 
 namespace strconv = docli::string_conversions;
@@ -27,6 +32,35 @@ static std::string GetDownloadId(RestApiParser& parser)
     return parser.GetStringParam(RestApiParameters::Id);
 }
 
+// "Ids" array of the JSON body
+static std::vector<std::string> GetDownloadIds(RestApiParser& parser)
+{
+    std::vector<std::string> ids;
+    const auto idsJson = parser.JsonBody().get_child_optional("Ids");
+    if (idsJson)
+    {
+        for (const auto& item : *idsJson)
+        {
+            ids.push_back(item.second.data());
+        }
+    }
+    return ids;
+}
+
+static boost::property_tree::ptree BatchResultToJson(const std::string& downloadId, HRESULT hr)
+{
+    boost::property_tree::ptree resultJson;
+    resultJson.put(RestApiParser::ParamToString(RestApiParameters::Id), downloadId);
+    resultJson.put("Result", std::to_string(hr));
+    return resultJson;
+}
+
+// Array elements are children with empty names
+static void AddToArray(boost::property_tree::ptree& array, boost::property_tree::ptree element)
+{
+    array.push_back(std::make_pair(std::string{}, std::move(element)));
+}
+
 static PCSTR DownloadStateToString(DownloadState state)
 {
 #define RETURN_DOWNLOAD_STATE_STR(state) \
@@ -69,6 +103,23 @@ RestApiRequestBase::RestApiRequestBase(const std::shared_ptr<microsoft::delivery
     case RestApiMethods::GetProperty:   _apiRequest = std::make_unique<RestApiGetPropertyRequest>(); break;
     case RestApiMethods::SetProperty:   _apiRequest = std::make_unique<RestApiSetPropertyRequest>(); break;
 
+    case RestApiMethods::GetHostEstimates:  _apiRequest = std::make_unique<RestApiGetHostEstimatesRequest>(); break;
+
+    case RestApiMethods::CreateBatch:       _apiRequest = std::make_unique<RestApiCreateBatchRequest>(); break;
+
+    case RestApiMethods::StartBatch:
+    case RestApiMethods::PauseBatch:
+    case RestApiMethods::FinalizeBatch:
+    case RestApiMethods::AbortBatch:
+        _apiRequest = std::make_unique<RestApiDownloadStateChangeBatchRequest>();
+        break;
+
+    case RestApiMethods::GetStatusBatch:    _apiRequest = std::make_unique<RestApiGetStatusBatchRequest>(); break;
+
+    case RestApiMethods::Stream:
+    case RestApiMethods::Subscribe:
+        break; // see ProcessStream
+
     default:
         DO_ASSERT(false);
         THROW_HR(E_UNEXPECTED);
@@ -80,6 +131,43 @@ HRESULT RestApiRequestBase::Process(DownloadManager& downloadManager, boost::pro
     return _apiRequest->ParseAndProcess(downloadManager, _parser, responseBody);
 } CATCH_RETURN()
 
+// Same fields as a getstatus response
+static void StatusToJson(const DownloadStatus& status, boost::property_tree::ptree& responseBody)
+{
+    responseBody.put("Status", DownloadStateToString(status.State));
+    responseBody.put("BytesTotal", std::to_string(status.BytesTotal));
+    responseBody.put("BytesTransferred", std::to_string(status.BytesTransferred));
+    responseBody.put("BytesVerified", std::to_string(status.BytesVerified));
+    responseBody.put("ErrorCode", std::to_string(status.Error));
+    responseBody.put("ExtendedErrorCode", std::to_string(status.ExtendedError));
+}
+
+// A server-sent event with the status JSON on a single data line
+static std::string StatusToEvent(const DownloadStatus& status)
+{
+    boost::property_tree::ptree statusJson;
+    StatusToJson(status, statusJson);
+    std::stringstream ss;
+    ss << "data: ";
+    boost::property_tree::write_json(ss, statusJson, false);   // ends with a newline
+    ss << "\n";
+    return ss.str();
+}
+
+HRESULT RestApiRequestBase::ProcessStream(DownloadManager& downloadManager, HttpListenerConnection& conn) try
+{
+    if (_parser.Method() == RestApiMethods::Subscribe)
+    {
+        downloadManager.AttachStatusStream(GetDownloadId(_parser), std::make_shared<DownloadStatusStream>(conn.Socket(), StatusToEvent));
+    }
+    else
+    {
+        downloadManager.AttachDownloadStream(GetDownloadId(_parser), std::make_shared<DownloadStream>(conn.Socket()));
+    }
+    conn.Detach();
+    return S_OK;
+} CATCH_RETURN()
+
 HRESULT RestApiCreateRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody)
 {
     std::string uri = GetUri(parser);
@@ -95,7 +183,16 @@ HRESULT RestApiEnumerateRequest::ParseAndProcess(DownloadManager& downloadManage
     std::string filePath = GetDownloadFilePath(parser);
     std::string uri = GetUri(parser);
     DoLogInfo("%s, %s", filePath.data(), uri.data());
-    return E_NOTIMPL;
+
+    boost::property_tree::ptree idsJson;
+    for (const auto& downloadId : downloadManager.EnumerateDownloads(uri, filePath))
+    {
+        boost::property_tree::ptree idJson;
+        idJson.put_value(downloadId);
+        AddToArray(idsJson, std::move(idJson));
+    }
+    responseBody.add_child("Ids", std::move(idsJson));
+    return S_OK;
 }
 
 HRESULT RestApiDownloadStateChangeRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser,
@@ -133,11 +230,7 @@ HRESULT RestApiGetStatusRequest::ParseAndProcess(DownloadManager& downloadManage
     boost::property_tree::ptree& responseBody)
 {
     auto status = downloadManager.GetDownloadStatus(GetDownloadId(parser));
-    responseBody.put("Status", DownloadStateToString(status.State));
-    responseBody.put("BytesTotal", std::to_string(status.BytesTotal));
-    responseBody.put("BytesTransferred", std::to_string(status.BytesTransferred));
-    responseBody.put("ErrorCode", std::to_string(status.Error));
-    responseBody.put("ExtendedErrorCode", std::to_string(status.ExtendedError));
+    StatusToJson(status, responseBody);
     return S_OK;
 }
 
@@ -166,6 +259,10 @@ HRESULT RestApiSetPropertyRequest::ParseAndProcess(DownloadManager& downloadMana
     for (const auto& item : requestQueryParams)
     {
         const RestApiParam* param = item.first;
+        if (param->paramId == RestApiParameters::Id)
+        {
+            continue; // identifies the download, not a property to set
+        }
         RETURN_HR_IF(DO_E_UNKNOWN_PROPERTY_ID, param->IsUnknownDownloadPropertyId());
         propertiesToSet.emplace_back(param->downloadPropertyId, item.second);
     }
@@ -177,3 +274,118 @@ HRESULT RestApiSetPropertyRequest::ParseAndProcess(DownloadManager& downloadMana
 
     return S_OK;
 }
+
+// Body is { "Downloads": [ { "Uri": ..., "DownloadFilePath": ... }, ... ], "Start": true|false }
+HRESULT RestApiCreateBatchRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser,
+    boost::property_tree::ptree& responseBody)
+{
+    const auto& body = parser.JsonBody();
+    std::vector<std::pair<std::string, std::string>> urlsAndPaths;
+    const auto downloadsJson = body.get_child_optional("Downloads");
+    RETURN_HR_IF_EXPECTED(E_INVALIDARG, !downloadsJson);
+    for (const auto& item : *downloadsJson)
+    {
+        urlsAndPaths.emplace_back(item.second.get<std::string>(RestApiParser::ParamToString(RestApiParameters::Uri), {}),
+            item.second.get<std::string>(RestApiParser::ParamToString(RestApiParameters::DownloadFilePath), {}));
+    }
+    const bool fStart = body.get<bool>("Start", false);
+    DoLogInfo("Creating %zu downloads, start: %d", urlsAndPaths.size(), fStart);
+
+    boost::property_tree::ptree resultsJson;
+    for (const auto& result : downloadManager.CreateDownloads(urlsAndPaths, fStart))
+    {
+        AddToArray(resultsJson, BatchResultToJson(result.first, result.second));
+    }
+    responseBody.add_child("Downloads", std::move(resultsJson));
+    return S_OK;
+}
+
+// Body is { "Ids": [ ... ] }
+HRESULT RestApiDownloadStateChangeBatchRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser,
+    boost::property_tree::ptree& responseBody)
+{
+    const auto downloadIds = GetDownloadIds(parser);
+    DoLogInfo("Download state change: %d, %zu downloads", static_cast<int>(parser.Method()), downloadIds.size());
+
+    std::vector<HRESULT> results;
+    switch (parser.Method())
+    {
+    case RestApiMethods::StartBatch:
+        results = downloadManager.StartDownloads(downloadIds);
+        break;
+
+    case RestApiMethods::PauseBatch:
+        results = downloadManager.PauseDownloads(downloadIds);
+        break;
+
+    case RestApiMethods::FinalizeBatch:
+        results = downloadManager.FinalizeDownloads(downloadIds);
+        break;
+
+    case RestApiMethods::AbortBatch:
+        results = downloadManager.AbortDownloads(downloadIds);
+        break;
+
+    default:
+        DO_ASSERT(false);
+        return E_NOTIMPL;
+    }
+
+    boost::property_tree::ptree resultsJson;
+    for (size_t i = 0; i < downloadIds.size(); ++i)
+    {
+        AddToArray(resultsJson, BatchResultToJson(downloadIds[i], results[i]));
+    }
+    responseBody.add_child("Downloads", std::move(resultsJson));
+    return S_OK;
+}
+
+// Body is { "Ids": [ ... ] }, all downloads without it. Each result has the getstatus fields when it succeeded.
+HRESULT RestApiGetStatusBatchRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser,
+    boost::property_tree::ptree& responseBody)
+{
+    auto downloadIds = GetDownloadIds(parser);
+    if (!parser.JsonBody().get_child_optional("Ids"))
+    {
+        downloadIds = downloadManager.EnumerateDownloads();
+    }
+
+    std::vector<DownloadStatus> statuses;
+    const auto results = downloadManager.GetDownloadStatuses(downloadIds, statuses);
+
+    boost::property_tree::ptree resultsJson;
+    for (size_t i = 0; i < downloadIds.size(); ++i)
+    {
+        auto resultJson = BatchResultToJson(downloadIds[i], results[i]);
+        if (SUCCEEDED(results[i]))
+        {
+            StatusToJson(statuses[i], resultJson);
+        }
+        AddToArray(resultsJson, std::move(resultJson));
+    }
+    responseBody.add_child("Downloads", std::move(resultsJson));
+    return S_OK;
+}
+
+HRESULT RestApiGetHostEstimatesRequest::ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser,
+    boost::property_tree::ptree& responseBody)
+{
+    boost::property_tree::ptree hosts;
+    for (const auto& info : downloadManager.GetHostEstimates())
+    {
+        boost::property_tree::ptree host;
+        host.put("Host", info.host);
+        host.put("ConnectTimeMs", std::to_string(info.smoothedConnectTime.count()));
+        host.put("ConnectTimeVariationMs", std::to_string(info.connectTimeVariation.count()));
+        host.put("ConnectSamples", std::to_string(info.connectSamples));
+        host.put("ConnectTimeouts", std::to_string(info.connectTimeouts));
+        host.put("BytesPerSecond", std::to_string(info.bytesPerSecond));
+        host.put("ThroughputSamples", std::to_string(info.throughputSamples));
+        host.put("StallBytesPerSecond", std::to_string(info.stallThreshold.bytesPerSecond));
+        host.put("StallTimeSeconds", std::to_string(info.stallThreshold.time.count()));
+        host.put("RetryDelayMs", std::to_string(info.retryDelay.count()));
+        hosts.push_back(std::make_pair("", std::move(host)));
+    }
+    responseBody.add_child("Hosts", hosts);
+    return S_OK;
+}
@@ -9,6 +9,7 @@
 #include "rest_api_parser.h"
 
 class DownloadManager;
+class HttpListenerConnection;
 
 class IRestApiRequest
 {
@@ -23,6 +24,10 @@ public:
     RestApiRequestBase(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& clientRequest);
     HRESULT Process(DownloadManager& downloadManager, boost::property_tree::ptree& responseBody);
 
+    // A stream or subscribe request gets no reply here, its connection is handed over to the download instead
+    bool IsStreamRequest() { return (_parser.Method() == RestApiMethods::Stream) || (_parser.Method() == RestApiMethods::Subscribe); }
+    HRESULT ProcessStream(DownloadManager& downloadManager, HttpListenerConnection& conn);
+
 private:
     std::unique_ptr<IRestApiRequest> _apiRequest;
     RestApiParser _parser;
@@ -63,3 +68,30 @@ class RestApiSetPropertyRequest : public IRestApiRequest
 private:
     HRESULT ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody) override;
 };
+
+// Batch requests carry their downloads in a JSON body and reply with a result per download, see DownloadManager
+
+class RestApiCreateBatchRequest : public IRestApiRequest
+{
+private:
+    HRESULT ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody) override;
+};
+
+class RestApiDownloadStateChangeBatchRequest : public IRestApiRequest
+{
+private:
+    HRESULT ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody) override;
+};
+
+class RestApiGetStatusBatchRequest : public IRestApiRequest
+{
+private:
+    HRESULT ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody) override;
+};
+
+// Not a download request, returns the per-host network estimates for debugging
+class RestApiGetHostEstimatesRequest : public IRestApiRequest
+{
+private:
+    HRESULT ParseAndProcess(DownloadManager& downloadManager, RestApiParser& parser, boost::property_tree::ptree& responseBody) override;
+};
@@ -4,7 +4,6 @@
 #include "do_common.h"
 #include "rest_http_controller.h"
 
-#include <boost/asio/ip/address.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
@@ -28,9 +27,10 @@ RestHttpController::~RestHttpController()
     (void)_callTracker.Wait();
 }
 
-void RestHttpController::Start(boost::asio::io_service& ioService)
+void RestHttpController::Start(boost::asio::io_service& ioService, const std::string& localSocketPath)
 {
-    _listener.Start(ioService, std::bind(&RestHttpController::_HttpListenerCallback, this, std::placeholders::_1, std::placeholders::_2));
+    _listener.Start(ioService, std::bind(&RestHttpController::_HttpListenerCallback, this, std::placeholders::_1, std::placeholders::_2),
+        localSocketPath);
 }
 
 std::string RestHttpController::ServerEndpoint() const
@@ -43,21 +43,30 @@ uint16_t RestHttpController::Port() const
     return _listener.Port();
 }
 
+// Runs on the io thread. The connection waits for the reply before handing over its next request,
+// so requests on one connection are still processed in order.
 void RestHttpController::_HttpListenerCallback(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet,
     HttpListenerConnection& conn)
 {
-    auto tracker = _callTracker.Enter();
+    TaskThread& requestThread = _requestThreads[_nextRequestThread++ % _requestThreads.Size()];
+    requestThread.Sched([this, tracker = _callTracker.Enter(), packet, conn = conn.shared_from_this()]()
+        {
+            _ProcessRequest(packet, *conn);
+        });
+}
 
+void RestHttpController::_ProcessRequest(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet,
+    HttpListenerConnection& conn)
+{
     HRESULT hr = S_OK;
     std::stringstream responseBodyStream;
     try
     {
         if (_config.RestControllerValidateRemoteAddr())
         {
-            const auto addr = conn.RemoteEndpoint().address();
-            if (!addr.is_loopback())
+            if (!conn.IsLocalPeer())
             {
-                DoLogVerbose("Request unexpected from non-loopback address: %s", addr.to_string().c_str());
+                DoLogVerbose("Request unexpected from a peer that is not local");
                 hr = E_INVALIDARG;
             }
         }
@@ -65,7 +74,20 @@ void RestHttpController::_HttpListenerCallback(const std::shared_ptr<microsoft::
         boost::property_tree::ptree responseBody;
         if (SUCCEEDED(hr))
         {
-            hr = RestApiRequestBase{packet}.Process(*_downloadManager, responseBody);
+            RestApiRequestBase request{packet};
+            if (request.IsStreamRequest())
+            {
+                // The download's data or status events follow their own reply on this connection
+                hr = request.ProcessStream(*_downloadManager, conn);
+                if (SUCCEEDED(hr))
+                {
+                    return;
+                }
+            }
+            else
+            {
+                hr = request.Process(*_downloadManager, responseBody);
+            }
         }
         if (SUCCEEDED(hr))
         {
@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <atomic>
 #include "rest_http_listener.h"
+#include "task_thread_pool.h"
 #include "waitable_counter.h"
 
 class ConfigManager;
@@ -13,19 +15,23 @@ class RestApiRequestBase;
 // Controller for the REST-over-HTTP interface in DO client.
 // This interface is used as the inter-process communication
 // mechanism for our clients to create and manage download requests.
+// Requests are processed off the io thread, on a pool of request threads, so a request that waits for a busy
+// download's task thread doesn't hold up the requests on other connections.
 class RestHttpController
 {
 public:
     RestHttpController(ConfigManager& config, std::shared_ptr<DownloadManager> downloadManager);
     ~RestHttpController();
 
-    void Start(boost::asio::io_service& ioService);
+    void Start(boost::asio::io_service& ioService, const std::string& localSocketPath = {});
     std::string ServerEndpoint() const;
     uint16_t Port() const;
 
 private:
     void _HttpListenerCallback(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet,
         HttpListenerConnection& conn);
+    void _ProcessRequest(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet,
+        HttpListenerConnection& conn);
     static void _OnFailure(HttpListenerConnection& conn, HRESULT hr);
     static UINT _HttpStatusFromHRESULT(HRESULT hr);
 
@@ -34,4 +40,8 @@ private:
     std::shared_ptr<DownloadManager> _downloadManager;
     RestHttpListener _listener;
     WaitableCounter _callTracker;
+
+    // Sized like the download manager's task threads, requests mostly wait for those
+    TaskThreadPool _requestThreads;
+    std::atomic<size_t> _nextRequestThread { 0 };
 };
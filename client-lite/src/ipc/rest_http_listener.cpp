@@ -4,9 +4,14 @@
 #include "do_common.h"
 #include "rest_http_listener.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 using boost_tcp_t = boost::asio::ip::tcp;
+using boost_local_t = boost::asio::local::stream_protocol;
 
-void RestHttpListener::Start(boost::asio::io_service& ioService, const http_listener_callback_t& requestHandler)
+void RestHttpListener::Start(boost::asio::io_service& ioService, const http_listener_callback_t& requestHandler,
+    const std::string& localSocketPath)
 {
     _io = &ioService;
     _requestHandler = requestHandler;
@@ -39,7 +44,23 @@ void RestHttpListener::Start(boost::asio::io_service& ioService, const http_list
     }
     DO_ASSERT(tmpListener.is_open());
     _listener = std::make_unique<boost_tcp_t::acceptor>(std::move(tmpListener));
-    _BeginAccept();
+    _BeginAccept(*_listener);
+
+    if (!localSocketPath.empty())
+    {
+        // The socket file of an earlier instance is left behind, it can't be removed once permissions are dropped
+        (void)unlink(localSocketPath.c_str());
+        _localListener = std::make_unique<boost_local_t::acceptor>(ioService, boost_local_t::endpoint(localSocketPath));
+
+        // Only the owner and group may connect, the agent hands the file to its user and group. Other users
+        // go through the loopback port. Connections are checked against the same, see HttpListenerConnection::IsLocalPeer.
+        if (chmod(localSocketPath.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) != 0)
+        {
+            DoLogWarning("Failed to set permissions of %s, errno: %d", localSocketPath.c_str(), errno);
+        }
+        _localSocketPath = localSocketPath;
+        _BeginAccept(*_localListener);
+    }
 }
 
 void RestHttpListener::Stop()
@@ -49,6 +70,20 @@ void RestHttpListener::Stop()
         _listener->close();
         _listener.reset();
     }
+    if (_localListener && _localListener->is_open())
+    {
+        _localListener->close();
+        _localListener.reset();
+    }
+    if (!_localSocketPath.empty())
+    {
+        // Fails once permissions are dropped if the directory is root's, the next start removes the file then
+        if ((unlink(_localSocketPath.c_str()) != 0) && (errno != ENOENT))
+        {
+            DoLogVerbose("Failed to remove %s, errno: %d", _localSocketPath.c_str(), errno);
+        }
+        _localSocketPath.clear();
+    }
     DoLogInfo("RestHttpListener: connections recvd: %u", _numConnections.load());
 }
 
@@ -56,6 +91,10 @@ std::string RestHttpListener::Endpoint() const
 {
     std::stringstream ss;
     ss << _listener->local_endpoint();
+    if (_localListener)
+    {
+        ss << ", " << _localListener->local_endpoint();
+    }
     return ss.str();
 }
 
@@ -64,10 +103,11 @@ uint16_t RestHttpListener::Port() const
     return _listener->local_endpoint().port();
 }
 
-void RestHttpListener::_BeginAccept()
+template <typename TAcceptor>
+void RestHttpListener::_BeginAccept(TAcceptor& acceptor)
 {
-    auto acceptSocket = std::make_shared<boost_tcp_t::socket>(*_io);
-    _listener->async_accept(*acceptSocket, [this, acceptSocket](const boost::system::error_code& ec) mutable
+    auto acceptSocket = std::make_shared<HttpListenerConnection::socket_t>(*_io);
+    acceptor.async_accept(*acceptSocket, [this, &acceptor, acceptSocket](const boost::system::error_code& ec) mutable
         {
             if (ec)
             {
@@ -83,6 +123,6 @@ void RestHttpListener::_BeginAccept()
                 ++_numConnections;
             } CATCH_LOG()
 
-            _BeginAccept(); // accept the next connection
+            _BeginAccept(acceptor); // accept the next connection
         });
 }
@@ -7,19 +7,25 @@
 #include <boost/asio.hpp>
 #include "rest_http_listener_conn.h"
 
+// Listens on a loopback TCP port and, if given a path, on a unix domain socket at that path.
+// Clients that know the path skip port discovery and the TCP stack. The socket is open to the file's owner
+// and group only, everyone else uses the port. The socket file is removed on Stop.
 class RestHttpListener
 {
 public:
-    void Start(boost::asio::io_service& ioService, const http_listener_callback_t& requestHandler);
+    void Start(boost::asio::io_service& ioService, const http_listener_callback_t& requestHandler,
+        const std::string& localSocketPath = {});
     void Stop();
     std::string Endpoint() const;
     uint16_t Port() const;
 
 private:
-    void _BeginAccept();
-    void _ProcessConnection(const std::shared_ptr<boost::asio::ip::tcp::socket>& socket);
+    template <typename TAcceptor>
+    void _BeginAccept(TAcceptor& acceptor);
 
     std::unique_ptr<boost::asio::ip::tcp::acceptor> _listener;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> _localListener;
+    std::string _localSocketPath;
     http_listener_callback_t _requestHandler;
     boost::asio::io_service* _io { nullptr };
 
@@ -4,43 +4,53 @@
 #include "do_common.h"
 #include "rest_http_listener_conn.h"
 
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
 #include "do_http_defines.h"
 #include "do_version.h"
 
-using boost_tcp_t = boost::asio::ip::tcp;
 namespace msdod = microsoft::deliveryoptimization::details;
 
-HttpListenerConnection::HttpListenerConnection(boost::asio::io_service& ioService, std::shared_ptr<boost::asio::ip::tcp::socket> socket) :
+HttpListenerConnection::HttpListenerConnection(boost::asio::io_service& ioService, std::shared_ptr<socket_t> socket) :
     _socket(std::move(socket)),
     _io(ioService)
 {
     _recvBuf.resize(2048);
+    _fLocalPeer = _CheckLocalPeer();
 }
 
 HttpListenerConnection::~HttpListenerConnection()
 {
-    if (_socket->is_open())
+    if (!_fDetached && _socket->is_open())
     {
-        std::stringstream ss;
-        ss << _socket->remote_endpoint();
-        DoLogDebug("Socket closing: was connected to %s", ss.str().c_str());
-        _socket->shutdown(boost_tcp_t::socket::shutdown_both);
-        _socket->close();
+        DoLogDebug("Socket closing");
+        boost::system::error_code ec;
+        _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
+        _socket->close(ec);
     }
 }
 
 std::shared_ptr<HttpListenerConnection> HttpListenerConnection::Make(boost::asio::io_service& ioService,
-    std::shared_ptr<boost::asio::ip::tcp::socket> socket)
+    std::shared_ptr<socket_t> socket)
 {
     return std::make_shared<HttpListenerConnection>(ioService, std::move(socket));
 }
 
 void HttpListenerConnection::Receive(http_listener_callback_t& callback)
+{
+    _callback = &callback;
+    _Read();
+}
+
+void HttpListenerConnection::_Read()
 {
     _socket->async_read_some(boost::asio::buffer(_recvBuf.data(), _recvBuf.size()),
-        [this, lifetime = shared_from_this(), &callback](const boost::system::error_code& ec, size_t cbRead)
+        [this, lifetime = shared_from_this()](const boost::system::error_code& ec, size_t cbRead)
             {
-                _OnData(ec, cbRead, callback);
+                _OnData(ec, cbRead);
             });
 }
 
@@ -81,31 +91,133 @@ void HttpListenerConnection::Reply(unsigned int statusCode, const std::string& b
         ss << body;
     }
 
-    auto replyHttpMessage = std::make_shared<std::string>(ss.str());
-    DoLogDebug("Sending response: %s\n", replyHttpMessage->c_str());
-    boost::asio::async_write(*_socket, boost::asio::buffer(replyHttpMessage->data(), replyHttpMessage->size()),
-        [this, lifetime = shared_from_this(), msgLifetime = replyHttpMessage](const boost::system::error_code& ec, size_t cbSent)
+    // The reply ends the request, the next one is parsed once the reply is sent
+    _io.dispatch([this, lifetime = shared_from_this(), reply = ss.str()]() mutable
+        {
+            _fRequestInProgress = false;
+            _replies.push_back(std::move(reply));
+            DoLogDebug("Sending response: %s\n", _replies.back().c_str());
+            if (_replies.size() == 1)
+            {
+                _WriteNextReply();
+            }
+        });
+}
+
+// Only one write may be in flight on the socket, the next reply is written once this one is sent
+void HttpListenerConnection::_WriteNextReply()
+{
+    const std::string& reply = _replies.front();
+    boost::asio::async_write(*_socket, boost::asio::buffer(reply.data(), reply.size()),
+        [this, lifetime = shared_from_this()](const boost::system::error_code& ec, size_t cbSent)
             {
                 if (ec)
                 {
                     DoLogWarning("Socket send error: %d, %s", ec.value(), ec.message().c_str());
+                    _replies.clear();
+                    return;
                 }
-                else
+
+                DoLogDebug("Socket sent %zu bytes", cbSent);
+                _replies.pop_front();
+                if (!_replies.empty())
+                {
+                    _WriteNextReply();
+                }
+                else if (!_fRequestInProgress)
                 {
-                    DoLogDebug("Socket sent %zu bytes", cbSent);
+                    _ContinueReceiving();
                 }
             });
 }
 
-boost::asio::ip::tcp::endpoint HttpListenerConnection::RemoteEndpoint() const
+// Unix domain socket peers are held to the same as the socket file's permissions, see RestHttpListener::Start:
+// root, the agent's user and members of the agent's group
+static bool IsAllowedLocalPeer(int fd, const struct ucred& peerCred)
+{
+    const gid_t agentGid = getegid();
+    if ((peerCred.uid == 0) || (peerCred.uid == geteuid()) || (peerCred.gid == agentGid))
+    {
+        return true;
+    }
+
+#ifdef SO_PEERGROUPS
+    // Supplementary groups of the peer as of when it connected
+    std::vector<gid_t> groups(16);
+    auto cbGroups = static_cast<socklen_t>(groups.size() * sizeof(gid_t));
+    int err = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups.data(), &cbGroups);
+    if ((err != 0) && (errno == ERANGE))
+    {
+        groups.resize(cbGroups / sizeof(gid_t));
+        err = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups.data(), &cbGroups);
+    }
+    if (err != 0)
+    {
+        DoLogWarning("Failed to get peer groups, errno: %d", errno);
+        return false;
+    }
+    groups.resize(cbGroups / sizeof(gid_t));
+    return std::find(groups.begin(), groups.end(), agentGid) != groups.end();
+#else
+    return false;
+#endif
+}
+
+bool HttpListenerConnection::_CheckLocalPeer() const
 {
     boost::system::error_code ec;
-    auto endpoint = _socket->remote_endpoint(ec);
-    return endpoint;
+    const auto endpoint = _socket->remote_endpoint(ec);
+    if (ec)
+    {
+        DoLogWarning("Failed to get remote endpoint: %d, %s", ec.value(), ec.message().c_str());
+        return false;
+    }
+
+    switch (endpoint.protocol().family())
+    {
+    case AF_UNIX:
+    {
+        struct ucred peerCred {};
+        socklen_t cbPeerCred = sizeof(peerCred);
+        if (getsockopt(_socket->native_handle(), SOL_SOCKET, SO_PEERCRED, &peerCred, &cbPeerCred) != 0)
+        {
+            DoLogWarning("Failed to get peer credentials, errno: %d", errno);
+            return false;
+        }
+        if (!IsAllowedLocalPeer(_socket->native_handle(), peerCred))
+        {
+            DoLogVerbose("Local connection from pid %d, uid %u not allowed", peerCred.pid, peerCred.uid);
+            return false;
+        }
+        DoLogDebug("Local connection from pid %d, uid %u", peerCred.pid, peerCred.uid);
+        return true;
+    }
+
+    case AF_INET:
+    {
+        const auto sin = reinterpret_cast<const struct sockaddr_in*>(endpoint.data());
+        const auto addr = boost::asio::ip::address_v4(ntohl(sin->sin_addr.s_addr));
+        if (!addr.is_loopback())
+        {
+            DoLogVerbose("Connection from non-loopback address: %s", addr.to_string().c_str());
+        }
+        return addr.is_loopback();
+    }
+
+    default:
+        DoLogVerbose("Connection from unexpected address family: %d", endpoint.protocol().family());
+        return false;
+    }
 }
 
-void HttpListenerConnection::_OnData(const boost::system::error_code& ec, size_t cbRead, http_listener_callback_t& callback)
+void HttpListenerConnection::_OnData(const boost::system::error_code& ec, size_t cbRead)
 {
+    if (_fDetached)
+    {
+        DoLogDebug("Socket handed over, stop receiving");
+        return;
+    }
+
     if (ec)
     {
         DoLogWarning("Socket receive error: %d, %s", ec.value(), ec.message().c_str());
@@ -118,25 +230,62 @@ void HttpListenerConnection::_OnData(const boost::system::error_code& ec, size_t
         return;
     }
 
-    try
+    _recvOffset = 0;
+    _cbReceived = cbRead;
+    _ParseReceived();
+}
+
+// A read can end partway through a message or hold several of them, the parser frames them.
+// Stops at the end of each message until the request is replied to, see Reply.
+void HttpListenerConnection::_ParseReceived()
+{
+    while (_cbReceived != 0)
     {
-        _httpParser.OnData(_recvBuf.data(), cbRead);
+        size_t cbParsed;
+        try
+        {
+            cbParsed = _httpParser.OnData(_recvBuf.data() + _recvOffset, _cbReceived);
+        }
+        catch (const std::exception&)
+        {
+            _cbReceived = 0;
+            _fKeepAlive = false;
+            Reply(400);
+            return;
+        }
+        _recvOffset += cbParsed;
+        _cbReceived -= cbParsed;
+
+        if (_httpParser.Done())
+        {
+            _fKeepAlive = _httpParser.ParsedData()->keepAlive;
+            _fRequestInProgress = true;
+            _io.post([this, lifetime = shared_from_this(), parsedData = _httpParser.ParsedData()]()
+                {
+                    (*_callback)(parsedData, *this);
+                });
+            _httpParser.Reset(); // get ready for the next message
+            return;
+        }
     }
-    catch (const std::exception&)
+
+    // read more data or next message
+    _Read();
+}
+
+void HttpListenerConnection::_ContinueReceiving()
+{
+    if (_fDetached)
     {
-        Reply(400);
+        DoLogDebug("Socket handed over, stop receiving");
         return;
     }
 
-    if (_httpParser.Done())
+    if (!_fKeepAlive)
     {
-        _io.post([this, lifetime = shared_from_this(), parsedData = _httpParser.ParsedData(), &callback]()
-            {
-                callback(parsedData, *this);
-            });
-        _httpParser.Reset(); // get ready for the next message
+        DoLogDebug("Connection: close from remote endpoint, stop receiving");
+        return;
     }
 
-    // read more data or next message
-    Receive(callback);
+    _ParseReceived();
 }
@@ -3,35 +3,71 @@
 
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include "do_http_parser.h"
 
 class HttpListenerConnection;
 using http_listener_callback_t = std::function<void(const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>&,
     HttpListenerConnection&)>;
 
+// A connection over TCP or a unix domain socket, see RestHttpListener.
+// Pipelined requests are handed to the callback one at a time, the next one once the reply to the previous one
+// is sent. Replies go out in order and a request that takes over the socket finds nothing else writing to it.
+// Runs on the io_service's thread, as does the callback. The callback need not reply before returning: Reply
+// can be called later from any thread, and the connection waits for it before handing over the next request.
 class HttpListenerConnection : public std::enable_shared_from_this<HttpListenerConnection>
 {
 public:
-    HttpListenerConnection(boost::asio::io_service& ioService, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+    using socket_t = boost::asio::generic::stream_protocol::socket;
+
+    HttpListenerConnection(boost::asio::io_service& ioService, std::shared_ptr<socket_t> socket);
     ~HttpListenerConnection();
 
     static std::shared_ptr<HttpListenerConnection> Make(boost::asio::io_service& ioService,
-        std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+        std::shared_ptr<socket_t> socket);
 
     void Receive(http_listener_callback_t& callback);
+    // Ends the request in progress, see above. Safe to call from any thread, the reply is queued on the io thread.
     void Reply(unsigned int statusCode);
     void Reply(unsigned int statusCode, const std::string& body);
 
-    boost::asio::ip::tcp::endpoint RemoteEndpoint() const;
+    // Whether the peer is on this machine and allowed in: connected over loopback, or over the unix domain socket
+    // as root, the agent's user or a member of the agent's group, going by the credentials the kernel reports for it.
+    // Determined once, when the connection is made.
+    bool IsLocalPeer() const noexcept { return _fLocalPeer; }
+
+    // Hands the connection over to a new owner, like a download that streams its data over it.
+    // No more requests are read or parsed from it and it is left open, the new owner closes it.
+    const std::shared_ptr<socket_t>& Socket() const { return _socket; }
+    void Detach() { _fDetached = true; }
 
 private:
-    void _OnData(const boost::system::error_code& ec, size_t cbRead, http_listener_callback_t& callback);
+    void _Read();
+    void _OnData(const boost::system::error_code& ec, size_t cbRead);
+    void _ParseReceived();
+    void _ContinueReceiving();
+    void _WriteNextReply();
+    bool _CheckLocalPeer() const;
 
-    std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
+    std::shared_ptr<socket_t> _socket;
     boost::asio::io_service& _io;
+    http_listener_callback_t* _callback { nullptr };
 
+    // Received data that is not parsed yet starts at _recvOffset
     std::vector<char> _recvBuf;
+    size_t _recvOffset { 0 };
+    size_t _cbReceived { 0 };
     microsoft::deliveryoptimization::details::HttpParser _httpParser;
+    bool _fRequestInProgress { false };
+    bool _fKeepAlive { true };
+
+    // Front is being written, the rest waits for it
+    std::deque<std::string> _replies;
+
+    std::atomic<bool> _fDetached { false };
+    bool _fLocalPeer { false };
 };
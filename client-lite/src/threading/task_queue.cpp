@@ -10,7 +10,7 @@ void TaskQueue::_Add(std::unique_ptr<Task>&& spTask, const duration_t& delay)
 
     auto opTime = clock_t::now() + adjustedDelay;
 
-    _ops.emplace(opTime, std::move(spTask));
+    _Insert(std::move(spTask), opTime);
 }
 
 void TaskQueue::_AddFront(std::unique_ptr<Task>&& spTask)
@@ -27,7 +27,7 @@ void TaskQueue::_AddFront(std::unique_ptr<Task>&& spTask)
         opTime = earliest - duration_t(1);
     }
 
-    _ops.emplace(opTime, std::move(spTask));
+    _Insert(std::move(spTask), opTime);
 }
 
 std::unique_ptr<TaskQueue::Task> TaskQueue::popNextReady(_Out_opt_ const void** tagp)
@@ -38,15 +38,13 @@ std::unique_ptr<TaskQueue::Task> TaskQueue::popNextReady(_Out_opt_ const void**
     }
 
     std::unique_ptr<Task> rval;
-    OpsMap::iterator it = _ops.begin();
-    if ((it != _ops.end()) && (it->first <= clock_t::now()))
+    if (!_heap.empty() && (_heap.front()->time <= clock_t::now()))
     {
-        rval = std::move(it->second);
+        rval = _RemoveAt(0);
         if (tagp)
         {
             *tagp = rval->Tag();
         }
-        _ops.erase(it);
     }
     return rval;
 }
@@ -55,41 +53,150 @@ void TaskQueue::Remove(_In_opt_ const void* tag)
 {
     if (tag != nullptr)
     {
-        // This is why we want boost::multi_index_container
-        OpsMap::iterator it = _ops.begin();
-        while (it != _ops.end())
+        auto it = _entriesByTag.find(tag);
+        if (it != _entriesByTag.end())
         {
-            if (it->second->Tag() == tag)
+            // _RemoveAt erases the tag's entry once its last op is gone
+            auto& entries = it->second;
+            while (entries.size() > 1)
             {
-                it = _ops.erase(it);
-            }
-            else
-            {
-                ++it;
+                (void)_RemoveAt(entries.back()->heapIndex);
             }
+            (void)_RemoveAt(entries.back()->heapIndex);
         }
     }
 }
 
 bool TaskQueue::Exists(_In_opt_ const void* tag) const
 {
-    bool result = false;
-    if (tag != nullptr)
+    return (tag != nullptr) && (_entriesByTag.find(tag) != _entriesByTag.end());
+}
+
+TaskQueue::timepoint_t TaskQueue::NextTime() const
+{
+    return !_heap.empty() ? _heap.front()->time : timepoint_t::max();
+}
+
+void TaskQueue::_Insert(std::unique_ptr<Task>&& spTask, timepoint_t opTime)
+{
+    auto entry = std::make_unique<Entry>();
+    entry->time = opTime;
+    entry->sequence = _nextSequence++;
+    entry->tag = spTask->Tag();
+    entry->task = std::move(spTask);
+    entry->heapIndex = _heap.size();
+
+    // Failing to grow either container must leave the queue unchanged. The heap is reserved first,
+    // the push_back into it can't fail then.
+    _heap.reserve(_heap.size() + 1);
+    if (entry->tag != nullptr)
     {
-        for (const auto& entry : _ops)
+        auto it = _entriesByTag.emplace(entry->tag, std::vector<Entry*>{}).first;
+        auto& entries = it->second;
+        try
+        {
+            entries.push_back(entry.get());
+        }
+        catch (...)
         {
-            if (entry.second->Tag() == tag)
+            // An empty tag vector would make Exists report the tag and Remove fail
+            if (entries.empty())
             {
-                result = true;
-                break;
+                _entriesByTag.erase(it);
             }
+            throw;
         }
+        entry->tagIndex = entries.size() - 1;
     }
-    return result;
+
+    _heap.push_back(std::move(entry));
+    _SiftUp(_heap.size() - 1);
 }
 
-TaskQueue::timepoint_t TaskQueue::NextTime() const
+std::unique_ptr<TaskQueue::Task> TaskQueue::_RemoveAt(size_t heapIndex)
 {
-    OpsMap::const_iterator it = _ops.begin();
-    return (it != _ops.end()) ? it->first : timepoint_t::max();
-}
\ No newline at end of file
+    DO_ASSERT(heapIndex < _heap.size());
+    std::unique_ptr<Entry> entry = std::move(_heap[heapIndex]);
+
+    if (entry->tag != nullptr)
+    {
+        auto it = _entriesByTag.find(entry->tag);
+        DO_ASSERT(it != _entriesByTag.end());
+        auto& entries = it->second;
+        entries[entry->tagIndex] = entries.back();
+        entries[entry->tagIndex]->tagIndex = entry->tagIndex;
+        entries.pop_back();
+        if (entries.empty())
+        {
+            _entriesByTag.erase(it);
+        }
+    }
+
+    // Fill the hole with the last entry and restore the heap order around it
+    const size_t lastIndex = _heap.size() - 1;
+    if (heapIndex != lastIndex)
+    {
+        _heap[heapIndex] = std::move(_heap[lastIndex]);
+        _heap[heapIndex]->heapIndex = heapIndex;
+        _heap.pop_back();
+        _SiftUp(heapIndex);
+        _SiftDown(heapIndex);
+    }
+    else
+    {
+        _heap.pop_back();
+    }
+    return std::move(entry->task);
+}
+
+bool TaskQueue::_IsBefore(size_t lhs, size_t rhs) const noexcept
+{
+    const Entry& l = *_heap[lhs];
+    const Entry& r = *_heap[rhs];
+    return (l.time < r.time) || ((l.time == r.time) && (l.sequence < r.sequence));
+}
+
+void TaskQueue::_Swap(size_t lhs, size_t rhs) noexcept
+{
+    std::swap(_heap[lhs], _heap[rhs]);
+    _heap[lhs]->heapIndex = lhs;
+    _heap[rhs]->heapIndex = rhs;
+}
+
+void TaskQueue::_SiftUp(size_t heapIndex) noexcept
+{
+    while (heapIndex > 0)
+    {
+        const size_t parent = (heapIndex - 1) / 2;
+        if (!_IsBefore(heapIndex, parent))
+        {
+            break;
+        }
+        _Swap(heapIndex, parent);
+        heapIndex = parent;
+    }
+}
+
+void TaskQueue::_SiftDown(size_t heapIndex) noexcept
+{
+    while (true)
+    {
+        const size_t left = (2 * heapIndex) + 1;
+        const size_t right = left + 1;
+        size_t smallest = heapIndex;
+        if ((left < _heap.size()) && _IsBefore(left, smallest))
+        {
+            smallest = left;
+        }
+        if ((right < _heap.size()) && _IsBefore(right, smallest))
+        {
+            smallest = right;
+        }
+        if (smallest == heapIndex)
+        {
+            break;
+        }
+        _Swap(heapIndex, smallest);
+        heapIndex = smallest;
+    }
+}
@@ -4,9 +4,13 @@
 #pragma once
 
 #include <chrono>
-#include <map>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
+// Timer queue ordered by due time, ops due at the same time run in the order they were added.
+// Ops are kept in a binary min-heap with each op tracking its own position in the heap, along
+// with an index from tag to ops. Add, Remove(tag) and popNextReady are O(log n) per op, Exists is O(1).
 // Note: Locking is left to the queue's owner
 class TaskQueue
 {
@@ -51,11 +55,29 @@ private:
         const void* _tag;
     };
 
+    struct Entry
+    {
+        timepoint_t time;
+        UINT64 sequence;
+        std::unique_ptr<Task> task;
+        const void* tag;
+        size_t heapIndex;
+        size_t tagIndex;    // position within _entriesByTag[tag]
+    };
+
     void _Add(std::unique_ptr<Task>&& spTask, const duration_t& delay);
     void _AddFront(std::unique_ptr<Task>&& spTask);
+    void _Insert(std::unique_ptr<Task>&& spTask, timepoint_t opTime);
+    std::unique_ptr<Task> _RemoveAt(size_t heapIndex);
+
+    bool _IsBefore(size_t lhs, size_t rhs) const noexcept;
+    void _Swap(size_t lhs, size_t rhs) noexcept;
+    void _SiftUp(size_t heapIndex) noexcept;
+    void _SiftDown(size_t heapIndex) noexcept;
 
-    typedef std::multimap<timepoint_t, std::unique_ptr<Task>> OpsMap;
-    OpsMap _ops;
+    std::vector<std::unique_ptr<Entry>> _heap;
+    std::unordered_map<const void*, std::vector<Entry*>> _entriesByTag;
+    UINT64 _nextSequence { 0 };
 
 public:
     // Note: If tag == nullptr, the op can't be removed. remove(nullptr) is a no-op.
@@ -14,11 +14,27 @@ TaskThread::TaskThread()
 
 TaskThread::~TaskThread()
 {
-    SchedImmediate([this]()
+    Stop();
+}
+
+void TaskThread::Stop()
+{
+    DO_ASSERT(!IsCurrentThread());
+    if (_thread.joinable())
     {
-        _fRunning = false;
-    });
-    _thread.join();
+        SchedImmediate([this]()
+        {
+            _fRunning = false;
+        });
+        _thread.join();
+    }
+
+    // Destroyed outside the lock, a task's captures may unschedule other tasks when they go away
+    TaskQueue discardedTasks;
+    {
+        std::unique_lock<std::mutex> lock(_taskQMutex);
+        std::swap(discardedTasks, _taskQ);
+    }
 }
 
 void TaskThread::Unschedule(_In_opt_ const void* tag)
@@ -16,6 +16,10 @@ public:
     TaskThread();
     ~TaskThread();
 
+    // Lets the task in progress, if any, complete and stops the thread. The queued tasks are discarded, they get
+    // destroyed on the calling thread. Tasks scheduled after this never run and SchedBlock would not return.
+    void Stop();
+
     void Unschedule(_In_opt_ const void* tag);
 
     template <typename TLambda, typename TDuration>
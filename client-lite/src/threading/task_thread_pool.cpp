@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "task_thread_pool.h"
+
+#include <algorithm>
+#include <thread>
+#include "config_defaults.h"
+
+TaskThreadPool::TaskThreadPool(size_t numThreads)
+{
+    DO_ASSERT(numThreads != 0);
+    _threads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        _threads.push_back(std::make_unique<TaskThread>());
+    }
+}
+
+TaskThreadPool::TaskThreadPool() :
+    TaskThreadPool(std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), g_taskThreadPoolMaxThreads)))
+{
+}
+
+void TaskThreadPool::Stop()
+{
+    for (auto& thread : _threads)
+    {
+        thread->Stop();
+    }
+}
+
+TaskThread& TaskThreadPool::ThreadFor(REFGUID id) const noexcept
+{
+    return *_threads[IndexFor(id)];
+}
+
+size_t TaskThreadPool::IndexFor(REFGUID id) const noexcept
+{
+    // Ids are random, the first 32 bits alone spread them evenly
+    return id.Data1 % _threads.size();
+}
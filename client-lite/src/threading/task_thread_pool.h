@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "do_guid.h"
+#include "do_noncopyable.h"
+#include "task_thread.h"
+
+// Fixed set of task threads that downloads are spread across.
+// All work for a download is scheduled on the thread its id maps to, which keeps that work
+// ordered while work for unrelated downloads runs in parallel on the other threads.
+class TaskThreadPool : public DONonCopyable
+{
+public:
+    TaskThreadPool(size_t numThreads);
+    TaskThreadPool();
+
+    // Stops all the threads, see TaskThread::Stop
+    void Stop();
+
+    TaskThread& ThreadFor(REFGUID id) const noexcept;
+    size_t IndexFor(REFGUID id) const noexcept;
+
+    TaskThread& operator[](size_t index) const noexcept { return *_threads[index]; }
+    size_t Size() const noexcept { return _threads.size(); }
+
+private:
+    std::vector<std::unique_ptr<TaskThread>> _threads;
+};
@@ -5,12 +5,61 @@
 #include "do_curl_wrappers.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <boost/optional.hpp>
+#include "config_defaults.h"
+#include "do_cpprest_uri.h"
+
+namespace msdod = microsoft::deliveryoptimization::details;
 
 CurlRequests::CurlRequests()
 {
     _multiHandle = curl_multi_init();
     THROW_HR_IF(E_OUTOFMEMORY, _multiHandle == nullptr);
 
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd == -1)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+    }
+
+    _wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeupFd == -1)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+    }
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _wakeupFd;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeupFd, &ev) == -1)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+    }
+
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_SOCKETFUNCTION, s_SocketCallback);
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_SOCKETDATA, this);
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_TIMERFUNCTION, s_TimerCallback);
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_TIMERDATA, this);
+
+    // All requests go through this multi handle, so its connection cache is already shared by them.
+    // Bound how many connections a single host gets and how many idle ones are kept around.
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, g_curlMaxConnectionsPerHost);
+    (void)curl_multi_setopt(_multiHandle, CURLMOPT_MAXCONNECTS, g_curlMaxCachedConnections);
+
+    // TLS sessions are cached per easy handle unless shared. Sharing the DNS cache as well keeps
+    // resolved names across easy handles that are not in the multi handle at the time.
+    _shareHandle = curl_share_init();
+    THROW_HR_IF(E_OUTOFMEMORY, _shareHandle == nullptr);
+    (void)curl_share_setopt(_shareHandle, CURLSHOPT_LOCKFUNC, s_ShareLockCallback);
+    (void)curl_share_setopt(_shareHandle, CURLSHOPT_UNLOCKFUNC, s_ShareUnlockCallback);
+    (void)curl_share_setopt(_shareHandle, CURLSHOPT_USERDATA, this);
+    (void)curl_share_setopt(_shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    (void)curl_share_setopt(_shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
     _fKeepRunning = true;
     _multiPerformThread = std::thread{[this]()
         {
@@ -23,7 +72,7 @@ CurlRequests::~CurlRequests()
     {
         std::unique_lock<std::mutex> lock{_mutex};
         _fKeepRunning = false;
-        _cv.notify_one();
+        _WakeUp();
     }
     _multiPerformThread.join();
 
@@ -31,9 +80,27 @@ CurlRequests::~CurlRequests()
         _activeHandles.RemoveAll(_multiHandle);
         _handlesToAdd.clear();
         _handlesToRemove.clear();
+        _handlesToUnpause.clear();
+        for (const auto& prewarm : _prewarms)
+        {
+            ReleaseEasyHandle(prewarm->easyHandle);
+        }
+        _prewarms.clear();
     }
 
     curl_multi_cleanup(_multiHandle);
+
+    // Easy handles must be gone before the share handle can be cleaned up
+    for (auto easyHandle : _idleEasyHandles)
+    {
+        curl_easy_cleanup(easyHandle);
+    }
+    _idleEasyHandles.clear();
+    const CURLSHcode shareResult = curl_share_cleanup(_shareHandle);
+    DO_ASSERT(shareResult == CURLSHE_OK);
+
+    close(_wakeupFd);
+    close(_epollFd);
 }
 
 void CurlRequests::Add(CURL* easyHandle, completion_callback_t pCallback, void* pCallbackUserData)
@@ -43,7 +110,7 @@ void CurlRequests::Add(CURL* easyHandle, completion_callback_t pCallback, void*
     auto itAdd = std::find(std::begin(_handlesToAdd), std::end(_handlesToAdd), easyHandle);
     THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS), itAdd != _handlesToAdd.end());
     _handlesToAdd.emplace_back(HandleData{easyHandle, pCallback, pCallbackUserData});
-    _cv.notify_one();
+    _WakeUp();
 }
 
 void CurlRequests::Remove(CURL* easyHandle)
@@ -53,6 +120,7 @@ void CurlRequests::Remove(CURL* easyHandle)
         std::unique_lock<std::mutex> lock{_mutex};
 
         _handlesToAdd.erase(std::remove(std::begin(_handlesToAdd), std::end(_handlesToAdd), easyHandle), _handlesToAdd.end());
+        _handlesToUnpause.erase(std::remove(std::begin(_handlesToUnpause), std::end(_handlesToUnpause), easyHandle), _handlesToUnpause.end());
 
         auto pExistingWrappedHandle = _activeHandles.Get(easyHandle);
         if (pExistingWrappedHandle == nullptr)
@@ -66,7 +134,7 @@ void CurlRequests::Remove(CURL* easyHandle)
         {
             _handlesToRemove.emplace_back(easyHandle);
         }
-        _cv.notify_one();
+        _WakeUp();
     }
 
     if (wrappedHandleToBeDeleted)
@@ -76,111 +144,239 @@ void CurlRequests::Remove(CURL* easyHandle)
     }
 }
 
-void CurlRequests::_DoWork()
+void CurlRequests::Unpause(CURL* easyHandle)
 {
-    while (true)
+    std::unique_lock<std::mutex> lock{_mutex};
+    if (std::find(std::begin(_handlesToUnpause), std::end(_handlesToUnpause), easyHandle) == _handlesToUnpause.end())
     {
-        std::unique_lock<std::mutex> lock{_mutex};
-        if (!_fKeepRunning)
-        {
-            break;
-        }
-
-        for (const auto& h : _handlesToAdd)
-        {
-            _activeHandles.Add(h, _multiHandle);
-        }
-        _handlesToAdd.clear();
+        _handlesToUnpause.emplace_back(easyHandle);
+        _WakeUp();
+    }
+}
 
-        for (const auto& h : _handlesToRemove)
-        {
-            _activeHandles.Remove(h, _multiHandle);
-        }
-        _handlesToRemove.clear();
+void CurlRequests::UnpauseAfter(CURL* easyHandle, std::chrono::milliseconds delay)
+{
+    // Called on the transfer thread, which is the only one accessing _delayedUnpauses
+    _CancelDelayedUnpause(easyHandle);
+    _delayedUnpauses.push_back({ easyHandle, std::chrono::steady_clock::now() + delay });
+}
 
-        if (_activeHandles.Empty())
+void CurlRequests::Prewarm(const std::string& url, std::function<void(int)> onComplete)
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+    THROW_HR_IF(E_NOT_VALID_STATE, !_fKeepRunning);
+    auto it = std::find_if(_prewarms.begin(), _prewarms.end(), [&url](const auto& prewarm)
         {
-            _cv.wait(lock, [this](){ return !_fKeepRunning || !_handlesToAdd.empty(); });
-        }
-        else
+            return prewarm->url == url;
+        });
+    if (it != _prewarms.end())
+    {
+        if (onComplete)
         {
-            lock.unlock();
-            _PerformTransferTasks();
+            (*it)->onComplete.push_back(std::move(onComplete));
         }
+        return;
+    }
+
+    auto prewarm = std::make_unique<PrewarmRequest>(PrewarmRequest{ this, nullptr, url, false, {} });
+    if (onComplete)
+    {
+        prewarm->onComplete.push_back(std::move(onComplete));
     }
+    prewarm->easyHandle = AcquireEasyHandle();
+    CURL* easyHandle = prewarm->easyHandle;
+    _prewarms.push_back(std::move(prewarm));
+
+    const auto host = msdod::cpprest_web::uri(url).host();
+    const auto connectTimeout = _hostEstimates.ConnectTimeout(host, g_connectionPrewarmConnectTimeout);
+    (void)curl_easy_setopt(easyHandle, CURLOPT_URL, url.c_str());
+    (void)curl_easy_setopt(easyHandle, CURLOPT_NOBODY, static_cast<long>(1));
+    (void)curl_easy_setopt(easyHandle, CURLOPT_CONNECTTIMEOUT, static_cast<long>(connectTimeout.count()));
+    (void)curl_easy_setopt(easyHandle, CURLOPT_TIMEOUT, static_cast<long>(g_connectionPrewarmTimeout.count()));
+    _handlesToAdd.emplace_back(HandleData{easyHandle, s_PrewarmCompleteCallback, _prewarms.back().get()});
+    _WakeUp();
 }
 
-// Returns when there are no more running handles OR after running for approximately 2s
-void CurlRequests::_PerformTransferTasks()
+CURL* CurlRequests::AcquireEasyHandle()
 {
-    int numRunningHandles = 0;
-    const auto startTime = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::duration elapsed {};
-    do
+    CURL* easyHandle = nullptr;
     {
-        long curlTimeoutMsecs;
-        curl_multi_timeout(_multiHandle, &curlTimeoutMsecs);
-        if (curlTimeoutMsecs < 0)
+        std::unique_lock<std::mutex> lock{_idleEasyHandlesMutex};
+        if (!_idleEasyHandles.empty())
         {
-            curlTimeoutMsecs = 1000;
+            easyHandle = _idleEasyHandles.back();
+            _idleEasyHandles.pop_back();
         }
+    }
 
-        fd_set fdsRead;
-        fd_set fdsWrite;
-        fd_set fdsException;
-        int maxfd = -1;
-        FD_ZERO(&fdsRead);
-        FD_ZERO(&fdsWrite);
-        FD_ZERO(&fdsException);
-
-        int selectResult;
-        CURLMcode mc = curl_multi_fdset(_multiHandle, &fdsRead, &fdsWrite, &fdsException, &maxfd);
-        if (maxfd == -1)
-        {
-            // no relevant handles to poll, short sleep
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            selectResult = 0;
-        }
-        else
+    if (easyHandle == nullptr)
+    {
+        easyHandle = curl_easy_init();
+        THROW_HR_IF(E_OUTOFMEMORY, easyHandle == nullptr);
+    }
+
+    (void)curl_easy_setopt(easyHandle, CURLOPT_SHARE, _shareHandle);
+#if CURL_AT_LEAST_VERSION(7,65,0)
+    (void)curl_easy_setopt(easyHandle, CURLOPT_MAXAGE_CONN, static_cast<long>(g_curlMaxIdleConnectionAge.count()));
+#endif
+    return easyHandle;
+}
+
+void CurlRequests::ReleaseEasyHandle(CURL* easyHandle) noexcept
+{
+    if (easyHandle == nullptr)
+    {
+        return;
+    }
+
+    // Caller must have removed the handle already, see Remove()
+    curl_easy_reset(easyHandle);
+    {
+        std::unique_lock<std::mutex> lock{_idleEasyHandlesMutex};
+        if (_idleEasyHandles.size() < g_curlMaxIdleEasyHandles)
         {
-            struct timeval timeout;
-            timeout.tv_sec = curlTimeoutMsecs / 1000;
-            timeout.tv_usec = (curlTimeoutMsecs % 1000) * 1000;
-            selectResult = select(maxfd + 1, &fdsRead, &fdsWrite, &fdsException, &timeout);
+            _idleEasyHandles.push_back(easyHandle);
+            return;
         }
+    }
+    curl_easy_cleanup(easyHandle);
+}
 
-        switch (selectResult)
+void CurlRequests::_DoWork()
+{
+    while (true)
+    {
         {
-            // TODO(shishirb) Should we do anything other than retry?
-            case -1:
-                DO_ASSERT(false);
+            std::unique_lock<std::mutex> lock{_mutex};
+            if (!_fKeepRunning)
+            {
                 break;
+            }
+
+            // Adding a handle triggers the timer callback with a zero timeout which kicks off the transfer
+            for (const auto& h : _handlesToAdd)
+            {
+                _CancelDelayedUnpause(h.easyHandle);
+                _activeHandles.Add(h, _multiHandle);
+            }
+            _handlesToAdd.clear();
 
-            // select() timed out or we did the short sleep above.
-            // Fallthrough and call curl_multi_perform even in this case to let
-            // libcurl perform internal retries and timeouts.
-            case 0:
+            for (const auto& h : _handlesToRemove)
+            {
+                _CancelDelayedUnpause(h);
+                _activeHandles.Remove(h, _multiHandle);
+            }
+            _handlesToRemove.clear();
+
+            // Collect the delayed unpauses that are due before unpausing anything, since the write
+            // callback can add to the list again
+            const auto now = std::chrono::steady_clock::now();
+            auto itDue = std::partition(_delayedUnpauses.begin(), _delayedUnpauses.end(), [now](const DelayedUnpause& du)
+                {
+                    return du.due > now;
+                });
+            for (auto it = itDue; it != _delayedUnpauses.end(); ++it)
+            {
+                _handlesToUnpause.push_back(it->easyHandle);
+            }
+            _delayedUnpauses.erase(itDue, _delayedUnpauses.end());
 
-            // Default case is select() indicating there are one or more sockets ready for reading/writing
-            default:
+            // Unpausing can deliver buffered data to the write callback right away,
+            // which could pause the transfer again. If the callback fails it instead, libcurl
+            // returns the error here and leaves the transfer stuck, so complete it right away.
+            for (const auto& h : _handlesToUnpause)
             {
-                mc = curl_multi_perform(_multiHandle, &numRunningHandles);
-                if (mc == CURLM_OK)
+                if (_activeHandles.Get(h) != nullptr)
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    if (numRunningHandles < static_cast<int>(_activeHandles.Size()))
+                    const CURLcode result = curl_easy_pause(h, CURLPAUSE_CONT);
+                    if (result != CURLE_OK)
                     {
-                        // One or more handles have completed, check and invoke callbacks
-                        _CheckForAndHandleCompletedRequestsUnderLock();
+                        _activeHandles.Complete(h, result, _multiHandle);
                     }
                 }
             }
+            _handlesToUnpause.clear();
+
+            _ReleaseCompletedPrewarmsUnderLock();
         }
 
-        // Return from here periodically to check for exit and handles to be removed
-        elapsed = std::chrono::steady_clock::now() - startTime;
+        _PerformTransferTasks();
+    }
+}
 
-    } while ((numRunningHandles > 0) && (elapsed < std::chrono::seconds(2)));
+// Waits for socket activity, timer expiry or a wakeup and lets libcurl act on it.
+// Returns after one round so that _DoWork can check for exit and handles to add/remove.
+void CurlRequests::_PerformTransferTasks()
+{
+    // Without a timer from libcurl or a delayed unpause, sleep until there is socket activity or a wakeup
+    boost::optional<std::chrono::steady_clock::time_point> wakeupDue;
+    if (_fTimerSet)
+    {
+        wakeupDue = _timerDue;
+    }
+    for (const auto& du : _delayedUnpauses)
+    {
+        if (!wakeupDue || (du.due < *wakeupDue))
+        {
+            wakeupDue = du.due;
+        }
+    }
+
+    int waitTimeoutMsecs = -1;
+    if (wakeupDue)
+    {
+        const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*wakeupDue - std::chrono::steady_clock::now());
+        waitTimeoutMsecs = static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+    }
+
+    constexpr int maxEvents = 64;
+    struct epoll_event events[maxEvents];
+    const int numEvents = epoll_wait(_epollFd, events, maxEvents, waitTimeoutMsecs);
+    if (numEvents == -1)
+    {
+        // EINTR is expected due to signals, anything else is unexpected
+        DO_ASSERT(errno == EINTR);
+        return;
+    }
+
+    for (int i = 0; i < numEvents; ++i)
+    {
+        if (events[i].data.fd == _wakeupFd)
+        {
+            uint64_t count;
+            (void)read(_wakeupFd, &count, sizeof(count));
+            continue;
+        }
+
+        int actionFlags = 0;
+        if (events[i].events & EPOLLIN)
+        {
+            actionFlags |= CURL_CSELECT_IN;
+        }
+        if (events[i].events & EPOLLOUT)
+        {
+            actionFlags |= CURL_CSELECT_OUT;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+        {
+            actionFlags |= CURL_CSELECT_ERR;
+        }
+        (void)curl_multi_socket_action(_multiHandle, events[i].data.fd, actionFlags, &_numRunningHandles);
+    }
+
+    // Let libcurl perform internal retries and timeouts once its timer is due
+    if (_fTimerSet && (_timerDue <= std::chrono::steady_clock::now()))
+    {
+        _fTimerSet = false;
+        (void)curl_multi_socket_action(_multiHandle, CURL_SOCKET_TIMEOUT, 0, &_numRunningHandles);
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_numRunningHandles < static_cast<int>(_activeHandles.Size()))
+    {
+        // One or more handles have completed, check and invoke callbacks
+        _CheckForAndHandleCompletedRequestsUnderLock();
+    }
 }
 
 void CurlRequests::_CheckForAndHandleCompletedRequestsUnderLock()
@@ -197,6 +393,110 @@ void CurlRequests::_CheckForAndHandleCompletedRequestsUnderLock()
     } while (msg != nullptr);
 }
 
+// Called on the transfer thread with _mutex held, while the handle is still in the multi handle
+void CurlRequests::s_PrewarmCompleteCallback(int curlResult, void* pUserData)
+{
+    auto prewarm = static_cast<PrewarmRequest*>(pUserData);
+    DoLogVerbose("Prewarmed connection for %s, result: %d", prewarm->url.data(), curlResult);
+    for (const auto& onComplete : prewarm->onComplete)
+    {
+        try
+        {
+            onComplete(curlResult);
+        } CATCH_LOG()
+    }
+    prewarm->fComplete = true;
+    prewarm->owner->_WakeUp();
+}
+
+void CurlRequests::_ReleaseCompletedPrewarmsUnderLock()
+{
+    auto itComplete = std::partition(_prewarms.begin(), _prewarms.end(), [](const auto& prewarm)
+        {
+            return !prewarm->fComplete;
+        });
+    for (auto it = itComplete; it != _prewarms.end(); ++it)
+    {
+        ReleaseEasyHandle((*it)->easyHandle);
+    }
+    _prewarms.erase(itComplete, _prewarms.end());
+}
+
+void CurlRequests::_CancelDelayedUnpause(CURL* easyHandle)
+{
+    _delayedUnpauses.erase(std::remove_if(_delayedUnpauses.begin(), _delayedUnpauses.end(), [easyHandle](const DelayedUnpause& du)
+        {
+            return du.easyHandle == easyHandle;
+        }), _delayedUnpauses.end());
+}
+
+void CurlRequests::_WakeUp()
+{
+    const uint64_t one = 1;
+    (void)write(_wakeupFd, &one, sizeof(one));
+}
+
+int CurlRequests::_OnSocketUpdate(curl_socket_t s, int what, void* socketp)
+{
+    if (what == CURL_POLL_REMOVE)
+    {
+        // Socket might already be closed, which removes it from the epoll set anyway
+        (void)epoll_ctl(_epollFd, EPOLL_CTL_DEL, s, nullptr);
+        return 0;
+    }
+
+    struct epoll_event ev {};
+    ev.data.fd = s;
+    if ((what == CURL_POLL_IN) || (what == CURL_POLL_INOUT))
+    {
+        ev.events |= EPOLLIN;
+    }
+    if ((what == CURL_POLL_OUT) || (what == CURL_POLL_INOUT))
+    {
+        ev.events |= EPOLLOUT;
+    }
+
+    // socketp is non-null once the socket has been added to the epoll set
+    const int op = (socketp != nullptr) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(_epollFd, op, s, &ev) == -1)
+    {
+        DoLogError("epoll_ctl(%d) failed for socket %d, errno: %d", op, s, errno);
+        return -1;
+    }
+
+    if (socketp == nullptr)
+    {
+        (void)curl_multi_assign(_multiHandle, s, this);
+    }
+    return 0;
+}
+
+void CurlRequests::_OnTimerUpdate(long timeoutMsecs)
+{
+    if (timeoutMsecs < 0)
+    {
+        _fTimerSet = false;
+    }
+    else
+    {
+        _fTimerSet = true;
+        _timerDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMsecs);
+    }
+}
+
+int CurlRequests::s_SocketCallback(CURL* easyHandle, curl_socket_t s, int what, void* userp, void* socketp)
+{
+    auto pThis = static_cast<CurlRequests*>(userp);
+    return pThis->_OnSocketUpdate(s, what, socketp);
+}
+
+int CurlRequests::s_TimerCallback(CURLM* multiHandle, long timeoutMsecs, void* userp)
+{
+    auto pThis = static_cast<CurlRequests*>(userp);
+    pThis->_OnTimerUpdate(timeoutMsecs);
+    return 0;
+}
+
 void CurlRequests::ActiveHandles::Add(const HandleData& inHandle, CURLM* multiHandle)
 {
     if (_Find(inHandle.easyHandle) == _handles.end())
@@ -250,3 +550,13 @@ void CurlRequests::ActiveHandles::_Remove(std::vector<std::shared_ptr<WrappedHan
     h.inactiveSignal.SetEvent();
     _handles.erase(where);
 }
+
+void CurlRequests::s_ShareLockCallback(CURL* /*easyHandle*/, curl_lock_data data, curl_lock_access /*access*/, void* userp)
+{
+    static_cast<CurlRequests*>(userp)->_shareLocks[data].lock();
+}
+
+void CurlRequests::s_ShareUnlockCallback(CURL* /*easyHandle*/, curl_lock_data data, void* userp)
+{
+    static_cast<CurlRequests*>(userp)->_shareLocks[data].unlock();
+}
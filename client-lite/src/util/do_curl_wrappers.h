@@ -4,11 +4,18 @@
 #pragma once
 
 #include <algorithm>
-#include <condition_variable>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <curl/curl.h>
 #include "do_event.h"
+#include "do_host_estimates.h"
+#include "do_token_bucket.h"
+#include "proxy_finder.h"
 
 class CurlGlobalInit
 {
@@ -30,6 +37,15 @@ public:
     CurlGlobalInit& operator=(CurlGlobalInit&&) noexcept = delete;
 };
 
+// Drives all curl transfers on a single thread. Waits on the sockets that libcurl is interested
+// in via epoll (CURLMOPT_SOCKETFUNCTION) and uses libcurl's timer (CURLMOPT_TIMERFUNCTION) as the
+// wait timeout. Add/Remove wake up the thread through an eventfd.
+// Also owns the state that all requests share: easy handles are pooled and hand out a share handle
+// for the DNS and TLS session caches, connections are pooled by the multi handle.
+// Transfers are paced by the agent-wide rate limiter, see HttpAgent's write callback.
+// Completed transfers feed the per-host estimates that requests derive their timeouts from.
+// Connections can be opened ahead of requests (Prewarm), they wait in the multi handle's connection
+// cache until a request to the same host takes them or they have been idle for too long.
 class CurlRequests
 {
 public:
@@ -41,6 +57,34 @@ public:
     void Add(CURL* easyHandle, completion_callback_t pCallback, void* pCallbackUserData);
     void Remove(CURL* easyHandle);
 
+    // Resumes a transfer paused from within its write callback. Safe to call from any thread.
+    void Unpause(CURL* easyHandle);
+
+    // Resumes a transfer paused from within its write callback once the delay has elapsed.
+    // Must be called from the write callback.
+    void UnpauseAfter(CURL* easyHandle, std::chrono::milliseconds delay);
+
+    // Bandwidth limit shared by all transfers
+    TokenBucket& RateLimiter() noexcept { return _rateLimiter; }
+
+    // Connect time and throughput measured per host
+    HostEstimateTable& HostEstimates() noexcept { return _hostEstimates; }
+    const HostEstimateTable& HostEstimates() const noexcept { return _hostEstimates; }
+
+    // Proxy lookups and how requests through each proxy went
+    ProxyCache& Proxies() noexcept { return _proxies; }
+
+    // Opens a connection to the url's host in the background with a HEAD request, unless one is already
+    // being opened. curl reuses only connections of completed transfers, hence a request instead of
+    // just connecting. Reopening within the max idle age keeps the connection warm.
+    // onComplete gets the curl result, on the transfer thread. It must not call back into CurlRequests.
+    void Prewarm(const std::string& url, std::function<void(int)> onComplete = nullptr);
+
+    // Easy handles come from a pool and are set up to use the shared caches.
+    // Released handles are reset to default options before going back into the pool.
+    CURL* AcquireEasyHandle();
+    void ReleaseEasyHandle(CURL* easyHandle) noexcept;
+
 private:
     struct HandleData
     {
@@ -85,18 +129,67 @@ private:
         auto Size() const noexcept { return _handles.size(); }
     };
 
+    // A prewarm request, freed on the transfer thread once complete
+    struct PrewarmRequest
+    {
+        CurlRequests* owner;
+        CURL* easyHandle;
+        std::string url;
+        bool fComplete;
+        std::vector<std::function<void(int)>> onComplete;
+    };
+
+    static void s_PrewarmCompleteCallback(int curlResult, void* pUserData);
+    void _ReleaseCompletedPrewarmsUnderLock();
+
     void _DoWork();
     void _PerformTransferTasks();
     void _CheckForAndHandleCompletedRequestsUnderLock();
+    void _CancelDelayedUnpause(CURL* easyHandle);
+    void _WakeUp();
+
+    int _OnSocketUpdate(curl_socket_t s, int what, void* socketp);
+    void _OnTimerUpdate(long timeoutMsecs);
+
+    static int s_SocketCallback(CURL* easyHandle, curl_socket_t s, int what, void* userp, void* socketp);
+    static int s_TimerCallback(CURLM* multiHandle, long timeoutMsecs, void* userp);
+
+    static void s_ShareLockCallback(CURL* easyHandle, curl_lock_data data, curl_lock_access access, void* userp);
+    static void s_ShareUnlockCallback(CURL* easyHandle, curl_lock_data data, void* userp);
 
     CURLM* _multiHandle { nullptr };
+    CURLSH* _shareHandle { nullptr };
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> _shareLocks;
+    int _epollFd { -1 };
+    int _wakeupFd { -1 };
+
+    // Accessed only on the transfer thread, through the curl_multi_socket_action callbacks
+    bool _fTimerSet { false };
+    std::chrono::steady_clock::time_point _timerDue;
+    int _numRunningHandles { 0 };
+
+    // Paused by the rate limiters, also accessed only on the transfer thread
+    struct DelayedUnpause
+    {
+        CURL* easyHandle;
+        std::chrono::steady_clock::time_point due;
+    };
+    std::vector<DelayedUnpause> _delayedUnpauses;
 
     std::vector<HandleData> _handlesToAdd;
     std::vector<CURL*> _handlesToRemove;
+    std::vector<CURL*> _handlesToUnpause;
+    std::vector<std::unique_ptr<PrewarmRequest>> _prewarms;
     ActiveHandles _activeHandles;
 
     std::thread _multiPerformThread;
     std::mutex _mutex;
-    std::condition_variable _cv;
     bool _fKeepRunning { false };
+
+    std::vector<CURL*> _idleEasyHandles;
+    std::mutex _idleEasyHandlesMutex;
+
+    TokenBucket _rateLimiter;
+    HostEstimateTable _hostEstimates;
+    ProxyCache _proxies;
 };
@@ -6,7 +6,10 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <cerrno>
+#include <vector>
 
 DOFile::DOFile(int fd) :
     _fd(fd)
@@ -16,7 +19,7 @@ DOFile::DOFile(int fd) :
 
 DOFile DOFile::Create(const std::string& path)
 {
-    int fd = open(path.data(), O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    int fd = open(path.data(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
     const HRESULT hr = (fd != -1) ? S_OK : HRESULT_FROM_XPLAT_SYSERR(errno);
     DoLogInfoHr(hr, "Create file %s", path.data());
     THROW_IF_FAILED(hr);
@@ -25,7 +28,8 @@ DOFile DOFile::Create(const std::string& path)
 
 DOFile DOFile::Open(const std::string& path)
 {
-    int fd = open(path.data(), O_APPEND | O_WRONLY);
+    // Not opened with O_APPEND because writes are positional, see Write()
+    int fd = open(path.data(), O_RDWR);
     const HRESULT hr = (fd != -1) ? S_OK : HRESULT_FROM_XPLAT_SYSERR(errno);
     DoLogInfoHr(hr, "Open file %s", path.data());
     THROW_IF_FAILED(hr);
@@ -46,9 +50,9 @@ void DOFile::Delete(const std::string& path)
     DoLogInfoHr(hr, "Delete file %s", path.data());
 }
 
-void DOFile::Append(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) const
+void DOFile::Write(UINT64 offset, _In_reads_bytes_(cbData) const BYTE* pData, UINT cbData) const
 {
-    const ssize_t cbWritten = write(_fd, pData, cbData);
+    const ssize_t cbWritten = pwrite(_fd, pData, cbData, static_cast<off_t>(offset));
     if (cbWritten == -1)
     {
         THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
@@ -56,6 +60,77 @@ void DOFile::Append(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) const
     THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_LENGTH), cbWritten != static_cast<ssize_t>(cbData));
 }
 
+void DOFile::Write(UINT64 offset, _In_reads_(numBuffers) const struct iovec* buffers, int numBuffers) const
+{
+    // pwritev can write less than requested, continue from where it left off
+    std::vector<struct iovec> remaining(buffers, buffers + numBuffers);
+    size_t iFirst = 0;
+    while (iFirst < remaining.size())
+    {
+        const ssize_t cbWritten = pwritev(_fd, remaining.data() + iFirst, static_cast<int>(remaining.size() - iFirst),
+            static_cast<off_t>(offset));
+        if (cbWritten == -1)
+        {
+            THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+        }
+        THROW_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_LENGTH), cbWritten == 0);
+
+        offset += static_cast<UINT64>(cbWritten);
+        size_t cbLeft = static_cast<size_t>(cbWritten);
+        while ((iFirst < remaining.size()) && (cbLeft >= remaining[iFirst].iov_len))
+        {
+            cbLeft -= remaining[iFirst].iov_len;
+            ++iFirst;
+        }
+        if (cbLeft != 0)
+        {
+            remaining[iFirst].iov_base = static_cast<BYTE*>(remaining[iFirst].iov_base) + cbLeft;
+            remaining[iFirst].iov_len -= cbLeft;
+        }
+    }
+}
+
+size_t DOFile::Read(UINT64 offset, _Out_writes_bytes_(cbData) BYTE* pData, size_t cbData) const
+{
+    size_t cbRead = 0;
+    while (cbRead < cbData)
+    {
+        const ssize_t cb = pread(_fd, pData + cbRead, cbData - cbRead, static_cast<off_t>(offset + cbRead));
+        if (cb == -1)
+        {
+            THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+        }
+        if (cb == 0)
+        {
+            break;
+        }
+        cbRead += static_cast<size_t>(cb);
+    }
+    return cbRead;
+}
+
+void DOFile::Preallocate(UINT64 cbSize) const
+{
+    if (fallocate(_fd, 0, 0, static_cast<off_t>(cbSize)) == -1)
+    {
+        const auto err = errno;
+        if ((err == EOPNOTSUPP) || (err == ENOSYS))
+        {
+            DoLogInfo("Preallocation not supported, size: %llu", cbSize);
+            return;
+        }
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(err));
+    }
+}
+
+void DOFile::Truncate(UINT64 cbSize) const
+{
+    if (ftruncate(_fd, static_cast<off_t>(cbSize)) == -1)
+    {
+        THROW_HR(HRESULT_FROM_XPLAT_SYSERR(errno));
+    }
+}
+
 void DOFile::Close()
 {
     if (_fd != -1)
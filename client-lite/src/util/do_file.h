@@ -5,7 +5,9 @@
 
 #include "do_noncopyable.h"
 
-// Write-only, binary file wrapper.
+struct iovec;
+
+// Binary file wrapper. Files are written by the download and read back only to verify what is already in them.
 // Uses POSIX APIs to provide better error codes than std::fstream/boost::fstream.
 class DOFile : DONonCopyable
 {
@@ -34,7 +36,22 @@ public:
     static DOFile Open(const std::string& path);
     static void Delete(const std::string& path);
 
-    void Append(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) const;
+    // Writes at the given offset without moving the file pointer. Safe to call concurrently
+    // for non-overlapping regions of the file.
+    void Write(UINT64 offset, _In_reads_bytes_(cbData) const BYTE* pData, UINT cbData) const;
+
+    // Gathers the buffers into a single positional write, the buffers land back to back starting at offset
+    void Write(UINT64 offset, _In_reads_(numBuffers) const struct iovec* buffers, int numBuffers) const;
+
+    // Reads at the given offset without moving the file pointer. Returns the number of bytes read,
+    // less than requested only at the end of the file.
+    size_t Read(UINT64 offset, _Out_writes_bytes_(cbData) BYTE* pData, size_t cbData) const;
+
+    // Allocates disk space for the file up to cbSize bytes, extending the file size if needed.
+    // Fails with the ENOSPC error if the space is not available. No-op on file systems without support for it.
+    void Preallocate(UINT64 cbSize) const;
+
+    void Truncate(UINT64 cbSize) const;
     void Close();
 
     operator bool() const noexcept { return IsValid(); }
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "do_host_estimates.h"
+
+#include <algorithm>
+#include <cmath>
+#include "config_defaults.h"
+
+template <typename TDuration>
+static TDuration DurationCeil(double secs)
+{
+    const double count = std::ceil(secs * TDuration::period::den / TDuration::period::num);
+    return TDuration(static_cast<typename TDuration::rep>(count));
+}
+
+void HostEstimateTable::OnConnected(const std::string& host, std::chrono::duration<double> connectTime)
+{
+    const double sampleSecs = connectTime.count();
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& estimate = _GetOrAddUnderLock(host);
+    if (estimate.connectSamples == 0)
+    {
+        estimate.srttSecs = sampleSecs;
+        estimate.rttvarSecs = sampleSecs / 2;
+    }
+    else
+    {
+        estimate.rttvarSecs = (0.75 * estimate.rttvarSecs) + (0.25 * std::abs(estimate.srttSecs - sampleSecs));
+        estimate.srttSecs = (0.875 * estimate.srttSecs) + (0.125 * sampleSecs);
+    }
+    ++estimate.connectSamples;
+    estimate.connectTimeouts = 0;
+}
+
+void HostEstimateTable::OnConnectTimedOut(const std::string& host)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& estimate = _GetOrAddUnderLock(host);
+    estimate.connectTimeouts = std::min(estimate.connectTimeouts + 1, g_connectTimeoutMaxBackoffs);
+}
+
+void HostEstimateTable::OnTransfer(const std::string& host, UINT64 cbTransferred, std::chrono::duration<double> transferTime)
+{
+    if ((cbTransferred < g_hostEstimatesMinThroughputSampleBytes) || (transferTime.count() <= 0))
+    {
+        return;
+    }
+
+    const double sampleBytesPerSecond = static_cast<double>(cbTransferred) / transferTime.count();
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& estimate = _GetOrAddUnderLock(host);
+    if (estimate.throughputSamples == 0)
+    {
+        estimate.bytesPerSecond = sampleBytesPerSecond;
+    }
+    else
+    {
+        estimate.bytesPerSecond = (0.75 * estimate.bytesPerSecond) + (0.25 * sampleBytesPerSecond);
+    }
+    ++estimate.throughputSamples;
+}
+
+// Leaves room for a lost SYN (retransmitted after 1s) and a few RTOs on top, backed off after connect timeouts
+std::chrono::seconds HostEstimateTable::ConnectTimeout(const std::string& host, std::chrono::seconds defaultTimeout) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const Estimate* estimate = _FindUnderLock(host);
+    if (estimate == nullptr)
+    {
+        return defaultTimeout;
+    }
+
+    auto timeout = defaultTimeout;
+    if (estimate->connectSamples != 0)
+    {
+        timeout = std::clamp(DurationCeil<std::chrono::seconds>(1 + (4 * estimate->RtoSecs())),
+            std::chrono::seconds(g_connectTimeoutMin), std::chrono::seconds(g_connectTimeoutMax));
+    }
+    for (UINT i = 0; (i < estimate->connectTimeouts) && (timeout < g_connectTimeoutMax); ++i)
+    {
+        timeout *= 2;
+    }
+    return std::min(timeout, std::chrono::seconds(g_connectTimeoutMax));
+}
+
+HostEstimateTable::StallThreshold HostEstimateTable::StallThresholdFor(const std::string& host) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _StallThreshold(_FindUnderLock(host));
+}
+
+std::chrono::milliseconds HostEstimateTable::RetryDelay(const std::string& host) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _RetryDelay(_FindUnderLock(host));
+}
+
+std::chrono::milliseconds HostEstimateTable::ExpectedFetchTime(const std::string& host, UINT64 cbFetch) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const Estimate* estimate = _FindUnderLock(host);
+    if ((estimate == nullptr) || (estimate->connectSamples == 0) || (estimate->throughputSamples == 0))
+    {
+        return std::chrono::milliseconds(0);
+    }
+    return DurationCeil<std::chrono::milliseconds>(estimate->srttSecs + (static_cast<double>(cbFetch) / estimate->bytesPerSecond));
+}
+
+std::vector<HostEstimateTable::HostInfo> HostEstimateTable::Snapshot() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<HostInfo> hosts;
+    hosts.reserve(_estimates.size());
+    for (const auto& item : _estimates)
+    {
+        const Estimate& estimate = item.second;
+        hosts.push_back({ item.first,
+            DurationCeil<std::chrono::milliseconds>(estimate.srttSecs),
+            DurationCeil<std::chrono::milliseconds>(estimate.rttvarSecs),
+            estimate.connectSamples,
+            estimate.connectTimeouts,
+            static_cast<UINT64>(estimate.bytesPerSecond),
+            estimate.throughputSamples,
+            _StallThreshold(&estimate),
+            _RetryDelay(&estimate) });
+    }
+    return hosts;
+}
+
+HostEstimateTable::Estimate& HostEstimateTable::_GetOrAddUnderLock(const std::string& host)
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto it = _estimates.find(host);
+    if (it == _estimates.end())
+    {
+        if (_estimates.size() >= g_hostEstimatesMaxHosts)
+        {
+            // Make room by dropping the host that was measured least recently
+            auto oldest = std::min_element(_estimates.begin(), _estimates.end(), [](const auto& a, const auto& b)
+                {
+                    return a.second.lastUpdate < b.second.lastUpdate;
+                });
+            _estimates.erase(oldest);
+        }
+        it = _estimates.emplace(host, Estimate{}).first;
+    }
+    it->second.lastUpdate = now;
+    return it->second;
+}
+
+const HostEstimateTable::Estimate* HostEstimateTable::_FindUnderLock(const std::string& host) const
+{
+    auto it = _estimates.find(host);
+    return (it != _estimates.end()) ? &it->second : nullptr;
+}
+
+// The speed limit follows the measured throughput, the time to wait it out follows the connect time
+HostEstimateTable::StallThreshold HostEstimateTable::_StallThreshold(const Estimate* estimate)
+{
+    StallThreshold threshold { g_stallSpeedLimitDefault, g_stallTimeDefault };
+    if ((estimate != nullptr) && (estimate->throughputSamples != 0))
+    {
+        const auto limit = static_cast<UINT64>(estimate->bytesPerSecond) / g_stallSpeedLimitDivisor;
+        threshold.bytesPerSecond = std::clamp(limit, g_stallSpeedLimitMin, g_stallSpeedLimitMax);
+    }
+    if ((estimate != nullptr) && (estimate->connectSamples != 0))
+    {
+        threshold.time = std::clamp(DurationCeil<std::chrono::seconds>(8 * estimate->RtoSecs()),
+            std::chrono::seconds(g_stallTimeMin), std::chrono::seconds(g_stallTimeDefault));
+    }
+    return threshold;
+}
+
+std::chrono::milliseconds HostEstimateTable::_RetryDelay(const Estimate* estimate)
+{
+    if ((estimate == nullptr) || (estimate->connectSamples == 0))
+    {
+        return g_retryDelayDefault;
+    }
+    return std::clamp(DurationCeil<std::chrono::milliseconds>(2 * estimate->RtoSecs()),
+        std::chrono::milliseconds(g_retryDelayMin), std::chrono::milliseconds(g_retryDelayMax));
+}
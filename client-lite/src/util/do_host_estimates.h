@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "do_noncopyable.h"
+
+// Connect time and throughput estimates per host, thread-safe.
+// Completed requests feed their measurements in, smoothed with an EWMA (the same way TCP estimates RTT,
+// RFC 6298), and requests to the host derive their connect timeout, stall threshold and retry delay from them.
+// Hosts without measurements get the defaults. Only the most recently measured hosts are kept.
+class HostEstimateTable : DONonCopyable
+{
+public:
+    // A request is considered stalled when it transfers slower than bytesPerSecond for this long
+    struct StallThreshold
+    {
+        UINT64 bytesPerSecond;
+        std::chrono::seconds time;
+    };
+
+    struct HostInfo
+    {
+        std::string host;
+        std::chrono::milliseconds smoothedConnectTime;
+        std::chrono::milliseconds connectTimeVariation;
+        UINT connectSamples;
+        UINT connectTimeouts;
+        UINT64 bytesPerSecond;
+        UINT throughputSamples;
+        StallThreshold stallThreshold;
+        std::chrono::milliseconds retryDelay;
+    };
+
+    void OnConnected(const std::string& host, std::chrono::duration<double> connectTime);
+    void OnConnectTimedOut(const std::string& host);
+    void OnTransfer(const std::string& host, UINT64 cbTransferred, std::chrono::duration<double> transferTime);
+
+    std::chrono::seconds ConnectTimeout(const std::string& host, std::chrono::seconds defaultTimeout) const;
+    StallThreshold StallThresholdFor(const std::string& host) const;
+    std::chrono::milliseconds RetryDelay(const std::string& host) const;
+
+    // Time to connect and then transfer cbFetch bytes going by the estimates, zero for hosts not measured yet
+    std::chrono::milliseconds ExpectedFetchTime(const std::string& host, UINT64 cbFetch) const;
+
+    std::vector<HostInfo> Snapshot() const;
+
+private:
+    struct Estimate
+    {
+        double srttSecs { 0 };
+        double rttvarSecs { 0 };
+        UINT connectSamples { 0 };
+        UINT connectTimeouts { 0 };     // since the last successful connect
+        double bytesPerSecond { 0 };
+        UINT throughputSamples { 0 };
+        std::chrono::steady_clock::time_point lastUpdate;
+
+        // Same as TCP's retransmission timeout, srtt + 4 * rttvar
+        double RtoSecs() const { return srttSecs + (4 * rttvarSecs); }
+    };
+
+    Estimate& _GetOrAddUnderLock(const std::string& host);
+    const Estimate* _FindUnderLock(const std::string& host) const;
+    static StallThreshold _StallThreshold(const Estimate* estimate);
+    static std::chrono::milliseconds _RetryDelay(const Estimate* estimate);
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, Estimate> _estimates;
+};
@@ -43,6 +43,20 @@ const std::string& GetRuntimeDirectory()
     return runDirectory;
 }
 
+// Clients connect here instead of looking up the port in the runtime directory
+const std::string& GetRestSocketPath()
+{
+    static std::string socketPath(ConstructPath(DO_RUN_DIRECTORY_PATH "/restapi.sock"));
+    return socketPath;
+}
+
+// Survives reboots, unlike the runtime directory
+const std::string& GetPersistenceDirectory()
+{
+    static std::string persistenceDirectory(ConstructPath(DO_PERSISTENCE_DIRECTORY_PATH));
+    return persistenceDirectory;
+}
+
 const std::string& GetConfigDirectory()
 {
     static std::string configDirectory(ConstructPath(DO_CONFIG_DIRECTORY_PATH));
@@ -7,6 +7,8 @@ namespace docli
 {
 const std::string& GetLogDirectory();
 const std::string& GetRuntimeDirectory();
+const std::string& GetRestSocketPath();
+const std::string& GetPersistenceDirectory();
 const std::string& GetConfigDirectory();
 const std::string& GetSDKConfigFilePath();
 const std::string& GetAdminConfigFilePath();
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "do_token_bucket.h"
+
+#include <algorithm>
+#include <cmath>
+#include "config_defaults.h"
+
+void TokenBucket::SetRate(UINT64 bytesPerSecond)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (bytesPerSecond == _rate)
+    {
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (_rate != 0)
+    {
+        // Settle the tokens accumulated at the old rate
+        _RefillUnderLock(now);
+    }
+
+    const double burstSecs = std::chrono::duration<double>(g_rateLimiterBurstInterval).count();
+    _capacity = std::max(static_cast<double>(bytesPerSecond) * burstSecs, static_cast<double>(g_rateLimiterMinBurstBytes));
+    _tokens = (_rate != 0) ? std::min(_tokens, _capacity) : _capacity;
+    _lastRefill = now;
+    _rate = bytesPerSecond;
+}
+
+UINT64 TokenBucket::Rate() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _rate;
+}
+
+std::chrono::milliseconds TokenBucket::Delay()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_rate == 0)
+    {
+        return std::chrono::milliseconds(0);
+    }
+
+    _RefillUnderLock(std::chrono::steady_clock::now());
+    if (_tokens >= 0)
+    {
+        return std::chrono::milliseconds(0);
+    }
+    const double delayMsecs = std::ceil(-_tokens * 1000 / static_cast<double>(_rate));
+    return std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(delayMsecs));
+}
+
+void TokenBucket::Consume(size_t cbConsumed)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_rate != 0)
+    {
+        _RefillUnderLock(std::chrono::steady_clock::now());
+        _tokens -= static_cast<double>(cbConsumed);
+    }
+}
+
+void TokenBucket::_RefillUnderLock(std::chrono::steady_clock::time_point now)
+{
+    const double elapsedSecs = std::chrono::duration<double>(now - _lastRefill).count();
+    _tokens = std::min(_tokens + (elapsedSecs * static_cast<double>(_rate)), _capacity);
+    _lastRefill = now;
+}
@@ -0,0 +1,34 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include "do_noncopyable.h"
+
+// Rate limiter for data transfers, thread-safe.
+// Tokens (bytes) accumulate at the configured rate up to a small burst allowance. Consuming is allowed
+// to overdraw the bucket since transfers hand over data in chunks they can't split. The debt then has
+// to be paid off before Delay() lets anyone consume again, which keeps the long term rate at the limit.
+class TokenBucket : DONonCopyable
+{
+public:
+    // Zero means unlimited, which is the default
+    void SetRate(UINT64 bytesPerSecond);
+    UINT64 Rate() const;
+
+    // Time to wait before consuming more, zero if tokens are available or the rate is unlimited
+    std::chrono::milliseconds Delay();
+
+    void Consume(size_t cbConsumed);
+
+private:
+    void _RefillUnderLock(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex _mutex;
+    UINT64 _rate { 0 };
+    double _capacity { 0 };
+    double _tokens { 0 };
+    std::chrono::steady_clock::time_point _lastRefill;
+};
@@ -0,0 +1,357 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_common.h"
+#include "do_write_behind.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sys/uio.h>
+#include "config_defaults.h"
+#include "do_file.h"
+
+// Buffers are page aligned, which keeps the kernel's copy for each write page aligned too
+static constexpr size_t g_bufferAlignment = 4096;
+
+WriteBehindQueue::Stream::Stream(WriteBehindQueue& queue, const DOFile& file, std::function<void()> onBuffersAvailable) :
+    _queue(queue),
+    _file(file),
+    _onBuffersAvailable(std::move(onBuffersAvailable))
+{
+}
+
+WriteBehindQueue::Stream::~Stream()
+{
+    UINT64 failedOffset;
+    (void)Drain(&failedOffset);
+}
+
+HRESULT WriteBehindQueue::Stream::Write(UINT64 offset, _In_reads_bytes_(cbData) const BYTE* pData, size_t cbData)
+{
+    std::unique_lock<std::mutex> lock(_queue._mutex);
+    if (FAILED(_hrWrite))
+    {
+        return _hrWrite;
+    }
+
+    if ((_current != nullptr) && (offset != (_current->offset + _current->cbUsed)))
+    {
+        _SubmitCurrentUnderLock();
+    }
+
+    // Reserve all the buffers needed up front. The caller retries with the same data after E_PENDING,
+    // so none of it must be consumed unless all of it can be.
+    const size_t cbFree = (_current != nullptr) ? (_queue._bufferSize - _current->cbUsed) : 0;
+    const size_t numBuffersNeeded = (cbData > cbFree) ? ((cbData - cbFree + _queue._bufferSize - 1) / _queue._bufferSize) : 0;
+    if (!_queue._ReserveBuffersUnderLock(numBuffersNeeded))
+    {
+        // Nothing to wait for if not even a single buffer could be allocated
+        if (_queue._allBuffers.empty())
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        // Write out what we have instead of holding on to the buffer while waiting. Otherwise streams
+        // holding partially filled buffers could end up waiting on each other. The same goes for the
+        // other streams: one that is paused, idle or rate limited would hold on to its buffer indefinitely,
+        // and with more streams than buffers they could leave none for the rest.
+        _SubmitCurrentUnderLock();
+        _queue._SubmitPartialBuffersUnderLock();
+        if (!_fWaitingForBuffers)
+        {
+            _fWaitingForBuffers = true;
+            _queue._waitingStreams.push_back(this);
+        }
+        return E_PENDING;
+    }
+
+    size_t cbCopied = 0;
+    while (cbCopied < cbData)
+    {
+        if (_current == nullptr)
+        {
+            _current = _queue._AcquireBufferUnderLock();
+            _current->offset = offset + cbCopied;
+            _current->stream = this;
+        }
+
+        const size_t cbToCopy = std::min(cbData - cbCopied, _queue._bufferSize - _current->cbUsed);
+        memcpy(_current->data.get() + _current->cbUsed, pData + cbCopied, cbToCopy);
+        _current->cbUsed += cbToCopy;
+        cbCopied += cbToCopy;
+
+        if (_current->cbUsed == _queue._bufferSize)
+        {
+            _SubmitCurrentUnderLock();
+        }
+    }
+    return S_OK;
+}
+
+void WriteBehindQueue::Stream::Flush(std::function<void(HRESULT)> onFlushed)
+{
+    std::unique_lock<std::mutex> lock(_queue._mutex);
+    _SubmitCurrentUnderLock();
+    if (_numPendingWrites != 0)
+    {
+        // I/O thread invokes the callback once the last pending write completes
+        _onFlushed = std::move(onFlushed);
+        return;
+    }
+
+    const HRESULT hrWrite = _hrWrite;
+    ++_numCallbacksInProgress;
+    lock.unlock();
+
+    onFlushed(hrWrite);
+
+    lock.lock();
+    --_numCallbacksInProgress;
+    _queue._cvStreamIdle.notify_all();
+}
+
+HRESULT WriteBehindQueue::Stream::Drain(_Out_ UINT64* pFailedOffset)
+{
+    std::unique_lock<std::mutex> lock(_queue._mutex);
+    _SubmitCurrentUnderLock();
+    if (_fWaitingForBuffers)
+    {
+        auto& waitingStreams = _queue._waitingStreams;
+        waitingStreams.erase(std::remove(waitingStreams.begin(), waitingStreams.end(), this), waitingStreams.end());
+        _fWaitingForBuffers = false;
+    }
+
+    _queue._cvStreamIdle.wait(lock, [this]()
+        {
+            return (_numPendingWrites == 0) && (_numCallbacksInProgress == 0);
+        });
+
+    const HRESULT hr = _hrWrite;
+    *pFailedOffset = _failedOffset;
+    _hrWrite = S_OK;
+    _failedOffset = 0;
+    return hr;
+}
+
+UINT64 WriteBehindQueue::Stream::WrittenOffset() const
+{
+    std::unique_lock<std::mutex> lock(_queue._mutex);
+    return _writtenOffset;
+}
+
+void WriteBehindQueue::Stream::_SubmitCurrentUnderLock()
+{
+    if (_current == nullptr)
+    {
+        return;
+    }
+
+    if (_current->cbUsed != 0)
+    {
+        _queue._writeQueue.push_back(_current);
+        ++_numPendingWrites;
+        _queue._cv.notify_one();
+    }
+    else
+    {
+        _queue._freeBuffers.push_back(_current);
+    }
+    _current = nullptr;
+}
+
+WriteBehindQueue::WriteBehindQueue(size_t bufferSize, UINT maxBuffers) :
+    _bufferSize(bufferSize),
+    _maxBuffers(maxBuffers)
+{
+    DO_ASSERT((_bufferSize != 0) && ((_bufferSize % g_bufferAlignment) == 0));
+    DO_ASSERT(_maxBuffers != 0);
+
+    _ioThread = std::thread{[this]()
+        {
+            _DoWork();
+        }};
+}
+
+WriteBehindQueue::WriteBehindQueue() :
+    WriteBehindQueue(g_writeBehindBufferSizeBytes, g_writeBehindMaxBuffers)
+{
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _fKeepRunning = false;
+        _cv.notify_one();
+    }
+    _ioThread.join();
+}
+
+void WriteBehindQueue::_DoWork()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _cv.wait(lock, [this]()
+            {
+                return !_fKeepRunning || !_writeQueue.empty();
+            });
+
+        // Queued writes are completed even when shutting down
+        if (_writeQueue.empty())
+        {
+            break;
+        }
+
+        std::vector<Buffer*> batch;
+        _DequeueWriteBatchUnderLock(batch);
+
+        lock.unlock();
+        const HRESULT hr = _WriteBuffers(batch);
+        lock.lock();
+
+        Stream* stream = batch.front()->stream;
+        if (FAILED(hr) && SUCCEEDED(stream->_hrWrite))
+        {
+            stream->_hrWrite = hr;
+            stream->_failedOffset = batch.front()->offset;
+        }
+        else if (SUCCEEDED(stream->_hrWrite))
+        {
+            // A stream's buffers are written in the order they were submitted
+            stream->_writtenOffset = batch.back()->offset + batch.back()->cbUsed;
+        }
+        for (auto buffer : batch)
+        {
+            buffer->cbUsed = 0;
+            buffer->stream = nullptr;
+            _freeBuffers.push_back(buffer);
+        }
+        stream->_numPendingWrites -= static_cast<UINT>(batch.size());
+
+        // Let the streams that ran out of buffers retry, and complete a flush if this was the last pending write
+        std::vector<Stream*> waitingStreams;
+        waitingStreams.swap(_waitingStreams);
+        for (auto waitingStream : waitingStreams)
+        {
+            waitingStream->_fWaitingForBuffers = false;
+            ++waitingStream->_numCallbacksInProgress;
+        }
+
+        std::function<void(HRESULT)> onFlushed;
+        const HRESULT hrFlushed = stream->_hrWrite;
+        if ((stream->_numPendingWrites == 0) && stream->_onFlushed)
+        {
+            onFlushed = std::move(stream->_onFlushed);
+            stream->_onFlushed = nullptr;
+            ++stream->_numCallbacksInProgress;
+        }
+
+        if (waitingStreams.empty() && !onFlushed)
+        {
+            _cvStreamIdle.notify_all();
+            continue;
+        }
+
+        lock.unlock();
+        for (auto waitingStream : waitingStreams)
+        {
+            waitingStream->_onBuffersAvailable();
+        }
+        if (onFlushed)
+        {
+            onFlushed(hrFlushed);
+        }
+        lock.lock();
+
+        for (auto waitingStream : waitingStreams)
+        {
+            --waitingStream->_numCallbacksInProgress;
+        }
+        if (onFlushed)
+        {
+            --stream->_numCallbacksInProgress;
+        }
+        _cvStreamIdle.notify_all();
+    }
+}
+
+// Takes the first queued buffer along with any queued buffers that continue it in the file.
+// A stream's buffers are queued in file order, so they can be picked out from between other streams' buffers.
+void WriteBehindQueue::_DequeueWriteBatchUnderLock(std::vector<Buffer*>& batch)
+{
+    Buffer* first = _writeQueue.front();
+    _writeQueue.pop_front();
+    batch.push_back(first);
+
+    UINT64 nextOffset = first->offset + first->cbUsed;
+    auto it = _writeQueue.begin();
+    while ((it != _writeQueue.end()) && (batch.size() < IOV_MAX))
+    {
+        Buffer* buffer = *it;
+        if (buffer->stream != first->stream)
+        {
+            ++it;
+            continue;
+        }
+        if (buffer->offset != nextOffset)
+        {
+            break;
+        }
+        batch.push_back(buffer);
+        nextOffset += buffer->cbUsed;
+        it = _writeQueue.erase(it);
+    }
+}
+
+// Ensures numBuffers can be acquired, allocating them if the pool is not at its limit yet
+bool WriteBehindQueue::_ReserveBuffersUnderLock(size_t numBuffers)
+{
+    while ((_freeBuffers.size() < numBuffers) && (_allBuffers.size() < _maxBuffers))
+    {
+        auto buffer = std::make_unique<Buffer>();
+        buffer->data.reset(static_cast<BYTE*>(aligned_alloc(g_bufferAlignment, _bufferSize)));
+        if (!buffer->data)
+        {
+            return false;
+        }
+        _freeBuffers.push_back(buffer.get());
+        _allBuffers.push_back(std::move(buffer));
+    }
+    return (_freeBuffers.size() >= numBuffers);
+}
+
+// Writes out the buffers that streams are still filling, see Stream::Write
+void WriteBehindQueue::_SubmitPartialBuffersUnderLock()
+{
+    for (const auto& buffer : _allBuffers)
+    {
+        Stream* stream = buffer->stream;
+        if ((stream != nullptr) && (stream->_current == buffer.get()))
+        {
+            stream->_SubmitCurrentUnderLock();
+        }
+    }
+}
+
+WriteBehindQueue::Buffer* WriteBehindQueue::_AcquireBufferUnderLock()
+{
+    DO_ASSERT(!_freeBuffers.empty());
+    Buffer* buffer = _freeBuffers.back();
+    _freeBuffers.pop_back();
+    return buffer;
+}
+
+HRESULT WriteBehindQueue::_WriteBuffers(const std::vector<Buffer*>& batch) try
+{
+    std::vector<struct iovec> iov;
+    iov.reserve(batch.size());
+    for (auto buffer : batch)
+    {
+        iov.push_back({ buffer->data.get(), buffer->cbUsed });
+    }
+    batch.front()->stream->_file.Write(batch.front()->offset, iov.data(), static_cast<int>(iov.size()));
+    return S_OK;
+} CATCH_RETURN()
@@ -0,0 +1,108 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "do_noncopyable.h"
+
+class DOFile;
+
+// Moves file writes off the curl transfer thread.
+// Incoming data is copied into large buffers from a bounded pool and written out by a dedicated
+// I/O thread. A writer that finds the pool exhausted is told to back off (E_PENDING) and is
+// notified once buffers are available again, see Stream::Write.
+class WriteBehindQueue : DONonCopyable
+{
+private:
+    struct Buffer;
+
+public:
+    // Sequential writer for one contiguous region of a file. Write and Flush are meant to be called
+    // from a single thread (the transfer callback thread), Drain from any other once writes have stopped.
+    class Stream : DONonCopyable
+    {
+    public:
+        Stream(WriteBehindQueue& queue, const DOFile& file, std::function<void()> onBuffersAvailable);
+        ~Stream();
+
+        // Copies the data into write buffers. Returns E_PENDING without consuming any data if the buffer pool
+        // is exhausted, onBuffersAvailable gets invoked (on the I/O thread) once the caller can retry.
+        // Returns the error from an earlier failed write, if any.
+        HRESULT Write(UINT64 offset, _In_reads_bytes_(cbData) const BYTE* pData, size_t cbData);
+
+        // Submits any partially filled buffer. onFlushed is invoked with the result of the outstanding
+        // writes once they complete, inline if there are none.
+        void Flush(std::function<void(HRESULT)> onFlushed);
+
+        // Submits any partially filled buffer and waits for all outstanding writes and callbacks to complete.
+        // Returns the first write error since the last Drain along with the file offset of the failed write.
+        HRESULT Drain(_Out_ UINT64* pFailedOffset);
+
+        // File offset up to which data written through this stream is known to be written out.
+        // Zero until the first write completes.
+        UINT64 WrittenOffset() const;
+
+    private:
+        friend class WriteBehindQueue;
+
+        void _SubmitCurrentUnderLock();
+
+        WriteBehindQueue& _queue;
+        const DOFile& _file;
+        std::function<void()> _onBuffersAvailable;
+
+        // Buffer being filled. Protected by the queue lock too, a stream that runs out of buffers
+        // submits the other streams' partially filled ones.
+        Buffer* _current { nullptr };
+
+        // Protected by the queue lock
+        std::function<void(HRESULT)> _onFlushed;
+        UINT _numPendingWrites { 0 };
+        UINT _numCallbacksInProgress { 0 };
+        bool _fWaitingForBuffers { false };
+        HRESULT _hrWrite { S_OK };
+        UINT64 _failedOffset { 0 };
+        UINT64 _writtenOffset { 0 };
+    };
+
+    WriteBehindQueue(size_t bufferSize, UINT maxBuffers);
+    WriteBehindQueue();
+    ~WriteBehindQueue();
+
+private:
+    struct Buffer
+    {
+        std::unique_ptr<BYTE, decltype(&free)> data { nullptr, &free };
+        size_t cbUsed { 0 };
+        UINT64 offset { 0 };
+        Stream* stream { nullptr };
+    };
+
+    void _DoWork();
+    void _DequeueWriteBatchUnderLock(std::vector<Buffer*>& batch);
+    bool _ReserveBuffersUnderLock(size_t numBuffers);
+    void _SubmitPartialBuffersUnderLock();
+    Buffer* _AcquireBufferUnderLock();
+    static HRESULT _WriteBuffers(const std::vector<Buffer*>& batch);
+
+    const size_t _bufferSize;
+    const UINT _maxBuffers;
+
+    std::vector<std::unique_ptr<Buffer>> _allBuffers;   // allocated on demand, up to _maxBuffers
+    std::vector<Buffer*> _freeBuffers;
+    std::deque<Buffer*> _writeQueue;
+    std::vector<Stream*> _waitingStreams;
+
+    std::thread _ioThread;
+    std::mutex _mutex;
+    std::condition_variable _cv;            // signals _ioThread about queued writes
+    std::condition_variable _cvStreamIdle;  // signals Drain about completed writes and callbacks
+    bool _fKeepRunning { true };
+};
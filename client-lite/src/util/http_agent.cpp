@@ -4,13 +4,17 @@
 #include "do_common.h"
 #include "http_agent.h"
 
-#include <sstream>
-#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <strings.h>
 #include "do_cpprest_uri_builder.h"
 #include "do_cpprest_uri.h"
 #include "do_curl_wrappers.h"
 #include "do_error.h"
 #include "do_http_defines.h"
+#include "do_token_bucket.h"
 #include "safe_int.h"
 
 // TBD version
@@ -18,16 +22,17 @@
 
 namespace msdod = microsoft::deliveryoptimization::details;
 
-HttpAgent::HttpAgent(CurlRequests& curlOps, IHttpAgentEvents& callback) :
+HttpAgent::HttpAgent(CurlRequests& curlOps, IHttpAgentEvents& callback, TokenBucket* rateLimiter) :
     _curlOps(curlOps),
-    _callback(callback)
+    _callback(callback),
+    _rateLimiter(rateLimiter)
 {
 }
 
 HttpAgent::~HttpAgent()
 {
     Close();
-    curl_easy_cleanup(_requestContext.curlHandle);
+    _curlOps.ReleaseEasyHandle(_requestContext.curlHandle);
 }
 
 // Determine if the status code is a 4xx code
@@ -36,9 +41,15 @@ bool HttpAgent::IsClientError(UINT httpStatusCode)
     return (400 <= httpStatusCode) && (httpStatusCode < 500);
 }
 
+// A length of UINT64 max makes an open ended range, up to the end of the content
 std::array<char, DO_HTTP_RANGEREQUEST_STR_LEN> HttpAgent::MakeRange(UINT64 startOffset, UINT64 lengthBytes)
 {
     std::array<char, DO_HTTP_RANGEREQUEST_STR_LEN> range;
+    if (lengthBytes == std::numeric_limits<UINT64>::max())
+    {
+        (void)StringPrintf(range.data(), range.size(), "%llu-", startOffset);
+        return range;
+    }
     const auto endOffset = UInt64Sub(UInt64Add(startOffset, lengthBytes), 1);
     (void)StringPrintf(range.data(), range.size(), "%llu-%llu", startOffset, endOffset);
     return range;
@@ -66,31 +77,64 @@ bool HttpAgent::ValidateUrl(const std::string& url)
 }
 
 // IHttpAgent
-HRESULT HttpAgent::SendRequest(PCSTR szUrl, PCSTR szProxyUrl, PCSTR szRange, UINT connectTimeoutSecs) try
+HRESULT HttpAgent::SendRequest(PCSTR szUrl, PCSTR szProxyUrl, PCSTR szRange, UINT connectTimeoutSecs, PCSTR szIfRange) try
 {
-    RETURN_IF_FAILED(_CreateClient(szUrl, szProxyUrl, connectTimeoutSecs));
+    RETURN_IF_FAILED(_CreateClient(szUrl, szProxyUrl));
     DO_ASSERT(_requestContext.curlHandle);
-    if (szRange == nullptr)
-    {
-        curl_slist_free_all(_requestContext.requestHeaders);
-        curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HTTPHEADER, nullptr);
-    }
-    else
+
+    // Headers from the previous request, if any, do not carry over
+    curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(_requestContext.requestHeaders);
+    _requestContext.requestHeaders = nullptr;
+    if (szRange != nullptr)
     {
         std::string rangeHeader("Range: bytes=");
         rangeHeader += szRange;
         auto tempList = curl_slist_append(_requestContext.requestHeaders, rangeHeader.c_str());
         RETURN_HR_IF(E_OUTOFMEMORY, tempList == nullptr);
         _requestContext.requestHeaders = tempList;
+
+        if ((szIfRange != nullptr) && (*szIfRange != '\0'))
+        {
+            std::string ifRangeHeader("If-Range: ");
+            ifRangeHeader += szIfRange;
+            tempList = curl_slist_append(_requestContext.requestHeaders, ifRangeHeader.c_str());
+            RETURN_HR_IF(E_OUTOFMEMORY, tempList == nullptr);
+            _requestContext.requestHeaders = tempList;
+        }
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HTTPHEADER, _requestContext.requestHeaders);
     }
 
-    _requestContext.responseHeaders.clear();
+    const auto& hostEstimates = _curlOps.HostEstimates();
+
+    // Default curl connect timeout is too long (300s). The caller's timeout applies until the host's
+    // connect time is known. Set on every request, the handle is reused across requests.
+    long connectTimeout = 0;
+    if (connectTimeoutSecs > 0)
+    {
+        connectTimeout = static_cast<long>(hostEstimates.ConnectTimeout(_requestContext.host,
+            std::chrono::seconds(connectTimeoutSecs)).count());
+    }
+    curl_easy_setopt(_requestContext.curlHandle, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+
+    // Timeout request if it stalls, 4KB/s for 20s unless the host's throughput and connect time are known.
+    // Not when bandwidth is limited, the limit could be lower. Downloads track lack of progress themselves.
+    const auto stallThreshold = hostEstimates.StallThresholdFor(_requestContext.host);
+    const long lowSpeedLimit = _IsRateLimited() ? 0 : static_cast<long>(stallThreshold.bytesPerSecond);
+    curl_easy_setopt(_requestContext.curlHandle, CURLOPT_LOW_SPEED_TIME, static_cast<long>(stallThreshold.time.count()));
+    curl_easy_setopt(_requestContext.curlHandle, CURLOPT_LOW_SPEED_LIMIT, lowSpeedLimit);
+    DoLogVerbose("Host %s, connect timeout: %ld s, stall threshold: %ld B/s for %lld s", _requestContext.host.data(),
+        connectTimeout, lowSpeedLimit, static_cast<long long>(stallThreshold.time.count()));
+
+    _requestContext.responseHeaderBlock.clear();
+    _requestContext.responseHeaderIndex.clear();
+    _requestContext.cbReceived = 0;
     _requestContext.responseStatusCode = 0;
     _requestContext.hrTranslatedStatusCode = S_OK;
     _requestContext.hrCallback = S_OK;
     _requestContext.responseOnHeadersAvailableInvoked = false;
     _requestContext.responseOnCompleteInvoked = false;
+    _requestContext.responseStoppedByCallback = false;
     _curlOps.Add(_requestContext.curlHandle, s_CompleteCallback, this);
     return S_OK;
 } CATCH_RETURN()
@@ -104,6 +148,14 @@ void HttpAgent::Close()
     // Clients may now make new requests if they choose
 }
 
+void HttpAgent::Unpause()
+{
+    if (_requestContext.curlHandle)
+    {
+        _curlOps.Unpause(_requestContext.curlHandle);
+    }
+}
+
 // The Query* functions are supposed to be called only from within the IHttpAgentEvents callbacks
 // function to get back valid data.
 HRESULT HttpAgent::QueryStatusCode(_Out_ UINT* pStatusCode) const
@@ -116,61 +168,57 @@ HRESULT HttpAgent::QueryContentLength(_Out_ UINT64* pContentLength)
 {
     *pContentLength = 0;
 
-    std::string lengthHeader;
+    std::string_view lengthHeader;
     if (SUCCEEDED(QueryHeaders("Content-Length", lengthHeader)))
     {
-        *pContentLength = std::stoull(lengthHeader);
+        const auto result = std::from_chars(lengthHeader.data(), lengthHeader.data() + lengthHeader.size(), *pContentLength);
+        RETURN_HR_IF(E_INVALIDARG, result.ec != std::errc());
     }
     return S_OK;
 }
 
-HRESULT HttpAgent::QueryContentLengthFromRange(_Out_ UINT64* pContentLength) try
+HRESULT HttpAgent::QueryContentLengthFromRange(_Out_ UINT64* pContentLength)
 {
     *pContentLength = 0;
 
-    std::string rangeHeader;
+    std::string_view rangeHeader;
     RETURN_IF_FAILED_EXPECTED(QueryHeadersByType(HttpAgentHeaders::Range, rangeHeader));
 
     // attempt to extract the content length from the content range format:
     // Content-Range: bytes <start>-<end>/<length>
-    auto marker = strchr(rangeHeader.data(), L'/');
-    RETURN_HR_IF_EXPECTED(E_NOT_SET, (marker == nullptr));
-    *pContentLength = std::stoull(marker + 1);
+    const auto marker = rangeHeader.find('/');
+    RETURN_HR_IF_EXPECTED(E_NOT_SET, (marker == std::string_view::npos));
+    const auto result = std::from_chars(rangeHeader.data() + marker + 1, rangeHeader.data() + rangeHeader.size(), *pContentLength);
+    RETURN_HR_IF(E_INVALIDARG, result.ec != std::errc());
     return S_OK;
-} CATCH_RETURN()
+}
 
-HRESULT HttpAgent::QueryHeaders(PCSTR pszName, std::string& headers) const noexcept
+HRESULT HttpAgent::QueryHeaders(PCSTR pszName, std::string_view& headers) const noexcept
 {
-    headers.clear();
-    const auto& reponseHeaders = _requestContext.responseHeaders;
+    const auto& block = _requestContext.responseHeaderBlock;
     if (pszName == nullptr)
     {
-        // Accumulate all headers into the output string
-        std::stringstream ss;
-        if (!reponseHeaders.empty())
-        {
-            for (const auto& item : reponseHeaders)
-            {
-                ss << item.first << ':' << item.second;
-                if (!boost::algorithm::ends_with(item.second, "\r\n"))
-                {
-                    ss << "\r\n";
-                }
-            }
-            ss << "\r\n";
-        }
-        headers = ss.str();
+        headers = block;
+        return S_OK;
     }
-    else
+
+    headers = {};
+    const size_t cchName = strlen(pszName);
+    const auto& index = _requestContext.responseHeaderIndex;
+
+    // The last occurrence of a repeated header wins
+    for (auto it = index.rbegin(); it != index.rend(); ++it)
     {
-        auto it = reponseHeaders.find(pszName);
-        RETURN_HR_IF_EXPECTED(E_NOT_SET, (it == reponseHeaders.end()));
-        headers = it->second;
+        if ((it->nameLength == cchName) && (strncasecmp(block.data() + it->nameOffset, pszName, cchName) == 0))
+        {
+            headers = std::string_view(block.data() + it->valueOffset, it->valueLength);
+            return S_OK;
+        }
     }
-    return S_OK;
+    return E_NOT_SET;
 }
 
-HRESULT HttpAgent::QueryHeadersByType(HttpAgentHeaders type, std::string& headers) noexcept
+HRESULT HttpAgent::QueryHeadersByType(HttpAgentHeaders type, std::string_view& headers) noexcept
 {
     PCSTR headerName;
     switch (type)
@@ -184,7 +232,7 @@ HRESULT HttpAgent::QueryHeadersByType(HttpAgentHeaders type, std::string& header
     return QueryHeaders(headerName, headers);
 }
 
-HRESULT HttpAgent::_CreateClient(PCSTR szUrl, PCSTR szProxyUrl, UINT connectTimeoutSecs) try
+HRESULT HttpAgent::_CreateClient(PCSTR szUrl, PCSTR szProxyUrl) try
 {
     std::unique_lock<std::recursive_mutex> lock(_requestLock);
 
@@ -195,8 +243,7 @@ HRESULT HttpAgent::_CreateClient(PCSTR szUrl, PCSTR szProxyUrl, UINT connectTime
         std::string url(szUrl);
         RETURN_HR_IF(INET_E_INVALID_URL, !ValidateUrl(url));
 
-        _requestContext.curlHandle = curl_easy_init();
-        RETURN_HR_IF(E_OUTOFMEMORY, _requestContext.curlHandle == nullptr);
+        _requestContext.curlHandle = _curlOps.AcquireEasyHandle();
         DoLogVerbose("New http_client for %s", szUrl);
 
         // Set options that are generic to all requests
@@ -208,17 +255,6 @@ HRESULT HttpAgent::_CreateClient(PCSTR szUrl, PCSTR szProxyUrl, UINT connectTime
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HTTPGET, static_cast<long>(1));
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_USERAGENT, DO_USER_AGENT_STR);
 
-        // Timeout request if download speed is less than 4KB/s for 20s (7KB/s or 56kb/s is dial-up modem speed)
-        curl_easy_setopt(_requestContext.curlHandle, CURLOPT_LOW_SPEED_TIME, static_cast<long>(20));
-        curl_easy_setopt(_requestContext.curlHandle, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(4000));
-
-        constexpr UINT c_curlDefaultTimeout = 300;
-        if ((connectTimeoutSecs > 0) && (connectTimeoutSecs < c_curlDefaultTimeout))
-        {
-            auto timeoutSecs = static_cast<long>(connectTimeoutSecs);
-            curl_easy_setopt(_requestContext.curlHandle, CURLOPT_CONNECTTIMEOUT, timeoutSecs);
-        }
-
         // Set up callbacks
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HEADERFUNCTION, s_HeaderCallback);
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_HEADERDATA, this);
@@ -231,6 +267,7 @@ HRESULT HttpAgent::_CreateClient(PCSTR szUrl, PCSTR szProxyUrl, UINT connectTime
         std::string url(szUrl);
         RETURN_HR_IF(INET_E_INVALID_URL, !ValidateUrl(url));
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_URL, szUrl);
+        _requestContext.host = msdod::cpprest_web::uri(url).host();
     }
 
     _SetWebProxyFromProxyUrl(szProxyUrl);
@@ -321,6 +358,7 @@ HRESULT HttpAgent::_ResultFromStatusCode(unsigned int code)
 
 void HttpAgent::_SetWebProxyFromProxyUrl(_In_opt_ PCSTR szProxyUrl)
 {
+    _requestContext.proxy = (szProxyUrl != nullptr) ? szProxyUrl : "";
     if (szProxyUrl == nullptr)
     {
         curl_easy_setopt(_requestContext.curlHandle, CURLOPT_PROXY, "");
@@ -340,23 +378,128 @@ void HttpAgent::_SetWebProxyFromProxyUrl(_In_opt_ PCSTR szProxyUrl)
     }
 }
 
+bool HttpAgent::_IsRateLimited() const
+{
+    return (_curlOps.RateLimiter().Rate() != 0) || ((_rateLimiter != nullptr) && (_rateLimiter->Rate() != 0));
+}
+
+std::chrono::milliseconds HttpAgent::_RateLimitDelay() const
+{
+    const auto delay = _curlOps.RateLimiter().Delay();
+    return (_rateLimiter != nullptr) ? std::max(delay, _rateLimiter->Delay()) : delay;
+}
+
+// Feeds the timings of the completed request into the host's estimates
+void HttpAgent::_UpdateHostEstimates(int curlResult) try
+{
+    auto& hostEstimates = _curlOps.HostEstimates();
+    CURL* curlHandle = _requestContext.curlHandle;
+
+    double connectSecs = 0;
+    double preTransferSecs = 0;
+    long numConnects = 0;
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_CONNECT_TIME, &connectSecs);
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_PRETRANSFER_TIME, &preTransferSecs);
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_NUM_CONNECTS, &numConnects);
+
+    if ((numConnects > 0) && (connectSecs > 0))
+    {
+        hostEstimates.OnConnected(_requestContext.host, std::chrono::duration<double>(connectSecs));
+    }
+    else if ((curlResult == CURLE_OPERATION_TIMEDOUT) && (preTransferSecs == 0))
+    {
+        // Timed out before the request could be sent, i.e. while resolving or connecting
+        hostEstimates.OnConnectTimedOut(_requestContext.host);
+    }
+
+    // A limited transfer measures the limit rather than the network
+    if ((_requestContext.cbReceived != 0) && !_IsRateLimited())
+    {
+        // Total time covers the redirects too, the other timings only the final request
+        double totalSecs = 0;
+        double redirectSecs = 0;
+        double startTransferSecs = 0;
+        (void)curl_easy_getinfo(curlHandle, CURLINFO_TOTAL_TIME, &totalSecs);
+        (void)curl_easy_getinfo(curlHandle, CURLINFO_REDIRECT_TIME, &redirectSecs);
+        (void)curl_easy_getinfo(curlHandle, CURLINFO_STARTTRANSFER_TIME, &startTransferSecs);
+        hostEstimates.OnTransfer(_requestContext.host, _requestContext.cbReceived,
+            std::chrono::duration<double>(totalSecs - redirectSecs - startTransferSecs));
+    }
+} CATCH_LOG()
+
+// Reports how the completed request went to the proxy's health, if it went through one
+void HttpAgent::_UpdateProxyHealth(int curlResult) try
+{
+    if (_requestContext.proxy.empty())
+    {
+        return;
+    }
+
+    auto& proxies = _curlOps.Proxies();
+    CURL* curlHandle = _requestContext.curlHandle;
+
+    double connectSecs = 0;
+    double preTransferSecs = 0;
+    long numConnects = 0;
+    long connectCode = 0;
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_CONNECT_TIME, &connectSecs);
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_PRETRANSFER_TIME, &preTransferSecs);
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_NUM_CONNECTS, &numConnects);
+    (void)curl_easy_getinfo(curlHandle, CURLINFO_HTTP_CONNECTCODE, &connectCode);
+
+    // The proxy could not be reached or refused to set up the tunnel
+    const bool fProxyFailed = (curlResult == CURLE_COULDNT_RESOLVE_PROXY)
+        || (curlResult == CURLE_COULDNT_CONNECT)
+        || ((curlResult == CURLE_OPERATION_TIMEDOUT) && (preTransferSecs == 0))
+        || (connectCode >= 400);
+    if (fProxyFailed)
+    {
+        proxies.OnProxyFailed(_requestContext.proxy);
+    }
+    else if ((curlResult == CURLE_OK) || (_requestContext.responseStatusCode != 0))
+    {
+        // Connect time is the time to connect to the proxy
+        const double sampleSecs = (numConnects > 0) ? connectSecs : 0;
+        proxies.OnProxySucceeded(_requestContext.proxy, std::chrono::duration<double>(sampleSecs));
+    }
+    // else failed further along, say it was cancelled or stalled, which says little about the proxy
+} CATCH_LOG()
+
 size_t HttpAgent::_HeaderCallback(char* pBuffer, size_t size, size_t nItems)
 {
     const auto cbBuffer = nItems * size;
     try
     {
-        auto pColon = reinterpret_cast<char*>(memchr(pBuffer, ':', cbBuffer));
-        if (pColon > pBuffer)
+        auto& block = _requestContext.responseHeaderBlock;
+        auto& index = _requestContext.responseHeaderIndex;
+
+        // A status line starts the headers of another response, after a redirect or an interim 1xx response
+        constexpr std::string_view statusLinePrefix = "HTTP/";
+        const bool fStatusLine = std::string_view(pBuffer, cbBuffer).substr(0, statusLinePrefix.size()) == statusLinePrefix;
+        if (fStatusLine)
         {
-            auto pBufferPastEnd = pBuffer + cbBuffer;
-            auto result = _requestContext.responseHeaders.emplace(std::piecewise_construct,
-                std::forward_as_tuple(pBuffer, pColon),
-                std::forward_as_tuple(pColon + 1, pBufferPastEnd));
-            if (!result.second)
+            block.clear();
+            index.clear();
+        }
+
+        const size_t lineOffset = block.size();
+        block.append(pBuffer, cbBuffer);
+
+        auto pColon = static_cast<const char*>(memchr(pBuffer, ':', cbBuffer));
+        if (!fStatusLine && (pColon > pBuffer))
+        {
+            const char* pValue = pColon + 1;
+            const char* pValueEnd = pBuffer + cbBuffer;
+            while ((pValue < pValueEnd) && isspace(static_cast<unsigned char>(*pValue)))
+            {
+                ++pValue;
+            }
+            while ((pValueEnd > pValue) && isspace(static_cast<unsigned char>(pValueEnd[-1])))
             {
-                // Duplicate header (likely following redirects), take the new one
-                result.first->second.assign(pColon + 1, pBufferPastEnd);
+                --pValueEnd;
             }
+            index.push_back({ lineOffset, static_cast<size_t>(pColon - pBuffer),
+                lineOffset + static_cast<size_t>(pValue - pBuffer), static_cast<size_t>(pValueEnd - pValue) });
         }
         return cbBuffer;
     }
@@ -377,7 +520,35 @@ size_t HttpAgent::_WriteCallback(char* pBuffer, size_t size, size_t nMemb)
     // Forward body only for success response
     if (SUCCEEDED(_requestContext.hrTranslatedStatusCode) && SUCCEEDED(_requestContext.hrCallback))
     {
-        _requestContext.hrCallback = _callback.OnData(reinterpret_cast<BYTE*>(pBuffer), cbBuffer);
+        // Hold off while over a bandwidth limit. Not reading from the socket meanwhile slows down the sender.
+        const auto delay = _RateLimitDelay();
+        if (delay.count() != 0)
+        {
+            _curlOps.UnpauseAfter(_requestContext.curlHandle, delay);
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
+        const HRESULT hr = _callback.OnData(reinterpret_cast<BYTE*>(pBuffer), cbBuffer);
+        if (hr == E_PENDING)
+        {
+            // Callback cannot take the data right now. Curl will deliver it again once unpaused.
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        _requestContext.hrCallback = hr;
+        _requestContext.cbReceived += cbBuffer;
+
+        _curlOps.RateLimiter().Consume(cbBuffer);
+        if (_rateLimiter != nullptr)
+        {
+            _rateLimiter->Consume(cbBuffer);
+        }
+    }
+
+    if (_requestContext.hrCallback == S_FALSE)
+    {
+        // Callback has received all the data it needs. Abort the transfer and report success upon completion.
+        _requestContext.responseStoppedByCallback = true;
+        return 0;
     }
 
     if (SUCCEEDED(_requestContext.hrTranslatedStatusCode) && SUCCEEDED(_requestContext.hrCallback))
@@ -419,6 +590,12 @@ void HttpAgent::_CompleteCallback(int curlResult)
     }
     _requestContext.responseOnCompleteInvoked = true;
 
+    if (_requestContext.responseStoppedByCallback && (curlResult == CURLE_WRITE_ERROR))
+    {
+        curlResult = CURLE_OK;
+        _requestContext.hrCallback = S_OK;
+    }
+
     if (curlResult == CURLE_OK)
     {
         // OnHeadersAvailable might not have been called earlier if response did not have a body
@@ -431,6 +608,8 @@ void HttpAgent::_CompleteCallback(int curlResult)
     }
     // else we already have the error code to report
 
+    _UpdateHostEstimates(curlResult);
+    _UpdateProxyHealth(curlResult);
     (void)_callback.OnComplete(_requestContext.hrTranslatedStatusCode, _requestContext.hrCallback);
 }
 
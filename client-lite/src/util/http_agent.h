@@ -3,20 +3,25 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <curl/curl.h>
 #include "http_agent_interface.h"
 
 #define DO_HTTP_RANGEREQUEST_STR_LEN    48              // two 64bit numbers plus a '-' character (20 digits in UINT64)
 
 class CurlRequests;
+class TokenBucket;
 
 class HttpAgent : public IHttpAgent
 {
 public:
-    HttpAgent(CurlRequests& curlOps, IHttpAgentEvents& callback);
+    // Data is received no faster than rateLimiter, if given, and the agent-wide limit allow
+    HttpAgent(CurlRequests& curlOps, IHttpAgentEvents& callback, TokenBucket* rateLimiter = nullptr);
     ~HttpAgent();
 
     static bool IsClientError(UINT httpStatusCode);
@@ -25,37 +30,62 @@ public:
 
     // IHttpAgent
 
-    HRESULT SendRequest(PCSTR szUrl = nullptr, PCSTR szProxyUrl = nullptr, PCSTR szRange = nullptr, UINT connectTimeoutSecs = 0) override;
+    HRESULT SendRequest(PCSTR szUrl = nullptr, PCSTR szProxyUrl = nullptr, PCSTR szRange = nullptr, UINT connectTimeoutSecs = 0,
+        PCSTR szIfRange = nullptr) override;
     void Close() override;
+    void Unpause() override;
 
     // The Query* functions are supposed to be called only from within the IHttpAgentEvents callbacks
     // function because the httpContext (which is the request handle) must be valid.
     HRESULT QueryStatusCode(_Out_ UINT* pStatusCode) const override;
     HRESULT QueryContentLength(_Out_ UINT64* pContentLength) override;
     HRESULT QueryContentLengthFromRange(_Out_ UINT64* pContentLength) override;
-    HRESULT QueryHeaders(_In_opt_z_ PCSTR pszName, std::string& headers) const noexcept override;
-    HRESULT QueryHeadersByType(HttpAgentHeaders type, std::string& headers) noexcept override;
+    // Without a name, the view covers all header lines of the response as received, status line included.
+    // Values are looked up case-insensitively and come without surrounding whitespace.
+    HRESULT QueryHeaders(_In_opt_z_ PCSTR pszName, std::string_view& headers) const noexcept override;
+    HRESULT QueryHeadersByType(HttpAgentHeaders type, std::string_view& headers) noexcept override;
 
 private:
     mutable std::recursive_mutex _requestLock;
 
     CurlRequests& _curlOps;
     IHttpAgentEvents& _callback;
+    TokenBucket* _rateLimiter;
     UINT64 _callbackContext { 0 };
 
     // Current usage pattern is to create only one request at a time.
     // Holding a single request context is sufficient.
     struct RequestContext
     {
+        // Location of a header's name and value within responseHeaderBlock
+        struct HeaderEntry
+        {
+            size_t nameOffset;
+            size_t nameLength;
+            size_t valueOffset;
+            size_t valueLength;
+        };
+
         CURL* curlHandle;
         struct curl_slist* requestHeaders;
 
         unsigned int responseStatusCode;
         HRESULT hrTranslatedStatusCode;
         HRESULT hrCallback;
-        std::unordered_map<std::string, std::string> responseHeaders;
+
+        // Header lines of the latest response (the final one when following redirects) and their index.
+        // Cleared but not freed between requests, so headers don't cost any allocations once these have grown.
+        std::string responseHeaderBlock;
+        std::vector<HeaderEntry> responseHeaderIndex;
+
+        // Host of the request url, identifies the host's estimates in CurlRequests
+        std::string host;
+        // Proxy the request goes through, identifies the proxy's reports in CurlRequests
+        std::string proxy;
+        UINT64 cbReceived;
         bool responseOnHeadersAvailableInvoked;
         bool responseOnCompleteInvoked;
+        bool responseStoppedByCallback;
 
         ~RequestContext()
         {
@@ -66,9 +96,13 @@ private:
     RequestContext _requestContext {};
 
 private:
-    HRESULT _CreateClient(PCSTR szUrl = nullptr, PCSTR szProxyUrl = nullptr, UINT connectTimeoutSecs = 0);
+    HRESULT _CreateClient(PCSTR szUrl = nullptr, PCSTR szProxyUrl = nullptr);
     static HRESULT _ResultFromStatusCode(unsigned int code);
     void _SetWebProxyFromProxyUrl(_In_opt_ PCSTR szProxyUrl);
+    bool _IsRateLimited() const;
+    std::chrono::milliseconds _RateLimitDelay() const;
+    void _UpdateHostEstimates(int curlResult);
+    void _UpdateProxyHealth(int curlResult);
 
     size_t _HeaderCallback(char* pBuffer, size_t size, size_t nItems);
     size_t _WriteCallback(char* pBuffer, size_t size, size_t nMemb);
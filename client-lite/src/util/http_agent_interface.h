@@ -3,22 +3,29 @@
 
 #pragma once
 
+#include <string_view>
+
 enum class HttpAgentHeaders
 {
     Range,
 };
 
+// Header views returned by the Query* functions point into the agent's buffers and are valid
+// until the next request is sent.
 class IHttpAgent
 {
 public:
     virtual ~IHttpAgent() = default;
-    virtual HRESULT SendRequest(PCSTR url, PCSTR proxyUrl = nullptr, PCSTR range = nullptr, UINT connectTimeoutSecs = 0) = 0;
+    // ifRange applies to range requests only, the server then sends the whole content if its validator doesn't match
+    virtual HRESULT SendRequest(PCSTR url, PCSTR proxyUrl = nullptr, PCSTR range = nullptr, UINT connectTimeoutSecs = 0,
+        PCSTR ifRange = nullptr) = 0;
     virtual void Close() = 0;
+    virtual void Unpause() = 0;
     virtual HRESULT QueryStatusCode(_Out_ UINT *statusCode) const = 0;
     virtual HRESULT QueryContentLength(_Out_ UINT64 *contentLength) = 0;
     virtual HRESULT QueryContentLengthFromRange(_Out_ UINT64 *contentLength) = 0;
-    virtual HRESULT QueryHeaders(_In_opt_z_ PCSTR name, std::string& headers) const noexcept = 0;
-    virtual HRESULT QueryHeadersByType(HttpAgentHeaders type, std::string& headers) noexcept = 0;
+    virtual HRESULT QueryHeaders(_In_opt_z_ PCSTR name, std::string_view& headers) const noexcept = 0;
+    virtual HRESULT QueryHeadersByType(HttpAgentHeaders type, std::string_view& headers) noexcept = 0;
 };
 
 class IHttpAgentEvents
@@ -26,6 +33,11 @@ class IHttpAgentEvents
 public:
     virtual ~IHttpAgentEvents() = default;
     virtual HRESULT OnHeadersAvailable() = 0;
+
+    // Returning S_FALSE stops the transfer after this block. The request is then
+    // reported as successfully completed. Useful when only a prefix of the response is needed.
+    // Returning E_PENDING pauses the transfer without consuming the block. The same block is
+    // delivered again after IHttpAgent::Unpause is called.
     virtual HRESULT OnData(_In_reads_bytes_(cbData) BYTE* pData, UINT cbData) = 0;
     virtual HRESULT OnComplete(HRESULT hrRequest, HRESULT hrCallback) = 0;
 };
@@ -75,6 +75,8 @@ inline void InitializeDOPaths()
     // No external process or linux user will be writing to the log directory, so no need for S_IWGRP
     InitializePath(docli::GetLogDirectory(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
     InitializePath(docli::GetRuntimeDirectory());
+    // Download journals, private to the agent
+    InitializePath(docli::GetPersistenceDirectory(), S_IRWXU | S_IRGRP | S_IXGRP);
 }
 
 inline void DropPermissions()
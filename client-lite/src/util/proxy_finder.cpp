@@ -4,78 +4,206 @@
 #include "do_common.h"
 #include "proxy_finder.h"
 
+#include <algorithm>
+#include <utility>
+#include "config_defaults.h"
+#include "do_cpprest_uri.h"
+#include "network_monitor.h"
+
 #ifdef DO_PROXY_SUPPORT
 #include <proxy.h> // libproxy
 #endif
 
-static char** GetProxiesForURL(const char* url)
+namespace msdod = microsoft::deliveryoptimization::details;
+
+ProxyFinder::~ProxyFinder()
 {
-    char** proxies = nullptr;
+    Reset();
+}
+
+ProxyFinder::proxy_list_t ProxyFinder::Get(const std::string& url)
+{
+    proxy_list_t result;
 #ifdef DO_PROXY_SUPPORT
-    auto proxyFactory = px_proxy_factory_new();
-    if (proxyFactory != nullptr)
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_proxyFactory == nullptr)
     {
-        proxies = px_proxy_factory_get_proxies(proxyFactory, url);
-        px_proxy_factory_free(proxyFactory);
+        _proxyFactory = px_proxy_factory_new();
+        if (_proxyFactory == nullptr)
+        {
+            return result;
+        }
+    }
+
+    char** proxies = px_proxy_factory_get_proxies(static_cast<pxProxyFactory*>(_proxyFactory), url.c_str());
+    lock.unlock();
+
+    if (proxies != nullptr)
+    {
+        for (size_t i = 0; proxies[i]; ++i)
+        {
+            char* cur = proxies[i];
+            DoLogDebug("Proxy[%zu]: %s", i, cur);
+            // direct is used to denote 'no proxy'
+            if (strcmp(cur, "direct://") != 0)
+            {
+                result.emplace_back(cur);
+            }
+            free(cur);
+        }
+        free(proxies);
     }
 #endif
-    return proxies;
+    return result;
 }
 
-ProxyFinder::ProxyFinder(PCSTR url)
+void ProxyFinder::Reset()
 {
-    _proxyList = GetProxiesForURL(url);
+#ifdef DO_PROXY_SUPPORT
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_proxyFactory != nullptr)
+    {
+        px_proxy_factory_free(static_cast<pxProxyFactory*>(_proxyFactory));
+        _proxyFactory = nullptr;
+    }
+#endif
 }
 
-ProxyFinder::~ProxyFinder()
+ProxyFinder::proxy_list_t ProxyCache::Lookup(const std::string& url)
 {
-    if (_proxyList != nullptr)
+    const msdod::cpprest_web::uri uri(url);
+    const std::string key = uri.scheme() + "://" + uri.host();
+    const std::string networkFingerprint = NetworkMonitor::ViableInterfacesFingerprint();
+    const auto now = std::chrono::steady_clock::now();
+
+    bool fNetworkChanged = false;
     {
-        for (size_t i = 0; _proxyList[i]; ++i)
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (networkFingerprint != _networkFingerprint)
+        {
+            if (!_lookups.empty() || !_health.empty())
+            {
+                DoLogInfo("Network changed, dropping %zu proxy lookups and %zu proxy reports", _lookups.size(), _health.size());
+            }
+            _lookups.clear();
+            _health.clear();
+            _networkFingerprint = networkFingerprint;
+            fNetworkChanged = true;
+        }
+
+        auto it = _lookups.find(key);
+        if ((it != _lookups.end()) && (now < it->second.expiry))
         {
-            free(_proxyList[i]);
+            return it->second.proxies;
         }
-        free(_proxyList);
     }
+
+    // The proxy configuration (and WPAD/PAC location) may be different on the new network
+    if (fNetworkChanged)
+    {
+        _finder.Reset();
+    }
+
+    // Resolving can take a while when a PAC script is involved, reports and other lookups don't wait for it
+    auto proxies = _finder.Get(url);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if ((_lookups.find(key) == _lookups.end()) && (_lookups.size() >= g_proxyCacheMaxHosts))
+    {
+        // Make room by dropping the lookup that expires first
+        auto oldest = std::min_element(_lookups.begin(), _lookups.end(), [](const auto& a, const auto& b)
+            {
+                return a.second.expiry < b.second.expiry;
+            });
+        _lookups.erase(oldest);
+    }
+    _lookups[key] = { proxies, now + g_proxyCacheTtl };
+    return proxies;
 }
 
-ProxyFinder::proxy_list_t ProxyFinder::Get() const
+void ProxyCache::OnProxySucceeded(const std::string& proxy, std::chrono::duration<double> connectTime)
 {
-    proxy_list_t result;
-    if (_proxyList != nullptr)
+    const double sampleSecs = connectTime.count();
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& health = _GetOrAddHealthUnderLock(proxy);
+    if (sampleSecs > 0)
     {
-        for (size_t i = 0; _proxyList[i]; ++i)
+        const bool fFirstSample = (health.connectSecs == 0);
+        health.connectSecs = fFirstSample ? sampleSecs : (0.875 * health.connectSecs) + (0.125 * sampleSecs);
+    }
+    ++health.successes;
+    health.consecutiveFailures = 0;
+}
+
+void ProxyCache::OnProxyFailed(const std::string& proxy)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto& health = _GetOrAddHealthUnderLock(proxy);
+    ++health.consecutiveFailures;
+    DoLogWarning("Proxy failed %u time(s) in a row", health.consecutiveFailures);
+}
+
+void ProxyCache::SortByHealth(ProxyFinder::proxy_list_t& proxies) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto now = std::chrono::steady_clock::now();
+
+    // Working proxies by connect time, then proxies without recent reports, then failing proxies by failure count
+    auto rankOf = [&](const std::string& proxy) -> std::pair<int, double>
         {
-            char* cur = _proxyList[i];
-            DoLogDebug("Proxy[%zu]: %s", i, cur);
-            // direct is used to denote 'no proxy'
-            if (strcmp(cur, "direct://") != 0)
+            auto it = _health.find(proxy);
+            if ((it == _health.end()) || ((now - it->second.lastUpdate) > g_proxyCacheTtl))
             {
-                result.emplace_back(cur);
+                return { 1, 0.0 };
             }
+            const Health& health = it->second;
+            if (health.consecutiveFailures != 0)
+            {
+                return { 2, static_cast<double>(health.consecutiveFailures) };
+            }
+            return { 0, health.connectSecs };
+        };
+
+    std::stable_sort(proxies.begin(), proxies.end(), [&](const std::string& a, const std::string& b)
+        {
+            return rankOf(a) < rankOf(b);
+        });
+}
+
+ProxyCache::Health& ProxyCache::_GetOrAddHealthUnderLock(const std::string& proxy)
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto it = _health.find(proxy);
+    if (it == _health.end())
+    {
+        if (_health.size() >= g_proxyCacheMaxProxies)
+        {
+            // Make room by dropping the proxy that was reported on least recently
+            auto oldest = std::min_element(_health.begin(), _health.end(), [](const auto& a, const auto& b)
+                {
+                    return a.second.lastUpdate < b.second.lastUpdate;
+                });
+            _health.erase(oldest);
         }
+        it = _health.emplace(proxy, Health{}).first;
     }
-    return result;
+    it->second.lastUpdate = now;
+    return it->second;
 }
 
-void ProxyList::Refresh(const std::string& url)
+void ProxyList::Refresh(ProxyCache& cache, const std::string& url)
 {
-    _candidateProxies = ProxyFinder(url.data()).Get();
-    Reset();
+    _cache = &cache;
+    _candidateProxies = cache.Lookup(url);
 }
 
-// Iterate through the list in round-robin fashion
-const ProxyList::proxy_value_t& ProxyList::Next()
+// Ranked again on each call, a proxy that just failed gives way to the next best one
+ProxyList::proxy_value_t ProxyList::Next()
 {
-    static proxy_value_t empty;
     if (Empty())
     {
-        return empty;
-    }
-    const auto& ret = *_it++;
-    if (_it == _candidateProxies.cend())
-    {
-        Reset();
+        return {};
     }
-    return ret;
+    _cache->SortByHealth(_candidateProxies);
+    return _candidateProxies.front();
 }
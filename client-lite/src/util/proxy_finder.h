@@ -3,41 +3,84 @@
 
 #pragma once
 
+#include <chrono>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "do_noncopyable.h"
 
-class ProxyFinder
+// Resolves the proxies to use for a url with libproxy, thread-safe.
+// The libproxy factory is created on first use and reused, so its configuration and PAC script
+// are not loaded again for every lookup.
+class ProxyFinder : DONonCopyable
 {
 public:
     using proxy_list_t = std::vector<std::string>;
 
-    ProxyFinder(PCSTR url);
+    ProxyFinder() = default;
     ~ProxyFinder();
 
-    proxy_list_t Get() const;
+    proxy_list_t Get(const std::string& url);
+
+    // Frees the factory, the next lookup starts over with the current configuration
+    void Reset();
 
 private:
-    char** _proxyList { nullptr };
+    std::mutex _mutex;
+    void* _proxyFactory { nullptr };    // pxProxyFactory*, libproxy is only included by the implementation
 };
 
-class ProxyList
+// Agent-wide cache of proxy lookups and of how well each proxy has been working, thread-safe.
+// Lookups are cached per scheme and host for g_proxyCacheTtl and all of it is dropped when the network changes.
+// Requests made through a proxy report how it went, and candidates are ranked by it: proxies that worked
+// (faster connects first), then proxies without recent reports in lookup order, then failing proxies.
+class ProxyCache : DONonCopyable
 {
 public:
-    using proxy_value_t = ProxyFinder::proxy_list_t::value_type;
+    ProxyFinder::proxy_list_t Lookup(const std::string& url);
 
-    ProxyList()
-    {
-        Reset();
-    }
+    // connectTime is zero when the request reused a connection
+    void OnProxySucceeded(const std::string& proxy, std::chrono::duration<double> connectTime);
+    void OnProxyFailed(const std::string& proxy);
 
-    void Refresh(const std::string& url);
+    // Best candidate first, candidates ranked the same keep their order
+    void SortByHealth(ProxyFinder::proxy_list_t& proxies) const;
 
-    const proxy_value_t& Next();
+private:
+    struct LookupEntry
+    {
+        ProxyFinder::proxy_list_t proxies;
+        std::chrono::steady_clock::time_point expiry;
+    };
 
-    void Reset()
+    struct Health
     {
-        _it = _candidateProxies.cbegin();
-    }
+        UINT successes { 0 };
+        UINT consecutiveFailures { 0 };
+        double connectSecs { 0 };       // smoothed over the connects that were measured
+        std::chrono::steady_clock::time_point lastUpdate;
+    };
+
+    Health& _GetOrAddHealthUnderLock(const std::string& proxy);
+
+    ProxyFinder _finder;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, LookupEntry> _lookups;
+    std::unordered_map<std::string, Health> _health;
+    std::string _networkFingerprint;
+};
+
+class ProxyList
+{
+public:
+    using proxy_value_t = ProxyFinder::proxy_list_t::value_type;
+
+    void Refresh(ProxyCache& cache, const std::string& url);
+
+    // The best candidate according to the latest reports, empty if there is none
+    proxy_value_t Next();
 
     size_t Size() const
     {
@@ -50,6 +93,6 @@ public:
     }
 
 private:
+    ProxyCache* _cache { nullptr };
     ProxyFinder::proxy_list_t _candidateProxies;
-    ProxyFinder::proxy_list_t::const_iterator _it;
 };
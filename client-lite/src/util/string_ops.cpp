@@ -65,5 +65,23 @@ UINT ToUInt(const std::string& val)
     return ret;
 }
 
+UINT64 ToUInt64(const std::string& val)
+{
+    UINT64 ret = 0;
+    try
+    {
+        ret = std::stoull(val);
+    }
+    catch (const std::invalid_argument&)
+    {
+        THROW_HR(E_INVALIDARG);
+    }
+    catch (const std::out_of_range&)
+    {
+        THROW_HR(E_INVALIDARG);
+    }
+    return ret;
+}
+
 } // namespace string_conversions
 } // namespace docli
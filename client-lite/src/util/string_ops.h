@@ -118,6 +118,7 @@ namespace string_conversions
 {
 
 UINT ToUInt(const std::string& val);
+UINT64 ToUInt64(const std::string& val);
 
 }
 }
@@ -0,0 +1,173 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <fstream>
+#include "download_journal.h"
+
+class DownloadJournalTests : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ClearTestTempDir();
+    }
+
+    static DownloadJournalRecord MakeRecord()
+    {
+        DownloadJournalRecord record;
+        record.id = CreateNewGuid();
+        record.url = "http://example.com/file";
+        record.destFilePath = (g_testTempDir / "file.test").string();
+        record.state = DownloadState::Paused;
+        record.bytesTotal = 3000;
+        record.segments.push_back({ 0, 3000, 1200 });
+        return record;
+    }
+
+    static void WriteFile(const std::string& name, const std::string& content)
+    {
+        std::ofstream file((g_testTempDir / name).string());
+        file << content;
+    }
+
+    const std::string _directory { g_testTempDir.string() };
+};
+
+TEST_F(DownloadJournalTests, Disabled)
+{
+    DownloadJournal journal;
+    ASSERT_FALSE(journal.IsEnabled());
+    journal.Save(MakeRecord());
+    ASSERT_TRUE(journal.LoadAll().empty());
+    ASSERT_TRUE(fs::is_empty(g_testTempDir));
+}
+
+TEST_F(DownloadJournalTests, SaveAndLoad)
+{
+    DownloadJournal journal(_directory);
+    ASSERT_TRUE(journal.IsEnabled());
+
+    DownloadJournalRecord record = MakeRecord();
+    record.noProgressTimeoutSecs = 60;
+    record.fDestFileCreated = true;
+    record.maxBytesPerSecond = 4096;
+    record.ranges = "0:1000,2000:1000";
+    record.integrityCheckInfo = "sha256:abcd";
+    record.fIntegrityCheckMandatory = true;
+    record.etag = "\"v1\"";
+    record.lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+    record.segments = { { 0, 1000, 1000 }, { 2000, 1000, 10 } };
+    journal.Save(record);
+
+    // Optional fields stay unset
+    const DownloadJournalRecord minimal = MakeRecord();
+    journal.Save(minimal);
+
+    auto records = journal.LoadAll();
+    ASSERT_EQ(records.size(), 2u);
+    if (GuidToString(records[0].id) != GuidToString(record.id))
+    {
+        std::swap(records[0], records[1]);
+    }
+
+    const auto& loaded = records[0];
+    ASSERT_EQ(GuidToString(loaded.id), GuidToString(record.id));
+    ASSERT_EQ(loaded.url, record.url);
+    ASSERT_EQ(loaded.destFilePath, record.destFilePath);
+    ASSERT_EQ(loaded.state, DownloadState::Paused);
+    ASSERT_EQ(loaded.bytesTotal, 3000u);
+    ASSERT_EQ(loaded.noProgressTimeoutSecs, 60u);
+    ASSERT_TRUE(loaded.fDestFileCreated);
+    ASSERT_TRUE(loaded.maxBytesPerSecond);
+    ASSERT_EQ(*loaded.maxBytesPerSecond, 4096u);
+    ASSERT_EQ(loaded.ranges, record.ranges);
+    ASSERT_EQ(loaded.integrityCheckInfo, record.integrityCheckInfo);
+    ASSERT_TRUE(loaded.fIntegrityCheckMandatory);
+    ASSERT_EQ(loaded.etag, record.etag);
+    ASSERT_EQ(loaded.lastModified, record.lastModified);
+    ASSERT_EQ(loaded.segments.size(), 2u);
+    ASSERT_EQ(loaded.segments[1].offset, 2000u);
+    ASSERT_EQ(loaded.segments[1].length, 1000u);
+    ASSERT_EQ(loaded.segments[1].bytesWritten, 10u);
+
+    const auto& loadedMinimal = records[1];
+    ASSERT_EQ(GuidToString(loadedMinimal.id), GuidToString(minimal.id));
+    ASSERT_FALSE(loadedMinimal.fDestFileCreated);
+    ASSERT_FALSE(loadedMinimal.maxBytesPerSecond);
+    ASSERT_TRUE(loadedMinimal.ranges.empty());
+    ASSERT_TRUE(loadedMinimal.integrityCheckInfo.empty());
+    ASSERT_FALSE(loadedMinimal.fIntegrityCheckMandatory);
+    ASSERT_EQ(loadedMinimal.segments.size(), 1u);
+    ASSERT_EQ(loadedMinimal.segments[0].bytesWritten, 1200u);
+}
+
+TEST_F(DownloadJournalTests, ReplaceAndDelete)
+{
+    DownloadJournal journal(_directory);
+    DownloadJournalRecord record = MakeRecord();
+    journal.Save(record);
+    record.state = DownloadState::Transferring;
+    record.segments[0].bytesWritten = 2500;
+    journal.Save(record);
+
+    // One record per download, no temporary file left behind
+    UINT cFiles = 0;
+    for (const auto& dirEntry : fs::directory_iterator(g_testTempDir))
+    {
+        ASSERT_EQ(dirEntry.path().extension(), ".json");
+        ++cFiles;
+    }
+    ASSERT_EQ(cFiles, 1u);
+
+    auto records = journal.LoadAll();
+    ASSERT_EQ(records.size(), 1u);
+    ASSERT_EQ(records[0].state, DownloadState::Transferring);
+    ASSERT_EQ(records[0].segments[0].bytesWritten, 2500u);
+
+    journal.Delete(record.id);
+    ASSERT_TRUE(journal.LoadAll().empty());
+
+    // Deleting a record that doesn't exist is fine
+    journal.Delete(record.id);
+}
+
+// Unreadable records are dropped without affecting the others, files that aren't records are left alone
+TEST_F(DownloadJournalTests, BadRecords)
+{
+    DownloadJournal journal(_directory);
+    const DownloadJournalRecord record = MakeRecord();
+    journal.Save(record);
+
+    const std::string id = GuidToString(CreateNewGuid());
+    WriteFile("truncated.json", "{\"version\":\"1\",\"id\":");
+    WriteFile("empty.json", "");
+    WriteFile("newer.json", "{\"version\":\"2\"}");
+    WriteFile("badid.json", "{\"version\":\"1\",\"id\":\"not a guid\"}");
+    WriteFile("missing.json", "{\"version\":\"1\",\"id\":\"" + id + "\",\"url\":\"http://example.com/file\"}");
+    WriteFile("nosegments.json", "{\"version\":\"1\",\"id\":\"" + id + "\",\"url\":\"u\",\"path\":\"p\",\"state\":\"5\","
+        "\"bytesTotal\":\"10\",\"noProgressTimeoutSecs\":\"0\",\"destFileCreated\":\"false\",\"etag\":\"\","
+        "\"lastModified\":\"\",\"segments\":\"\"}");
+    WriteFile("other.txt", "not a record");
+    WriteFile("record.json.tmp", "{");
+
+    const auto records = journal.LoadAll();
+    ASSERT_EQ(records.size(), 1u);
+    ASSERT_EQ(GuidToString(records[0].id), GuidToString(record.id));
+
+    for (PCSTR name : { "truncated.json", "empty.json", "newer.json", "badid.json", "missing.json", "nosegments.json" })
+    {
+        ASSERT_FALSE(fs::exists(g_testTempDir / name)) << name;
+    }
+    ASSERT_TRUE(fs::exists(g_testTempDir / "other.txt"));
+    ASSERT_TRUE(fs::exists(g_testTempDir / "record.json.tmp"));
+    ASSERT_EQ(journal.LoadAll().size(), 1u);
+}
+
+// Nothing journaled yet
+TEST_F(DownloadJournalTests, MissingDirectory)
+{
+    DownloadJournal journal((g_testTempDir / "missing").string());
+    ASSERT_TRUE(journal.LoadAll().empty());
+}
@@ -3,10 +3,14 @@
 
 #include "test_common.h"
 
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/read.hpp>
 #include "config_manager.h"
 #include "do_error.h"
+#include "do_test_helpers.h"
 #include "download.h"
 #include "download_manager.h"
+#include "download_status_stream.h"
 #include "test_data.h"
 #include "test_verifiers.h"
 
@@ -82,6 +86,78 @@ TEST_F(DownloadManagerTests, SmallFileDownload)
     VerifyDownloadNotFound(manager, id);
 }
 
+TEST_F(DownloadManagerTests, StatusEvents)
+{
+    dotest::util::BoostAsioWorker asioWorker;
+    boost::asio::local::stream_protocol::socket agentSide(asioWorker.Service());
+    boost::asio::local::stream_protocol::socket clientSide(asioWorker.Service());
+    boost::asio::local::connect_pair(agentSide, clientSide);
+    auto agentSocket = std::make_shared<boost::asio::generic::stream_protocol::socket>(std::move(agentSide));
+
+    const std::string destFile = g_testTempDir / "smallfile.test";
+    const std::string id = manager.CreateDownload(g_smallFileUrl, destFile);
+    manager.AttachStatusStream(id, std::make_shared<DownloadStatusStream>(agentSocket, [](const DownloadStatus& status)
+        {
+            return std::to_string(static_cast<int>(status.State)) + "\n";
+        }));
+    ASSERT_EQ(StartAndWaitUntilNotTransferring(manager, id), S_OK);
+    VerifyDownloadComplete(manager, id, 1837);
+    manager.FinalizeDownload(id);
+
+    // The stream ends after the finalized event
+    boost::asio::streambuf received;
+    boost::system::error_code ec;
+    boost::asio::read(clientSide, received, ec);
+    ASSERT_EQ(ec, boost::asio::error::eof);
+    std::string events(boost::asio::buffers_begin(received.data()), boost::asio::buffers_end(received.data()));
+    events.erase(0, events.find("\r\n\r\n") + 4);
+    std::cout << "Status events:\n" << events;
+
+    const auto created = std::to_string(static_cast<int>(DownloadState::Created)) + "\n";
+    const auto transferred = std::to_string(static_cast<int>(DownloadState::Transferred)) + "\n";
+    const auto finalized = std::to_string(static_cast<int>(DownloadState::Finalized)) + "\n";
+    ASSERT_EQ(events.find(created), 0u);
+    ASSERT_NE(events.find(transferred), std::string::npos);
+    ASSERT_EQ(events.rfind(finalized), events.size() - finalized.size());
+}
+
+TEST_F(DownloadManagerTests, BatchDownloads)
+{
+    const std::string destFile1 = g_testTempDir / "smallfile1.test";
+    const std::string destFile2 = g_testTempDir / "smallfile2.test";
+    std::vector<std::string> ids;
+    for (const auto& result : manager.CreateDownloads({ { g_smallFileUrl, destFile1 }, { g_smallFileUrl, destFile2 } }, true))
+    {
+        ASSERT_EQ(result.second, S_OK);
+        ids.push_back(result.first);
+    }
+    ASSERT_EQ(ids.size(), 2u);
+    ASSERT_EQ(manager.EnumerateDownloads().size(), 2u);
+    ASSERT_EQ(manager.EnumerateDownloads(g_smallFileUrl, destFile2), std::vector<std::string>{ ids[1] });
+
+    std::vector<DownloadStatus> statuses;
+    auto endTime = std::chrono::steady_clock::now() + 5s;
+    do
+    {
+        std::this_thread::sleep_for(500ms);
+        for (HRESULT hr : manager.GetDownloadStatuses(ids, statuses))
+        {
+            ASSERT_EQ(hr, S_OK);
+        }
+    } while ((std::chrono::steady_clock::now() < endTime) && std::any_of(statuses.begin(), statuses.end(),
+        [](const DownloadStatus& status) { return status.State != DownloadState::Transferred; }));
+    VerifyDownloadComplete(manager, ids[0], 1837);
+    VerifyDownloadComplete(manager, ids[1], 1837);
+
+    // Unknown ids fail on their own
+    ids.push_back(GuidToString(CreateNewGuid()));
+    ASSERT_EQ(manager.FinalizeDownloads(ids), (std::vector<HRESULT>{ S_OK, S_OK, E_NOT_SET }));
+    VerifyDownloadNotFound(manager, ids[0]);
+    VerifyDownloadNotFound(manager, ids[1]);
+    VerifyFileSize(destFile1, 1837);
+    VerifyFileSize(destFile2, 1837);
+}
+
 TEST_F(DownloadManagerTests, MultipleDownloads)
 {
     const std::string destFile1 = g_testTempDir / "smallfile.test";
@@ -199,7 +275,8 @@ TEST_F(DownloadManagerTests, PauseResumeDownload)
     ASSERT_EQ(status.ExtendedError, S_OK);
     ASSERT_EQ(status.BytesTotal, 536870440);
     ASSERT_NE(status.BytesTransferred, 0);
-    VerifyFileSize(destFile, status.BytesTransferred);
+    // Segments are written at their own offsets, file can be larger than the bytes transferred so far
+    ASSERT_GE(fs::file_size(destFile), status.BytesTransferred);
 
     ASSERT_EQ(StartAndWaitUntilNotTransferring(manager, id, 5min), S_OK);
     VerifyDownloadComplete(manager, id, 536870440);
@@ -290,3 +367,34 @@ TEST_F(DownloadManagerTests, DownloadPathNotFound)
     });
     manager.AbortDownload(id);
 }
+
+TEST_F(DownloadManagerTests, IntegrityCheckMismatch)
+{
+    const std::string destFile = g_testTempDir / "prodfile.test";
+    const std::string id = manager.CreateDownload(g_smallFileUrl, destFile);
+    VerifyDOResultException(E_INVALIDARG, [&]()
+    {
+        manager.SetDownloadProperty(id, DownloadProperty::IntegrityCheckInfo, "sha256:1234");
+    });
+    manager.SetDownloadProperty(id, DownloadProperty::IntegrityCheckInfo,
+        "sha256:0000000000000000000000000000000000000000000000000000000000000000");
+
+    ASSERT_EQ(StartAndWaitUntilNotTransferring(manager, id, 1min), S_OK);
+    const auto status = manager.GetDownloadStatus(id);
+    VerifyError(status, DO_E_INTEGRITY_CHECK_FAILED);
+    ASSERT_EQ(status.BytesVerified, 0);
+    manager.AbortDownload(id);
+    VerifyFileNotFound(destFile);
+}
+
+TEST_F(DownloadManagerTests, IntegrityCheckMandatory)
+{
+    const std::string destFile = g_testTempDir / "prodfile.test";
+    const std::string id = manager.CreateDownload(g_smallFileUrl, destFile);
+    manager.SetDownloadProperty(id, DownloadProperty::IntegrityCheckMandatory, "1");
+    VerifyDOResultException(DO_E_INTEGRITY_CHECK_INFO_MISSING, [&]()
+    {
+        manager.StartDownload(id);
+    });
+    manager.AbortDownload(id);
+}
@@ -0,0 +1,277 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <openssl/evp.h>
+#include "config_manager.h"
+#include "do_error.h"
+#include "download.h"
+#include "download_manager.h"
+#include "test_http_server.h"
+
+using namespace std::chrono_literals; // NOLINT(build/namespaces)
+
+// Retries, resume with If-Range, restarts on changed content and resume after an agent restart, against a local server
+class DownloadRangeTests : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ClearTestTempDir();
+        _configs = std::make_unique<ConfigManager>((g_testTempDir / "admin-config.json").string(),
+            (g_testTempDir / "sdk-config.json").string());
+        _manager = std::make_unique<DownloadManager>(*_configs);
+        _destFile = (g_testTempDir / "range.test").string();
+    }
+
+    void TearDown() override
+    {
+        _manager.reset();
+        _configs.reset();
+    }
+
+protected:
+    static std::string MakeContent(size_t size, char first)
+    {
+        std::string content(size, '\0');
+        for (size_t i = 0; i < size; ++i)
+        {
+            content[i] = static_cast<char>(first + (i % 26));
+        }
+        return content;
+    }
+
+    // Digests of each piece of the content, in the IntegrityCheckInfo property format
+    static std::string PieceDigests(const std::string& content, size_t pieceSize)
+    {
+        std::ostringstream value;
+        value << "sha256:" << pieceSize << ':' << std::hex << std::setfill('0');
+        for (size_t offset = 0; offset < content.size(); offset += pieceSize)
+        {
+            const std::string piece = content.substr(offset, pieceSize);
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int cbDigest = 0;
+            EVP_Digest(piece.data(), piece.size(), digest, &cbDigest, EVP_sha256(), nullptr);
+            value << ((offset != 0) ? "," : "");
+            for (unsigned int i = 0; i < cbDigest; ++i)
+            {
+                value << std::setw(2) << static_cast<int>(digest[i]);
+            }
+        }
+        return value.str();
+    }
+
+    DownloadStatus DownloadAndWait(const std::string& ranges = {})
+    {
+        const std::string id = _manager->CreateDownload(_server.Url(), _destFile);
+        if (!ranges.empty())
+        {
+            _manager->SetDownloadProperty(id, DownloadProperty::Ranges, ranges);
+        }
+        return StartAndWait(id);
+    }
+
+    DownloadStatus StartAndWait(const std::string& id)
+    {
+        _manager->StartDownload(id);
+        const auto endTime = std::chrono::steady_clock::now() + 15s;
+        while ((std::chrono::steady_clock::now() < endTime)
+            && (_manager->GetDownloadStatus(id).State == DownloadState::Transferring))
+        {
+            std::this_thread::sleep_for(100ms);
+        }
+        return _manager->GetDownloadStatus(id);
+    }
+
+    // Starts a throttled download with the digests and pauses it part way. The manager is then replaced by
+    // one that has only the journal to go by, as after an agent restart.
+    std::string PauseAndRestore(const std::string& digests)
+    {
+        const std::string journalDir = (g_testTempDir / "journal").string();
+        fs::create_directories(journalDir);
+        _manager.reset();
+        _manager = std::make_unique<DownloadManager>(*_configs, journalDir);
+
+        const std::string id = _manager->CreateDownload(_server.Url(), _destFile);
+        _manager->SetDownloadProperty(id, DownloadProperty::IntegrityCheckInfo, digests);
+        _manager->SetDownloadProperty(id, DownloadProperty::IntegrityCheckMandatory, "1");
+        _manager->SetDownloadProperty(id, DownloadProperty::MaxBytesPerSecond, std::to_string(64 * 1024));
+        _manager->StartDownload(id);
+        std::this_thread::sleep_for(1s);
+        _manager->PauseDownload(id);
+        _statusBeforeRestore = _manager->GetDownloadStatus(id);
+
+        _manager.reset();
+        _manager = std::make_unique<DownloadManager>(*_configs, journalDir);
+        _manager->RestoreDownloads();
+        _manager->SetDownloadProperty(id, DownloadProperty::MaxBytesPerSecond, "0");
+        return id;
+    }
+
+    std::string FileContent() const
+    {
+        std::ifstream file(_destFile, std::ios::binary);
+        return std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    }
+
+    TestHttpServer _server;
+    std::unique_ptr<ConfigManager> _configs;
+    std::unique_ptr<DownloadManager> _manager;
+    std::string _destFile;
+    DownloadStatus _statusBeforeRestore;
+};
+
+// Connection breaks after the headers of the first response, before any data. Nothing is known about the
+// content yet, the retry asks for the full file again.
+TEST_F(DownloadRangeTests, RetryAfterHeaders)
+{
+    const auto content = MakeContent(64 * 1024, 'a');
+    _server.SetContent(content, "\"v1\"");
+    _server.CutOffNextResponse(0);
+
+    const auto status = DownloadAndWait();
+    ASSERT_EQ(status.State, DownloadState::Transferred);
+    ASSERT_EQ(status.BytesTransferred, content.size());
+    ASSERT_EQ(FileContent(), content);
+
+    const auto requests = _server.Requests();
+    ASSERT_EQ(requests.size(), 2u);
+    ASSERT_TRUE(requests[0].range.empty());
+    ASSERT_TRUE(requests[1].range.empty());
+}
+
+// A range from the start of the file gets the full content from a server without range support, which is
+// as good as the range then, on the first request as well as on the retry.
+TEST_F(DownloadRangeTests, RetryFromStartWithoutRangeSupport)
+{
+    const auto content = MakeContent(64 * 1024, 'a');
+    _server.SetContent(content, "\"v1\"");
+    _server.SetRangeSupport(false);
+    _server.CutOffNextResponse(0);
+
+    const auto status = DownloadAndWait("0:1000");
+    ASSERT_EQ(status.State, DownloadState::Transferred);
+    ASSERT_EQ(status.BytesTransferred, 1000u);
+    ASSERT_EQ(FileContent().substr(0, 1000), content.substr(0, 1000));
+
+    const auto requests = _server.Requests();
+    ASSERT_EQ(requests.size(), 2u);
+    ASSERT_EQ(requests[0].range, "bytes=0-999");
+    ASSERT_EQ(requests[1].range, "bytes=0-999");
+}
+
+// A range further into the file can't be served without range support
+TEST_F(DownloadRangeTests, ResumeWithoutRangeSupportFails)
+{
+    const auto content = MakeContent(64 * 1024, 'a');
+    _server.SetContent(content, "\"v1\"");
+    _server.SetRangeSupport(false);
+    _server.CutOffNextResponse(1000);
+
+    const auto status = DownloadAndWait();
+    ASSERT_EQ(status.State, DownloadState::Paused);
+    ASSERT_EQ(status.Error, DO_E_INSUFFICIENT_RANGE_SUPPORT);
+    ASSERT_EQ(_server.Requests().size(), 2u);
+}
+
+TEST_F(DownloadRangeTests, ResumeWithIfRange)
+{
+    const auto content = MakeContent(64 * 1024, 'a');
+    _server.SetContent(content, "\"v1\"");
+    _server.CutOffNextResponse(1000);
+
+    const auto status = DownloadAndWait();
+    ASSERT_EQ(status.State, DownloadState::Transferred);
+    ASSERT_EQ(FileContent(), content);
+
+    const auto requests = _server.Requests();
+    ASSERT_EQ(requests.size(), 2u);
+    ASSERT_TRUE(requests[0].ifRange.empty());
+    ASSERT_EQ(requests[1].range, "bytes=1000-65535");
+    ASSERT_EQ(requests[1].ifRange, "\"v1\"");
+}
+
+// Content changes at the source between the first request and the retry. The retry's If-Range doesn't match,
+// the server sends the new content in full and the download starts over with it.
+TEST_F(DownloadRangeTests, RestartOnContentChange)
+{
+    const auto oldContent = MakeContent(64 * 1024, 'a');
+    const auto newContent = MakeContent(48 * 1024, 'A');
+    _server.SetContent(oldContent, "\"v1\"");
+    _server.CutOffNextResponse(1000);
+
+    const std::string id = _manager->CreateDownload(_server.Url(), _destFile);
+    _manager->StartDownload(id);
+    const auto endTime = std::chrono::steady_clock::now() + 15s;
+    while (_server.Requests().empty() && (std::chrono::steady_clock::now() < endTime))
+    {
+        std::this_thread::sleep_for(10ms);
+    }
+    _server.SetContent(newContent, "\"v2\"");
+    while ((std::chrono::steady_clock::now() < endTime) && (_manager->GetDownloadStatus(id).State == DownloadState::Transferring))
+    {
+        std::this_thread::sleep_for(100ms);
+    }
+
+    const auto status = _manager->GetDownloadStatus(id);
+    ASSERT_EQ(status.State, DownloadState::Transferred);
+    ASSERT_EQ(status.BytesTotal, newContent.size());
+    ASSERT_EQ(FileContent(), newContent);
+
+    const auto requests = _server.Requests();
+    ASSERT_EQ(requests.size(), 3u);
+    ASSERT_EQ(requests[1].ifRange, "\"v1\"");
+    ASSERT_TRUE(requests[2].range.empty());
+}
+
+// The digests come back with a restored download. Pieces written before the restart count as verified,
+// the rest is verified as the download resumes.
+TEST_F(DownloadRangeTests, IntegrityCheckAfterRestore)
+{
+    constexpr size_t pieceSize = 16 * 1024;
+    const auto content = MakeContent(256 * 1024, 'a');
+    const auto digests = PieceDigests(content, pieceSize);
+    _server.SetContent(content, "\"v1\"");
+
+    const std::string id = PauseAndRestore(digests);
+    ASSERT_EQ(_statusBeforeRestore.State, DownloadState::Paused);
+    ASSERT_GT(_statusBeforeRestore.BytesTransferred, 0u);
+    ASSERT_LT(_statusBeforeRestore.BytesTransferred, content.size());
+
+    ASSERT_EQ(_manager->GetDownloadProperty(id, DownloadProperty::IntegrityCheckInfo), digests);
+    ASSERT_EQ(_manager->GetDownloadProperty(id, DownloadProperty::IntegrityCheckMandatory), "1");
+    auto status = _manager->GetDownloadStatus(id);
+    ASSERT_EQ(status.State, DownloadState::Paused);
+    ASSERT_LE(status.BytesVerified, status.BytesTransferred);
+    ASSERT_EQ(status.BytesVerified % pieceSize, 0u);
+
+    status = StartAndWait(id);
+    ASSERT_EQ(status.State, DownloadState::Transferred);
+    ASSERT_EQ(status.BytesVerified, content.size());
+    ASSERT_EQ(FileContent(), content);
+}
+
+// Data that doesn't match the digests fails the download after a restart just as well
+TEST_F(DownloadRangeTests, IntegrityCheckFailsAfterRestore)
+{
+    auto content = MakeContent(256 * 1024, 'a');
+    const auto digests = PieceDigests(content, 16 * 1024);
+    _server.SetContent(content, "\"v1\"");
+
+    const std::string id = PauseAndRestore(digests);
+    ASSERT_LT(_statusBeforeRestore.BytesTransferred, content.size());
+
+    // Same validator, the server doesn't know the content is different
+    content.back() = '!';
+    _server.SetContent(content, "\"v1\"");
+    const auto status = StartAndWait(id);
+    ASSERT_EQ(status.State, DownloadState::Paused);
+    ASSERT_EQ(status.Error, DO_E_INTEGRITY_CHECK_FAILED);
+    ASSERT_LT(status.BytesVerified, content.size());
+}
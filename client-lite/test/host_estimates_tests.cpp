@@ -0,0 +1,139 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <algorithm>
+#include <thread>
+#include "config_defaults.h"
+#include "do_host_estimates.h"
+
+using namespace std::chrono_literals; // NOLINT(build/namespaces)
+
+static const HostEstimateTable::HostInfo* FindHost(const std::vector<HostEstimateTable::HostInfo>& hosts,
+    const std::string& host)
+{
+    auto it = std::find_if(hosts.begin(), hosts.end(), [&host](const auto& info)
+        {
+            return info.host == host;
+        });
+    return (it != hosts.end()) ? &(*it) : nullptr;
+}
+
+TEST(HostEstimatesTests, DefaultsForUnknownHost)
+{
+    HostEstimateTable table;
+    ASSERT_EQ(table.ConnectTimeout("a", 15s), 15s);
+    const auto stallThreshold = table.StallThresholdFor("a");
+    ASSERT_EQ(stallThreshold.bytesPerSecond, g_stallSpeedLimitDefault);
+    ASSERT_EQ(stallThreshold.time, g_stallTimeDefault);
+    ASSERT_EQ(table.RetryDelay("a"), g_retryDelayDefault);
+    ASSERT_EQ(table.ExpectedFetchTime("a", 1024), 0ms);
+    ASSERT_TRUE(table.Snapshot().empty());
+}
+
+// Smoothed the same way TCP smooths RTT samples. Samples are binary fractions of a second,
+// so the estimates are exact and their rounding is predictable.
+TEST(HostEstimatesTests, ConnectTimeEwma)
+{
+    HostEstimateTable table;
+    table.OnConnected("a", 125ms);
+    auto info = FindHost(table.Snapshot(), "a");
+    ASSERT_NE(info, nullptr);
+    ASSERT_EQ(info->smoothedConnectTime, 125ms);
+    ASSERT_EQ(info->connectTimeVariation, 63ms);     // half the first sample, 62.5ms
+    ASSERT_EQ(info->connectSamples, 1u);
+
+    // srtt = 7/8 * 125 + 1/8 * 250 = 140.625ms, rttvar = 3/4 * 62.5 + 1/4 * 125 = 78.125ms
+    table.OnConnected("a", 250ms);
+    const auto hosts = table.Snapshot();
+    info = FindHost(hosts, "a");
+    ASSERT_NE(info, nullptr);
+    ASSERT_EQ(info->smoothedConnectTime, 141ms);
+    ASSERT_EQ(info->connectTimeVariation, 79ms);
+    ASSERT_EQ(info->connectSamples, 2u);
+
+    // rto = srtt + 4 * rttvar = 453.125ms
+    ASSERT_EQ(table.ConnectTimeout("a", 15s), 3s);      // 1s + 4 * rto
+    ASSERT_EQ(table.RetryDelay("a"), 907ms);            // 2 * rto
+    ASSERT_EQ(table.StallThresholdFor("a").time, 4s);   // 8 * rto
+    ASSERT_EQ(table.StallThresholdFor("a").bytesPerSecond, g_stallSpeedLimitDefault);
+}
+
+TEST(HostEstimatesTests, ConnectTimeoutBackoff)
+{
+    HostEstimateTable table;
+    table.OnConnectTimedOut("a");
+    table.OnConnectTimedOut("a");
+    ASSERT_EQ(table.ConnectTimeout("a", 5s), 20s);
+
+    // Bounded in count and duration
+    for (int i = 0; i < 10; ++i)
+    {
+        table.OnConnectTimedOut("a");
+    }
+    ASSERT_EQ(FindHost(table.Snapshot(), "a")->connectTimeouts, g_connectTimeoutMaxBackoffs);
+    ASSERT_EQ(table.ConnectTimeout("a", 5s), g_connectTimeoutMax);
+
+    // A successful connect ends the backoff
+    table.OnConnected("a", 125ms);
+    ASSERT_EQ(table.ConnectTimeout("a", 5s), 3s);
+}
+
+TEST(HostEstimatesTests, ThroughputEwma)
+{
+    constexpr UINT64 oneMB = 1024 * 1024;
+    HostEstimateTable table;
+
+    // Too small to tell
+    table.OnTransfer("a", g_hostEstimatesMinThroughputSampleBytes - 1, 1ms);
+    ASSERT_TRUE(table.Snapshot().empty());
+
+    table.OnTransfer("a", oneMB, 1s);
+    ASSERT_EQ(FindHost(table.Snapshot(), "a")->bytesPerSecond, oneMB);
+    ASSERT_EQ(table.StallThresholdFor("a").bytesPerSecond, oneMB / g_stallSpeedLimitDivisor);
+
+    // 3/4 * 1MB/s + 1/4 * 2MB/s
+    table.OnTransfer("a", 2 * oneMB, 1s);
+    const auto info = FindHost(table.Snapshot(), "a");
+    ASSERT_EQ(info->bytesPerSecond, oneMB + (oneMB / 4));
+    ASSERT_EQ(info->throughputSamples, 2u);
+
+    // Connect time and throughput are needed to expect a fetch time
+    ASSERT_EQ(table.ExpectedFetchTime("a", oneMB), 0ms);
+    table.OnConnected("a", 125ms);
+    ASSERT_EQ(table.ExpectedFetchTime("a", oneMB + (oneMB / 4)), 1125ms);
+
+    // Stall limit stays within bounds for very slow and very fast hosts
+    table.OnTransfer("slow", g_hostEstimatesMinThroughputSampleBytes, 1000s);
+    ASSERT_EQ(table.StallThresholdFor("slow").bytesPerSecond, g_stallSpeedLimitMin);
+    table.OnTransfer("fast", 1024 * oneMB, 1s);
+    ASSERT_EQ(table.StallThresholdFor("fast").bytesPerSecond, g_stallSpeedLimitMax);
+}
+
+// The host measured least recently makes room for a new one
+TEST(HostEstimatesTests, Eviction)
+{
+    HostEstimateTable table;
+    table.OnConnected("host0", 125ms);
+    table.OnConnected("host1", 125ms);
+    std::this_thread::sleep_for(2ms);
+    for (size_t i = 2; i < g_hostEstimatesMaxHosts; ++i)
+    {
+        table.OnConnected("host" + std::to_string(i), 125ms);
+    }
+    ASSERT_EQ(table.Snapshot().size(), g_hostEstimatesMaxHosts);
+
+    std::this_thread::sleep_for(2ms);
+    table.OnConnectTimedOut("host0");
+    table.OnConnected("new", 125ms);
+
+    const auto hosts = table.Snapshot();
+    ASSERT_EQ(hosts.size(), g_hostEstimatesMaxHosts);
+    ASSERT_EQ(FindHost(hosts, "host1"), nullptr);
+    ASSERT_NE(FindHost(hosts, "host0"), nullptr);
+    ASSERT_NE(FindHost(hosts, "new"), nullptr);
+
+    // Evicted host is back to the defaults
+    ASSERT_EQ(table.RetryDelay("host1"), g_retryDelayDefault);
+}
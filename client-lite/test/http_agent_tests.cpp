@@ -0,0 +1,131 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <future>
+#include <map>
+#include "do_curl_wrappers.h"
+#include "http_agent.h"
+#include "test_http_server.h"
+
+// Response headers as seen from within OnHeadersAvailable, where the Query* functions are meant to be called
+class HttpAgentTests : public ::testing::Test, public IHttpAgentEvents
+{
+protected:
+    // Sends the request and waits for it to complete
+    void Get(const std::string& url, PCSTR szRange = nullptr)
+    {
+        _completed = std::promise<HRESULT>{};
+        auto result = _completed.get_future();
+        ASSERT_EQ(_agent.SendRequest(url.data(), nullptr, szRange), S_OK);
+        ASSERT_EQ(result.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+        ASSERT_EQ(result.get(), S_OK);
+    }
+
+    // Header value, or "<not set>" if the response doesn't have it
+    const std::string& Header(const std::string& name) const
+    {
+        return _headers.at(name);
+    }
+
+    HRESULT OnHeadersAvailable() override
+    {
+        std::string_view headers;
+        EXPECT_EQ(_agent.QueryHeaders(nullptr, headers), S_OK);
+        _headerBlock = headers;
+        _headers.clear();
+        for (PCSTR name : { "content-length", "ETAG", "X-Padded", "X-Repeated", "X-Empty", "X-Redirect", "X-Missing" })
+        {
+            if (SUCCEEDED(_agent.QueryHeaders(name, headers)))
+            {
+                _headers[name] = headers;
+            }
+            else
+            {
+                _headers[name] = "<not set>";
+            }
+        }
+        _hrContentLength = _agent.QueryContentLength(&_contentLength);
+        _hrContentLengthFromRange = _agent.QueryContentLengthFromRange(&_contentLengthFromRange);
+        return S_OK;
+    }
+
+    HRESULT OnData(BYTE*, UINT) override
+    {
+        return S_OK;
+    }
+
+    HRESULT OnComplete(HRESULT hrRequest, HRESULT hrCallback) override
+    {
+        _completed.set_value(FAILED(hrRequest) ? hrRequest : hrCallback);
+        return S_OK;
+    }
+
+    TestHttpServer _server;
+    CurlRequests _curlOps;
+    HttpAgent _agent { _curlOps, *this };
+    std::promise<HRESULT> _completed;
+
+    std::string _headerBlock;
+    std::map<std::string, std::string> _headers;
+    HRESULT _hrContentLength { E_UNEXPECTED };
+    UINT64 _contentLength { 0 };
+    HRESULT _hrContentLengthFromRange { E_UNEXPECTED };
+    UINT64 _contentLengthFromRange { 0 };
+};
+
+TEST_F(HttpAgentTests, QueryHeaders)
+{
+    _server.SetContent(std::string(1000, 'a'), "\"v1\"");
+    _server.SetExtraHeaders("X-Padded: \t value with  spaces \t\r\n"
+        "X-Repeated: first\r\n"
+        "x-repeated: second\r\n"
+        "X-Empty:\r\n");
+    Get(_server.Url());
+
+    // Names are case-insensitive, values come without surrounding whitespace, the last of repeated headers wins
+    ASSERT_EQ(Header("content-length"), "1000");
+    ASSERT_EQ(Header("ETAG"), "\"v1\"");
+    ASSERT_EQ(Header("X-Padded"), "value with  spaces");
+    ASSERT_EQ(Header("X-Repeated"), "second");
+    ASSERT_EQ(Header("X-Empty"), "");
+    ASSERT_EQ(Header("X-Missing"), "<not set>");
+
+    // All header lines as received, status line first
+    ASSERT_EQ(_headerBlock.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+    ASSERT_NE(_headerBlock.find("X-Repeated: first\r\n"), std::string::npos);
+
+    ASSERT_EQ(_hrContentLength, S_OK);
+    ASSERT_EQ(_contentLength, 1000u);
+    ASSERT_EQ(_hrContentLengthFromRange, E_NOT_SET);
+}
+
+TEST_F(HttpAgentTests, QueryContentLengthFromRange)
+{
+    _server.SetContent(std::string(1000, 'a'), "\"v1\"");
+    Get(_server.Url(), "100-199");
+
+    ASSERT_EQ(Header("content-length"), "100");
+    ASSERT_EQ(_hrContentLengthFromRange, S_OK);
+    ASSERT_EQ(_contentLengthFromRange, 1000u);
+}
+
+// Only the final response's headers are kept when following a redirect, the index is rebuilt for it
+TEST_F(HttpAgentTests, HeadersAfterRedirect)
+{
+    _server.SetContent(std::string(1000, 'a'), "\"v1\"");
+    Get(_server.UrlForPath("/moved"));
+    ASSERT_EQ(_server.Requests().size(), 2u);
+
+    ASSERT_EQ(Header("X-Redirect"), "<not set>");
+    ASSERT_EQ(Header("content-length"), "1000");
+    ASSERT_EQ(_headerBlock.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+    ASSERT_EQ(_headerBlock.find("302"), std::string::npos);
+
+    // Same agent, next request starts over with the headers
+    _server.SetExtraHeaders("X-Repeated: only\r\n");
+    Get(_server.Url());
+    ASSERT_EQ(Header("X-Repeated"), "only");
+    ASSERT_EQ(Header("X-Redirect"), "<not set>");
+}
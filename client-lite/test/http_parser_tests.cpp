@@ -0,0 +1,167 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <chrono>
+#include <stdexcept>
+#include "do_http_parser.h"
+
+namespace msdod = microsoft::deliveryoptimization::details;
+
+static const std::string g_request = "POST /download/create?Uri=http://example.com/file HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 13\r\n"
+    "\r\n"
+    "{\"Ids\":[\"1\"]}";
+
+static const std::string g_response = "HTTP/1.1 200 OK\r\n"
+    "content-length: 2\r\n"
+    "Server: Delivery-Optimization-Agent/1.0\r\n"
+    "\r\n"
+    "{}";
+
+static void VerifyRequest(const msdod::HttpParser& parser)
+{
+    ASSERT_TRUE(parser.Done());
+    ASSERT_EQ(parser.Method(), "POST");
+    ASSERT_EQ(parser.Url().path(), "/download/create");
+    ASSERT_EQ(parser.Body(), "{\"Ids\":[\"1\"]}");
+    ASSERT_TRUE(parser.ParsedData()->keepAlive);
+}
+
+TEST(HttpParserTests, Request)
+{
+    msdod::HttpParser parser;
+    ASSERT_EQ(parser.OnData(g_request.data(), g_request.size()), g_request.size());
+    VerifyRequest(parser);
+}
+
+TEST(HttpParserTests, Response)
+{
+    msdod::HttpParser parser;
+    ASSERT_EQ(parser.OnData(g_response.data(), g_response.size()), g_response.size());
+    ASSERT_TRUE(parser.Done());
+    ASSERT_EQ(parser.StatusCode(), 200u);
+    ASSERT_EQ(parser.Body(), "{}");
+}
+
+TEST(HttpParserTests, ByteAtATime)
+{
+    msdod::HttpParser parser;
+    for (size_t i = 0; i < g_request.size(); ++i)
+    {
+        ASSERT_FALSE(parser.Done());
+        ASSERT_EQ(parser.OnData(&g_request[i], 1), 1u);
+    }
+    VerifyRequest(parser);
+}
+
+TEST(HttpParserTests, KeepAliveFraming)
+{
+    const std::string getRequest = "GET /download/enumerate HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    const std::string data = g_request + getRequest + g_request;
+
+    msdod::HttpParser parser;
+    size_t offset = parser.OnData(data.data(), data.size());
+    ASSERT_EQ(offset, g_request.size());
+    VerifyRequest(parser);
+
+    // Parsed message stays valid after Reset, the listener hands it to another thread
+    const auto firstRequest = parser.ParsedData();
+    parser.Reset();
+    offset += parser.OnData(data.data() + offset, data.size() - offset);
+    ASSERT_EQ(offset, g_request.size() + getRequest.size());
+    ASSERT_TRUE(parser.Done());
+    ASSERT_EQ(parser.Method(), "GET");
+    ASSERT_TRUE(parser.Body().empty());
+    ASSERT_EQ(firstRequest->body, "{\"Ids\":[\"1\"]}");
+
+    parser.Reset();
+    offset += parser.OnData(data.data() + offset, data.size() - offset);
+    ASSERT_EQ(offset, data.size());
+    VerifyRequest(parser);
+}
+
+TEST(HttpParserTests, SplitReads)
+{
+    // Split in the middle of the request line, a field and the body
+    const size_t splits[] = { 10, 70, g_request.size() - 5 };
+    msdod::HttpParser parser;
+    size_t offset = 0;
+    for (auto split : splits)
+    {
+        ASSERT_EQ(parser.OnData(g_request.data() + offset, split - offset), split - offset);
+        ASSERT_FALSE(parser.Done());
+        offset = split;
+    }
+    ASSERT_EQ(parser.OnData(g_request.data() + offset, g_request.size() - offset), g_request.size() - offset);
+    VerifyRequest(parser);
+}
+
+TEST(HttpParserTests, ConnectionClose)
+{
+    const std::string request = "GET /download/enumerate HTTP/1.1\r\nConnection: Close\r\n\r\n";
+    msdod::HttpParser parser;
+    parser.OnData(request.data(), request.size());
+    ASSERT_TRUE(parser.Done());
+    ASSERT_FALSE(parser.ParsedData()->keepAlive);
+}
+
+TEST(HttpParserTests, MalformedMessages)
+{
+    auto fnParse = [](const std::string& message)
+    {
+        msdod::HttpParser parser;
+        parser.OnData(message.data(), message.size());
+    };
+
+    ASSERT_THROW(fnParse("NOT A VALID LINE\r\n"), std::invalid_argument);
+    ASSERT_THROW(fnParse("GET /download/enumerate HTTP/1.1\n"), std::invalid_argument);
+    ASSERT_THROW(fnParse("HTTP/1.1 2x0 OK\r\n"), std::invalid_argument);
+    ASSERT_THROW(fnParse("GET / HTTP/1.1\r\nContent-Length: abc\r\n"), std::invalid_argument);
+    ASSERT_THROW(fnParse("GET / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n"), std::length_error);
+    ASSERT_THROW(fnParse("GET /" + std::string(20 * 1024, 'a')), std::length_error);
+}
+
+TEST(HttpParserTests, PerMessageCost)
+{
+    std::string data;
+    constexpr size_t numMessages = 1000;
+    for (size_t i = 0; i < numMessages; ++i)
+    {
+        data += g_request;
+    }
+
+    // Fed in the listener's receive buffer size, so most messages span two reads
+    constexpr size_t recvBufSize = 2048;
+    constexpr size_t numIterations = 20;
+    msdod::HttpParser parser;
+    size_t numParsed = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t iteration = 0; iteration < numIterations; ++iteration)
+    {
+        for (size_t offset = 0; offset < data.size(); offset += recvBufSize)
+        {
+            const char* pData = data.data() + offset;
+            size_t cbData = std::min(recvBufSize, data.size() - offset);
+            while (cbData != 0)
+            {
+                const size_t cbParsed = parser.OnData(pData, cbData);
+                pData += cbParsed;
+                cbData -= cbParsed;
+                if (parser.Done())
+                {
+                    ++numParsed;
+                    parser.Reset();
+                }
+            }
+        }
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    ASSERT_EQ(numParsed, numMessages * numIterations);
+    std::cout << "Parsed " << numParsed << " messages of " << g_request.size() << " bytes, "
+        << (elapsed.count() / numParsed) << " ns per message\n";
+}
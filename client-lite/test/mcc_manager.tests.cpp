@@ -15,6 +15,7 @@
 #include "config_defaults.h"
 #include "config_manager.h"
 #include "do_error.h"
+#include "do_host_estimates.h"
 #include "do_test_helpers.h"
 #include "download_manager.h"
 #include "download_status.h"
@@ -87,12 +88,12 @@ public:
     }
 
 protected:
-    void _VerifyExpectedCacheHost(const std::string& expectedHostValue)
+    void _VerifyExpectedCacheHosts(const std::vector<std::string>& expectedHostValues)
     {
         ConfigManager configReader(g_adminConfigFilePath.string(), g_sdkConfigFilePath.string());
         MCCManager mccManager(configReader);
-        std::string mccHost = mccManager.GetHost();
-        ASSERT_EQ(mccHost, expectedHostValue);
+        const auto mccHosts = mccManager.GetHosts();
+        ASSERT_EQ(mccHosts, expectedHostValues);
     }
 };
 
@@ -100,35 +101,99 @@ TEST_F(MCCManagerTests, ParseIoTConnectionString)
 {
     // Gateway specified as the last element
     SetIoTConnectionString("HostName=instance-company-iothub-ver.host.tld;DeviceId=user-dev-name;SharedAccessKey=abcdefghijklmnopqrstuvwxyzABCDE123456789012=;GatewayHostName=" TEST_MOCK_MCC_HOST);
-    _VerifyExpectedCacheHost(TEST_MOCK_MCC_HOST);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST });
 
     // Gateway specified in the middle
     SetIoTConnectionString("HostName=instance-company-iothub-ver.host.tld;GatewayHostName=" TEST_MOCK_MCC_HOST ";DeviceId=user-dev-name;SharedAccessKey=abcdefghijklmnopqrstuvwxyzABCDE123456789012=");
-    _VerifyExpectedCacheHost(TEST_MOCK_MCC_HOST);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST });
 
     // No gateway specified
     fs::remove(g_sdkConfigFilePath);
-    _VerifyExpectedCacheHost("");
+    _VerifyExpectedCacheHosts({});
 }
 
 TEST_F(MCCManagerTests, AdminConfigOverride)
 {
     SetIoTConnectionString("HostName=instance-company-iothub-ver.host.tld;DeviceId=user-dev-name;SharedAccessKey=abcdefghijklmnopqrstuvwxyzABCDE123456789012=;GatewayHostName=" TEST_MOCK_MCC_HOST);
     SetDOCacheHostConfig(TEST_MOCK_MCC_HOST2);
-    _VerifyExpectedCacheHost(TEST_MOCK_MCC_HOST2);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST2 });
 
     fs::remove(g_adminConfigFilePath);
-    _VerifyExpectedCacheHost(TEST_MOCK_MCC_HOST);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST });
 }
 
 TEST_F(MCCManagerTests, AdminConfigEmptyString)
 {
     SetIoTConnectionString("HostName=instance-company-iothub-ver.host.tld;DeviceId=user-dev-name;SharedAccessKey=abcdefghijklmnopqrstuvwxyzABCDE123456789012=;GatewayHostName=" TEST_MOCK_MCC_HOST);
     SetDOCacheHostConfig("");
-    _VerifyExpectedCacheHost("");
+    _VerifyExpectedCacheHosts({});
 
     fs::remove(g_adminConfigFilePath);
-    _VerifyExpectedCacheHost(TEST_MOCK_MCC_HOST);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST });
+}
+
+TEST_F(MCCManagerTests, AdminConfigHostList)
+{
+    SetDOCacheHostConfig(TEST_MOCK_MCC_HOST ", " TEST_MOCK_MCC_HOST2);
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST, TEST_MOCK_MCC_HOST2 });
+
+    SetDOCacheHostConfig(" " TEST_MOCK_MCC_HOST2 "  " TEST_MOCK_MCC_HOST ",");
+    _VerifyExpectedCacheHosts({ TEST_MOCK_MCC_HOST2, TEST_MOCK_MCC_HOST });
+}
+
+TEST_F(MCCManagerTests, SelectHostByEstimatesAndHealth)
+{
+    const std::string originalHost = "dl.delivery.mp.microsoft.com";
+    SetDOCacheHostConfig(TEST_MOCK_MCC_HOST ", " TEST_MOCK_MCC_HOST2);
+
+    ConfigManager configReader(g_adminConfigFilePath.string(), g_sdkConfigFilePath.string());
+    MCCManager mccManager(configReader);
+    HostEstimateTable hostEstimates;
+
+    // Nothing measured yet, configured order
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates), TEST_MOCK_MCC_HOST);
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates, TEST_MOCK_MCC_HOST), TEST_MOCK_MCC_HOST2);
+
+    // Faster host first
+    hostEstimates.OnConnected(TEST_MOCK_MCC_HOST, 50ms);
+    hostEstimates.OnTransfer(TEST_MOCK_MCC_HOST, 4 * 1024 * 1024, 4s);
+    hostEstimates.OnConnected(TEST_MOCK_MCC_HOST2, 5ms);
+    hostEstimates.OnTransfer(TEST_MOCK_MCC_HOST2, 4 * 1024 * 1024, 1s);
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates), TEST_MOCK_MCC_HOST2);
+
+    // Failing host last
+    for (int i = 0; i < 4; ++i)
+    {
+        mccManager.ReportHostError(HTTP_E_STATUS_SERVER_ERROR, 500, TEST_MOCK_MCC_HOST2, originalHost);
+    }
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates), TEST_MOCK_MCC_HOST);
+
+    // Banned host not at all
+    mccManager.ReportHostError(HRESULT_FROM_WIN32(ERROR_WINHTTP_CANNOT_CONNECT), 0, TEST_MOCK_MCC_HOST, originalHost);
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates), TEST_MOCK_MCC_HOST2);
+    ASSERT_EQ(mccManager.SelectHost(originalHost, hostEstimates, TEST_MOCK_MCC_HOST2), "");
+}
+
+TEST_F(MCCManagerTests, ProbeResultBansAndUnbans)
+{
+    const std::string originalHost = "dl.delivery.mp.microsoft.com";
+    const std::string otherOriginalHost = "download.windowsupdate.com";
+    ConfigManager configReader(g_adminConfigFilePath.string(), g_sdkConfigFilePath.string());
+    MCCManager mccManager(configReader);
+
+    mccManager.ReportProbeResult(TEST_MOCK_MCC_HOST, false);
+    ASSERT_TRUE(mccManager.IsBanned(TEST_MOCK_MCC_HOST, originalHost));
+    ASSERT_TRUE(mccManager.IsBanned(TEST_MOCK_MCC_HOST, otherOriginalHost));
+    ASSERT_FALSE(mccManager.IsBanned(TEST_MOCK_MCC_HOST2, originalHost));
+
+    mccManager.ReportProbeResult(TEST_MOCK_MCC_HOST, true);
+    ASSERT_FALSE(mccManager.IsBanned(TEST_MOCK_MCC_HOST, originalHost));
+
+    // A host that doesn't serve an original host keeps that ban after a successful probe
+    mccManager.ReportHostError(HTTP_E_STATUS_NOT_FOUND, 404, TEST_MOCK_MCC_HOST, originalHost);
+    mccManager.ReportProbeResult(TEST_MOCK_MCC_HOST, true);
+    ASSERT_TRUE(mccManager.IsBanned(TEST_MOCK_MCC_HOST, originalHost));
+    ASSERT_FALSE(mccManager.IsBanned(TEST_MOCK_MCC_HOST, otherOriginalHost));
 }
 
 // Disabled tests: Azure lab MCC instance isn't responding quickly with 404.
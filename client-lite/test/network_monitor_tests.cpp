@@ -54,6 +54,14 @@ TEST_F(NetworkMonitorTests, BasicNetworkConnected)
     ASSERT_TRUE(NetworkMonitor::HasViableInterface());
 }
 
+// Proxy lookups are cached for as long as the fingerprint stays the same
+TEST_F(NetworkMonitorTests, FingerprintStableWhileConnected)
+{
+    const auto fingerprint = NetworkMonitor::ViableInterfacesFingerprint();
+    ASSERT_FALSE(fingerprint.empty());
+    ASSERT_EQ(fingerprint, NetworkMonitor::ViableInterfacesFingerprint());
+}
+
 void NetworkMonitorTests::_EnableNetwork()
 {
     TestHelpers::EnableNetwork();
@@ -4,6 +4,16 @@
 #include "test_common.h"
 #include "rest_http_listener.h"
 
+#include <future>
+#include <mutex>
+#include <thread>
+#include <grp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "do_test_helpers.h"
 
 using btcp_t = boost::asio::ip::tcp;
@@ -67,3 +77,307 @@ TEST(RestListenerTests, ManyPortsInUse)
     std::cout << "Time taken for listener to start: " << elapsedMsecs << "ms\n";
     EXPECT_LT(elapsedMsecs, 2000);
 }
+
+TEST(RestListenerTests, LocalSocketPeerIsLocal)
+{
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    std::promise<bool> peerIsLocal;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(),
+        [&peerIsLocal](const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>&, HttpListenerConnection& conn)
+        {
+            peerIsLocal.set_value(conn.IsLocalPeer());
+        }, socketPath);
+    std::cout << "Listener started at: " << listener.Endpoint() << "\n";
+
+    boost::asio::local::stream_protocol::socket sock(asioWorker.Service());
+    sock.connect(boost::asio::local::stream_protocol::endpoint(socketPath));
+    const std::string request = "GET /download/enumerate HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    boost::asio::write(sock, boost::asio::buffer(request));
+
+    auto result = peerIsLocal.get_future();
+    ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_TRUE(result.get());
+    listener.Stop();
+}
+
+TEST(RestListenerTests, LocalSocketPermissions)
+{
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(), http_listener_callback_t{}, socketPath);
+
+    struct stat st {};
+    ASSERT_EQ(stat(socketPath.c_str(), &st), 0);
+    ASSERT_EQ(st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO), static_cast<mode_t>(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP));
+
+    listener.Stop();
+    ASSERT_FALSE(fs::exists(socketPath));
+}
+
+// Connects to the socket as another user in a child process and sends a request, returns the child's pid
+static pid_t ConnectAsUser(const std::string& socketPath, uid_t uid, gid_t gid, const std::vector<gid_t>& groups)
+{
+    const pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+
+    if ((setgroups(groups.size(), groups.data()) != 0) || (setgid(gid) != 0) || (setuid(uid) != 0))
+    {
+        _exit(1);
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        _exit(2);
+    }
+    const char request[] = "GET /download/enumerate HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    if (write(fd, request, sizeof(request) - 1) != static_cast<ssize_t>(sizeof(request) - 1))
+    {
+        _exit(3);
+    }
+
+    // Stay connected until the listener is done with the connection
+    char buf[1];
+    (void)read(fd, buf, sizeof(buf));
+    _exit(0);
+}
+
+// Peers on the unix domain socket must be root, the agent's user or in its group. The socket file is opened up
+// here so that the kernel lets the other users connect and it comes down to the listener's check.
+TEST(RestListenerTests, LocalSocketPeerPolicy)
+{
+    if (geteuid() != 0)
+    {
+        GTEST_SKIP() << "Needs root to connect as other users";
+    }
+
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    std::mutex mutex;
+    std::promise<bool> peerIsLocal;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(),
+        [&](const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>&, HttpListenerConnection& conn)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            peerIsLocal.set_value(conn.IsLocalPeer());
+            conn.Reply(200);
+        }, socketPath);
+    ASSERT_EQ(chmod(socketPath.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH), 0);
+
+    // nobody, without and then with the agent's group as a supplementary group
+    constexpr uid_t nobody = 65534;
+    const std::vector<std::pair<std::vector<gid_t>, bool>> cases = { { {}, false }, { { getegid() }, true } };
+    for (const auto& testCase : cases)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        peerIsLocal = std::promise<bool>{};
+        auto result = peerIsLocal.get_future();
+        lock.unlock();
+
+        const pid_t pid = ConnectAsUser(socketPath, nobody, nobody, testCase.first);
+        ASSERT_EQ(result.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+        EXPECT_EQ(result.get(), testCase.second);
+
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        EXPECT_TRUE(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+    listener.Stop();
+}
+
+using local_socket_t = boost::asio::local::stream_protocol::socket;
+
+// Reads one response and returns its body
+static std::string ReadResponse(local_socket_t& sock, boost::asio::streambuf& buf)
+{
+    const size_t cbHeaders = boost::asio::read_until(sock, buf, "\r\n\r\n");
+    const std::string headers{boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + cbHeaders};
+    buf.consume(cbHeaders);
+
+    const std::string contentLengthName = "Content-Length: ";
+    const auto contentLengthStart = headers.find(contentLengthName);
+    const size_t cbBody = (contentLengthStart != std::string::npos)
+        ? std::stoul(headers.substr(contentLengthStart + contentLengthName.size())) : 0;
+    if (buf.size() < cbBody)
+    {
+        boost::asio::read(sock, buf, boost::asio::transfer_exactly(cbBody - buf.size()));
+    }
+    const std::string body{boost::asio::buffers_begin(buf.data()), boost::asio::buffers_begin(buf.data()) + cbBody};
+    buf.consume(cbBody);
+    return body;
+}
+
+// Returns once the handlers posted so far, and the ones they post, have run
+static void WaitForPostedHandlers(boost::asio::io_service& io)
+{
+    std::promise<void> done;
+    io.post([&io, &done]()
+        {
+            io.post([&done]() { done.set_value(); });
+        });
+    done.get_future().wait();
+}
+
+// Replies large enough to take several writes each must still go out whole and in order
+TEST(RestListenerTests, PipelinedRequestsReplyInOrder)
+{
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(),
+        [](const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet, HttpListenerConnection& conn)
+        {
+            const std::string path = packet->url.path();
+            conn.Reply(200, std::string(1024 * 1024, path.back()));
+        }, socketPath);
+
+    local_socket_t sock(asioWorker.Service());
+    sock.connect(boost::asio::local::stream_protocol::endpoint(socketPath));
+    const std::string requests = "GET /a HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+        "GET /b HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+        "GET /c HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    boost::asio::write(sock, boost::asio::buffer(requests));
+
+    boost::asio::streambuf buf;
+    for (const char expected : { 'a', 'b', 'c' })
+    {
+        const std::string body = ReadResponse(sock, buf);
+        ASSERT_EQ(body.size(), 1024u * 1024u);
+        ASSERT_EQ(body.find_first_not_of(expected), std::string::npos);
+    }
+    listener.Stop();
+}
+
+// A request replied to later, from another thread, holds up the requests after it on its connection only
+TEST(RestListenerTests, LateReply)
+{
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    std::mutex mutex;
+    std::vector<std::string> paths;
+    std::promise<std::shared_ptr<HttpListenerConnection>> slowConn;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(),
+        [&](const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet, HttpListenerConnection& conn)
+        {
+            const std::string path = packet->url.path();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                paths.push_back(path);
+            }
+            if (path == "/slow")
+            {
+                slowConn.set_value(conn.shared_from_this());
+                return;
+            }
+            conn.Reply(200, path);
+        }, socketPath);
+
+    local_socket_t slowSock(asioWorker.Service());
+    slowSock.connect(boost::asio::local::stream_protocol::endpoint(socketPath));
+    const std::string slowRequests = "GET /slow HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+        "GET /after HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    boost::asio::write(slowSock, boost::asio::buffer(slowRequests));
+    auto connFuture = slowConn.get_future();
+    ASSERT_EQ(connFuture.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+
+    local_socket_t fastSock(asioWorker.Service());
+    fastSock.connect(boost::asio::local::stream_protocol::endpoint(socketPath));
+    const std::string fastRequest = "GET /fast HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    boost::asio::write(fastSock, boost::asio::buffer(fastRequest));
+    boost::asio::streambuf fastBuf;
+    ASSERT_EQ(ReadResponse(fastSock, fastBuf), "/fast");
+
+    WaitForPostedHandlers(asioWorker.Service());
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ASSERT_EQ(paths, (std::vector<std::string>{ "/slow", "/fast" }));
+    }
+
+    auto conn = connFuture.get();
+    std::thread([&conn]() { conn->Reply(200, "/slow"); }).join();
+    conn.reset();
+
+    boost::asio::streambuf slowBuf;
+    ASSERT_EQ(ReadResponse(slowSock, slowBuf), "/slow");
+    ASSERT_EQ(ReadResponse(slowSock, slowBuf), "/after");
+    listener.Stop();
+}
+
+// Requests pipelined after one that takes over the socket belong to the new owner, they are not parsed
+TEST(RestListenerTests, NoRequestsAfterTakeOver)
+{
+    ClearTestTempDir();
+    const auto socketPath = (g_testTempDir / "restapi.sock").string();
+
+    dotest::util::BoostAsioWorker asioWorker;
+    std::mutex mutex;
+    std::vector<std::string> paths;
+    std::promise<std::shared_ptr<HttpListenerConnection::socket_t>> takenSocket;
+    RestHttpListener listener;
+    listener.Start(asioWorker.Service(),
+        [&](const std::shared_ptr<microsoft::deliveryoptimization::details::HttpPacket>& packet, HttpListenerConnection& conn)
+        {
+            const std::string path = packet->url.path();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                paths.push_back(path);
+            }
+            if (path == "/take")
+            {
+                conn.Detach();
+                takenSocket.set_value(conn.Socket());
+                return;
+            }
+            conn.Reply(200, path);
+        }, socketPath);
+
+    local_socket_t sock(asioWorker.Service());
+    sock.connect(boost::asio::local::stream_protocol::endpoint(socketPath));
+    const std::string requests = "GET /a HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+        "GET /take HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+        "GET /b HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    boost::asio::write(sock, boost::asio::buffer(requests));
+
+    boost::asio::streambuf buf;
+    ASSERT_EQ(ReadResponse(sock, buf), "/a");
+
+    // The new owner's data comes next, nothing for /b before or after it
+    auto socketFuture = takenSocket.get_future();
+    ASSERT_EQ(socketFuture.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    auto socket = socketFuture.get();
+    const std::string ownerData = "owner";
+    boost::asio::write(*socket, boost::asio::buffer(ownerData));
+    socket->shutdown(boost::asio::socket_base::shutdown_both);
+    socket->close();
+
+    boost::system::error_code ec;
+    boost::asio::read(sock, buf, boost::asio::transfer_all(), ec);
+    ASSERT_EQ(ec, boost::asio::error::eof);
+    ASSERT_EQ(std::string(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_end(buf.data())), ownerData);
+
+    WaitForPostedHandlers(asioWorker.Service());
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_EQ(paths, (std::vector<std::string>{ "/a", "/take" }));
+    lock.unlock();
+    listener.Stop();
+}
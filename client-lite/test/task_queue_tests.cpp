@@ -0,0 +1,145 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <algorithm>
+#include <thread>
+#include "task_queue.h"
+
+class TaskQueueTests : public ::testing::Test
+{
+protected:
+    void Add(int id, std::chrono::milliseconds delay, const void* tag = nullptr)
+    {
+        _queue.Add([this, id]() { _ran.push_back(id); }, delay, tag);
+    }
+
+    // Runs all ops that are ready and returns their ids in the order they ran
+    std::vector<int> RunReady()
+    {
+        _ran.clear();
+        while (auto task = _queue.popNextReady())
+        {
+            task->Run();
+        }
+        return _ran;
+    }
+
+    TaskQueue _queue;
+    std::vector<int> _ran;
+};
+
+TEST_F(TaskQueueTests, TimeOrdering)
+{
+    Add(3, std::chrono::milliseconds(60));
+    Add(1, std::chrono::milliseconds(20));
+    Add(2, std::chrono::milliseconds(40));
+    ASSERT_GT(_queue.NextTime(), TaskQueue::clock_t::now());
+    ASSERT_EQ(_queue.popNextReady(), nullptr);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(RunReady(), (std::vector<int>{ 1, 2, 3 }));
+    ASSERT_EQ(_queue.NextTime(), TaskQueue::timepoint_t::max());
+}
+
+TEST_F(TaskQueueTests, FifoForSameDueTime)
+{
+    std::vector<int> expected;
+    for (int i = 0; i < 100; ++i)
+    {
+        Add(i, std::chrono::milliseconds(0));
+        expected.push_back(i);
+    }
+    ASSERT_EQ(RunReady(), expected);
+}
+
+TEST_F(TaskQueueTests, AddFront)
+{
+    Add(1, std::chrono::milliseconds(0));
+    Add(2, std::chrono::milliseconds(0));
+    _queue.AddFront([this]() { _ran.push_back(0); });
+    ASSERT_EQ(RunReady(), (std::vector<int>{ 0, 1, 2 }));
+
+    // Runs right away even when the earliest op is not due yet
+    Add(2, std::chrono::hours(1));
+    _queue.AddFront([this]() { _ran.push_back(1); });
+    ASSERT_EQ(RunReady(), (std::vector<int>{ 1 }));
+}
+
+TEST_F(TaskQueueTests, RemoveByTag)
+{
+    int tagA = 0;
+    int tagB = 0;
+    Add(1, std::chrono::milliseconds(0), &tagA);
+    Add(2, std::chrono::milliseconds(0), &tagB);
+    Add(3, std::chrono::milliseconds(0), &tagA);
+    Add(4, std::chrono::milliseconds(0));
+    Add(5, std::chrono::milliseconds(0), &tagA);
+    Add(6, std::chrono::milliseconds(0), &tagB);
+    ASSERT_TRUE(_queue.Exists(&tagA));
+    ASSERT_TRUE(_queue.Exists(&tagB));
+    ASSERT_FALSE(_queue.Exists(nullptr));
+
+    _queue.Remove(&tagA);
+    _queue.Remove(nullptr);
+    ASSERT_FALSE(_queue.Exists(&tagA));
+    ASSERT_TRUE(_queue.Exists(&tagB));
+
+    const void* tag = nullptr;
+    auto task = _queue.popNextReady(&tag);
+    ASSERT_NE(task, nullptr);
+    ASSERT_EQ(tag, &tagB);
+    task->Run();
+    ASSERT_TRUE(_queue.Exists(&tagB));  // one more op with this tag
+
+    ASSERT_EQ(RunReady(), (std::vector<int>{ 4, 6 }));
+    ASSERT_FALSE(_queue.Exists(&tagB));
+
+    // Tag can be reused once its ops are gone
+    Add(7, std::chrono::milliseconds(0), &tagA);
+    ASSERT_TRUE(_queue.Exists(&tagA));
+    ASSERT_EQ(RunReady(), (std::vector<int>{ 7 }));
+    ASSERT_FALSE(_queue.Exists(&tagA));
+}
+
+// Removing ops from anywhere in the heap must keep the rest in order
+TEST_F(TaskQueueTests, RemoveFromMiddle)
+{
+    constexpr int numOps = 60;
+    std::vector<int> tags(numOps);
+    std::vector<std::pair<int, int>> delayAndId;
+    for (int i = 0; i < numOps; ++i)
+    {
+        // Spread across buckets that are far enough apart for the time spent adding not to matter
+        const int delayMs = ((i * 7) % 20) * 5;
+        Add(i, std::chrono::milliseconds(delayMs), &tags[i]);
+        delayAndId.emplace_back(delayMs, i);
+    }
+
+    for (int i = 0; i < numOps; i += 3)
+    {
+        _queue.Remove(&tags[i]);
+    }
+    delayAndId.erase(std::remove_if(delayAndId.begin(), delayAndId.end(), [](const auto& entry)
+        {
+            return (entry.second % 3) == 0;
+        }), delayAndId.end());
+
+    std::stable_sort(delayAndId.begin(), delayAndId.end(), [](const auto& lhs, const auto& rhs)
+        {
+            return lhs.first < rhs.first;
+        });
+    std::vector<int> expected;
+    for (const auto& entry : delayAndId)
+    {
+        expected.push_back(entry.second);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_EQ(RunReady(), expected);
+    for (int i = 0; i < numOps; ++i)
+    {
+        ASSERT_FALSE(_queue.Exists(&tags[i]));
+    }
+}
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+#include "test_http_server.h"
+
+#include <sstream>
+
+using btcp_t = boost::asio::ip::tcp;
+
+struct TestHttpServer::Connection
+{
+    Connection(boost::asio::io_service& io) :
+        socket(io)
+    {
+    }
+
+    btcp_t::socket socket;
+    boost::asio::streambuf requestBuf;
+    std::string response;
+};
+
+// Value of the header in the request's header block, empty if not present
+static std::string HeaderValue(const std::string& headers, const std::string& name)
+{
+    const std::string prefix = "\r\n" + name + ": ";
+    const auto start = headers.find(prefix);
+    if (start == std::string::npos)
+    {
+        return {};
+    }
+    const auto valueStart = start + prefix.size();
+    return headers.substr(valueStart, headers.find("\r\n", valueStart) - valueStart);
+}
+
+TestHttpServer::TestHttpServer() :
+    _acceptor(_io, btcp_t::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+{
+    _Accept();
+    _ioThread = std::thread{[this]() { _io.run(); }};
+}
+
+TestHttpServer::~TestHttpServer()
+{
+    _io.stop();
+    _ioThread.join();
+}
+
+std::string TestHttpServer::Url() const
+{
+    return UrlForPath("/file");
+}
+
+std::string TestHttpServer::UrlForPath(const std::string& path) const
+{
+    return "http://127.0.0.1:" + std::to_string(_acceptor.local_endpoint().port()) + path;
+}
+
+void TestHttpServer::SetContent(std::string content, std::string etag)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _content = std::move(content);
+    _etag = std::move(etag);
+}
+
+void TestHttpServer::SetRangeSupport(bool fSupported)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _fRangeSupport = fSupported;
+}
+
+void TestHttpServer::SetExtraHeaders(std::string headerLines)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _extraHeaders = std::move(headerLines);
+}
+
+void TestHttpServer::CutOffNextResponse(size_t cbBody)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cbCutOff = cbBody;
+}
+
+std::vector<TestHttpServer::Request> TestHttpServer::Requests() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _requests;
+}
+
+void TestHttpServer::_Accept()
+{
+    auto connection = std::make_shared<Connection>(_io);
+    _acceptor.async_accept(connection->socket, [this, connection](const boost::system::error_code& ec)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            boost::asio::async_read_until(connection->socket, connection->requestBuf, "\r\n\r\n",
+                [this, connection](const boost::system::error_code& ec, size_t)
+                {
+                    if (!ec)
+                    {
+                        _OnRequest(connection);
+                    }
+                });
+            _Accept();
+        });
+}
+
+void TestHttpServer::_OnRequest(const std::shared_ptr<Connection>& connection)
+{
+    const std::string headers{boost::asio::buffers_begin(connection->requestBuf.data()),
+        boost::asio::buffers_end(connection->requestBuf.data())};
+    Request request;
+    const auto methodEnd = headers.find(' ');
+    request.method = headers.substr(0, methodEnd);
+    const std::string path = headers.substr(methodEnd + 1, headers.find(' ', methodEnd + 1) - (methodEnd + 1));
+    request.range = HeaderValue(headers, "Range");
+    request.ifRange = HeaderValue(headers, "If-Range");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    const bool fHead = (request.method == "HEAD");
+    if (!fHead)
+    {
+        _requests.push_back(request);
+    }
+
+    std::ostringstream response;
+    if (path != "/file")
+    {
+        response << "HTTP/1.1 302 Found\r\nLocation: /file\r\nX-Redirect: " << path << "\r\n";
+        response << "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        lock.unlock();
+        _Send(connection, response.str());
+        return;
+    }
+
+    // Full content unless the range is supported and, with If-Range, the content is unchanged
+    size_t first = 0;
+    size_t last = _content.size() - 1;
+    const bool fPartial = !request.range.empty() && _fRangeSupport && (request.ifRange.empty() || (request.ifRange == _etag));
+    if (fPartial)
+    {
+        const std::string range = request.range.substr(request.range.find('=') + 1);
+        const auto dash = range.find('-');
+        first = std::stoull(range.substr(0, dash));
+        if ((dash + 1) < range.size())
+        {
+            last = std::min<size_t>(std::stoull(range.substr(dash + 1)), last);
+        }
+    }
+
+    response << (fPartial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n");
+    response << "Content-Length: " << (last - first + 1) << "\r\n";
+    if (fPartial)
+    {
+        response << "Content-Range: bytes " << first << '-' << last << '/' << _content.size() << "\r\n";
+    }
+    if (_fRangeSupport)
+    {
+        response << "Accept-Ranges: bytes\r\n";
+    }
+    if (!_etag.empty())
+    {
+        response << "ETag: " << _etag << "\r\n";
+    }
+    response << _extraHeaders;
+    response << "Connection: close\r\n\r\n";
+    if (!fHead)
+    {
+        response << _content.substr(first, std::min(last - first + 1, _cbCutOff));
+        _cbCutOff = std::string::npos;
+    }
+    lock.unlock();
+    _Send(connection, response.str());
+}
+
+void TestHttpServer::_Send(const std::shared_ptr<Connection>& connection, std::string response)
+{
+    connection->response = std::move(response);
+    boost::asio::async_write(connection->socket, boost::asio::buffer(connection->response),
+        [connection](const boost::system::error_code&, size_t)
+        {
+            boost::system::error_code ec;
+            connection->socket.shutdown(btcp_t::socket::shutdown_both, ec);
+            connection->socket.close(ec);
+        });
+}
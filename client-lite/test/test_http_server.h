@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+// Serves a single file over http on the loopback interface, for download tests that need control over
+// the server's behavior. Responses close the connection. Ranges are single "first-last" or "first-" ranges.
+// Requests for any other path are redirected to the file, with the path in an X-Redirect header.
+class TestHttpServer
+{
+public:
+    struct Request
+    {
+        std::string method;
+        std::string range;      // Range header value, empty if none
+        std::string ifRange;    // If-Range header value, empty if none
+    };
+
+    TestHttpServer();
+    ~TestHttpServer();
+
+    std::string Url() const;
+    std::string UrlForPath(const std::string& path) const;
+
+    void SetContent(std::string content, std::string etag);
+
+    // Without range support, range requests get the full content with a 200
+    void SetRangeSupport(bool fSupported);
+
+    // Header lines, each ending with "\r\n", added to the file's responses
+    void SetExtraHeaders(std::string headerLines);
+
+    // The next GET response is cut off after cbBody bytes of its body, as if the connection broke
+    void CutOffNextResponse(size_t cbBody);
+
+    // GET requests only, HEAD requests from connection prewarming are left out
+    std::vector<Request> Requests() const;
+
+private:
+    struct Connection;
+
+    void _Accept();
+    void _OnRequest(const std::shared_ptr<Connection>& connection);
+    void _Send(const std::shared_ptr<Connection>& connection, std::string response);
+
+    boost::asio::io_service _io;
+    boost::asio::ip::tcp::acceptor _acceptor;
+    std::thread _ioThread;
+
+    mutable std::mutex _mutex;
+    std::string _content;
+    std::string _etag;
+    std::string _extraHeaders;
+    bool _fRangeSupport { true };
+    size_t _cbCutOff { std::string::npos };
+    std::vector<Request> _requests;
+};
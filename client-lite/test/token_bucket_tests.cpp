@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <thread>
+#include "config_defaults.h"
+#include "do_token_bucket.h"
+
+using namespace std::chrono_literals; // NOLINT(build/namespaces)
+
+constexpr UINT64 g_oneMBps = 1024 * 1024;
+
+TEST(TokenBucketTests, UnlimitedByDefault)
+{
+    TokenBucket bucket;
+    ASSERT_EQ(bucket.Rate(), 0u);
+    bucket.Consume(100 * 1024 * 1024);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+}
+
+// A full bucket allows a burst right away, consuming beyond it is a debt paid off at the rate
+TEST(TokenBucketTests, BurstThenDebt)
+{
+    TokenBucket bucket;
+    bucket.SetRate(g_oneMBps);
+    ASSERT_EQ(bucket.Rate(), g_oneMBps);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+
+    // Burst allowance is the rate over the burst interval
+    const auto cbBurst = static_cast<size_t>(g_oneMBps * g_rateLimiterBurstInterval.count() / 1000);
+    bucket.Consume(cbBurst);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+
+    bucket.Consume(g_oneMBps);
+    auto delay = bucket.Delay();
+    ASSERT_LE(delay, 1000ms);
+    ASSERT_GT(delay, 900ms);
+
+    std::this_thread::sleep_for(300ms);
+    delay = bucket.Delay();
+    ASSERT_LE(delay, 700ms);
+    ASSERT_GT(delay, 500ms);
+}
+
+// Small rates still allow one transfer chunk at a time
+TEST(TokenBucketTests, MinimumBurst)
+{
+    TokenBucket bucket;
+    bucket.SetRate(1024);
+    bucket.Consume(g_rateLimiterMinBurstBytes);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+
+    bucket.Consume(1024);
+    ASSERT_GT(bucket.Delay(), 900ms);
+}
+
+TEST(TokenBucketTests, RateChange)
+{
+    TokenBucket bucket;
+    bucket.SetRate(g_oneMBps);
+    bucket.Consume(static_cast<size_t>(g_oneMBps / 10) + g_oneMBps);
+    ASSERT_GT(bucket.Delay(), 900ms);
+
+    // The debt carries over and is paid off at the new rate
+    bucket.SetRate(2 * g_oneMBps);
+    auto delay = bucket.Delay();
+    ASSERT_LE(delay, 500ms);
+    ASSERT_GT(delay, 400ms);
+
+    // Unlimited drops the debt, a new limit starts with a full bucket
+    bucket.SetRate(0);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+    bucket.SetRate(g_oneMBps);
+    ASSERT_EQ(bucket.Delay(), 0ms);
+}
+
+// Consumers that wait out the delay stay within the rate plus the burst
+TEST(TokenBucketTests, LongTermRate)
+{
+    constexpr UINT64 rate = 4 * g_oneMBps;
+    constexpr size_t cbChunk = 64 * 1024;
+    TokenBucket bucket;
+    bucket.SetRate(rate);
+
+    const auto start = std::chrono::steady_clock::now();
+    UINT64 cbConsumed = 0;
+    while (cbConsumed < (2 * rate))
+    {
+        const auto delay = bucket.Delay();
+        if (delay != 0ms)
+        {
+            std::this_thread::sleep_for(delay);
+            continue;
+        }
+        bucket.Consume(cbChunk);
+        cbConsumed += cbChunk;
+    }
+    const double elapsedSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The last chunk is consumed without waiting for it
+    const double cbAllowed = (elapsedSecs * rate) + (static_cast<double>(rate) / 10) + cbChunk;
+    ASSERT_LE(static_cast<double>(cbConsumed), cbAllowed);
+    ASSERT_GT(elapsedSecs, 1.5);
+}
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "test_common.h"
+
+#include <condition_variable>
+#include <mutex>
+#include "do_file.h"
+#include "do_write_behind.h"
+
+// Streams that stop writing partway through a buffer must not keep the others from getting one
+TEST(WriteBehindTests, MoreStreamsThanBuffers)
+{
+    ClearTestTempDir();
+    const auto filePath = (g_testTempDir / "write_behind.dat").string();
+    DOFile file = DOFile::Create(filePath);
+
+    constexpr size_t bufferSize = 4096;
+    constexpr UINT maxBuffers = 2;
+    constexpr size_t numStreams = 5;
+    WriteBehindQueue queue(bufferSize, maxBuffers);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t numBuffersAvailable = 0;
+    std::vector<std::unique_ptr<WriteBehindQueue::Stream>> streams;
+    for (size_t i = 0; i < numStreams; ++i)
+    {
+        streams.push_back(std::make_unique<WriteBehindQueue::Stream>(queue, file, [&]()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++numBuffersAvailable;
+                cv.notify_all();
+            }));
+    }
+
+    // Each stream writes less than a buffer into its own region of the file and then goes quiet,
+    // like a paused or rate limited transfer
+    constexpr size_t cbWrite = 100;
+    for (size_t i = 0; i < numStreams; ++i)
+    {
+        const std::vector<BYTE> data(cbWrite, static_cast<BYTE>('a' + i));
+        const UINT64 offset = i * bufferSize;
+        HRESULT hr = streams[i]->Write(offset, data.data(), data.size());
+        if (hr == E_PENDING)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return numBuffersAvailable != 0; }));
+            numBuffersAvailable = 0;
+            lock.unlock();
+            hr = streams[i]->Write(offset, data.data(), data.size());
+        }
+        ASSERT_EQ(hr, S_OK) << "Stream " << i;
+    }
+
+    for (auto& stream : streams)
+    {
+        UINT64 failedOffset;
+        ASSERT_EQ(stream->Drain(&failedOffset), S_OK);
+    }
+
+    for (size_t i = 0; i < numStreams; ++i)
+    {
+        std::vector<BYTE> readBuf(cbWrite);
+        ASSERT_EQ(file.Read(i * bufferSize, readBuf.data(), readBuf.size()), cbWrite);
+        ASSERT_EQ(readBuf, std::vector<BYTE>(cbWrite, static_cast<BYTE>('a' + i)));
+        ASSERT_EQ(streams[i]->WrittenOffset(), (i * bufferSize) + cbWrite);
+    }
+
+    streams.clear();
+    file.Close();
+}
@@ -4,7 +4,6 @@
 #ifndef _DELIVERY_OPTIMIZATION_DO_HTTP_PACKET_H
 #define _DELIVERY_OPTIMIZATION_DO_HTTP_PACKET_H
 
-#include <sstream>
 #include <string>
 #include "do_cpprest_uri.h"
 
@@ -21,7 +20,8 @@ struct HttpPacket
     cpprest_web::uri url;           // request or response
     unsigned int statusCode { 0 };  // response
     size_t contentLength { 0 };     // request or response
-    std::stringstream body;         // request or response
+    std::string body;               // request or response
+    bool keepAlive { true };        // request or response, false for "Connection: close"
 };
 
 } // namespace details
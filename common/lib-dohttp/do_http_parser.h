@@ -5,9 +5,8 @@
 #define _DELIVERY_OPTIMIZATION_DO_HTTP_PARSER_H
 
 #include <memory>
-#include <sstream>
 #include <string>
-#include <vector>
+#include <string_view>
 #include "do_http_packet.h"
 
 namespace microsoft
@@ -19,12 +18,23 @@ namespace details
 
 // Very limited parsing abilities, just enough to support the SDK/Agent's requests and responses.
 // Credit: Code takes a little inspiration from Boost.Beast. Too bad it is not available on Ubuntu 18.04.
+//
+// Incremental: lines are parsed in place from the data passed in, only a line split across OnData calls is
+// copied, into a buffer reserved the first time that happens. Messages are framed by Content-Length, so several
+// of them can arrive back to back on a keep-alive connection.
+//
+// Each message is still parsed into its own HttpPacket: the packet is handed off to the caller and outlives the
+// data it was parsed from, so it owns copies of the url and body. The method fits in the string's small buffer.
 class HttpParser
 {
 public:
     HttpParser();
 
-    void OnData(const char* pData, size_t cb);
+    // Parses up to the end of the current message and returns how much of the data that took.
+    // The rest belongs to the next message, pass it in again after Reset().
+    size_t OnData(const char* pData, size_t cb);
+
+    // Starts the next message, the parsed one stays with whoever holds ParsedData()
     void Reset();
 
     bool Done() const noexcept
@@ -35,13 +45,14 @@ public:
     const std::string& Method() const { return _parsedData->method; }
     const cpprest_web::uri& Url() const { return _parsedData->url; }
     unsigned int StatusCode() const { return _parsedData->statusCode; }
-    std::stringstream& Body() { return _parsedData->body; }
+    const std::string& Body() const { return _parsedData->body; }
     const std::shared_ptr<HttpPacket>& ParsedData() const { return _parsedData; }
 
 private:
-    bool _ParseBuf();
-    bool _ParseNextField();
-    std::vector<char>::iterator _FindCRLF(std::vector<char>::iterator itStart);
+    void _OnLine(std::string_view line);
+    void _OnFirstLine(std::string_view line);
+    void _OnField(std::string_view field);
+    size_t _OnBodyData(const char* pData, size_t cb);
 
     // Parsing info
     enum class ParserState
@@ -53,8 +64,8 @@ private:
     };
 
     ParserState _state { ParserState::FirstLine };
-    std::vector<char> _incomingDataBuf;
-    std::vector<char>::iterator _itParseFrom;
+    std::string _partialLine;
+    size_t _cbHeaders { 0 };
 
     std::shared_ptr<HttpPacket> _parsedData;
 };
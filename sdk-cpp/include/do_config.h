@@ -22,6 +22,11 @@ extern "C"
     // Returns: 0 on success, error code otherwise
     int deliveryoptimization_set_iot_connection_string(const char* value);
 
+    // Sets how many connections to the agent the SDK may keep open, which is how many requests from different
+    // threads can be in flight at once. Requests beyond that wait for a connection. Defaults to 8.
+    // Returns: 0 on success, error code otherwise
+    int deliveryoptimization_set_max_agent_connections(unsigned int maxConnections);
+
     // Future: Version and any future methods could be moved out from the extern C area
     // (and use C++ features) if ADU client does not have a need to call these from its lower layer.
 
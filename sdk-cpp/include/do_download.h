@@ -8,6 +8,7 @@
 #include <chrono>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "do_download_status.h"
@@ -95,9 +96,24 @@ public:
     static std::error_code get_downloads(download_property prop, const std::string& value, std::vector<std::unique_ptr<download>>& out) noexcept;
     static std::error_code get_downloads(download_property prop, const std::wstring& value, std::vector<std::unique_ptr<download>>& out) noexcept;
 
+    // Batch forms of make, start, pause, finalize, abort and get_status. Each is a single request to the agent however
+    // many downloads it covers. results has the outcome for each download, in the order given, and a failure for one
+    // download doesn't fail the others. The returned error is for the batch as a whole.
+    // make_batch takes (uri, downloadFilePath) pairs, out gets nullptr for the downloads that failed to be made.
+    static std::error_code make_batch(const std::vector<std::pair<std::string, std::string>>& urisAndPaths, bool start,
+        std::vector<std::unique_ptr<download>>& out, std::vector<std::error_code>& results) noexcept;
+    static std::error_code start_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept;
+    static std::error_code pause_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept;
+    static std::error_code finalize_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept;
+    static std::error_code abort_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept;
+    static std::error_code get_status_batch(const std::vector<download*>& downloads, std::vector<download_status>& statuses,
+        std::vector<std::error_code>& results) noexcept;
+
 private:
     download();
 
+    static std::error_code _GetImpls(const std::vector<download*>& downloads, std::vector<details::IDownload*>& impls) noexcept;
+
     std::unique_ptr<details::IDownload> _download;
 };
 
@@ -9,6 +9,11 @@ extern "C" int deliveryoptimization_set_iot_connection_string(const char* value)
     return internal_set_iot_connection_string(value);
 }
 
+extern "C" int deliveryoptimization_set_max_agent_connections(unsigned int maxConnections)
+{
+    return internal_set_max_agent_connections(maxConnections);
+}
+
 extern "C" char* deliveryoptimization_get_components_version()
 {
     return internal_get_components_version();
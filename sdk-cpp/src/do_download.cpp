@@ -5,7 +5,6 @@
 
 #include <system_error>
 #include <cassert>
-#include <thread>
 
 #include "download_impl.h"
 #include "do_errors.h"
@@ -123,12 +122,12 @@ std::error_code download::start_and_wait_until_completion(const std::atomic_bool
         {
             break;
         }
-        std::this_thread::sleep_for(pollTime);
+        // Returns as soon as the status changes, pollTime only bounds how long a cancel can go unnoticed
+        DO_RETURN_IF_FAILED(_download->WaitForStatusChange(status, pollTime));
         if (pollTime < maxPollTime)
         {
             pollTime += 500ms;
         }
-        DO_RETURN_IF_FAILED(get_status(status));
         timedOut = std::chrono::system_clock::now() >= endTime;
     } while ((status.state() == download_state::created || status.state() == download_state::transferring || status.is_transient_error())
         && !timedOut);
@@ -238,5 +237,75 @@ std::error_code download::get_downloads(download_property prop, const std::wstri
     return DO_OK;
 }
 
+std::error_code download::make_batch(const std::vector<std::pair<std::string, std::string>>& urisAndPaths, bool start,
+    std::vector<std::unique_ptr<download>>& out, std::vector<std::error_code>& results) noexcept
+{
+    out.clear();
+    results.clear();
+    std::vector<std::unique_ptr<details::IDownload>> impls;
+    DO_RETURN_IF_FAILED(msdod::CDownloadImpl::MakeBatch(urisAndPaths, start, impls, results));
+    for (auto& impl : impls)
+    {
+        std::unique_ptr<download> tmp;
+        if (impl)
+        {
+            tmp.reset(new download());
+            tmp->_download = std::move(impl);
+        }
+        out.push_back(std::move(tmp));
+    }
+    return DO_OK;
+}
+
+std::error_code download::start_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept
+{
+    std::vector<details::IDownload*> impls;
+    DO_RETURN_IF_FAILED(_GetImpls(downloads, impls));
+    return msdod::CDownloadImpl::OperationBatch(msdod::CDownloadImpl::BatchOperation::Start, impls, results);
+}
+
+std::error_code download::pause_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept
+{
+    std::vector<details::IDownload*> impls;
+    DO_RETURN_IF_FAILED(_GetImpls(downloads, impls));
+    return msdod::CDownloadImpl::OperationBatch(msdod::CDownloadImpl::BatchOperation::Pause, impls, results);
+}
+
+std::error_code download::finalize_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept
+{
+    std::vector<details::IDownload*> impls;
+    DO_RETURN_IF_FAILED(_GetImpls(downloads, impls));
+    return msdod::CDownloadImpl::OperationBatch(msdod::CDownloadImpl::BatchOperation::Finalize, impls, results);
+}
+
+std::error_code download::abort_batch(const std::vector<download*>& downloads, std::vector<std::error_code>& results) noexcept
+{
+    std::vector<details::IDownload*> impls;
+    DO_RETURN_IF_FAILED(_GetImpls(downloads, impls));
+    return msdod::CDownloadImpl::OperationBatch(msdod::CDownloadImpl::BatchOperation::Abort, impls, results);
+}
+
+std::error_code download::get_status_batch(const std::vector<download*>& downloads, std::vector<download_status>& statuses,
+    std::vector<std::error_code>& results) noexcept
+{
+    std::vector<details::IDownload*> impls;
+    DO_RETURN_IF_FAILED(_GetImpls(downloads, impls));
+    return msdod::CDownloadImpl::GetStatusBatch(impls, statuses, results);
+}
+
+std::error_code download::_GetImpls(const std::vector<download*>& downloads, std::vector<details::IDownload*>& impls) noexcept
+{
+    impls.clear();
+    for (download* pDownload : downloads)
+    {
+        if (pDownload == nullptr)
+        {
+            return details::make_error_code(errc::invalid_arg);
+        }
+        impls.push_back(pDownload->_download.get());
+    }
+    return DO_OK;
+}
+
 } // namespace deliveryoptimization
 } // namespace microsoft
@@ -10,6 +10,11 @@ int internal_set_iot_connection_string(const char* value)
     return msdo::errc::not_impl;
 }
 
+int internal_set_max_agent_connections(unsigned int maxConnections)
+{
+    return msdo::errc::not_impl;
+}
+
 char* internal_get_components_version()
 {
     return nullptr;
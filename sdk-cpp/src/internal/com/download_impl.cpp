@@ -3,6 +3,8 @@
 
 #include "download_impl.h"
 
+#include <thread>
+
 #include "do_download_property_internal.h"
 #include "do_error_helpers.h"
 
@@ -195,6 +197,13 @@ std::error_code CDownloadImpl::GetStatus(msdo::download_status& status) noexcept
     return DO_OK;
 }
 
+// DoSvc invokes the status callback, waits poll
+std::error_code CDownloadImpl::WaitForStatusChange(msdo::download_status& status, std::chrono::milliseconds timeout) noexcept
+{
+    std::this_thread::sleep_for(timeout);
+    return GetStatus(status);
+}
+
 std::error_code CDownloadImpl::SetStatusCallback(const msdo::status_callback_t& callback, msdo::download& download) noexcept
 {
     ComPtr<DOStatusCallback> spCallback;
@@ -334,6 +343,62 @@ std::error_code CDownloadImpl::EnumDownloads(download_property prop, const std::
     return _EnumDownloads(&category, out);
 }
 
+// The COM interface has no batch calls, the batch methods go through the downloads one by one
+std::error_code CDownloadImpl::MakeBatch(const std::vector<std::pair<std::string, std::string>>& urisAndPaths, bool start,
+    std::vector<std::unique_ptr<IDownload>>& out, std::vector<std::error_code>& results) noexcept
+{
+    out.clear();
+    results.clear();
+    for (const auto& uriAndPath : urisAndPaths)
+    {
+        auto tmp = std::make_unique<CDownloadImpl>();
+        std::error_code ec = tmp->Init(uriAndPath.first, uriAndPath.second);
+        if (ec)
+        {
+            tmp.reset();
+        }
+        else if (start)
+        {
+            ec = tmp->Start();
+        }
+        out.push_back(std::move(tmp));
+        results.push_back(ec);
+    }
+    return DO_OK;
+}
+
+std::error_code CDownloadImpl::OperationBatch(BatchOperation op, const std::vector<IDownload*>& downloads,
+    std::vector<std::error_code>& results) noexcept
+{
+    results.clear();
+    for (IDownload* download : downloads)
+    {
+        switch (op)
+        {
+        case BatchOperation::Start:     results.push_back(download->Start()); break;
+        case BatchOperation::Pause:     results.push_back(download->Pause()); break;
+        case BatchOperation::Finalize:  results.push_back(download->Finalize()); break;
+        case BatchOperation::Abort:     results.push_back(download->Abort()); break;
+        default:
+            results.clear();
+            return make_error_code(errc::invalid_arg);
+        }
+    }
+    return DO_OK;
+}
+
+std::error_code CDownloadImpl::GetStatusBatch(const std::vector<IDownload*>& downloads, std::vector<download_status>& statuses,
+    std::vector<std::error_code>& results) noexcept
+{
+    statuses.assign(downloads.size(), download_status{});
+    results.clear();
+    for (size_t i = 0; i < downloads.size(); ++i)
+    {
+        results.push_back(downloads[i]->GetStatus(statuses[i]));
+    }
+    return DO_OK;
+}
+
 std::error_code CDownloadImpl::_EnumDownloads(const DO_DOWNLOAD_ENUM_CATEGORY* pCategory, std::vector<std::unique_ptr<IDownload>>& out) noexcept
 {
     out.clear();
@@ -8,6 +8,8 @@
 
 int internal_set_iot_connection_string(const char* value);
 
+int internal_set_max_agent_connections(unsigned int maxConnections);
+
 char* internal_get_components_version();
 
 void internal_free_version_buf(char** ppBuffer);
@@ -4,7 +4,13 @@
 #ifndef _DELIVERY_OPTIMIZATION_DOWNLOAD_IMPL_H
 #define _DELIVERY_OPTIMIZATION_DOWNLOAD_IMPL_H
 
+#include <memory>
+#include <utility>
 #include <vector>
+#if defined(DO_INTERFACE_REST)
+#include <condition_variable>
+#include <mutex>
+#endif
 
 #include "download_interface.h"
 
@@ -13,6 +19,9 @@
 
 // Future: delete the local copy of deliveryoptimization.h and require Windows SDK 22621+
 #include <deliveryoptimization.h> // IDODownload, etc.
+#elif defined(DO_INTERFACE_REST)
+#include "do_download_stream.h"
+#include "do_status_subscription.h"
 #endif
 
 namespace microsoft
@@ -35,6 +44,7 @@ public:
     std::error_code Abort() noexcept override;
 
     std::error_code GetStatus(download_status& status) noexcept override;
+    std::error_code WaitForStatusChange(download_status& status, std::chrono::milliseconds timeout) noexcept override;
     std::error_code SetStatusCallback(const status_callback_t& callback, download& download) noexcept override;
     std::error_code SetStreamCallback(const output_stream_callback_t& callback) noexcept override;
     std::error_code GetProperty(download_property key, download_property_value& value) noexcept override;
@@ -46,6 +56,21 @@ public:
     static std::error_code EnumDownloads(download_property prop, const std::string& value, std::vector<std::unique_ptr<IDownload>>& out) noexcept;
     static std::error_code EnumDownloads(download_property prop, const std::wstring& value, std::vector<std::unique_ptr<IDownload>>& out) noexcept;
 
+    // See download::make_batch and the other batch methods. Downloads passed in are all CDownloadImpl.
+    enum class BatchOperation
+    {
+        Start,
+        Pause,
+        Finalize,
+        Abort,
+    };
+    static std::error_code MakeBatch(const std::vector<std::pair<std::string, std::string>>& urisAndPaths, bool start,
+        std::vector<std::unique_ptr<IDownload>>& out, std::vector<std::error_code>& results) noexcept;
+    static std::error_code OperationBatch(BatchOperation op, const std::vector<IDownload*>& downloads,
+        std::vector<std::error_code>& results) noexcept;
+    static std::error_code GetStatusBatch(const std::vector<IDownload*>& downloads, std::vector<download_status>& statuses,
+        std::vector<std::error_code>& results) noexcept;
+
 private:
 #if defined(DO_INTERFACE_COM)
     static std::error_code CDownloadImpl::_EnumDownloads(const DO_DOWNLOAD_ENUM_CATEGORY* pCategory, std::vector<std::unique_ptr<IDownload>>& out) noexcept;
@@ -54,8 +79,26 @@ private:
     std::unique_ptr<DO_DOWNLOAD_RANGES_INFO> _spRanges;
 #elif defined(DO_INTERFACE_REST)
     std::error_code _DownloadOperationCall(const std::string& type) noexcept;
+    std::error_code _EnsureStream() noexcept;
+    std::error_code _EnsureStatusSubscription() noexcept;
+    void _OnStatusEvent(const boost::property_tree::ptree* statusJson);
 
     std::string _id;
+    output_stream_callback_t _streamCallback;
+    std::unique_ptr<CDownloadStream> _stream;
+
+    // Latest status pushed by the agent, see CStatusSubscription
+    std::mutex _statusMutex;
+    std::condition_variable _cvStatusEvent;
+    download_status _lastStatusEvent;
+    bool _fStatusEventReceived { false };
+    bool _fSubscriptionEnded { false };
+    status_callback_t _statusCallback;
+    download* _statusCallbackDownload { nullptr };
+
+    // Declared last, its thread invokes _OnStatusEvent until it is destroyed
+    std::mutex _subscriptionMutex;
+    std::unique_ptr<CStatusSubscription> _statusSubscription;
 #endif
 };
 
@@ -4,6 +4,7 @@
 #ifndef _DELIVERY_OPTIMIZATION_DOWNLOAD_INTERFACE_H
 #define _DELIVERY_OPTIMIZATION_DOWNLOAD_INTERFACE_H
 
+#include <chrono>
 #include <string>
 
 #include "do_download_status.h"
@@ -32,6 +33,9 @@ public:
     virtual std::error_code Abort() noexcept = 0;
 
     virtual std::error_code GetStatus(download_status& status) noexcept = 0;
+
+    // Returns the current status once it differs from the given one or the timeout elapses, whichever is first
+    virtual std::error_code WaitForStatusChange(download_status& status, std::chrono::milliseconds timeout) noexcept = 0;
     virtual std::error_code SetStatusCallback(const status_callback_t& callback, download& download) noexcept = 0;
     virtual std::error_code SetStreamCallback(const output_stream_callback_t& callback) noexcept = 0;
 
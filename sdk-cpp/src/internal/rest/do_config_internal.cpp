@@ -13,9 +13,9 @@
 #include "do_filesystem.h"
 #include "do_persistence.h"
 #include "do_version.h"
-#elif defined(DO_CLIENT_DOSVC)
-#include "do_errors.h" // msdo::errc::not_impl
 #endif
+#include "do_errors.h" // msdo::errc
+#include "do_http_client.h"
 
 namespace msdo = microsoft::deliveryoptimization;
 
@@ -209,3 +209,12 @@ void internal_free_version_buf(char** ppBuffer)
 
 #endif // End !DO_CLIENT_AGENT
 
+int internal_set_max_agent_connections(unsigned int maxConnections)
+{
+    if (maxConnections == 0)
+    {
+        return msdo::errc::invalid_arg;
+    }
+    microsoft::deliveryoptimization::details::CHttpClient::SetMaxConnections(maxConnections);
+    return 0;
+}
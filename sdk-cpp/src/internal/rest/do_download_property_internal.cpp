@@ -12,6 +12,20 @@ namespace deliveryoptimization
 namespace details
 {
 
+// Values are read back as the type they were made with
+template <typename T>
+static std::error_code GetAs(const CDownloadPropertyValueInternal::native_type& var, T& val) noexcept
+{
+    const T* pVal = boost::get<T>(&var);
+    if (pVal == nullptr)
+    {
+        return make_error_code(errc::invalid_arg);
+    }
+    val = *pVal;
+    return DO_OK;
+}
+
+// None of the properties the agent supports take a string yet
 std::error_code CDownloadPropertyValueInternal::Init(const std::string& val) noexcept
 {
     return make_error_code(errc::not_impl);
@@ -24,32 +38,35 @@ std::error_code CDownloadPropertyValueInternal::Init(const std::wstring& val) no
 
 std::error_code CDownloadPropertyValueInternal::Init(uint32_t val) noexcept
 {
-    return make_error_code(errc::not_impl);
+    _var = val;
+    return DO_OK;
 }
 
 std::error_code CDownloadPropertyValueInternal::Init(uint64_t val) noexcept
 {
-    return make_error_code(errc::not_impl);
+    _var = val;
+    return DO_OK;
 }
 
 std::error_code CDownloadPropertyValueInternal::Init(bool val) noexcept
 {
-    return make_error_code(errc::not_impl);
+    _var = val;
+    return DO_OK;
 }
 
 std::error_code CDownloadPropertyValueInternal::As(bool& val) const noexcept
 {
-    return make_error_code(errc::not_impl);
+    return GetAs(_var, val);
 }
 
 std::error_code CDownloadPropertyValueInternal::As(uint32_t& val) const noexcept
 {
-    return make_error_code(errc::not_impl);
+    return GetAs(_var, val);
 }
 
 std::error_code CDownloadPropertyValueInternal::As(uint64_t& val) const noexcept
 {
-    return make_error_code(errc::not_impl);
+    return GetAs(_var, val);
 }
 
 std::error_code CDownloadPropertyValueInternal::As(std::string& val) const noexcept
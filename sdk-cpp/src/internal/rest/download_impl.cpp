@@ -3,6 +3,7 @@
 
 #include "download_impl.h"
 
+#include <algorithm>
 #include <map>
 #include <thread>
 
@@ -23,6 +24,108 @@ namespace deliveryoptimization
 {
 namespace details
 {
+
+// Same fields in getstatus responses and status events. Throws when the JSON doesn't have them.
+static download_status StatusFromJson(const boost::property_tree::ptree& statusJson)
+{
+    uint64_t bytesTotal = statusJson.get<uint64_t>("BytesTotal");
+    uint64_t bytesTransferred = statusJson.get<uint64_t>("BytesTransferred");
+    int32_t errorCode = statusJson.get<int32_t>("ErrorCode");
+    int32_t extendedErrorCode = statusJson.get<int32_t>("ExtendedErrorCode");
+
+    static const std::map<std::string, download_state> stateMap =
+    { { "Created", download_state::created },
+    { "Transferring", download_state::transferring },
+    { "Transferred", download_state::transferred },
+    { "Finalized", download_state::finalized },
+    { "Aborted", download_state::aborted },
+    { "Paused", download_state::paused } };
+
+    download_state status = download_state::created;
+    auto it = stateMap.find(statusJson.get<std::string>("Status"));
+    if (it != stateMap.end())
+    {
+        status = it->second;
+    }
+    else
+    {
+        ThrowException(msdo::errc::unexpected);
+    }
+
+    return download_status(bytesTotal, bytesTransferred, errorCode, extendedErrorCode, status);
+}
+
+static bool IsSameStatus(const download_status& a, const download_status& b)
+{
+    return (a.state() == b.state()) && (a.bytes_total() == b.bytes_total()) && (a.bytes_transferred() == b.bytes_transferred())
+        && (a.error_code() == b.error_code()) && (a.extended_error_code() == b.extended_error_code());
+}
+
+// Properties the agent supports through setproperty and getproperty, all of them uint32
+static const char* AgentPropertyName(download_property key)
+{
+    switch (key)
+    {
+    case download_property::callback_freq_percent: return "CallbackFreqPercent";
+    case download_property::callback_freq_seconds: return "CallbackFreqSeconds";
+    default: return nullptr;
+    }
+}
+
+// Array elements are children with empty names
+static void AddToArray(boost::property_tree::ptree& array, boost::property_tree::ptree element)
+{
+    array.push_back(std::make_pair(std::string{}, std::move(element)));
+}
+
+// A batch response has a result for each download of the request, in the same order
+static std::vector<boost::property_tree::ptree> BatchResultsFromJson(const boost::property_tree::ptree& respBody, size_t count)
+{
+    std::vector<boost::property_tree::ptree> items;
+    const auto downloadsJson = respBody.get_child_optional("Downloads");
+    if (downloadsJson)
+    {
+        for (const auto& item : *downloadsJson)
+        {
+            items.push_back(item.second);
+        }
+    }
+    if (items.size() != count)
+    {
+        ThrowException(msdo::errc::unexpected);
+    }
+    return items;
+}
+
+static std::error_code BatchResultCode(const boost::property_tree::ptree& item)
+{
+    const auto hr = item.get<int32_t>("Result");
+    return (hr == 0) ? DO_OK : make_error_code(hr);
+}
+
+// Ids of the agent's downloads, filtered by the query param if given
+static std::vector<std::string> EnumDownloadIds(const char* paramName, const std::string& value)
+{
+    cpprest_web::uri_builder builder(g_downloadUriPart);
+    builder.append_path("enumerate");
+    if (paramName != nullptr)
+    {
+        builder.append_query(paramName, value);
+    }
+    const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::GET, builder.to_string());
+
+    std::vector<std::string> ids;
+    const auto idsJson = respBody.get_child_optional("Ids");
+    if (idsJson)
+    {
+        for (const auto& item : *idsJson)
+        {
+            ids.push_back(item.second.data());
+        }
+    }
+    return ids;
+}
+
 std::error_code CDownloadImpl::Init(const std::string& uri, const std::string& downloadFilePath) noexcept
 {
     try
@@ -68,6 +171,7 @@ std::error_code CDownloadImpl::Init(const std::string& uri, const std::string& d
 
 std::error_code CDownloadImpl::Start() noexcept
 {
+    DO_RETURN_IF_FAILED(_EnsureStream());
     return _DownloadOperationCall("start");
 }
 
@@ -100,64 +204,139 @@ std::error_code CDownloadImpl::GetStatus(msdo::download_status& outStatus) noexc
         builder.append_query("Id", _id);
 
         const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::GET, builder.to_string());
+        outStatus = StatusFromJson(respBody);
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
+}
 
-        uint64_t bytesTotal = respBody.get<uint64_t>("BytesTotal");
-        uint64_t bytesTransferred = respBody.get<uint64_t>("BytesTransferred");
-        int32_t errorCode = respBody.get<int32_t>("ErrorCode");
-        int32_t extendedErrorCode = respBody.get<int32_t>("ExtendedErrorCode");
-
-        static const std::map<std::string, download_state> stateMap =
-        { { "Created", download_state::created },
-        { "Transferring", download_state::transferring },
-        { "Transferred", download_state::transferred },
-        { "Finalized", download_state::finalized },
-        { "Aborted", download_state::aborted },
-        { "Paused", download_state::paused } };
-
-        download_state status = download_state::created;
-        auto it = stateMap.find(respBody.get<std::string>("Status"));
-        if (it != stateMap.end())
+// Status events end the wait as soon as the status changes. Without them, like when the agent can't be
+// reached for the subscription, the status is read again once the timeout elapses.
+std::error_code CDownloadImpl::WaitForStatusChange(msdo::download_status& status, std::chrono::milliseconds timeout) noexcept
+{
+    if (!_EnsureStatusSubscription())
+    {
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        const bool fChanged = _cvStatusEvent.wait_for(lock, timeout, [this, &status]()
+            {
+                return _fSubscriptionEnded || (_fStatusEventReceived && !IsSameStatus(_lastStatusEvent, status));
+            });
+        if (fChanged && !_fSubscriptionEnded)
         {
-            status = it->second;
+            status = _lastStatusEvent;
+            return DO_OK;
         }
-        else
+    }
+    else
+    {
+        std::this_thread::sleep_for(timeout);
+    }
+    return GetStatus(status);
+}
+
+std::error_code CDownloadImpl::GetProperty(msdo::download_property key, msdo::download_property_value& value) noexcept
+{
+    try
+    {
+        const char* agentName = AgentPropertyName(key);
+        if (agentName == nullptr)
         {
-            ThrowException(msdo::errc::unexpected);
+            return make_error_code(msdo::errc::not_impl);
         }
 
-        msdo::download_status out(bytesTotal, bytesTransferred, errorCode, extendedErrorCode, status);
-        outStatus = out;
-        return DO_OK;
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path("getproperty");
+        builder.append_query("Id", _id);
+        builder.append_query("PropertyKey", agentName);
+        const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::GET, builder.to_string());
+        return download_property_value::make(respBody.get<uint32_t>(agentName), value);
     }
     catch (msdo::details::exception& e)
     {
         return e.error_code();
     }
-}
-
-std::error_code CDownloadImpl::GetProperty(msdo::download_property key, msdo::download_property_value& value) noexcept
-{
-    return make_error_code(msdo::errc::not_impl);
+    catch (const boost::property_tree::ptree_error&)
+    {
+        return make_error_code(msdo::errc::unexpected);
+    }
 }
 
 std::error_code CDownloadImpl::SetProperty(msdo::download_property key, const msdo::download_property_value& val) noexcept
 {
-    return make_error_code(msdo::errc::not_impl);
+    try
+    {
+        const char* agentName = AgentPropertyName(key);
+        if (agentName == nullptr)
+        {
+            return make_error_code(msdo::errc::not_impl);
+        }
+
+        uint32_t value;
+        DO_RETURN_IF_FAILED(val.as(value));
+
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path("setproperty");
+        builder.append_query("Id", _id);
+        builder.append_query(agentName, std::to_string(value));
+        (void)CHttpClient::GetInstance().SendRequest(HttpRequest::POST, builder.to_string());
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
 }
 
+// Invoked on the subscription's thread for every status event, see CStatusSubscription
 std::error_code CDownloadImpl::SetStatusCallback(const status_callback_t& callback, download& download) noexcept
 {
-    return make_error_code(msdo::errc::not_impl);
+    {
+        std::unique_lock<std::mutex> lock(_statusMutex);
+        _statusCallback = callback;
+        _statusCallbackDownload = &download;
+    }
+    return _EnsureStatusSubscription();
 }
 
+// The agent sends the data over a connection of its own instead of writing it to a file, see CDownloadStream
 std::error_code CDownloadImpl::SetStreamCallback(const output_stream_callback_t& callback) noexcept
 {
-    return make_error_code(msdo::errc::not_impl);
+    _streamCallback = callback;
+    return DO_OK;
 }
 
+// Sent to the agent as "offset:length,...", it merges overlapping and adjacent ranges.
+// Like with DoSvc, ranges must be set before the download is started.
 std::error_code CDownloadImpl::SetRanges(const download_range* ranges, size_t count) noexcept
 {
-    return make_error_code(errc::not_impl);
+    try
+    {
+        std::string value;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i != 0)
+            {
+                value += ',';
+            }
+            value += std::to_string(ranges[i].offset);
+            value += ':';
+            value += std::to_string(ranges[i].length);
+        }
+
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path("setproperty");
+        builder.append_query("Id", _id);
+        builder.append_query("Ranges", value);
+        (void)CHttpClient::GetInstance().SendRequest(HttpRequest::POST, builder.to_string());
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
 }
 
 std::error_code CDownloadImpl::SetClientCert(const unsigned char* data, size_t size) noexcept
@@ -167,12 +346,64 @@ std::error_code CDownloadImpl::SetClientCert(const unsigned char* data, size_t s
 
 std::error_code CDownloadImpl::EnumDownloads(std::vector<std::unique_ptr<IDownload>>& out) noexcept
 {
-    return make_error_code(errc::not_impl);
+    out.clear();
+    try
+    {
+        for (auto& id : EnumDownloadIds(nullptr, {}))
+        {
+            auto tmp = std::make_unique<CDownloadImpl>();
+            tmp->_id = std::move(id);
+            out.push_back(std::move(tmp));
+        }
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
 }
 
 std::error_code CDownloadImpl::EnumDownloads(download_property prop, const std::string& value, std::vector<std::unique_ptr<IDownload>>& out) noexcept
 {
-    return make_error_code(errc::not_impl);
+    out.clear();
+    try
+    {
+        std::vector<std::string> ids;
+        switch (prop)
+        {
+        case download_property::id:
+            ids = EnumDownloadIds(nullptr, {});
+            ids.erase(std::remove_if(ids.begin(), ids.end(), [&value](const std::string& id) { return id != value; }), ids.end());
+            break;
+
+        case download_property::uri:
+            ids = EnumDownloadIds("Uri", value);
+            break;
+
+        case download_property::download_file_path:
+            ids = EnumDownloadIds("DownloadFilePath", value);
+            break;
+
+        default:
+            return make_error_code(errc::not_impl);
+        }
+
+        if (ids.empty())
+        {
+            return make_error_code(errc::no_downloads);
+        }
+        for (auto& id : ids)
+        {
+            auto tmp = std::make_unique<CDownloadImpl>();
+            tmp->_id = std::move(id);
+            out.push_back(std::move(tmp));
+        }
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
 }
 
 std::error_code CDownloadImpl::EnumDownloads(download_property prop, const std::wstring& value, std::vector<std::unique_ptr<IDownload>>& out) noexcept
@@ -180,6 +411,245 @@ std::error_code CDownloadImpl::EnumDownloads(download_property prop, const std::
     return make_error_code(errc::not_impl);
 }
 
+std::error_code CDownloadImpl::MakeBatch(const std::vector<std::pair<std::string, std::string>>& urisAndPaths, bool start,
+    std::vector<std::unique_ptr<IDownload>>& out, std::vector<std::error_code>& results) noexcept
+{
+    out.clear();
+    results.clear();
+    try
+    {
+        boost::property_tree::ptree downloadsJson;
+        for (const auto& uriAndPath : urisAndPaths)
+        {
+            boost::property_tree::ptree downloadJson;
+            downloadJson.put("Uri", uriAndPath.first);
+            if (!uriAndPath.second.empty())
+            {
+                downloadJson.put("DownloadFilePath", uriAndPath.second);
+            }
+            AddToArray(downloadsJson, std::move(downloadJson));
+        }
+        boost::property_tree::ptree body;
+        body.add_child("Downloads", std::move(downloadsJson));
+        body.put("Start", start);
+
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path("createbatch");
+        const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::POST, builder.to_string(), body);
+
+        // A download that was made but failed to start is still returned, with the start error
+        for (const auto& item : BatchResultsFromJson(respBody, urisAndPaths.size()))
+        {
+            std::unique_ptr<CDownloadImpl> tmp;
+            auto id = item.get<std::string>("Id", {});
+            if (!id.empty())
+            {
+                tmp = std::make_unique<CDownloadImpl>();
+                tmp->_id = std::move(id);
+            }
+            out.push_back(std::move(tmp));
+            results.push_back(BatchResultCode(item));
+        }
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        out.clear();
+        results.clear();
+        return e.error_code();
+    }
+    catch (const boost::property_tree::ptree_error&)
+    {
+        out.clear();
+        results.clear();
+        return make_error_code(msdo::errc::unexpected);
+    }
+}
+
+std::error_code CDownloadImpl::OperationBatch(BatchOperation op, const std::vector<IDownload*>& downloads,
+    std::vector<std::error_code>& results) noexcept
+{
+    results.assign(downloads.size(), DO_OK);
+    try
+    {
+        const char* type = nullptr;
+        switch (op)
+        {
+        case BatchOperation::Start:     type = "startbatch"; break;
+        case BatchOperation::Pause:     type = "pausebatch"; break;
+        case BatchOperation::Finalize:  type = "finalizebatch"; break;
+        case BatchOperation::Abort:     type = "abortbatch"; break;
+        default:
+            return make_error_code(msdo::errc::invalid_arg);
+        }
+
+        // Downloads whose stream can't be set up fail without being sent, same as Start
+        std::vector<size_t> sentIndexes;
+        boost::property_tree::ptree idsJson;
+        for (size_t i = 0; i < downloads.size(); ++i)
+        {
+            auto download = static_cast<CDownloadImpl*>(downloads[i]);
+            if (op == BatchOperation::Start)
+            {
+                results[i] = download->_EnsureStream();
+                if (results[i])
+                {
+                    continue;
+                }
+            }
+            boost::property_tree::ptree idJson;
+            idJson.put_value(download->_id);
+            AddToArray(idsJson, std::move(idJson));
+            sentIndexes.push_back(i);
+        }
+        boost::property_tree::ptree body;
+        body.add_child("Ids", std::move(idsJson));
+
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path(type);
+        const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::POST, builder.to_string(), body);
+        const auto items = BatchResultsFromJson(respBody, sentIndexes.size());
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            results[sentIndexes[i]] = BatchResultCode(items[i]);
+        }
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        results.clear();
+        return e.error_code();
+    }
+    catch (const boost::property_tree::ptree_error&)
+    {
+        results.clear();
+        return make_error_code(msdo::errc::unexpected);
+    }
+}
+
+std::error_code CDownloadImpl::GetStatusBatch(const std::vector<IDownload*>& downloads, std::vector<download_status>& statuses,
+    std::vector<std::error_code>& results) noexcept
+{
+    statuses.assign(downloads.size(), download_status{});
+    results.assign(downloads.size(), DO_OK);
+    try
+    {
+        boost::property_tree::ptree idsJson;
+        for (IDownload* download : downloads)
+        {
+            boost::property_tree::ptree idJson;
+            idJson.put_value(static_cast<CDownloadImpl*>(download)->_id);
+            AddToArray(idsJson, std::move(idJson));
+        }
+        boost::property_tree::ptree body;
+        body.add_child("Ids", std::move(idsJson));
+
+        cpprest_web::uri_builder builder(g_downloadUriPart);
+        builder.append_path("getstatusbatch");
+        const auto respBody = CHttpClient::GetInstance().SendRequest(HttpRequest::POST, builder.to_string(), body);
+        const auto items = BatchResultsFromJson(respBody, downloads.size());
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            results[i] = BatchResultCode(items[i]);
+            if (!results[i])
+            {
+                statuses[i] = StatusFromJson(items[i]);
+            }
+        }
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        statuses.clear();
+        results.clear();
+        return e.error_code();
+    }
+    catch (const boost::property_tree::ptree_error&)
+    {
+        statuses.clear();
+        results.clear();
+        return make_error_code(msdo::errc::unexpected);
+    }
+}
+
+// A single subscription serves the status callback and waits, it is opened again after the agent ended it
+std::error_code CDownloadImpl::_EnsureStatusSubscription() noexcept
+{
+    std::unique_lock<std::mutex> lock(_subscriptionMutex);
+    {
+        std::unique_lock<std::mutex> statusLock(_statusMutex);
+        if (_statusSubscription && !_fSubscriptionEnded)
+        {
+            return DO_OK;
+        }
+        _fSubscriptionEnded = false;
+        _fStatusEventReceived = false;
+    }
+
+    try
+    {
+        _statusSubscription.reset();
+        _statusSubscription = std::make_unique<CStatusSubscription>(_id, [this](const boost::property_tree::ptree* statusJson)
+            {
+                _OnStatusEvent(statusJson);
+            });
+        return DO_OK;
+    }
+    catch (msdo::details::exception& e)
+    {
+        return e.error_code();
+    }
+}
+
+void CDownloadImpl::_OnStatusEvent(const boost::property_tree::ptree* statusJson)
+{
+    std::unique_lock<std::mutex> lock(_statusMutex);
+    if (statusJson == nullptr)
+    {
+        _fSubscriptionEnded = true;
+        _cvStatusEvent.notify_all();
+        return;
+    }
+
+    try
+    {
+        _lastStatusEvent = StatusFromJson(*statusJson);
+    }
+    catch (...)
+    {
+        return;
+    }
+    _fStatusEventReceived = true;
+    _cvStatusEvent.notify_all();
+
+    // The callback may call back into the download, like to read a property
+    auto callback = _statusCallback;
+    download* pDownload = _statusCallbackDownload;
+    download_status status = _lastStatusEvent;
+    lock.unlock();
+    if (callback)
+    {
+        callback(*pDownload, status);
+    }
+}
+
+// The stream connection must be in place before the agent sends any data
+std::error_code CDownloadImpl::_EnsureStream() noexcept
+{
+    if (_streamCallback && !_stream)
+    {
+        try
+        {
+            _stream = std::make_unique<CDownloadStream>(_id, _streamCallback);
+        }
+        catch (msdo::details::exception& e)
+        {
+            return e.error_code();
+        }
+    }
+    return DO_OK;
+}
+
 std::error_code CDownloadImpl::_DownloadOperationCall(const std::string& type) noexcept
 {
     try
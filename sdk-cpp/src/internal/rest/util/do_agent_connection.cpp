@@ -0,0 +1,42 @@
+#include "do_agent_connection.h"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <gsl/gsl>
+
+#include "do_filesystem.h"
+#include "do_persistence.h"
+#include "do_port_finder.h"
+
+namespace net = boost::asio;        // from <boost/asio.hpp>
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+boost::system::error_code ConnectToAgent(net::generic::stream_protocol::socket& socket, bool launchClientFirst)
+{
+    boost::system::error_code ec;
+    const std::string& socketPath = GetRestSocketPath();
+    if (fs::exists(socketPath))
+    {
+        socket.connect(net::local::stream_protocol::endpoint(socketPath), ec);
+        if (!ec)
+        {
+            return ec;
+        }
+        // Not open to this user, or left behind by an agent that is gone. The port file says where the agent is.
+        socket.close(ec);
+    }
+
+    const auto port = std::strtoul(CPortFinder::GetDOPort(launchClientFirst).data(), nullptr, 10);
+    socket.connect(net::ip::tcp::endpoint(net::ip::address_v4::loopback(), gsl::narrow<ushort>(port)), ec);
+    return ec;
+}
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
@@ -0,0 +1,21 @@
+#ifndef _DELIVERY_OPTIMIZATION_DO_AGENT_CONNECTION_H
+#define _DELIVERY_OPTIMIZATION_DO_AGENT_CONNECTION_H
+
+#include <boost/asio/generic/stream_protocol.hpp>
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+// Connects to the agent's unix domain socket, or to its loopback port for agents that don't listen on one and
+// for users the socket is not open to.
+// Throws no_service when the port can't be discovered either.
+boost::system::error_code ConnectToAgent(boost::asio::generic::stream_protocol::socket& socket, bool launchClientFirst = false);
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
+#endif
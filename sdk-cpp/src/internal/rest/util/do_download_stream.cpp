@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_download_stream.h"
+
+#include "do_agent_connection.h"
+#include "do_cpprest_uri_builder.h"
+#include "do_errors.h"
+#include "do_error_helpers.h"
+#include "do_http_message.h"
+
+namespace net = boost::asio;        // from <boost/asio.hpp>
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+// Data is read in chunks of up to this size and handed to the callback as is
+constexpr size_t g_streamReadBufferSize = 64 * 1024;
+
+CDownloadStream::CDownloadStream(const std::string& downloadId, output_stream_callback_t callback) :
+    _callback(std::move(callback))
+{
+    const auto ec = ConnectToAgent(_socket);
+    if (ec)
+    {
+        ThrowException(microsoft::deliveryoptimization::errc::no_service);
+    }
+
+    cpprest_web::uri_builder builder("download");
+    builder.append_path("stream");
+    builder.append_query("Id", downloadId);
+
+    std::vector<char> bodyStart;
+    HttpResponse response;
+    try
+    {
+        const auto url = builder.to_string();
+        HttpRequest{HttpRequest::GET, url}.Serialize(_socket);
+        bodyStart = response.DeserializeStreamHeaders(_socket);
+    }
+    catch (const boost::system::system_error& e)
+    {
+        ThrowException(e.code().value());
+    }
+
+    if (response.StatusCode() != 200)
+    {
+        auto agentErrorCode = response.ExtractJsonBody().get_optional<int32_t>("ErrorCode");
+        ThrowException(agentErrorCode ? *agentErrorCode : -1);
+    }
+
+    _readThread = std::thread{[this, bodyStart = std::move(bodyStart)]() mutable
+        {
+            _ReadLoop(std::move(bodyStart));
+        }};
+}
+
+CDownloadStream::~CDownloadStream()
+{
+    // Wakes up the read thread, the agent sees the connection close if the download is still in progress
+    boost::system::error_code ec;
+    _socket.shutdown(net::socket_base::shutdown_both, ec);
+    if (_readThread.joinable())
+    {
+        _readThread.join();
+    }
+}
+
+// Runs until the agent closes the stream at the end of the download, or the connection fails
+void CDownloadStream::_ReadLoop(std::vector<char> bodyStart)
+{
+    if (!bodyStart.empty() && _callback(reinterpret_cast<const unsigned char*>(bodyStart.data()), bodyStart.size()))
+    {
+        boost::system::error_code ec;
+        _socket.shutdown(net::socket_base::shutdown_both, ec);
+        return;
+    }
+
+    std::vector<unsigned char> readBuf(g_streamReadBufferSize);
+    while (true)
+    {
+        boost::system::error_code ec;
+        const size_t bytesRead = _socket.read_some(net::buffer(readBuf.data(), readBuf.size()), ec);
+        if (ec)
+        {
+            break;
+        }
+
+        if (_callback(readBuf.data(), bytesRead))
+        {
+            _socket.shutdown(net::socket_base::shutdown_both, ec);
+            break;
+        }
+    }
+}
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _DELIVERY_OPTIMIZATION_DO_DOWNLOAD_STREAM_H
+#define _DELIVERY_OPTIMIZATION_DO_DOWNLOAD_STREAM_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include "do_download_status.h"
+#include "do_noncopyable.h"
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+// Receives a download's data from the agent over a dedicated connection, in place of the download's file.
+// Must be opened before the download starts. The callback is invoked on a thread of its own for each chunk
+// of data as it arrives, in order. Returning an error from it closes the connection, the download then
+// fails on the agent side.
+class CDownloadStream : CDONoncopyable
+{
+public:
+    CDownloadStream(const std::string& downloadId, output_stream_callback_t callback);
+    ~CDownloadStream();
+
+private:
+    void _ReadLoop(std::vector<char> bodyStart);
+
+    output_stream_callback_t _callback;
+    boost::asio::io_service _ioc;
+    boost::asio::generic::stream_protocol::socket _socket{_ioc};
+    std::thread _readThread;
+};
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
+#endif
@@ -1,21 +1,21 @@
 #include "do_http_client.h"
 
+#include <atomic>
+#include <sstream>
 #include <thread>
-#include <boost/asio/connect.hpp>
 // Debian10 uses 1.67 while Ubuntu18.04 has 1.65.1.
 // Starting in 1.66, boost::asio::io_service changed to io_context and retained io_service as a typedef.
 // Include this header explicitly to get it regardless of which boost version is installed.
 #include <boost/asio/io_service.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <gsl/gsl>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
+#include "do_agent_connection.h"
 #include "do_errors.h"
 #include "do_error_helpers.h"
 #include "do_http_message.h"
-#include "do_port_finder.h"
 
 namespace net = boost::asio;        // from <boost/asio.hpp>
-using tcp = net::ip::tcp;           // from <boost/asio/ip/tcp.hpp>
 
 namespace microsoft
 {
@@ -27,28 +27,30 @@ namespace details
 class CHttpClientImpl
 {
 public:
+    CHttpClientImpl(net::io_service& ioc) :
+        _socket(ioc)
+    {
+    }
+
     ~CHttpClientImpl()
     {
         if (_socket.is_open())
         {
             // Gracefully close the socket
             boost::system::error_code ec;
-            _socket.shutdown(tcp::socket::shutdown_both, ec);
+            _socket.shutdown(net::socket_base::shutdown_both, ec);
         }
     }
 
-    boost::system::error_code Connect(ushort port)
+    boost::system::error_code Connect(bool launchClientFirst)
     {
-        tcp::resolver resolver{_ioc};
-        const auto endpoints = resolver.resolve({ "127.0.0.1", std::to_string(port) });
-        boost::system::error_code ec;
-        boost::asio::connect(_socket, endpoints, ec);
-        return ec;
+        return ConnectToAgent(_socket, launchClientFirst);
     }
 
-    std::pair<unsigned int, boost::property_tree::ptree> GetResponse(HttpRequest::Method method, const std::string& url)
+    std::pair<unsigned int, boost::property_tree::ptree> GetResponse(HttpRequest::Method method, const std::string& url,
+        const std::string& body)
     {
-        HttpRequest request{method, url};
+        HttpRequest request{method, url, body};
         request.Serialize(_socket);
 
         HttpResponse response;
@@ -58,10 +60,13 @@ public:
     }
 
 private:
-    net::io_service _ioc;
-    net::ip::tcp::socket _socket{_ioc};
+    net::generic::stream_protocol::socket _socket;
 };
 
+// Enough for a handful of threads managing downloads at once, each request holds a connection only briefly
+constexpr size_t g_defaultMaxAgentConnections = 8;
+static std::atomic<size_t> g_maxAgentConnections { g_defaultMaxAgentConnections };
+
 CHttpClient::~CHttpClient() = default;
 
 CHttpClient& CHttpClient::GetInstance()
@@ -70,41 +75,47 @@ CHttpClient& CHttpClient::GetInstance()
     return myInstance;
 }
 
-void CHttpClient::_InitializeDOConnection(bool launchClientFirst)
+void CHttpClient::SetMaxConnections(size_t maxConnections) noexcept
 {
-    const auto port = std::strtoul(CPortFinder::GetDOPort(launchClientFirst).data(), nullptr, 10);
-    auto spImpl = std::make_unique<CHttpClientImpl>();
-    auto ec = spImpl->Connect(gsl::narrow<ushort>(port));
-    if (ec)
-    {
-        // TODO(shishirb) Log the actual error when logging is available
-        ThrowException(microsoft::deliveryoptimization::errc::no_service);
-    }
-
-    std::unique_lock<std::mutex> lock(_mutex);
-    _httpClientImpl = std::move(spImpl);
+    g_maxAgentConnections = maxConnections;
 }
 
 boost::property_tree::ptree CHttpClient::SendRequest(HttpRequest::Method method, const std::string& url, bool retry)
 {
+    return _SendRequest(method, url, std::string{}, retry);
+}
+
+boost::property_tree::ptree CHttpClient::SendRequest(HttpRequest::Method method, const std::string& url,
+    const boost::property_tree::ptree& body)
+{
+    std::stringstream bodyStream;
+    boost::property_tree::write_json(bodyStream, body, false);
+    return _SendRequest(method, url, bodyStream.str(), true);
+}
+
+boost::property_tree::ptree CHttpClient::_SendRequest(HttpRequest::Method method, const std::string& url, const std::string& body,
+    bool retry)
+{
+    // The retry goes over a new connection, the agent may have restarted since the failed one was opened
+    auto connection = _AcquireConnection(!retry);
+
     auto responseStatusCode = 0u;
     boost::property_tree::ptree responseBodyJson;
     try
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        auto pClient = static_cast<CHttpClientImpl*>(_httpClientImpl.get());
-        std::tie(responseStatusCode, responseBodyJson) = pClient->GetResponse(method, url);
+        std::tie(responseStatusCode, responseBodyJson) = connection->GetResponse(method, url, body);
     }
     catch (const boost::system::system_error& e)
     {
+        _DropConnection(std::move(connection));
         if (retry)
         {
-            _InitializeDOConnection(true);
-            return SendRequest(method, url, false);
+            return _SendRequest(method, url, body, false);
         }
 
         ThrowException(e.code().value());
     }
+    _ReleaseConnection(std::move(connection));
 
     if (responseStatusCode != 200)
     {
@@ -117,7 +128,95 @@ boost::property_tree::ptree CHttpClient::SendRequest(HttpRequest::Method method,
 
 CHttpClient::CHttpClient()
 {
-    _InitializeDOConnection();
+    // Fail right away if the agent can't be reached, the same as a request would
+    _idleConnections.push_back(_Connect(false));
+    _numConnections = 1;
+}
+
+std::unique_ptr<CHttpClientImpl> CHttpClient::_AcquireConnection(bool fNewConnection)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        // Idle connections beyond a lowered max would keep their slots for good, close them
+        const size_t maxConnections = g_maxAgentConnections;
+        while ((_numConnections > maxConnections) && !_idleConnections.empty())
+        {
+            _idleConnections.pop_back();
+            --_numConnections;
+        }
+
+        if (!fNewConnection && !_idleConnections.empty())
+        {
+            auto connection = std::move(_idleConnections.back());
+            _idleConnections.pop_back();
+            return connection;
+        }
+
+        // A new connection replaces an idle one when the pool is full. Idle connections are never released
+        // otherwise, a pool full of them would keep the retry waiting forever.
+        if (fNewConnection && (_numConnections >= maxConnections) && !_idleConnections.empty())
+        {
+            _idleConnections.pop_back();
+            --_numConnections;
+        }
+
+        if (_numConnections < maxConnections)
+        {
+            break;
+        }
+        _cvConnectionAvailable.wait(lock);
+    }
+
+    // Reserve the slot and connect without holding up other requests
+    ++_numConnections;
+    lock.unlock();
+    try
+    {
+        return _Connect(fNewConnection);
+    }
+    catch (...)
+    {
+        lock.lock();
+        --_numConnections;
+        _cvConnectionAvailable.notify_one();
+        throw;
+    }
+}
+
+void CHttpClient::_ReleaseConnection(std::unique_ptr<CHttpClientImpl> connection)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_numConnections > g_maxAgentConnections)
+    {
+        // The max was lowered while the connection was in use
+        --_numConnections;
+    }
+    else
+    {
+        _idleConnections.push_back(std::move(connection));
+    }
+    _cvConnectionAvailable.notify_one();
+}
+
+void CHttpClient::_DropConnection(std::unique_ptr<CHttpClientImpl> connection)
+{
+    connection.reset();
+    std::unique_lock<std::mutex> lock(_mutex);
+    --_numConnections;
+    _cvConnectionAvailable.notify_one();
+}
+
+std::unique_ptr<CHttpClientImpl> CHttpClient::_Connect(bool launchClientFirst)
+{
+    auto connection = std::make_unique<CHttpClientImpl>(_ioc);
+    auto ec = connection->Connect(launchClientFirst);
+    if (ec)
+    {
+        // TODO(shishirb) Log the actual error when logging is available
+        ThrowException(microsoft::deliveryoptimization::errc::no_service);
+    }
+    return connection;
 }
 
 } // namespace details
@@ -1,7 +1,11 @@
 #ifndef _DELIVERY_OPTIMIZATION_DO_HTTP_CLIENT_H
 #define _DELIVERY_OPTIMIZATION_DO_HTTP_CLIENT_H
 
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <vector>
+#include <boost/asio/io_service.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include "do_http_message.h"
 #include "do_noncopyable.h"
@@ -15,6 +19,9 @@ namespace details
 
 class CHttpClientImpl;
 
+// Sends requests to the agent over a pool of connections, so requests from different threads don't wait
+// for each other. Connections are opened as needed, up to the max, and reused. A connection that fails is
+// dropped and the request retried once over a new one, the rest of the pool is left alone.
 class CHttpClient : CDONoncopyable
 {
 public:
@@ -22,12 +29,29 @@ public:
     static CHttpClient& GetInstance();
     boost::property_tree::ptree SendRequest(HttpRequest::Method method, const std::string& url, bool retry = true);
 
+    // Sends the JSON body along, for the batch requests
+    boost::property_tree::ptree SendRequest(HttpRequest::Method method, const std::string& url,
+        const boost::property_tree::ptree& body);
+
+    // Takes effect for requests sent from here on, connections beyond a lowered max are closed once they are idle.
+    // Must be at least 1.
+    static void SetMaxConnections(size_t maxConnections) noexcept;
+
 private:
     CHttpClient();
-    void _InitializeDOConnection(bool launchClientFirst = false);
+    boost::property_tree::ptree _SendRequest(HttpRequest::Method method, const std::string& url, const std::string& body, bool retry);
+    std::unique_ptr<CHttpClientImpl> _AcquireConnection(bool fNewConnection);
+    void _ReleaseConnection(std::unique_ptr<CHttpClientImpl> connection);
+    void _DropConnection(std::unique_ptr<CHttpClientImpl> connection);
+    std::unique_ptr<CHttpClientImpl> _Connect(bool launchClientFirst);
+
+    // Shared by all connections, requests run synchronously on the caller's thread
+    boost::asio::io_service _ioc;
 
-    mutable std::mutex _mutex;
-    std::unique_ptr<CHttpClientImpl> _httpClientImpl;
+    std::mutex _mutex;
+    std::condition_variable _cvConnectionAvailable;
+    std::vector<std::unique_ptr<CHttpClientImpl>> _idleConnections;
+    size_t _numConnections { 0 };   // idle, in use and being opened
 };
 } // namespace details
 } // namespace deliveryoptimization
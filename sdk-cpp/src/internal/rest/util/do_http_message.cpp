@@ -6,6 +6,10 @@
 #ifdef DO_DEBUG_REST_INTERFACE
 #include <iostream>
 #endif
+#include <sstream>
+#include <boost/asio/buffers_iterator.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include "do_http_defines.h"
@@ -19,20 +23,27 @@ namespace deliveryoptimization
 namespace details
 {
 
-HttpRequest::HttpRequest(Method method, const std::string& url) :
+HttpRequest::HttpRequest(Method method, const std::string& url, const std::string& body) :
     _method(method),
-    _url(url.data())
+    _url(url.data()),
+    _body(body)
 {
 }
 
-void HttpRequest::Serialize(boost::asio::ip::tcp::socket& socket) const
+void HttpRequest::Serialize(boost::asio::generic::stream_protocol::socket& socket) const
 {
     std::stringstream request;
     const char* pVerb = (_method == Method::GET) ? http_methods::GET : http_methods::POST;
     request << pVerb << ' ' << _url << ' ' << "HTTP/1.1\r\n";
     request << "Host: 127.0.0.1\r\n";
     request << "User-Agent: DO-SDK-CPP\r\n";
+    if (!_body.empty())
+    {
+        request << "Content-Type: application/json\r\n";
+        request << "Content-Length: " << _body.size() << "\r\n";
+    }
     request << "\r\n";
+    request << _body;
 
     const auto req = request.str();
 #ifdef DO_DEBUG_REST_INTERFACE
@@ -41,7 +52,7 @@ void HttpRequest::Serialize(boost::asio::ip::tcp::socket& socket) const
     net::write(socket, net::buffer(req.data(), req.size()));
 }
 
-void HttpResponse::Deserialize(boost::asio::ip::tcp::socket& socket)
+void HttpResponse::Deserialize(boost::asio::generic::stream_protocol::socket& socket)
 {
     std::vector<char> readBuf(1024);
     do
@@ -51,14 +62,38 @@ void HttpResponse::Deserialize(boost::asio::ip::tcp::socket& socket)
     } while (!_parser.Done());
 }
 
+std::vector<char> HttpResponse::DeserializeStreamHeaders(boost::asio::generic::stream_protocol::socket& socket)
+{
+    net::streambuf readBuf;
+    net::read_until(socket, readBuf, "\r\n\r\n");
+    std::vector<char> received(net::buffers_begin(readBuf.data()), net::buffers_end(readBuf.data()));
+    const size_t cbParsed = _parser.OnData(received.data(), received.size());
+    if (_parser.Done())
+    {
+        // Without a Content-Length the message ends with the headers, what follows is the stream
+        received.erase(received.begin(), received.begin() + cbParsed);
+        return received;
+    }
+
+    // Not a stream, like an error response with a JSON body
+    std::vector<char> moreBuf(1024);
+    while (!_parser.Done())
+    {
+        auto bytesRead = socket.read_some(net::buffer(moreBuf.data(), moreBuf.size()));
+        _parser.OnData(moreBuf.data(), bytesRead);
+    }
+    return {};
+}
+
 boost::property_tree::ptree HttpResponse::ExtractJsonBody()
 {
     boost::property_tree::ptree responseBodyJson;
-    if (_parser.Body().rdbuf()->in_avail() > 0)
+    if (!_parser.Body().empty())
     {
         try
         {
-            boost::property_tree::read_json(_parser.Body(), responseBodyJson);
+            std::istringstream body{_parser.Body()};
+            boost::property_tree::read_json(body, responseBodyJson);
         }
         catch (...)
         {
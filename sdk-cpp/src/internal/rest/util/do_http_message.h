@@ -6,7 +6,7 @@
 
 #include <string>
 #include <vector>
-#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include "do_http_parser.h"
 
@@ -27,18 +27,24 @@ public:
         POST
     };
 
-    HttpRequest(Method method, const std::string& url);
-    void Serialize(boost::asio::ip::tcp::socket& socket) const;
+    // body is sent as JSON, if not empty
+    HttpRequest(Method method, const std::string& url, const std::string& body = {});
+    void Serialize(boost::asio::generic::stream_protocol::socket& socket) const;
 
 private:
     Method _method;
     const char* _url;
+    std::string _body;
 };
 
 class HttpResponse
 {
 public:
-    void Deserialize(boost::asio::ip::tcp::socket& socket);
+    void Deserialize(boost::asio::generic::stream_protocol::socket& socket);
+
+    // For a response whose body is streamed until the connection closes. Reads up to the end of the headers
+    // and returns the body data received along with them. A response with a Content-Length is read in full.
+    std::vector<char> DeserializeStreamHeaders(boost::asio::generic::stream_protocol::socket& socket);
 
     unsigned int StatusCode() const { return _parser.StatusCode(); }
     boost::property_tree::ptree ExtractJsonBody();
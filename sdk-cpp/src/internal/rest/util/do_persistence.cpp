@@ -48,6 +48,13 @@ const std::string& GetRuntimeDirectory()
     return runDirectory;
 }
 
+// Unix domain socket the agent listens on, alongside its port number file
+const std::string& GetRestSocketPath()
+{
+    static std::string socketPath(GetRuntimeDirectory() + "/restapi.sock");
+    return socketPath;
+}
+
 const std::string& GetConfigFilePath()
 {
 #ifdef DO_BUILD_FOR_SNAP
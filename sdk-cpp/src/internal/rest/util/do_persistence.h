@@ -12,6 +12,7 @@ namespace details
 {
 
 const std::string& GetRuntimeDirectory();
+const std::string& GetRestSocketPath();
 const std::string& GetConfigFilePath();
 const std::string& GetAdminConfigFilePath();
 
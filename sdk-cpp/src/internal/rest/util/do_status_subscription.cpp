@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "do_status_subscription.h"
+
+#include <sstream>
+#include <vector>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "do_agent_connection.h"
+#include "do_cpprest_uri_builder.h"
+#include "do_errors.h"
+#include "do_error_helpers.h"
+#include "do_http_message.h"
+
+namespace net = boost::asio;        // from <boost/asio.hpp>
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+// Events are a few hundred bytes at most
+constexpr size_t g_statusEventReadBufferSize = 4 * 1024;
+
+// The JSON of a "data:" line, events carry nothing else
+static bool ParseEvent(const std::string& event, boost::property_tree::ptree& status)
+{
+    static const std::string dataField = "data:";
+    std::istringstream lines(event);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (line.compare(0, dataField.size(), dataField) == 0)
+        {
+            try
+            {
+                std::istringstream json(line.substr(dataField.size()));
+                boost::property_tree::read_json(json, status);
+                return true;
+            }
+            catch (const boost::property_tree::ptree_error&)
+            {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+CStatusSubscription::CStatusSubscription(const std::string& downloadId, event_handler_t handler) :
+    _handler(std::move(handler))
+{
+    const auto ec = ConnectToAgent(_socket);
+    if (ec)
+    {
+        ThrowException(microsoft::deliveryoptimization::errc::no_service);
+    }
+
+    cpprest_web::uri_builder builder("download");
+    builder.append_path("subscribe");
+    builder.append_query("Id", downloadId);
+
+    std::vector<char> bodyStart;
+    HttpResponse response;
+    try
+    {
+        const auto url = builder.to_string();
+        HttpRequest{HttpRequest::GET, url}.Serialize(_socket);
+        bodyStart = response.DeserializeStreamHeaders(_socket);
+    }
+    catch (const boost::system::system_error& e)
+    {
+        ThrowException(e.code().value());
+    }
+
+    if (response.StatusCode() != 200)
+    {
+        auto agentErrorCode = response.ExtractJsonBody().get_optional<int32_t>("ErrorCode");
+        ThrowException(agentErrorCode ? *agentErrorCode : -1);
+    }
+
+    _readThread = std::thread{[this, received = std::string(bodyStart.begin(), bodyStart.end())]() mutable
+        {
+            _ReadLoop(std::move(received));
+        }};
+}
+
+CStatusSubscription::~CStatusSubscription()
+{
+    // Wakes up the read thread, the agent drops the subscription on its next event
+    boost::system::error_code ec;
+    _socket.shutdown(net::socket_base::shutdown_both, ec);
+    if (_readThread.joinable())
+    {
+        _readThread.join();
+    }
+}
+
+// Runs until the agent closes the stream or the connection fails
+void CStatusSubscription::_ReadLoop(std::string received)
+{
+    std::vector<char> readBuf(g_statusEventReadBufferSize);
+    while (true)
+    {
+        // Events end with a blank line
+        size_t eventEnd;
+        while ((eventEnd = received.find("\n\n")) != std::string::npos)
+        {
+            boost::property_tree::ptree status;
+            if (ParseEvent(received.substr(0, eventEnd), status))
+            {
+                _handler(&status);
+            }
+            received.erase(0, eventEnd + 2);
+        }
+
+        boost::system::error_code ec;
+        const size_t bytesRead = _socket.read_some(net::buffer(readBuf.data(), readBuf.size()), ec);
+        if (ec)
+        {
+            break;
+        }
+        received.append(readBuf.data(), bytesRead);
+    }
+    _handler(nullptr);
+}
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
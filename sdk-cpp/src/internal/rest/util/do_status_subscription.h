@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#ifndef _DELIVERY_OPTIMIZATION_DO_STATUS_SUBSCRIPTION_H
+#define _DELIVERY_OPTIMIZATION_DO_STATUS_SUBSCRIPTION_H
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include "do_noncopyable.h"
+
+namespace microsoft
+{
+namespace deliveryoptimization
+{
+namespace details
+{
+
+// Receives a download's status events from the agent over a dedicated connection, sent as server-sent events
+// with the same JSON as a getstatus response. The agent sends the current status right away and then every
+// change of it. The handler is invoked on a thread of its own for each event, in order, and once more with
+// nullptr when the agent ends the stream, after the download is finalized or aborted, or the connection fails.
+class CStatusSubscription : CDONoncopyable
+{
+public:
+    using event_handler_t = std::function<void(const boost::property_tree::ptree* status)>;
+
+    CStatusSubscription(const std::string& downloadId, event_handler_t handler);
+    ~CStatusSubscription();
+
+private:
+    void _ReadLoop(std::string received);
+
+    event_handler_t _handler;
+    boost::asio::io_service _ioc;
+    boost::asio::generic::stream_protocol::socket _socket{_ioc};
+    std::thread _readThread;
+};
+
+} // namespace details
+} // namespace deliveryoptimization
+} // namespace microsoft
+#endif
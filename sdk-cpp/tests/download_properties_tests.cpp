@@ -165,6 +165,32 @@ TEST_F(DownloadPropertyTests, OverrideCallbackTest)
     ASSERT_EQ(i, 0);
 }
 
+TEST_F(DownloadPropertyTests, CallbackFrequencyTest)
+{
+    auto simpleDownload = msdot::download::make(g_largeFileUrl, g_tmpFileName);
+    simpleDownload->set_property(msdo::download_property::callback_freq_percent, static_cast<uint32_t>(10));
+
+    uint32_t outVal = 0;
+    simpleDownload->get_property(msdo::download_property::callback_freq_percent, outVal);
+    ASSERT_EQ(outVal, 10u);
+
+    std::atomic<int> numCallbacks { 0 };
+    std::atomic<bool> fTransferred { false };
+    simpleDownload->set_status_callback([&numCallbacks, &fTransferred](msdo::download&, msdo::download_status& status)
+        {
+            ++numCallbacks;
+            if (status.state() == msdo::download_state::transferred)
+            {
+                fTransferred = true;
+            }
+        });
+    simpleDownload->start_and_wait_until_completion();
+
+    // At least one progress update every 10% on the way to transferred
+    ASSERT_TRUE(fTransferred);
+    ASSERT_GE(numCallbacks, 10);
+}
+
 TEST_F(DownloadPropertyTests, ForegroundBackgroundRace)
 {
     uint32_t backgroundDuration = TimeOperation([&]()
@@ -287,6 +313,30 @@ TEST_F(DownloadPropertyTests, SmallDownloadSetCallerNameFailureTest)
     ASSERT_EQ(ec.value(), msdo::errc::not_impl);
 }
 
+TEST_F(DownloadPropertyTests, RangesToSparseFileTest)
+{
+    auto simpleDownload = msdot::download::make(g_largeFileUrl, g_tmpFileName);
+
+    // Coalesced into { 0, 100 } and { 200, 1800 }
+    msdo::download_range ranges[3] =
+    {
+        { 1200,  800 },
+        {    0,  100 },
+        {  200, 1000 },
+    };
+    simpleDownload->set_ranges(ranges, 3);
+
+    simpleDownload->start();
+    TestHelpers::WaitForState(*simpleDownload, msdo::download_state::transferred, g_smallFileWaitTime);
+
+    auto status = simpleDownload->get_status();
+    ASSERT_EQ(status.bytes_total(), 1900u);
+    ASSERT_EQ(status.bytes_transferred(), 1900u);
+    ASSERT_EQ(fs::file_size(g_tmpFileName), g_largeFileSizeBytes);
+
+    simpleDownload->finalize();
+}
+
 #else
 #error "Target client unknown"
 #endif // DO_CLIENT_DOSVC
@@ -81,6 +81,45 @@ TEST_F(DownloadTests, SimpleDownloadTest)
     ASSERT_EQ(fs::file_size(fs::path(g_tmpFileName)), g_smallFileSizeBytes);
 }
 
+TEST_F(DownloadTests, BatchDownloadTest)
+{
+    std::vector<std::unique_ptr<msdo::download>> downloads;
+    std::vector<std::error_code> results;
+    ASSERT_EQ(msdo::download::make_batch({ { g_smallFileUrl, g_tmpFileName }, { g_smallFileUrl, g_tmpFileName2 } }, true,
+        downloads, results).value(), 0);
+    ASSERT_EQ(downloads.size(), 2u);
+    ASSERT_EQ(results.size(), 2u);
+    std::vector<msdo::download*> batch;
+    for (size_t i = 0; i < downloads.size(); ++i)
+    {
+        ASSERT_EQ(results[i].value(), 0);
+        ASSERT_NE(downloads[i], nullptr);
+        batch.push_back(downloads[i].get());
+    }
+
+    std::vector<msdo::download_status> statuses;
+    const auto endtime = std::chrono::steady_clock::now() + g_smallFileWaitTime;
+    bool fAllTransferred = false;
+    while (!fAllTransferred && (std::chrono::steady_clock::now() < endtime))
+    {
+        std::this_thread::sleep_for(500ms);
+        ASSERT_EQ(msdo::download::get_status_batch(batch, statuses, results).value(), 0);
+        fAllTransferred = true;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            ASSERT_EQ(results[i].value(), 0);
+            fAllTransferred = fAllTransferred && (statuses[i].state() == msdo::download_state::transferred);
+        }
+    }
+    ASSERT_TRUE(fAllTransferred);
+
+    ASSERT_EQ(msdo::download::finalize_batch(batch, results).value(), 0);
+    ASSERT_EQ(results[0].value(), 0);
+    ASSERT_EQ(results[1].value(), 0);
+    ASSERT_EQ(fs::file_size(fs::path(g_tmpFileName)), g_smallFileSizeBytes);
+    ASSERT_EQ(fs::file_size(fs::path(g_tmpFileName2)), g_smallFileSizeBytes);
+}
+
 TEST_F(DownloadTests, SimpleBlockingDownloadTest)
 {
     ASSERT_FALSE(fs::exists(g_tmpFileName));
@@ -4,15 +4,21 @@
 #include "tests_common.h"
 
 #include <cstring>
+#include <thread>
+#include <vector>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include "do_config.h"
+#include "do_download.h"
+#include "do_download_status.h"
+#include "do_errors.h"
 #include "do_persistence.h"
 #include "test_data.h"
 #include "test_helpers.h"
 
 namespace msdo = microsoft::deliveryoptimization;
 namespace msdod = microsoft::deliveryoptimization::details;
+namespace msdot = microsoft::deliveryoptimization::test;
 
 class ConfigTests : public ::testing::Test
 {
@@ -58,3 +64,56 @@ TEST(ConfigVersionTests, GetVersion)
     deliveryoptimization_free_version_buf(&version);
     ASSERT_EQ(version, nullptr);
 }
+
+TEST(ConfigConnectionTests, MaxAgentConnections)
+{
+    ASSERT_EQ(deliveryoptimization_set_max_agent_connections(0), msdo::errc::invalid_arg);
+    ASSERT_EQ(deliveryoptimization_set_max_agent_connections(2), 0);
+
+    // More threads than connections, requests wait for a connection instead of failing
+    auto simpleDownload = msdot::download::make(g_smallFileUrl, g_tmpFileName);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i)
+    {
+        threads.emplace_back([&simpleDownload]()
+            {
+                for (int j = 0; j < 10; ++j)
+                {
+                    const msdo::download_status status = simpleDownload->get_status();
+                    EXPECT_EQ(status.state(), msdo::download_state::created);
+                }
+            });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    simpleDownload->abort();
+
+    ASSERT_EQ(deliveryoptimization_set_max_agent_connections(8), 0);
+}
+
+// Requests for different downloads from different threads each get their own connection and the agent
+// processes them side by side
+TEST(ConfigConnectionTests, ConcurrentRequests)
+{
+    const std::vector<std::string> filePaths = { g_tmpFileName, g_tmpFileName2, g_tmpFileName3 };
+    std::vector<std::thread> threads;
+    for (const auto& filePath : filePaths)
+    {
+        threads.emplace_back([&filePath]()
+            {
+                auto simpleDownload = msdot::download::make(g_smallFileUrl, filePath);
+                for (int i = 0; i < 10; ++i)
+                {
+                    const msdo::download_status status = simpleDownload->get_status();
+                    EXPECT_EQ(status.state(), msdo::download_state::created);
+                }
+                simpleDownload->abort();
+            });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}